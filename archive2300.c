@@ -0,0 +1,562 @@
+/*  open2300 - archive2300.c
+ *
+ *  Version 1.11
+ *
+ *  Columnar archive for long term station history. Every field is
+ *  stored in its own file so a scan over one field only reads that
+ *  field. See archive2300.h for the file layout.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include <errno.h>
+#include <sys/mman.h>
+#include "archive2300.h"
+#include "codec2300.h"
+
+// Column layout of new archives. Scales match the decimals used in
+// the text log files so nothing is lost when importing them.
+static const struct archive_column default_columns[ARCHIVE_COLUMNS] = {
+	{ "time", 0, 0, 1 },
+	{ "Ti",   2, 1, 10 },
+	{ "To",   2, 1, 10 },
+	{ "DP",   2, 1, 10 },
+	{ "RHi",  1, 0, 1 },
+	{ "RHo",  1, 0, 1 },
+	{ "WS",   2, 0, 10 },
+	{ "DIR",  2, 0, 10 },
+	{ "WC",   2, 1, 10 },
+	{ "rain", 4, 1, 100 },
+	{ "RP",   4, 1, 1000 }
+};
+
+
+/********************************************************************
+ * put_le / get_le store and load little endian integers
+ *
+ ********************************************************************/
+static void put_le(unsigned char *buffer, unsigned long value, int width)
+{
+	int i;
+
+	for (i = 0; i < width; i++)
+		buffer[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static unsigned long get_le(const unsigned char *buffer, int width)
+{
+	unsigned long value = 0;
+	int i;
+
+	for (i = width - 1; i >= 0; i--)
+		value = (value << 8) | buffer[i];
+
+	return value;
+}
+
+
+/********************************************************************
+ * record_value returns the value of a record that goes into a
+ * column
+ *
+ ********************************************************************/
+static double record_value(struct log_record *record, int column)
+{
+	switch (column)
+	{
+	case ARCHIVE_TI:   return record->temperature_indoor;
+	case ARCHIVE_TO:   return record->temperature_outdoor;
+	case ARCHIVE_DP:   return record->dewpoint;
+	case ARCHIVE_RHI:  return record->humidity_indoor == HUMIDITY_MISSING ?
+	                          NAN : record->humidity_indoor;
+	case ARCHIVE_RHO:  return record->humidity_outdoor == HUMIDITY_MISSING ?
+	                          NAN : record->humidity_outdoor;
+	case ARCHIVE_WS:   return record->windspeed;
+	case ARCHIVE_DIR:  return record->winddir_degrees;
+	case ARCHIVE_WC:   return record->windchill;
+	case ARCHIVE_RAIN: return record->rain_total;
+	case ARCHIVE_RP:   return record->rel_pressure;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * archive_column_id finds a column by name (time, Ti, To, DP, RHi,
+ * RHo, WS, DIR, WC, rain, RP)
+ *
+ * Input:   name - column name
+ *
+ * Returns: column number, -1 if not found
+ *
+ ********************************************************************/
+int archive_column_id(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARCHIVE_COLUMNS; i++)
+	{
+		if (strcmp(default_columns[i].name, name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+
+/********************************************************************
+ * encode_header / decode_header convert a column header
+ *
+ ********************************************************************/
+static void encode_header(struct archive_column *column, unsigned char *buffer)
+{
+	memset(buffer, 0, ARCHIVE_HEADER_SIZE);
+	memcpy(buffer, ARCHIVE_MAGIC, 8);
+	put_le(buffer + 8, ARCHIVE_VERSION, 2);
+	buffer[10] = column->width;
+	buffer[11] = column->is_signed;
+	put_le(buffer + 12, column->scale, 2);
+	put_le(buffer + 16, column->count, 4);
+	put_le(buffer + 20, (unsigned long) column->base, 4);
+	put_le(buffer + 24, (unsigned long) column->last_time, 4);
+	put_le(buffer + 28, (unsigned long) column->last_delta, 4);
+	put_le(buffer + 32, column->data_bytes, 4);
+}
+
+static int decode_header(struct archive_column *column, const unsigned char *buffer)
+{
+	if (memcmp(buffer, ARCHIVE_MAGIC, 8) != 0 ||
+	    get_le(buffer + 8, 2) != ARCHIVE_VERSION)
+		return -1;
+
+	column->width = buffer[10];
+	column->is_signed = buffer[11];
+	column->scale = get_le(buffer + 12, 2);
+	column->count = get_le(buffer + 16, 4);
+	column->base = (time_t) get_le(buffer + 20, 4);
+	column->last_time = (time_t) get_le(buffer + 24, 4);
+	column->last_delta = (long) (int) get_le(buffer + 28, 4);
+	column->data_bytes = get_le(buffer + 32, 4);
+
+	if (column->width > 4 || column->scale == 0)
+		return -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * column_path builds the file name of a column
+ *
+ ********************************************************************/
+static void column_path(struct archive *archive, int column, char *path, int size)
+{
+	snprintf(path, size, "%s/%s.col", archive->path, archive->column[column].name);
+}
+
+
+/********************************************************************
+ * archive_open opens an archive directory. A writable archive is
+ * created if it does not exist. A read only archive maps no
+ * columns until archive_map is called.
+ *
+ * Input:   path - archive directory
+ *          writable - 0 = read only, 1 = open for appending
+ *
+ * Output:  archive - handle to the archive
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int archive_open(struct archive *archive, const char *path, int writable)
+{
+	unsigned char header[ARCHIVE_HEADER_SIZE];
+	char filename[300];
+	struct archive_column *column;
+	long records = -1;
+	int i;
+
+	memset(archive, 0, sizeof(*archive));
+	snprintf(archive->path, sizeof(archive->path), "%s", path);
+	archive->writable = writable;
+
+	for (i = 0; i < ARCHIVE_COLUMNS; i++)
+		archive->column[i] = default_columns[i];
+
+	if (!writable)
+		return 0;
+
+	if (mkdir(path, 0755) != 0 && errno != EEXIST)
+		return -1;
+
+	for (i = 0; i < ARCHIVE_COLUMNS; i++)
+	{
+		column = &archive->column[i];
+		column_path(archive, i, filename, sizeof(filename));
+
+		if ((column->file = fopen(filename, "r+b")) != NULL)
+		{
+			if (fread(header, 1, ARCHIVE_HEADER_SIZE, column->file) != ARCHIVE_HEADER_SIZE ||
+			    decode_header(column, header) != 0)
+			{
+				archive_close(archive);
+				return -1;
+			}
+		}
+		else if ((column->file = fopen(filename, "w+b")) != NULL)
+		{
+			encode_header(column, header);
+			fwrite(header, 1, ARCHIVE_HEADER_SIZE, column->file);
+		}
+		else
+		{
+			archive_close(archive);
+			return -1;
+		}
+
+		if (records < 0 || column->count < records)
+			records = column->count;
+	}
+
+	// All columns must agree. They can only differ if an append was
+	// interrupted and then the headers were never updated, but be safe.
+	for (i = 1; i < ARCHIVE_COLUMNS; i++)
+	{
+		column = &archive->column[i];
+		column->count = records;
+		column->data_bytes = records * column->width;
+	}
+
+	if (archive->column[ARCHIVE_TIME].count != records)
+	{
+		archive_close(archive);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * archive_close writes the column headers of a writable archive
+ * and releases all files and mappings
+ *
+ ********************************************************************/
+void archive_close(struct archive *archive)
+{
+	unsigned char header[ARCHIVE_HEADER_SIZE];
+	struct archive_column *column;
+	int i;
+
+	for (i = 0; i < ARCHIVE_COLUMNS; i++)
+	{
+		column = &archive->column[i];
+
+		if (column->file != NULL)
+		{
+			if (archive->writable)
+			{
+				encode_header(column, header);
+				fseek(column->file, 0L, SEEK_SET);
+				fwrite(header, 1, ARCHIVE_HEADER_SIZE, column->file);
+			}
+			fclose(column->file);
+			column->file = NULL;
+		}
+
+		if (column->map != NULL)
+		{
+			munmap(column->map, column->map_size);
+			column->map = NULL;
+		}
+	}
+}
+
+
+/********************************************************************
+ * archive_last_time returns the time of the newest record,
+ * 0 if the archive is empty
+ *
+ ********************************************************************/
+time_t archive_last_time(struct archive *archive)
+{
+	if (archive->column[ARCHIVE_TIME].count == 0)
+		return 0;
+
+	return archive->column[ARCHIVE_TIME].last_time;
+}
+
+
+/********************************************************************
+ * archive_append adds one record to all columns. Records must be
+ * appended in time order. The headers are written by archive_close
+ * so a crash before that leaves the archive as it was.
+ *
+ * Input:   archive - archive opened writable
+ *          record - the record to add
+ *
+ * Returns: 0 on success, -1 if fail or the record is older than
+ *          the last one in the archive
+ *
+ ********************************************************************/
+int archive_append(struct archive *archive, struct log_record *record)
+{
+	struct archive_column *column;
+	unsigned char buffer[10];
+	long delta, scaled;
+	double value;
+	int i, length;
+
+	column = &archive->column[ARCHIVE_TIME];
+
+	if (column->count == 0)
+	{
+		column->base = record->timestamp;
+		column->last_time = record->timestamp;
+		column->last_delta = 0;
+	}
+	else if (record->timestamp < column->last_time)
+	{
+		return -1;
+	}
+
+	// Value columns first, the time column decides how many records
+	// are complete
+	for (i = 1; i < ARCHIVE_COLUMNS; i++)
+	{
+		column = &archive->column[i];
+		value = record_value(record, i);
+
+		if (isnan(value) && column->is_signed)
+			scaled = -(1L << (8 * column->width - 1));
+		else
+			scaled = (long) floor(value * column->scale + 0.5);
+
+		put_le(buffer, (unsigned long) scaled, column->width);
+
+		if (fseek(column->file, ARCHIVE_HEADER_SIZE + column->data_bytes, SEEK_SET) != 0 ||
+		    fwrite(buffer, 1, column->width, column->file) != (size_t) column->width)
+			return -1;
+
+		column->data_bytes += column->width;
+		column->count++;
+	}
+
+	column = &archive->column[ARCHIVE_TIME];
+
+	delta = (long) (record->timestamp - column->last_time);
+	length = varint_put(buffer, zigzag_encode(delta - column->last_delta)) - buffer;
+
+	if (fseek(column->file, ARCHIVE_HEADER_SIZE + column->data_bytes, SEEK_SET) != 0 ||
+	    fwrite(buffer, 1, length, column->file) != (size_t) length)
+		return -1;
+
+	column->data_bytes += length;
+	column->count++;
+	column->last_time = record->timestamp;
+	column->last_delta = delta;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * archive_map maps one column file into memory for reading
+ *
+ * Input:   archive - open archive
+ *          column - column number
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int archive_map(struct archive *archive, int column_number)
+{
+	struct archive_column *column = &archive->column[column_number];
+	char filename[300];
+	struct stat filestat;
+	void *map;
+	int fd;
+
+	if (column->map != NULL)
+		return 0;
+
+	column_path(archive, column_number, filename, sizeof(filename));
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return -1;
+
+	if (fstat(fd, &filestat) != 0 || filestat.st_size < ARCHIVE_HEADER_SIZE)
+	{
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, filestat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return -1;
+
+	column->map = map;
+	column->map_size = filestat.st_size;
+
+	if (decode_header(column, column->map) != 0 ||
+	    ARCHIVE_HEADER_SIZE + column->data_bytes > (long) column->map_size)
+	{
+		munmap(column->map, column->map_size);
+		column->map = NULL;
+		return -1;
+	}
+
+	madvise(column->map, column->map_size, MADV_SEQUENTIAL);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * archive_value returns value number 'number' of a mapped value
+ * column. Missing values are returned as NAN.
+ *
+ ********************************************************************/
+double archive_value(struct archive *archive, int column_number, long number)
+{
+	struct archive_column *column = &archive->column[column_number];
+	unsigned long raw;
+	long value;
+
+	raw = get_le(column->map + ARCHIVE_HEADER_SIZE + number * column->width,
+	             column->width);
+
+	if (column->is_signed && (raw & (1UL << (8 * column->width - 1))))
+	{
+		if (raw == (1UL << (8 * column->width - 1)))
+			return NAN;
+		value = (long) raw - (1L << (8 * column->width));
+	}
+	else
+	{
+		value = (long) raw;
+	}
+
+	return (double) value / column->scale;
+}
+
+
+/********************************************************************
+ * archive_time_range finds the records between two times by
+ * decoding the time column. If the range covers the whole archive
+ * the time column is not read at all.
+ *
+ * Input:   archive - open archive
+ *          from, to - time range, both included
+ *
+ * Output:  first - number of the first record in the range
+ *
+ * Returns: number of records in the range, -1 if fail
+ *
+ ********************************************************************/
+long archive_time_range(struct archive *archive, time_t from, time_t to,
+                        long *first)
+{
+	struct archive_column *column = &archive->column[ARCHIVE_TIME];
+	const unsigned char *p, *end;
+	unsigned long zigzag;
+	long delta = 0, number, count = 0;
+	time_t timestamp;
+
+	*first = 0;
+
+	if (archive_map(archive, ARCHIVE_TIME) != 0)
+		return -1;
+
+	if (column->count == 0)
+		return 0;
+
+	if (from <= column->base && to >= column->last_time)
+		return column->count;
+
+	p = column->map + ARCHIVE_HEADER_SIZE;
+	end = p + column->data_bytes;
+	timestamp = column->base;
+
+	for (number = 0; number < column->count; number++)
+	{
+		if ((p = varint_get(p, end, &zigzag)) == NULL)
+			break;
+
+		delta += zigzag_decode(zigzag);
+		timestamp += delta;
+
+		if (timestamp < from)
+			continue;
+		if (timestamp > to)
+			break;
+		if (count++ == 0)
+			*first = number;
+	}
+
+	return count;
+}
+
+
+/********************************************************************
+ * archive_stats calculates count, min, max, sum and mean of one
+ * column over a time range. Only the value column (and the time
+ * column if the range is not the whole archive) is mapped.
+ *
+ * Input:   archive - open archive
+ *          column - value column number
+ *          from, to - time range, both included
+ *
+ * Output:  stats - the result. Missing values are not counted.
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int archive_stats(struct archive *archive, int column, time_t from,
+                  time_t to, struct archive_stats *stats)
+{
+	struct archive_column *value_column = &archive->column[column];
+	long first, count, number;
+	double value;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (column <= ARCHIVE_TIME || column >= ARCHIVE_COLUMNS)
+		return -1;
+
+	// The headers are small. Reading the time header does not touch
+	// the time data pages.
+	if ((count = archive_time_range(archive, from, to, &first)) < 0 ||
+	    archive_map(archive, column) != 0)
+		return -1;
+
+	if (first + count > value_column->count)
+		count = value_column->count - first;
+
+	if (count <= 0)
+		return 0;
+
+	stats->min = HUGE_VAL;
+	stats->max = -HUGE_VAL;
+
+	for (number = first; number < first + count; number++)
+	{
+		value = archive_value(archive, column, number);
+		if (isnan(value))
+			continue;
+		if (value < stats->min)
+			stats->min = value;
+		if (value > stats->max)
+			stats->max = value;
+		stats->sum += value;
+		stats->count++;
+	}
+
+	if (stats->count > 0)
+		stats->mean = stats->sum / stats->count;
+
+	return 0;
+}
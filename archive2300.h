@@ -0,0 +1,91 @@
+/* open2300 - archive2300.h
+ * Include file for the columnar station history archive.
+ *
+ * An archive is a directory with one file per field (time.col,
+ * Ti.col, To.col ...). Each file has a 40 byte header:
+ *   magic "WS2300CO", version (2 bytes), width (1), signed (1),
+ *   scale (2), reserved (2), record count (4), base time (4),
+ *   last time (4), last delta (4), data bytes (4), reserved (4)
+ * all little endian. The time column stores delta-of-delta values
+ * as zigzag varints (one byte per record at a fixed log interval).
+ * The value columns store fixed width scaled integers so value
+ * number i is found at header + i * width. Readers mmap only the
+ * columns they need.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_ARCHIVE2300_H_
+#define _INCLUDE_ARCHIVE2300_H_
+
+#include "record2300.h"
+
+#define ARCHIVE_MAGIC         "WS2300CO"
+#define ARCHIVE_VERSION       1
+#define ARCHIVE_HEADER_SIZE   40
+
+#define ARCHIVE_TIME          0
+#define ARCHIVE_TI            1
+#define ARCHIVE_TO            2
+#define ARCHIVE_DP            3
+#define ARCHIVE_RHI           4
+#define ARCHIVE_RHO           5
+#define ARCHIVE_WS            6
+#define ARCHIVE_DIR           7
+#define ARCHIVE_WC            8
+#define ARCHIVE_RAIN          9
+#define ARCHIVE_RP            10
+#define ARCHIVE_COLUMNS       11
+
+struct archive_column
+{
+	char   name[9];
+	int    width;
+	int    is_signed;
+	int    scale;
+	FILE  *file;                  // open for appending (writer)
+	unsigned char *map;           // mapped file (reader)
+	size_t map_size;
+	long   count;
+	long   data_bytes;
+	time_t base;
+	time_t last_time;
+	long   last_delta;
+};
+
+struct archive
+{
+	char   path[256];
+	int    writable;
+	struct archive_column column[ARCHIVE_COLUMNS];
+};
+
+struct archive_stats
+{
+	long   count;
+	double min;
+	double max;
+	double sum;
+	double mean;
+};
+
+int    archive_column_id(const char *name);
+
+int    archive_open(struct archive *archive, const char *path, int writable);
+
+void   archive_close(struct archive *archive);
+
+int    archive_append(struct archive *archive, struct log_record *record);
+
+time_t archive_last_time(struct archive *archive);
+
+int    archive_map(struct archive *archive, int column);
+
+double archive_value(struct archive *archive, int column, long number);
+
+long   archive_time_range(struct archive *archive, time_t from, time_t to,
+                          long *first);
+
+int    archive_stats(struct archive *archive, int column, time_t from,
+                     time_t to, struct archive_stats *stats);
+
+#endif /* _INCLUDE_ARCHIVE2300_H_ */
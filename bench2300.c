@@ -0,0 +1,637 @@
+/*  open2300 - bench2300.c
+ *
+ *  Version 1.11
+ *
+ *  Benchmarks of the station protocol, the decoders, the log line
+ *  formatter and the log sinks
+ *
+ *  The station benchmarks run against the station of the
+ *  configuration or, with -s, against a recording played back by
+ *  trace2300.c at the given speed, so they can run without a station.
+ *  make bench plays bench2300.trace, a session at 2400 baud, at speed
+ *  1. Without -r an empty recording is played and the station model
+ *  answers with its own byte timing. At speed 0 nothing waits for the
+ *  station and the station results are the overhead of the library
+ *  alone; their names end in _overhead. The CPU and sink benchmarks
+ *  use synthetic readings, their files are made in a new directory
+ *  under -t. The results are written as JSON.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "rw2300.h"
+#include "trace2300.h"
+#include "binlog2300.h"
+#include "spool2300.h"
+#include "stats2300.h"
+#include "metrics2300.h"
+
+#define BENCH_ROUNDS        5          // default rounds of a station benchmark
+#define BENCH_SAMPLES       1000       // most rounds
+#define BENCH_RESULTS       20
+#define BENCH_TIME          500000     // us a rate benchmark runs at least
+#define BENCH_BATCH         1000       // operations between clock reads
+#define BENCH_POOL          256        // synthetic readings
+#define BENCH_SINK_RECORDS  20000      // records written to each sink
+#define BENCH_HISTORY       0xAF       // records in the history ring
+#define BENCH_NAME_SIZE     40
+
+struct bench_result
+{
+	char   name[BENCH_NAME_SIZE];
+	int    rate;                   // 0 = latency in ms, 1 = per second
+	long   iterations;
+	double seconds;                // rate benchmarks
+	double mean, min, p50, p90, max;   // latency benchmarks, ms
+};
+
+static struct bench_result results[BENCH_RESULTS];
+static int result_count;
+
+static struct log_record pool[BENCH_POOL];
+static char pool_lines[BENCH_POOL][LOG_LINE_SIZE];
+static int pool_lengths[BENCH_POOL];
+static unsigned char history_data[BENCH_POOL][10];
+static unsigned char current_data[BENCH_POOL][CURRENT_ITEMS][3];
+
+static volatile double sink;   // keeps the optimizer from dropping the work
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("bench2300 - Benchmarks of the station protocol, decoders and log sinks.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("bench2300 [-n rounds] [-o file.json] [-t directory] [-s speed] [-r recording]\n");
+	printf("          [config_filename]\n");
+	printf("-n rounds of each station benchmark (default %d)\n", BENCH_ROUNDS);
+	printf("-o write the JSON results to file instead of standard out\n");
+	printf("-t directory for the files of the sink benchmarks (default /tmp)\n");
+	printf("-s play a recording back instead of the station, speed 1 = as\n");
+	printf("   recorded, 0 = no waiting (library overhead only)\n");
+	printf("-r the recording (SERIAL_TRACE file) for -s, e.g. bench2300.trace.\n");
+	printf("   Without it the station model answers with 2400 baud timing.\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * compare_samples orders latencies for qsort
+ *
+ ********************************************************************/
+static int compare_samples(const void *a, const void *b)
+{
+	long long x = *(const long long *) a, y = *(const long long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+/********************************************************************
+ * add_latency adds a latency result
+ *
+ * Input:   name - of the benchmark
+ *          suffix - added to the name
+ *          samples - microseconds of each round, sorted here
+ *          count - number of rounds
+ *
+ ********************************************************************/
+static void add_latency(const char *name, const char *suffix, long long *samples,
+                        int count)
+{
+	struct bench_result *result = &results[result_count++];
+	long long total = 0;
+	int i;
+
+	qsort(samples, count, sizeof(samples[0]), compare_samples);
+
+	for (i = 0; i < count; i++)
+		total += samples[i];
+
+	snprintf(result->name, sizeof(result->name), "%s%s", name, suffix);
+	result->rate = 0;
+	result->iterations = count;
+	result->mean = total / 1000.0 / count;
+	result->min = samples[0] / 1000.0;
+	result->p50 = samples[(count - 1) * 50 / 100] / 1000.0;
+	result->p90 = samples[(count - 1) * 90 / 100] / 1000.0;
+	result->max = samples[count - 1] / 1000.0;
+}
+
+
+/********************************************************************
+ * add_rate adds a throughput result
+ *
+ * Input:   name - of the benchmark
+ *          iterations - operations done
+ *          start - clock_microseconds when they started
+ *
+ ********************************************************************/
+static void add_rate(const char *name, long iterations, long long start)
+{
+	struct bench_result *result = &results[result_count++];
+
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->rate = 1;
+	result->iterations = iterations;
+	result->seconds = (clock_microseconds() - start) / 1000000.0;
+	if (result->seconds <= 0)
+		result->seconds = 1e-6;
+}
+
+
+/********************************************************************
+ * make_pool makes the synthetic readings, their log lines and raw
+ * station data for the decoders
+ *
+ ********************************************************************/
+static void make_pool(void)
+{
+	struct log_record *record;
+	int i, j, k;
+
+	srand(2300);
+
+	for (i = 0; i < BENCH_POOL; i++)
+	{
+		record = &pool[i];
+		record->timestamp = 1136073600 + i * 300L;
+		record->format = LOG_FORMAT_CURRENT;
+		record->temperature_indoor = 18.0 + (rand() % 80) / 10.0;
+		record->temperature_outdoor = -10.0 + (rand() % 400) / 10.0;
+		record->dewpoint = record->temperature_outdoor - (rand() % 80) / 10.0;
+		record->humidity_indoor = 30 + rand() % 40;
+		record->humidity_outdoor = 20 + rand() % 80;
+		record->windspeed = (rand() % 200) / 10.0;
+		record->winddir_degrees = (rand() % 16) * 22.5;
+		record->windchill = record->temperature_outdoor - (rand() % 50) / 10.0;
+		record->rain_1h = (rand() % 100) / 10.0;
+		record->rain_24h = record->rain_1h + (rand() % 300) / 10.0;
+		record->rain_total = 1000.0 + (rand() % 10000) / 10.0;
+		record->rel_pressure = 980.0 + (rand() % 600) / 10.0;
+		record->tendency = rand() % 3;
+		record->forecast = rand() % 3;
+
+		pool_lengths[i] = format_log_line(record, pool_lines[i], LOG_LINE_SIZE);
+
+		for (j = 0; j < 10; j++)
+			history_data[i][j] = rand() & 0xFF;
+
+		// BCD digits as the station stores them
+		for (j = 0; j < CURRENT_ITEMS; j++)
+			for (k = 0; k < 3; k++)
+				current_data[i][j][k] = (rand() % 10) << 4 | rand() % 10;
+	}
+}
+
+
+/********************************************************************
+ * fetch_all reads what fetch2300 reads
+ *
+ ********************************************************************/
+static void fetch_all(WEATHERSTATION ws2300, struct config_type *config)
+{
+	double value, minimum, maximum, winddir[6];
+	int index, int_min, int_max;
+	char tendency[15], forecast[15];
+	struct timestamp time_min, time_max;
+
+	value = temperature_indoor(ws2300, config->temperature_conv);
+	temperature_indoor_minmax(ws2300, config->temperature_conv, &minimum,
+	                          &maximum, &time_min, &time_max);
+	value += temperature_outdoor(ws2300, config->temperature_conv);
+	temperature_outdoor_minmax(ws2300, config->temperature_conv, &minimum,
+	                           &maximum, &time_min, &time_max);
+	value += dewpoint(ws2300, config->temperature_conv);
+	dewpoint_minmax(ws2300, config->temperature_conv, &minimum,
+	                &maximum, &time_min, &time_max);
+	value += humidity_indoor_all(ws2300, &int_min, &int_max, &time_min, &time_max);
+	value += humidity_outdoor_all(ws2300, &int_min, &int_max, &time_min, &time_max);
+	value += wind_all(ws2300, config->wind_speed_conv_factor, &index, winddir);
+	value += windchill(ws2300, config->temperature_conv);
+	windchill_minmax(ws2300, config->temperature_conv, &minimum,
+	                 &maximum, &time_min, &time_max);
+	wind_minmax(ws2300, config->wind_speed_conv_factor, &minimum,
+	            &maximum, &time_min, &time_max);
+	value += rain_1h_all(ws2300, config->rain_conv_factor, &maximum, &time_max);
+	value += rain_24h_all(ws2300, config->rain_conv_factor, &maximum, &time_max);
+	value += rain_total_all(ws2300, config->rain_conv_factor, &time_max);
+	value += rel_pressure(ws2300, config->pressure_conv_factor);
+	rel_pressure_minmax(ws2300, config->pressure_conv_factor, &minimum,
+	                    &maximum, &time_min, &time_max);
+	tendency_forecast(ws2300, tendency, forecast);
+
+	sink = value;
+}
+
+
+/********************************************************************
+ * bench_station runs the station benchmarks: a fetch2300 reading,
+ * the download of the history ring, a reset and a resync after an
+ * interrupted command
+ *
+ * Input:   rounds - of each benchmark
+ *          suffix - of the result names
+ *
+ ********************************************************************/
+static void bench_station(WEATHERSTATION ws2300, struct config_type *config,
+                          int rounds, const char *suffix)
+{
+	static long long samples[BENCH_SAMPLES];
+	unsigned char data[20], command[25], address[4];
+	double values[10];
+	int humidity[2], interval, countdown, records;
+	struct timestamp time_last;
+	long long start;
+	int i, j;
+
+	for (i = 0; i < rounds; i++)
+	{
+		start = clock_microseconds();
+		fetch_all(ws2300, config);
+		samples[i] = clock_microseconds() - start;
+	}
+	add_latency("full_fetch", suffix, samples, rounds);
+
+	for (i = 0; i < rounds; i++)
+	{
+		start = clock_microseconds();
+		read_history_info(ws2300, &interval, &countdown, &time_last, &records);
+		for (j = 0; j < BENCH_HISTORY; j++)
+			read_history_record(ws2300, j, config, &values[0], &values[1], &values[2],
+			                    &humidity[0], &humidity[1], &values[3], &values[4],
+			                    &values[5], &values[6], &values[7]);
+		samples[i] = clock_microseconds() - start;
+	}
+	add_latency("history_download", suffix, samples, rounds);
+
+	for (i = 0; i < rounds; i++)
+	{
+		start = clock_microseconds();
+		reset_06(ws2300);
+		samples[i] = clock_microseconds() - start;
+	}
+	add_latency("reset", suffix, samples, rounds);
+
+	// A read command cut off after two address bytes, as when a
+	// program is stopped, then the reset and the read that follow
+	address_encoder(0x346, address);
+	for (i = 0; i < rounds; i++)
+	{
+		reset_06(ws2300);
+		for (j = 0; j < 2; j++)
+		{
+			write_device(ws2300, &address[j], 1);
+			read_device(ws2300, data, 1);
+		}
+		start = clock_microseconds();
+		reset_06(ws2300);
+		if (read_safe(ws2300, 0x346, 2, data, command) != 2)
+			read_error_exit();
+		samples[i] = clock_microseconds() - start;
+	}
+	add_latency("resync", suffix, samples, rounds);
+}
+
+
+/********************************************************************
+ * bench_cpu runs the decoder, formatter and parser benchmarks
+ *
+ ********************************************************************/
+static void bench_cpu(struct config_type *config)
+{
+	static char text[METRICS_TEXT_SIZE];
+	struct metrics_station station = {"", &pool[0], stats_get()};
+	struct log_record record;
+	char line[LOG_LINE_SIZE];
+	double values[8];
+	int humidity[2];
+	long long start;
+	long count;
+	int i, j;
+
+	start = clock_microseconds();
+	for (count = 0; clock_microseconds() - start < BENCH_TIME; )
+		for (i = 0; i < BENCH_BATCH; i++, count++)
+		{
+			decode_history_record(history_data[count % BENCH_POOL], config,
+			                      &values[0], &values[1], &values[2], &humidity[0],
+			                      &humidity[1], &values[3], &values[4], &values[5],
+			                      &values[6], &values[7]);
+			sink = values[0];
+		}
+	add_rate("decode_history_record", count, start);
+
+	memset(&record, 0, sizeof(record));
+	start = clock_microseconds();
+	for (count = 0; clock_microseconds() - start < BENCH_TIME; )
+		for (i = 0; i < BENCH_BATCH; i++, count++)
+		{
+			for (j = 0; j < CURRENT_ITEMS; j++)
+				decode_current(&record, current_items[j].address,
+				               current_data[count % BENCH_POOL][j]);
+			sink = record.temperature_indoor;
+		}
+	add_rate("decode_current", count, start);
+
+	start = clock_microseconds();
+	for (count = 0; clock_microseconds() - start < BENCH_TIME; )
+		for (i = 0; i < BENCH_BATCH; i++, count++)
+			sink = format_log_line(&pool[count % BENCH_POOL], line, sizeof(line));
+	add_rate("format_log_line", count, start);
+
+	start = clock_microseconds();
+	for (count = 0; clock_microseconds() - start < BENCH_TIME; )
+		for (i = 0; i < BENCH_BATCH; i++, count++)
+			sink = parse_log_line(pool_lines[count % BENCH_POOL],
+			                      pool_lengths[count % BENCH_POOL], &record);
+	add_rate("parse_log_line", count, start);
+
+	start = clock_microseconds();
+	for (count = 0; clock_microseconds() - start < BENCH_TIME; )
+		for (i = 0; i < BENCH_BATCH / 10; i++, count++)
+		{
+			station.record = &pool[count % BENCH_POOL];
+			sink = metrics_format(text, sizeof(text), &station, 1, METRICS_OPENMETRICS);
+		}
+	add_rate("metrics_format", count, start);
+}
+
+
+/********************************************************************
+ * drain_nowhere is a spool target that takes everything
+ *
+ ********************************************************************/
+static int drain_nowhere(void *context, char **entries, int *sizes, int count)
+{
+	return count;
+}
+
+
+/********************************************************************
+ * bench_sinks times writing readings to a text log, a binary log and
+ * a spool in a new directory in directory, and draining the spool.
+ * The files and the new directory are removed afterwards.
+ *
+ * Returns: 0 on success, -1 if a file cannot be written
+ *
+ ********************************************************************/
+static int bench_sinks(const char *directory)
+{
+	struct binlog binlog;
+	struct spool spool;
+	struct log_record record;
+	char work[250], path[300], spool_path[300];
+	long long start;
+	unsigned long segment;
+	long delivered;
+	FILE *fptr;
+	int i;
+
+	// Not known names in a shared directory such as /tmp
+	snprintf(work, sizeof(work), "%s/bench2300.XXXXXX", directory);
+	if (mkdtemp(work) == NULL)
+	{
+		fprintf(stderr, "Cannot create a directory in %s\n", directory);
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/bench2300.log", work);
+	if ((fptr = fopen(path, "w")) == NULL)
+	{
+		fprintf(stderr, "Cannot create %s\n", path);
+		return -1;
+	}
+	start = clock_microseconds();
+	for (i = 0; i < BENCH_SINK_RECORDS; i++)
+		fputs(pool_lines[i % BENCH_POOL], fptr);
+	sync_file(fptr);
+	fclose(fptr);
+	add_rate("text_log_append", BENCH_SINK_RECORDS, start);
+	remove(path);
+
+	snprintf(path, sizeof(path), "%s/bench2300.bin", work);
+	if (binlog_open(&binlog, path, 1) != 0)
+	{
+		fprintf(stderr, "Cannot create %s\n", path);
+		return -1;
+	}
+	start = clock_microseconds();
+	for (i = 0; i < BENCH_SINK_RECORDS; i++)
+	{
+		record = pool[i % BENCH_POOL];
+		record.timestamp = pool[0].timestamp + i * 300L;
+		binlog_append(&binlog, &record);
+	}
+	sync_file(binlog.file);
+	add_rate("binlog_append", BENCH_SINK_RECORDS, start);
+	remove(binlog.index_path);
+	binlog_close(&binlog);
+	remove(path);
+
+	snprintf(spool_path, sizeof(spool_path), "%s/bench2300.spool", work);
+	if (spool_open(&spool, spool_path, "bench2300") != 0)
+		return -1;
+	start = clock_microseconds();
+	for (i = 0; i < BENCH_SINK_RECORDS; i++)
+		if (spool_append(&spool, pool_lines[i % BENCH_POOL],
+		                 pool_lengths[i % BENCH_POOL]) != 0)
+			return -1;
+	spool_sync(&spool);
+	add_rate("spool_append", BENCH_SINK_RECORDS, start);
+
+	start = clock_microseconds();
+	delivered = spool_drain(&spool, SPOOL_BATCH, drain_nowhere, NULL);
+	add_rate("spool_drain", delivered > 0 ? delivered : 0, start);
+
+	spool_close(&spool);
+	for (segment = spool.read_segment; segment <= spool.write_segment; segment++)
+	{
+		snprintf(path, sizeof(path), "%s/%08lu.seg", spool.dir, segment);
+		remove(path);
+	}
+	snprintf(path, sizeof(path), "%s/cursor", spool.dir);
+	remove(path);
+	snprintf(path, sizeof(path), "%s/lock", spool.dir);
+	remove(path);
+	remove(spool.dir);
+	remove(spool_path);
+	remove(work);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * write_json writes the results
+ *
+ ********************************************************************/
+static void write_json(FILE *fptr, struct config_type *config, double speed)
+{
+	struct protocol_stats *stats = stats_get();
+	struct bench_result *result;
+	unsigned long retries = 0;
+	const char *c;
+	int i;
+
+	for (i = 0; i < STATS_RANGES; i++)
+		retries += stats->retries[i];
+
+	fprintf(fptr, "{\n  \"program\": \"bench2300\",\n  \"version\": \"%s\",\n", VERSION);
+	fprintf(fptr, "  \"device\": \"");
+	for (c = config->serial_device_name; *c != '\0'; c++)
+		fprintf(fptr, *c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+	fprintf(fptr, "\",\n");
+	if (speed >= 0)
+		fprintf(fptr, "  \"replay_speed\": %g,\n", speed);
+	else
+		fprintf(fptr, "  \"replay_speed\": null,\n");
+	fprintf(fptr, "  \"time\": %ld,\n  \"results\": [\n", (long) time(NULL));
+
+	for (i = 0; i < result_count; i++)
+	{
+		result = &results[i];
+		if (result->rate)
+			fprintf(fptr, "    {\"name\": \"%s\", \"unit\": \"per_second\", "
+			        "\"iterations\": %ld, \"seconds\": %.6f, \"rate\": %.1f}",
+			        result->name, result->iterations, result->seconds,
+			        result->iterations / result->seconds);
+		else
+			fprintf(fptr, "    {\"name\": \"%s\", \"unit\": \"ms\", \"iterations\": %ld, "
+			        "\"mean\": %.3f, \"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+			        "\"max\": %.3f}",
+			        result->name, result->iterations, result->mean, result->min,
+			        result->p50, result->p90, result->max);
+		fprintf(fptr, "%s\n", i < result_count - 1 ? "," : "");
+	}
+
+	fprintf(fptr, "  ],\n  \"protocol\": {\"transactions\": %lu, \"failed\": %lu, "
+	        "\"bytes_sent\": %lu, \"bytes_received\": %lu, \"timeouts\": %lu, "
+	        "\"retries\": %lu, \"resets\": %lu}\n}\n",
+	        stats->transactions, stats->failed, stats->bytes_sent,
+	        stats->bytes_received, stats->timeouts, retries, stats->resets);
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program runs the benchmarks and writes the results as JSON.
+ *
+ * It takes one parameter which is the config file name with path
+ * If this parameter is omitted the program will look at the default paths
+ * See the open2300.conf-dist file for info
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	WEATHERSTATION ws2300;
+	struct config_type config;
+	char *output = NULL, *directory = "/tmp", *recording = NULL;
+	char trace_path[300] = "";
+	double speed = -1;
+	int rounds = BENCH_ROUNDS;
+	int arg, fd;
+	FILE *fptr;
+
+	stats_option(&argc, argv);
+
+	for (arg = 1; arg < argc && argv[arg][0] == '-'; arg += 2)
+	{
+		if (arg + 1 >= argc)
+			print_usage();
+
+		switch (argv[arg][1])
+		{
+		case 'n':
+			rounds = atoi(argv[arg + 1]);
+			break;
+		case 'o':
+			output = argv[arg + 1];
+			break;
+		case 't':
+			directory = argv[arg + 1];
+			break;
+		case 's':
+			if ((speed = atof(argv[arg + 1])) < 0)
+				print_usage();
+			break;
+		case 'r':
+			recording = argv[arg + 1];
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	if (rounds < 1 || rounds > BENCH_SAMPLES || (recording != NULL && speed < 0))
+		print_usage();
+
+	get_configuration(&config, argv[arg]);
+
+	if (speed >= 0 && recording == NULL)
+	{
+		// An empty recording: the station model answers everything
+		snprintf(trace_path, sizeof(trace_path), "%s/bench2300.XXXXXX", directory);
+		if ((fd = mkstemp(trace_path)) < 0 || (fptr = fdopen(fd, "wb")) == NULL ||
+		    fputs(TRACE_MAGIC, fptr) == EOF || fclose(fptr) != 0)
+		{
+			fprintf(stderr, "Cannot create a recording in %s\n", directory);
+			exit(EXIT_FAILURE);
+		}
+		recording = trace_path;
+	}
+
+	if (speed >= 0)
+	{
+		if (snprintf(config.serial_device_name, sizeof(config.serial_device_name),
+		             "%s%s", TRACE_REPLAY, recording) >=
+		    (int) sizeof(config.serial_device_name))
+		{
+			fprintf(stderr, "Recording name too long: %s\n", recording);
+			remove(trace_path);
+			exit(EXIT_FAILURE);
+		}
+		trace_setup(config.serial_trace, speed);
+	}
+
+	make_pool();
+
+	ws2300 = open_weatherstation(config.serial_device_name);
+	bench_station(ws2300, &config, rounds, speed == 0 ? "_overhead" : "");
+	close_weatherstation(ws2300);
+
+	if (trace_path[0] != '\0')
+		remove(trace_path);
+
+	bench_cpu(&config);
+
+	if (bench_sinks(directory) != 0)
+		exit(EXIT_FAILURE);
+
+	if (output == NULL)
+		fptr = stdout;
+	else if ((fptr = fopen(output, "w")) == NULL)
+	{
+		fprintf(stderr, "Cannot create %s\n", output);
+		exit(EXIT_FAILURE);
+	}
+
+	write_json(fptr, &config, speed);
+
+	if (fptr != stdout)
+		fclose(fptr);
+
+	return(0);
+}
@@ -9,6 +9,7 @@
  */
 
 #include "rw2300.h"
+#include "stats2300.h"
 
 /********************************************************************
  * print_usage prints a short user guide
@@ -57,6 +58,8 @@ int main(int argc, char *argv[])
 	int bytes = 15;
 	struct config_type config;
 
+	stats_option(&argc, argv);
+
 	// Get serial port from connfig file.
 	// Note: There is no command line config file path feature!
 	// history2300 will only search the default locations for the config file
@@ -0,0 +1,610 @@
+/*  open2300 - binlog2300.c
+ *
+ *  Version 1.11
+ *
+ *  Compact binary log format. Fixed width records of scaled
+ *  integers with epoch timestamps, a header describing the fields
+ *  and a sparse time index so a reader can seek straight to a time.
+ *  See binlog2300.h for the file layout.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "binlog2300.h"
+
+#define FIELD_TIME      0
+#define FIELD_FORMAT    1
+#define FIELD_TI        2
+#define FIELD_TO        3
+#define FIELD_DP        4
+#define FIELD_RHI       5
+#define FIELD_RHO       6
+#define FIELD_WS        7
+#define FIELD_DIR       8
+#define FIELD_WC        9
+#define FIELD_R1H       10
+#define FIELD_R24H      11
+#define FIELD_RTOT      12
+#define FIELD_RP        13
+#define FIELD_TEND      14
+#define FIELD_FCST      15
+#define FIELD_COUNT     16
+
+#define HEADER_SIZE     16
+#define DESCRIPTOR_SIZE 12
+
+// The layout written by this version. Readers use the descriptors
+// found in the file so a changed scale or width is still understood.
+static const struct binlog_field default_fields[FIELD_COUNT] = {
+	{ "time",   4, 0, 1,    0 },
+	{ "format", 1, 0, 1,    0 },
+	{ "Ti",     2, 1, 10,   0 },
+	{ "To",     2, 1, 10,   0 },
+	{ "DP",     2, 1, 10,   0 },
+	{ "RHi",    1, 0, 1,    0 },
+	{ "RHo",    1, 0, 1,    0 },
+	{ "WS",     2, 0, 10,   0 },
+	{ "DIR",    2, 0, 10,   0 },
+	{ "WC",     2, 1, 10,   0 },
+	{ "R1h",    4, 1, 100,  0 },
+	{ "R24h",   4, 1, 100,  0 },
+	{ "Rtot",   4, 1, 100,  0 },
+	{ "RP",     4, 1, 1000, 0 },
+	{ "Tend",   1, 1, 1,    0 },
+	{ "Fcst",   1, 1, 1,    0 }
+};
+
+
+/********************************************************************
+ * put_le / get_le store and load little endian integers
+ *
+ ********************************************************************/
+static void put_le(unsigned char *buffer, unsigned long value, int width)
+{
+	int i;
+
+	for (i = 0; i < width; i++)
+		buffer[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static unsigned long get_le(const unsigned char *buffer, int width)
+{
+	unsigned long value = 0;
+	int i;
+
+	for (i = width - 1; i >= 0; i--)
+		value = (value << 8) | buffer[i];
+
+	return value;
+}
+
+
+/********************************************************************
+ * field_id returns the FIELD_ number for a descriptor name
+ *
+ ********************************************************************/
+static int field_id(const char *name)
+{
+	int i;
+
+	for (i = 0; i < FIELD_COUNT; i++)
+	{
+		if (strcmp(default_fields[i].name, name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+
+/********************************************************************
+ * get_field / set_field move a value between a record and a
+ * double using the FIELD_ numbers. A missing value is NAN as a
+ * double and the missing value of the field in the record.
+ *
+ ********************************************************************/
+static double get_field(struct log_record *record, int id)
+{
+	switch (id)
+	{
+	case FIELD_TIME:   return (double) record->timestamp;
+	case FIELD_FORMAT: return record->format;
+	case FIELD_TI:     return record->temperature_indoor;
+	case FIELD_TO:     return record->temperature_outdoor;
+	case FIELD_DP:     return record->dewpoint;
+	case FIELD_RHI:    return record->humidity_indoor == HUMIDITY_MISSING ?
+	                          NAN : record->humidity_indoor;
+	case FIELD_RHO:    return record->humidity_outdoor == HUMIDITY_MISSING ?
+	                          NAN : record->humidity_outdoor;
+	case FIELD_WS:     return record->windspeed;
+	case FIELD_DIR:    return record->winddir_degrees;
+	case FIELD_WC:     return record->windchill;
+	case FIELD_R1H:    return record->rain_1h;
+	case FIELD_R24H:   return record->rain_24h;
+	case FIELD_RTOT:   return record->rain_total;
+	case FIELD_RP:     return record->rel_pressure;
+	case FIELD_TEND:   return record->tendency;
+	case FIELD_FCST:   return record->forecast;
+	}
+
+	return 0;
+}
+
+static int int_value(double value, int missing)
+{
+	return isfinite(value) ? (int) value : missing;
+}
+
+static void set_field(struct log_record *record, int id, double value)
+{
+	switch (id)
+	{
+	case FIELD_TIME:   record->timestamp = isfinite(value) ? (time_t) value : 0; break;
+	case FIELD_FORMAT: record->format = int_value(value, LOG_FORMAT_CURRENT); break;
+	case FIELD_TI:     record->temperature_indoor = value; break;
+	case FIELD_TO:     record->temperature_outdoor = value; break;
+	case FIELD_DP:     record->dewpoint = value; break;
+	case FIELD_RHI:    record->humidity_indoor = int_value(value, HUMIDITY_MISSING); break;
+	case FIELD_RHO:    record->humidity_outdoor = int_value(value, HUMIDITY_MISSING); break;
+	case FIELD_WS:     record->windspeed = value; break;
+	case FIELD_DIR:    record->winddir_degrees = value; break;
+	case FIELD_WC:     record->windchill = value; break;
+	case FIELD_R1H:    record->rain_1h = value; break;
+	case FIELD_R24H:   record->rain_24h = value; break;
+	case FIELD_RTOT:   record->rain_total = value; break;
+	case FIELD_RP:     record->rel_pressure = value; break;
+	case FIELD_TEND:   record->tendency = int_value(value, -1); break;
+	case FIELD_FCST:   record->forecast = int_value(value, -1); break;
+	}
+}
+
+
+/********************************************************************
+ * encode_record / decode_record convert between a record and
+ * the fixed width binary form described by the log header.
+ * For signed fields the lowest possible value marks a missing
+ * value (NAN), e.g. a dewpoint that could not be calculated, and
+ * for unsigned fields the highest.
+ *
+ ********************************************************************/
+static void encode_record(struct binlog *log, struct log_record *record,
+                          unsigned char *buffer)
+{
+	struct binlog_field *field;
+	double value;
+	long scaled;
+	int i, id;
+
+	memset(buffer, 0, log->record_size);
+
+	for (i = 0; i < log->field_count; i++)
+	{
+		field = &log->field[i];
+		if ((id = field_id(field->name)) < 0)
+			continue;
+
+		value = get_field(record, id);
+
+		if (!isfinite(value) && field->is_signed)
+			scaled = -(1L << (8 * field->width - 1));
+		else if (!isfinite(value))
+			scaled = -1;           // all bits set
+		else
+			scaled = (long) floor(value * field->scale + 0.5);
+
+		put_le(buffer + field->offset, (unsigned long) scaled, field->width);
+	}
+}
+
+static void decode_record(struct binlog *log, const unsigned char *buffer,
+                          struct log_record *record)
+{
+	struct binlog_field *field;
+	unsigned long raw;
+	long value;
+	int i, id;
+
+	memset(record, 0, sizeof(*record));
+	record->tendency = -1;
+	record->forecast = -1;
+
+	for (i = 0; i < log->field_count; i++)
+	{
+		field = &log->field[i];
+		if ((id = field_id(field->name)) < 0)
+			continue;
+
+		raw = get_le(buffer + field->offset, field->width);
+
+		if (field->is_signed && field->width < (int) sizeof(long) &&
+		    (raw & (1UL << (8 * field->width - 1))))
+		{
+			if (raw == (1UL << (8 * field->width - 1)))
+			{
+				set_field(record, id, NAN);
+				continue;
+			}
+			value = (long) raw - (1L << (8 * field->width));
+		}
+		else if (!field->is_signed && field->width < (int) sizeof(long) &&
+		         raw == (1UL << (8 * field->width)) - 1)
+		{
+			set_field(record, id, NAN);
+			continue;
+		}
+		else
+		{
+			value = (long) raw;
+		}
+
+		set_field(record, id, (double) value / field->scale);
+	}
+}
+
+
+/********************************************************************
+ * is_binlog_name tells if a file name selects the binary log
+ * format (name ends in .bin)
+ *
+ * Input:   path - file name
+ *
+ * Returns: 1 if binary format, 0 if text
+ *
+ ********************************************************************/
+int is_binlog_name(const char *path)
+{
+	int length = strlen(path);
+
+	return (length > 4 && strcmp(path + length - 4, ".bin") == 0);
+}
+
+
+/********************************************************************
+ * write_header writes the header of a new binary log using the
+ * default field layout
+ *
+ ********************************************************************/
+static int write_header(struct binlog *log)
+{
+	unsigned char buffer[HEADER_SIZE + DESCRIPTOR_SIZE * BINLOG_MAX_FIELDS];
+	unsigned char *p;
+	int i, offset = 0;
+
+	log->field_count = FIELD_COUNT;
+	log->index_interval = BINLOG_INDEX_INTERVAL;
+
+	for (i = 0; i < FIELD_COUNT; i++)
+	{
+		log->field[i] = default_fields[i];
+		log->field[i].offset = offset;
+		offset += log->field[i].width;
+	}
+	log->record_size = offset;
+
+	memset(buffer, 0, sizeof(buffer));
+	memcpy(buffer, BINLOG_MAGIC, 8);
+	put_le(buffer + 8, BINLOG_VERSION, 2);
+	put_le(buffer + 10, log->field_count, 2);
+	put_le(buffer + 12, log->record_size, 2);
+	put_le(buffer + 14, log->index_interval, 2);
+
+	for (i = 0; i < log->field_count; i++)
+	{
+		p = buffer + HEADER_SIZE + i * DESCRIPTOR_SIZE;
+		strncpy((char *) p, log->field[i].name, 8);
+		p[8] = log->field[i].width;
+		p[9] = log->field[i].is_signed;
+		put_le(p + 10, log->field[i].scale, 2);
+	}
+
+	log->data_start = HEADER_SIZE + log->field_count * DESCRIPTOR_SIZE;
+
+	if (fseek(log->file, 0L, SEEK_SET) != 0 ||
+	    fwrite(buffer, 1, log->data_start, log->file) != (size_t) log->data_start)
+		return -1;
+
+	fflush(log->file);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * read_header reads and validates the header of a binary log
+ *
+ ********************************************************************/
+static int read_header(struct binlog *log)
+{
+	unsigned char buffer[HEADER_SIZE + DESCRIPTOR_SIZE * BINLOG_MAX_FIELDS];
+	unsigned char *p;
+	int i, offset = 0;
+
+	if (fseek(log->file, 0L, SEEK_SET) != 0 ||
+	    fread(buffer, 1, HEADER_SIZE, log->file) != HEADER_SIZE ||
+	    memcmp(buffer, BINLOG_MAGIC, 8) != 0 ||
+	    get_le(buffer + 8, 2) != BINLOG_VERSION)
+		return -1;
+
+	log->field_count = get_le(buffer + 10, 2);
+	log->record_size = get_le(buffer + 12, 2);
+	log->index_interval = get_le(buffer + 14, 2);
+
+	if (log->field_count > BINLOG_MAX_FIELDS || log->index_interval == 0 ||
+	    fread(buffer + HEADER_SIZE, DESCRIPTOR_SIZE, log->field_count,
+	          log->file) != (size_t) log->field_count)
+		return -1;
+
+	for (i = 0; i < log->field_count; i++)
+	{
+		p = buffer + HEADER_SIZE + i * DESCRIPTOR_SIZE;
+		memcpy(log->field[i].name, p, 8);
+		log->field[i].name[8] = '\0';
+		log->field[i].width = p[8];
+		log->field[i].is_signed = p[9];
+		log->field[i].scale = get_le(p + 10, 2);
+		log->field[i].offset = offset;
+		if (log->field[i].width < 1 || log->field[i].width > 4 ||
+		    log->field[i].scale == 0)
+			return -1;
+		offset += log->field[i].width;
+	}
+
+	if (offset != log->record_size)
+		return -1;
+
+	log->data_start = HEADER_SIZE + log->field_count * DESCRIPTOR_SIZE;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * binlog_open opens a binary log file. A writable log is created
+ * with a new header if it does not exist or is empty.
+ *
+ * Input:   path - file name of the log
+ *          writable - 0 = read only, 1 = open for appending
+ *
+ * Output:  log - handle to the open log
+ *
+ * Returns: 0 on success, -1 if the file cannot be opened or is
+ *          not a valid binary log
+ *
+ ********************************************************************/
+int binlog_open(struct binlog *log, char *path, int writable)
+{
+	long size;
+
+	memset(log, 0, sizeof(*log));
+	snprintf(log->index_path, sizeof(log->index_path), "%s.tix", path);
+
+	log->file = fopen(path, writable ? "r+b" : "rb");
+	if (log->file == NULL && writable)
+		log->file = fopen(path, "w+b");
+	if (log->file == NULL)
+		return -1;
+
+	fseek(log->file, 0L, SEEK_END);
+	size = ftell(log->file);
+
+	if (size == 0 && writable)
+	{
+		remove(log->index_path);
+		if (write_header(log) == 0)
+			return 0;
+	}
+	else if (read_header(log) == 0)
+	{
+		// A partly written last record is ignored (and overwritten)
+		log->records = (size - log->data_start) / log->record_size;
+		return 0;
+	}
+
+	fclose(log->file);
+	log->file = NULL;
+
+	return -1;
+}
+
+
+/********************************************************************
+ * binlog_close closes a binary log
+ *
+ ********************************************************************/
+void binlog_close(struct binlog *log)
+{
+	if (log->file != NULL)
+		fclose(log->file);
+	log->file = NULL;
+}
+
+
+/********************************************************************
+ * index_entries returns the number of entries in the index file,
+ * -1 if it does not exist
+ *
+ ********************************************************************/
+static long index_entries(struct binlog *log)
+{
+	FILE *fptr;
+	long size;
+
+	if ((fptr = fopen(log->index_path, "rb")) == NULL)
+		return -1;
+
+	fseek(fptr, 0L, SEEK_END);
+	size = ftell(fptr);
+	fclose(fptr);
+
+	return size / 8;
+}
+
+
+/********************************************************************
+ * binlog_append adds a record at the end of the log and updates
+ * the sparse time index. Records must be appended in time order.
+ *
+ * Input:   log - log opened writable
+ *          record - the record to add
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int binlog_append(struct binlog *log, struct log_record *record)
+{
+	unsigned char buffer[BINLOG_MAX_FIELDS * 4];
+	unsigned char entry[8];
+	FILE *fptr;
+
+	if (log->records % log->index_interval == 0)
+	{
+		if (index_entries(log) != log->records / log->index_interval)
+			binlog_rebuild_index(log);
+
+		if ((fptr = fopen(log->index_path, "ab")) != NULL)
+		{
+			put_le(entry, (unsigned long) record->timestamp, 4);
+			put_le(entry + 4, (unsigned long) log->records, 4);
+			fwrite(entry, 1, 8, fptr);
+			fclose(fptr);
+		}
+	}
+
+	encode_record(log, record, buffer);
+
+	if (fseek(log->file, log->data_start + log->records * log->record_size,
+	          SEEK_SET) != 0 ||
+	    fwrite(buffer, 1, log->record_size, log->file) != (size_t) log->record_size ||
+	    fflush(log->file) != 0)
+		return -1;
+
+	log->records++;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * binlog_read reads one record by record number
+ *
+ * Input:   log - open log
+ *          number - record number, 0 is the first record
+ *
+ * Output:  record - the decoded record
+ *
+ * Returns: 1 on success, 0 if the record does not exist
+ *
+ ********************************************************************/
+int binlog_read(struct binlog *log, long number, struct log_record *record)
+{
+	unsigned char buffer[BINLOG_MAX_FIELDS * 4];
+
+	if (number < 0 || number >= log->records)
+		return 0;
+
+	if (fseek(log->file, log->data_start + number * log->record_size,
+	          SEEK_SET) != 0 ||
+	    fread(buffer, 1, log->record_size, log->file) != (size_t) log->record_size)
+		return 0;
+
+	decode_record(log, buffer, record);
+
+	return 1;
+}
+
+
+/********************************************************************
+ * binlog_rebuild_index writes the sparse time index from scratch
+ * by reading every index_interval'th record of the log
+ *
+ * Input:   log - open log
+ *
+ * Returns: 0 on success, -1 if the index cannot be written
+ *
+ ********************************************************************/
+int binlog_rebuild_index(struct binlog *log)
+{
+	struct log_record record;
+	unsigned char entry[8];
+	FILE *fptr;
+	long number;
+
+	if ((fptr = fopen(log->index_path, "wb")) == NULL)
+		return -1;
+
+	for (number = 0; number < log->records; number += log->index_interval)
+	{
+		if (!binlog_read(log, number, &record))
+			break;
+		put_le(entry, (unsigned long) record.timestamp, 4);
+		put_le(entry + 4, (unsigned long) number, 4);
+		fwrite(entry, 1, 8, fptr);
+	}
+
+	fclose(fptr);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * binlog_find finds the first record at or after a given time.
+ * The sparse index narrows the search to one block of
+ * index_interval records which is then binary searched.
+ * Without a usable index the whole log is binary searched.
+ *
+ * Input:   log - open log
+ *          timestamp - time to look for
+ *
+ * Returns: record number, log->records if all records are older
+ *
+ ********************************************************************/
+long binlog_find(struct binlog *log, time_t timestamp)
+{
+	struct log_record record;
+	unsigned char *index = NULL;
+	long entries, low = 0, high = log->records, middle;
+	long first, last;
+	FILE *fptr;
+
+	entries = index_entries(log);
+
+	if (entries > 0 &&
+	    entries == (log->records + log->index_interval - 1) / log->index_interval &&
+	    (index = malloc(entries * 8)) != NULL &&
+	    (fptr = fopen(log->index_path, "rb")) != NULL)
+	{
+		if (fread(index, 8, entries, fptr) == (size_t) entries)
+		{
+			// last index entry with a time before the one we look for
+			first = 0;
+			last = entries - 1;
+			while (first < last)
+			{
+				middle = (first + last + 1) / 2;
+				if ((time_t) get_le(index + middle * 8, 4) < timestamp)
+					first = middle;
+				else
+					last = middle - 1;
+			}
+			low = get_le(index + first * 8 + 4, 4);
+			if (first + 1 < entries)
+				high = get_le(index + (first + 1) * 8 + 4, 4);
+		}
+		fclose(fptr);
+	}
+
+	free(index);
+
+	// first record in [low, high) with time >= timestamp
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+		if (binlog_read(log, middle, &record) && record.timestamp < timestamp)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
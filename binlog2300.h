@@ -0,0 +1,63 @@
+/* open2300 - binlog2300.h
+ * Include file for the compact binary log format.
+ *
+ * File layout (all integers little endian):
+ *   header   magic "WS2300BL", version (2 bytes), field count (2),
+ *            record size (2), index interval (2)
+ *   fields   one descriptor per field: name (8 bytes, zero padded),
+ *            width in bytes (1), signed flag (1), scale (2)
+ *            value = stored integer / scale
+ *   records  fixed width, fields in descriptor order
+ *
+ * The sparse time index is kept in a sidecar file (log name + ".tix").
+ * It holds a (timestamp, record number) pair of 4 bytes each for every
+ * BINLOG_INDEX_INTERVAL records and can be rebuilt from the log.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_BINLOG2300_H_
+#define _INCLUDE_BINLOG2300_H_
+
+#include "record2300.h"
+
+#define BINLOG_MAGIC          "WS2300BL"
+#define BINLOG_VERSION        1
+#define BINLOG_INDEX_INTERVAL 256
+#define BINLOG_MAX_FIELDS     20
+
+struct binlog_field
+{
+	char name[9];
+	int  width;
+	int  is_signed;
+	int  scale;
+	int  offset;
+};
+
+struct binlog
+{
+	FILE  *file;
+	char   index_path[300];
+	int    field_count;
+	int    record_size;
+	int    index_interval;
+	long   data_start;
+	long   records;
+	struct binlog_field field[BINLOG_MAX_FIELDS];
+};
+
+int  is_binlog_name(const char *path);
+
+int  binlog_open(struct binlog *log, char *path, int writable);
+
+void binlog_close(struct binlog *log);
+
+int  binlog_append(struct binlog *log, struct log_record *record);
+
+int  binlog_read(struct binlog *log, long number, struct log_record *record);
+
+long binlog_find(struct binlog *log, time_t timestamp);
+
+int  binlog_rebuild_index(struct binlog *log);
+
+#endif /* _INCLUDE_BINLOG2300_H_ */
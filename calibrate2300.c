@@ -0,0 +1,405 @@
+/*  open2300 - calibrate2300.c
+ *
+ *  Version 1.11
+ *
+ *  Measures the timing of the serial link to the station and writes
+ *  the timing profile of the device (see link2300.h)
+ *
+ *  The station is only read. Each setting is tried with a number of
+ *  resets and reads: first the read timeout, then the pause between
+ *  command bytes, the bytes per read and the pause between resets,
+ *  each with the best of the settings before it. The settings whose
+ *  reads do not fail significantly more often than allowed are ranked
+ *  on the time of a good read, retries included, and a slower setting
+ *  is only taken if it is clearly faster in that. The pause between
+ *  resets stays the built-in one unless another is clearly faster.
+ *  The tries of read_safe follow from how often a read failed.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include <math.h>
+#include "rw2300.h"
+#include "link2300.h"
+#include "stats2300.h"
+
+#define CALIBRATE_READS    50      // default reads per setting
+#define CALIBRATE_ERRORS   1.0     // default accepted failed reads, percent
+#define CALIBRATE_ADDRESS  0x346   // read from here (temperature indoor)
+#define CALIBRATE_FAILURE  1e-6    // accepted share of read_safe that fail
+#define CALIBRATE_LEVEL    0.05    // chance of failures taken as too many by noise
+#define CALIBRATE_MARGIN   0.05    // share a slower setting must be faster by
+
+static const int timeouts[] = {100, 200, 300, 500, 1000, 2000};
+static const int byte_delays[] = {0, 1, 2, 5, 10};
+static const int read_sizes[] = {15, 8, 5, 3, 1};
+static const int backoffs[] = {0, 10, 25, 50, 100};
+
+#define COUNT(array) ((int) (sizeof(array) / sizeof(array[0])))
+
+struct probe
+{
+	int    reads;
+	int    failed;
+	double mean;                   // ms per try, reset included
+	double cost;                   // ms per good read, retries included
+};
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("calibrate2300 - Measure the serial timing of a WS-2300 and store it.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("calibrate2300 [-n reads] [-e percent] [config_filename]\n");
+	printf("-n reads at each setting (default %d)\n", CALIBRATE_READS);
+	printf("-e reads that may fail, percent (default %g). A few more pass as chance.\n",
+	       CALIBRATE_ERRORS);
+	printf("The profile is written to LINK_PROFILE_DIR of the config file.\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * probe does reads of the station as read_safe does them, a reset
+ * and a read, with the link timing as it is set
+ *
+ * Input:   reads - number of tries
+ *          number - bytes per read
+ *
+ * Output:  result - failed reads and times
+ *
+ ********************************************************************/
+static void probe(WEATHERSTATION ws2300, int reads, int number, struct probe *result)
+{
+	unsigned char data[20], command[25];
+	long long start = clock_microseconds();
+	int i;
+
+	result->reads = reads;
+	result->failed = 0;
+
+	for (i = 0; i < reads; i++)
+	{
+		reset_06(ws2300);
+		if (read_data(ws2300, CALIBRATE_ADDRESS, number, data, command) != number)
+			result->failed++;
+	}
+
+	result->mean = (clock_microseconds() - start) / 1000.0 / reads;
+	result->cost = result->failed < reads ?
+	               result->mean * reads / (reads - result->failed) : HUGE_VAL;
+}
+
+
+/********************************************************************
+ * acceptable tells if the failed reads of a probe can be due to
+ * chance with reads failing at the accepted rate: the chance of that
+ * many failures or more is at least CALIBRATE_LEVEL. With 50 reads
+ * and 1 % up to 2 failures pass, so a setting is not dropped for one
+ * unlucky read.
+ *
+ * Input:   errors - accepted share of failed reads
+ *
+ ********************************************************************/
+static int acceptable(struct probe *result, double errors)
+{
+	double chance = 0;
+	int k, n = result->reads;
+
+	if (result->failed == 0)
+		return 1;
+	if (errors <= 0)
+		return 0;
+	if (errors >= 1)
+		return 1;
+
+	// Binomial tail P(failures >= failed)
+	for (k = result->failed; k <= n; k++)
+		chance += exp(lgamma(n + 1) - lgamma(k + 1) - lgamma(n - k + 1) +
+		              k * log(errors) + (n - k) * log(1 - errors));
+
+	return chance >= CALIBRATE_LEVEL;
+}
+
+
+/********************************************************************
+ * better tells if a probe is a better setting than the best so far.
+ * The settings are tried from the fastest to the slowest, so the
+ * probe is of a slower setting: it must be acceptable and cost
+ * CALIBRATE_MARGIN less, or fail less if neither is acceptable.
+ *
+ ********************************************************************/
+static int better(struct probe *result, struct probe *best, double errors)
+{
+	int result_ok, best_ok;
+
+	if (best->reads == 0)
+		return 1;
+
+	result_ok = acceptable(result, errors);
+	best_ok = acceptable(best, errors);
+
+	if (result_ok != best_ok)
+		return result_ok;
+	if (!result_ok && result->failed != best->failed)
+		return result->failed < best->failed;
+
+	return result->cost < best->cost * (1 - CALIBRATE_MARGIN);
+}
+
+
+/********************************************************************
+ * print_probe prints the result of a setting
+ *
+ ********************************************************************/
+static void print_probe(const char *setting, int value, const char *unit,
+                        struct probe *result)
+{
+	printf("%-12s %5d %-5s %4d reads %4d failed (%5.1f %%) %9.1f ms per %d bytes\n",
+	       setting, value, unit, result->reads, result->failed,
+	       100.0 * result->failed / result->reads, result->cost, LINK_READ_SIZE);
+}
+
+
+/********************************************************************
+ * echo_latency measures how long the station takes to answer a
+ * command byte, writing the byte included
+ *
+ * Output:  mean, max - milliseconds
+ *
+ ********************************************************************/
+static void echo_latency(WEATHERSTATION ws2300, int reads, double *mean, double *max)
+{
+	unsigned char address[4], answer;
+	long long start, latency, total = 0, longest = 0;
+	int i, count = 0;
+
+	address_encoder(CALIBRATE_ADDRESS, address);
+
+	for (i = 0; i < reads; i++)
+	{
+		reset_06(ws2300);
+		start = clock_microseconds();
+		write_device(ws2300, address, 1);
+		if (read_device(ws2300, &answer, 1) != 1)
+			continue;
+		latency = clock_microseconds() - start;
+		total += latency;
+		if (latency > longest)
+			longest = latency;
+		count++;
+	}
+
+	*mean = count > 0 ? total / 1000.0 / count : 0;
+	*max = longest / 1000.0;
+}
+
+
+/********************************************************************
+ * resync_time measures a reset after a read that was cut off after
+ * two address bytes, with the pause between resets as it is set
+ *
+ * Returns: milliseconds per reset
+ *
+ ********************************************************************/
+static double resync_time(WEATHERSTATION ws2300, int rounds)
+{
+	unsigned char address[4], answer;
+	long long start, total = 0;
+	int i, j;
+
+	address_encoder(CALIBRATE_ADDRESS, address);
+
+	for (i = 0; i < rounds; i++)
+	{
+		reset_06(ws2300);
+		for (j = 0; j < 2; j++)
+		{
+			write_device(ws2300, address + j, 1);
+			read_device(ws2300, &answer, 1);
+		}
+		start = clock_microseconds();
+		reset_06(ws2300);
+		total += clock_microseconds() - start;
+	}
+
+	return total / 1000.0 / rounds;
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program measures the link timing and writes the profile.
+ *
+ * It takes one parameter which is the config file name with path
+ * If this parameter is omitted the program will look at the default paths
+ * See the open2300.conf-dist file for info
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	WEATHERSTATION ws2300;
+	struct config_type config;
+	struct link_timing *timing = link_timing();
+	struct probe result, best;
+	char path[300], comment[200];
+	double errors = CALIBRATE_ERRORS / 100, failure, mean, max, resync, fastest;
+	int reads = CALIBRATE_READS;
+	int arg, i, parts, chosen = 0;
+	time_t basictime;
+
+	stats_option(&argc, argv);
+
+	for (arg = 1; arg < argc && argv[arg][0] == '-'; arg += 2)
+	{
+		if (arg + 1 >= argc)
+			print_usage();
+
+		switch (argv[arg][1])
+		{
+		case 'n':
+			reads = atoi(argv[arg + 1]);
+			break;
+		case 'e':
+			errors = atof(argv[arg + 1]) / 100;
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	if (reads < 1 || errors < 0)
+		print_usage();
+
+	get_configuration(&config, argv[arg]);
+
+	// Start from the built-in timing, not an old profile
+	link_setup("");
+	ws2300 = open_weatherstation(config.serial_device_name);
+	link_setup(config.link_profile_dir);
+
+	echo_latency(ws2300, reads, &mean, &max);
+	printf("echo latency %.1f ms mean, %.1f ms max\n", mean, max);
+
+	best.reads = 0;
+	for (i = 0; i < COUNT(timeouts); i++)
+	{
+		timing->timeout = timeouts[i];
+		if (set_read_timeout(ws2300, timing->timeout) != 0)
+		{
+			perror("Cannot set the read timeout");
+			exit(EXIT_FAILURE);
+		}
+		probe(ws2300, reads, LINK_READ_SIZE, &result);
+		print_probe("timeout", timeouts[i], "ms", &result);
+		// The shortest timeout that is good enough, a longer one only
+		// if reads still time out
+		if (better(&result, &best, errors) &&
+		    (best.reads == 0 || !acceptable(&best, errors)))
+		{
+			best = result;
+			chosen = timeouts[i];
+		}
+	}
+	timing->timeout = chosen;
+	set_read_timeout(ws2300, timing->timeout);
+
+	best.reads = 0;
+	for (i = 0; i < COUNT(byte_delays); i++)
+	{
+		timing->byte_delay = byte_delays[i];
+		probe(ws2300, reads, LINK_READ_SIZE, &result);
+		print_probe("byte delay", byte_delays[i], "ms", &result);
+		if (better(&result, &best, errors))
+		{
+			best = result;
+			chosen = byte_delays[i];
+		}
+	}
+	timing->byte_delay = chosen;
+
+	// A 15 byte read in parts: the cost of a part times the parts
+	best.reads = 0;
+	for (i = 0; i < COUNT(read_sizes); i++)
+	{
+		probe(ws2300, reads, read_sizes[i], &result);
+		parts = (LINK_READ_SIZE + read_sizes[i] - 1) / read_sizes[i];
+		result.cost *= parts;
+		print_probe("read size", read_sizes[i], "bytes", &result);
+		if (better(&result, &best, errors))
+		{
+			best = result;
+			timing->read_size = read_sizes[i];
+		}
+	}
+
+	// The built-in pause first, another only if it is clearly faster
+	timing->backoff = LINK_BACKOFF;
+	fastest = resync_time(ws2300, reads);
+	chosen = LINK_BACKOFF;
+	printf("%-12s %5d %-5s %4d resets %9.1f ms per resync (built-in)\n",
+	       "reset pause", LINK_BACKOFF, "ms", reads, fastest);
+	for (i = 0; i < COUNT(backoffs); i++)
+	{
+		if (backoffs[i] == LINK_BACKOFF)
+			continue;
+		timing->backoff = backoffs[i];
+		resync = resync_time(ws2300, reads);
+		printf("%-12s %5d %-5s %4d resets %9.1f ms per resync\n",
+		       "reset pause", backoffs[i], "ms", reads, resync);
+		if (resync < fastest * 0.9 && fastest - resync > 1)
+		{
+			fastest = resync;
+			chosen = backoffs[i];
+		}
+	}
+	timing->backoff = chosen;
+
+	close_weatherstation(ws2300);
+
+	// Tries so that read_safe fails at most CALIBRATE_FAILURE, with at
+	// least 3 failed reads of all assumed (rule of three)
+	failure = (best.failed > 3 ? best.failed : 3) / (double) best.reads;
+	timing->retries = failure < 1 ?
+	                  (int) ceil(log(CALIBRATE_FAILURE) / log(failure)) : MAXRETRIES;
+	if (timing->retries < 3)
+		timing->retries = 3;
+	if (timing->retries > MAXRETRIES)
+		timing->retries = MAXRETRIES;
+
+	printf("\nTIMEOUT %d\nRESET_BACKOFF %d\nRETRIES %d\nBYTE_DELAY %d\nREAD_SIZE %d\n",
+	       timing->timeout, timing->backoff, timing->retries,
+	       timing->byte_delay, timing->read_size);
+
+	if (link_profile_path(config.serial_device_name, path, sizeof(path)) != 0)
+	{
+		printf("\nSet LINK_PROFILE_DIR in the config file to store the profile\n");
+		return(0);
+	}
+
+	time(&basictime);
+	strftime(comment, sizeof(comment), "calibrate2300 %Y-%m-%d %H:%M:%S", localtime(&basictime));
+
+	if (link_profile_save(config.serial_device_name, timing, comment) != 0)
+	{
+		printf("Cannot write file %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("\nWritten to %s\n", path);
+
+	return(0);
+}
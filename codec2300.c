@@ -0,0 +1,608 @@
+/*  open2300 - codec2300.c
+ *
+ *  Version 1.11
+ *
+ *  Time series codec for station records. Encodes records in
+ *  independent blocks using delta-of-delta timestamps and either
+ *  delta or XOR encoded values. See codec2300.h for the format.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "codec2300.h"
+
+// Field list used for log records. Scales match the decimals of the
+// log2300 text format so the values survive a round trip unchanged.
+static const struct codec_field record_fields[CODEC_RECORD_FIELDS] = {
+	{ "format", CODEC_DELTA, 1 },
+	{ "Ti",     CODEC_DELTA, 10 },
+	{ "To",     CODEC_DELTA, 10 },
+	{ "DP",     CODEC_DELTA, 10 },
+	{ "RHi",    CODEC_DELTA, 1 },
+	{ "RHo",    CODEC_DELTA, 1 },
+	{ "WS",     CODEC_DELTA, 10 },
+	{ "DIR",    CODEC_DELTA, 10 },
+	{ "WC",     CODEC_DELTA, 10 },
+	{ "R1h",    CODEC_DELTA, 100 },
+	{ "R24h",   CODEC_DELTA, 100 },
+	{ "Rtot",   CODEC_DELTA, 100 },
+	{ "RP",     CODEC_DELTA, 1000 },
+	{ "Tend",   CODEC_DELTA, 1 },
+	{ "Fcst",   CODEC_DELTA, 1 }
+};
+
+
+/********************************************************************
+ * put_le / get_le store and load little endian integers
+ *
+ ********************************************************************/
+static void put_le(unsigned char *buffer, unsigned long value, int width)
+{
+	int i;
+
+	for (i = 0; i < width; i++)
+		buffer[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static unsigned long get_le(const unsigned char *buffer, int width)
+{
+	unsigned long value = 0;
+	int i;
+
+	for (i = width - 1; i >= 0; i--)
+		value = (value << 8) | buffer[i];
+
+	return value;
+}
+
+
+/********************************************************************
+ * varint_put writes an unsigned number as a varint: 7 bits per
+ * byte, lowest bits first, high bit set on all but the last byte
+ *
+ * Input:   buffer - where to write (up to 10 bytes)
+ *          value - the number
+ *
+ * Returns: pointer to the byte after the varint
+ *
+ ********************************************************************/
+unsigned char *varint_put(unsigned char *buffer, unsigned long value)
+{
+	while (value >= 0x80)
+	{
+		*buffer++ = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	*buffer++ = value;
+
+	return buffer;
+}
+
+
+/********************************************************************
+ * varint_get reads a varint written by varint_put
+ *
+ * Input:   buffer - start of the varint
+ *          end - end of the available data
+ *
+ * Output:  value - the number
+ *
+ * Returns: pointer to the byte after the varint, NULL if the data
+ *          ends inside the varint
+ *
+ ********************************************************************/
+const unsigned char *varint_get(const unsigned char *buffer,
+                                const unsigned char *end, unsigned long *value)
+{
+	unsigned long result = 0;
+	int shift = 0;
+
+	while (buffer < end && shift < 64)
+	{
+		result |= (unsigned long) (*buffer & 0x7F) << shift;
+		if (!(*buffer++ & 0x80))
+		{
+			*value = result;
+			return buffer;
+		}
+		shift += 7;
+	}
+
+	return NULL;
+}
+
+
+/********************************************************************
+ * zigzag_encode / zigzag_decode map signed numbers to unsigned so
+ * small negative numbers also give short varints
+ * (0, -1, 1, -2 ... becomes 0, 1, 2, 3 ...)
+ *
+ ********************************************************************/
+unsigned long zigzag_encode(long value)
+{
+	return ((unsigned long) value << 1) ^ (unsigned long) (value >> (8 * sizeof(long) - 1));
+}
+
+long zigzag_decode(unsigned long value)
+{
+	return (long) (value >> 1) ^ -(long) (value & 1);
+}
+
+
+/********************************************************************
+ * codec_record_fields gives the field list used for log records
+ *
+ * Input:   method - CODEC_DELTA or CODEC_XOR for all fields
+ *
+ * Output:  field - CODEC_RECORD_FIELDS field descriptions
+ *
+ * Returns: number of fields
+ *
+ ********************************************************************/
+int codec_record_fields(struct codec_field *field, int method)
+{
+	int i;
+
+	for (i = 0; i < CODEC_RECORD_FIELDS; i++)
+	{
+		field[i] = record_fields[i];
+		field[i].method = method;
+	}
+
+	return CODEC_RECORD_FIELDS;
+}
+
+
+/********************************************************************
+ * codec_record_values / codec_values_record move the values of a
+ * log record to and from the array used by the codec
+ *
+ ********************************************************************/
+void codec_record_values(struct log_record *record, double *values)
+{
+	values[0]  = record->format;
+	values[1]  = record->temperature_indoor;
+	values[2]  = record->temperature_outdoor;
+	values[3]  = record->dewpoint;
+	values[4]  = record->humidity_indoor;
+	values[5]  = record->humidity_outdoor;
+	values[6]  = record->windspeed;
+	values[7]  = record->winddir_degrees;
+	values[8]  = record->windchill;
+	values[9]  = record->rain_1h;
+	values[10] = record->rain_24h;
+	values[11] = record->rain_total;
+	values[12] = record->rel_pressure;
+	values[13] = record->tendency;
+	values[14] = record->forecast;
+}
+
+void codec_values_record(time_t timestamp, const double *values,
+                         struct log_record *record)
+{
+	record->timestamp           = timestamp;
+	record->format              = (int) values[0];
+	record->temperature_indoor  = values[1];
+	record->temperature_outdoor = values[2];
+	record->dewpoint            = values[3];
+	record->humidity_indoor     = (int) values[4];
+	record->humidity_outdoor    = (int) values[5];
+	record->windspeed           = values[6];
+	record->winddir_degrees     = values[7];
+	record->windchill           = values[8];
+	record->rain_1h             = values[9];
+	record->rain_24h            = values[10];
+	record->rain_total          = values[11];
+	record->rel_pressure        = values[12];
+	record->tendency            = (int) values[13];
+	record->forecast            = (int) values[14];
+}
+
+
+/********************************************************************
+ * codec_block_init sets up an empty block for a list of fields
+ *
+ * Input:   field - field descriptions
+ *          field_count - number of fields (max CODEC_MAX_FIELDS)
+ *
+ * Output:  block - empty block
+ *
+ ********************************************************************/
+void codec_block_init(struct codec_block *block, struct codec_field *field,
+                      int field_count)
+{
+	block->field_count = field_count;
+	memcpy(block->field, field, field_count * sizeof(struct codec_field));
+	codec_block_reset(block);
+}
+
+
+/********************************************************************
+ * codec_block_reset empties a block so new records can be added
+ *
+ ********************************************************************/
+void codec_block_reset(struct codec_block *block)
+{
+	block->records = 0;
+	block->used = 0;
+	codec_block_rewind(block);
+}
+
+
+/********************************************************************
+ * codec_block_rewind restarts decoding at the first record
+ *
+ ********************************************************************/
+void codec_block_rewind(struct codec_block *block)
+{
+	block->position = 0;
+	block->decoded = 0;
+	block->last_time = block->first_time;
+	block->last_delta = 0;
+	memset(block->previous, 0, sizeof(block->previous));
+	memset(block->previous_bits, 0, sizeof(block->previous_bits));
+}
+
+
+/********************************************************************
+ * double_bits / bits_double reinterpret a double as 64 bits
+ *
+ ********************************************************************/
+static unsigned long long double_bits(double value)
+{
+	unsigned long long bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+
+	return bits;
+}
+
+static double bits_double(unsigned long long bits)
+{
+	double value;
+
+	memcpy(&value, &bits, sizeof(value));
+
+	return value;
+}
+
+
+/********************************************************************
+ * codec_block_add encodes one record at the end of a block
+ *
+ * Input:   block - block with room for one more record
+ *          timestamp - time of the record, not older than the last
+ *          values - one value per field, NAN if missing
+ *
+ * Returns: 0 on success, -1 if the block is full or the time goes
+ *          backwards
+ *
+ ********************************************************************/
+int codec_block_add(struct codec_block *block, time_t timestamp,
+                    const double *values)
+{
+	unsigned char *p = block->data + block->used;
+	unsigned long long bits, xor;
+	long delta, scaled;
+	int i, lead, trail, length;
+
+	if (block->records >= CODEC_BLOCK_RECORDS)
+		return -1;
+
+	if (block->records == 0)
+	{
+		block->first_time = timestamp;
+		block->last_time = timestamp;
+		block->last_delta = 0;
+		memset(block->previous, 0, sizeof(block->previous));
+		memset(block->previous_bits, 0, sizeof(block->previous_bits));
+	}
+	else
+	{
+		if (timestamp < block->last_time)
+			return -1;
+
+		delta = (long) (timestamp - block->last_time);
+		p = varint_put(p, zigzag_encode(delta - block->last_delta));
+		block->last_delta = delta;
+		block->last_time = timestamp;
+	}
+
+	for (i = 0; i < block->field_count; i++)
+	{
+		if (block->field[i].method == CODEC_XOR)
+		{
+			bits = double_bits(values[i]);
+			xor = bits ^ block->previous_bits[i];
+			block->previous_bits[i] = bits;
+
+			if (xor == 0)
+			{
+				*p++ = 0;
+				continue;
+			}
+
+			for (lead = 0; !(xor >> (8 * (7 - lead)) & 0xFF); lead++)
+				;
+			for (trail = 0; !(xor >> (8 * trail) & 0xFF); trail++)
+				;
+			length = 8 - lead - trail;
+
+			*p++ = (lead << 4) | length;
+			xor >>= 8 * trail;
+			while (length--)
+			{
+				*p++ = xor & 0xFF;
+				xor >>= 8;
+			}
+		}
+		else if (isnan(values[i]))
+		{
+			*p++ = 0;
+		}
+		else
+		{
+			scaled = (long) floor(values[i] * block->field[i].scale + 0.5);
+			p = varint_put(p, zigzag_encode(scaled - block->previous[i]) + 1);
+			block->previous[i] = scaled;
+		}
+	}
+
+	block->used = p - block->data;
+	block->records++;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * codec_block_next decodes the next record of a block
+ *
+ * Input:   block - block to read
+ *
+ * Output:  timestamp - time of the record
+ *          values - one value per field
+ *
+ * Returns: 1 if a record was decoded, 0 at the end of the block,
+ *          -1 if the block data is damaged
+ *
+ ********************************************************************/
+int codec_block_next(struct codec_block *block, time_t *timestamp,
+                     double *values)
+{
+	const unsigned char *p = block->data + block->position;
+	const unsigned char *end = block->data + block->used;
+	unsigned long long xor;
+	unsigned long token;
+	int i, lead, length, k;
+
+	if (block->decoded >= block->records)
+		return 0;
+
+	if (block->decoded > 0)
+	{
+		if ((p = varint_get(p, end, &token)) == NULL)
+			return -1;
+		block->last_delta += zigzag_decode(token);
+		block->last_time += block->last_delta;
+	}
+
+	*timestamp = block->last_time;
+
+	for (i = 0; i < block->field_count; i++)
+	{
+		if (block->field[i].method == CODEC_XOR)
+		{
+			if (p >= end)
+				return -1;
+
+			if (*p == 0)
+			{
+				p++;
+			}
+			else
+			{
+				lead = *p >> 4;
+				length = *p++ & 0x0F;
+				if (length == 0 || lead + length > 8 || p + length > end)
+					return -1;
+
+				xor = 0;
+				for (k = length - 1; k >= 0; k--)
+					xor = (xor << 8) | p[k];
+				p += length;
+
+				block->previous_bits[i] ^= xor << (8 * (8 - lead - length));
+			}
+			values[i] = bits_double(block->previous_bits[i]);
+		}
+		else
+		{
+			if ((p = varint_get(p, end, &token)) == NULL)
+				return -1;
+
+			if (token == 0)
+			{
+				values[i] = NAN;
+				continue;
+			}
+
+			block->previous[i] += zigzag_decode(token - 1);
+			values[i] = (double) block->previous[i] / block->field[i].scale;
+		}
+	}
+
+	block->position = p - block->data;
+	block->decoded++;
+
+	return 1;
+}
+
+
+/********************************************************************
+ * codec_write_header writes the stream header with the field list
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int codec_write_header(FILE *file, struct codec_field *field, int field_count)
+{
+	unsigned char buffer[12 + CODEC_MAX_FIELDS * 12];
+	unsigned char *p;
+	int i, size;
+
+	memcpy(buffer, CODEC_MAGIC, 8);
+	put_le(buffer + 8, CODEC_VERSION, 2);
+	put_le(buffer + 10, field_count, 2);
+
+	for (i = 0, p = buffer + 12; i < field_count; i++, p += 12)
+	{
+		memset(p, 0, 12);
+		strncpy((char *) p, field[i].name, 8);
+		p[8] = field[i].method;
+		put_le(p + 10, field[i].scale, 2);
+	}
+
+	size = p - buffer;
+
+	if (fwrite(buffer, 1, size, file) != (size_t) size)
+		return -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * codec_read_header reads the stream header
+ *
+ * Output:  field - field list (CODEC_MAX_FIELDS entries)
+ *
+ * Returns: number of fields, -1 if not a valid stream
+ *
+ ********************************************************************/
+int codec_read_header(FILE *file, struct codec_field *field)
+{
+	unsigned char buffer[12];
+	int i, field_count;
+
+	if (fread(buffer, 1, 12, file) != 12 ||
+	    memcmp(buffer, CODEC_MAGIC, 8) != 0 ||
+	    get_le(buffer + 8, 2) != CODEC_VERSION)
+		return -1;
+
+	field_count = get_le(buffer + 10, 2);
+	if (field_count > CODEC_MAX_FIELDS)
+		return -1;
+
+	for (i = 0; i < field_count; i++)
+	{
+		if (fread(buffer, 1, 12, file) != 12)
+			return -1;
+		memcpy(field[i].name, buffer, 8);
+		field[i].name[8] = '\0';
+		field[i].method = buffer[8];
+		field[i].scale = get_le(buffer + 10, 2);
+		if (field[i].method > CODEC_XOR || field[i].scale == 0)
+			return -1;
+	}
+
+	return field_count;
+}
+
+
+/********************************************************************
+ * codec_write_block writes a block with its frame. Empty blocks
+ * are not written.
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int codec_write_block(FILE *file, struct codec_block *block)
+{
+	unsigned char frame[CODEC_FRAME_SIZE];
+
+	if (block->records == 0)
+		return 0;
+
+	frame[0] = 'B';
+	frame[1] = 'K';
+	put_le(frame + 2, block->records, 2);
+	put_le(frame + 4, (unsigned long) block->first_time, 4);
+	put_le(frame + 8, (unsigned long) block->last_time, 4);
+	put_le(frame + 12, block->used, 4);
+
+	if (fwrite(frame, 1, CODEC_FRAME_SIZE, file) != CODEC_FRAME_SIZE ||
+	    fwrite(block->data, 1, block->used, file) != (size_t) block->used)
+		return -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * codec_read_block reads the next block of a stream. The block
+ * must have been set up with the field list of the stream.
+ *
+ * Returns: 1 if a block was read, 0 at the end of the stream,
+ *          -1 if the stream is damaged
+ *
+ ********************************************************************/
+int codec_read_block(FILE *file, struct codec_block *block)
+{
+	unsigned char frame[CODEC_FRAME_SIZE];
+	size_t count;
+
+	if ((count = fread(frame, 1, CODEC_FRAME_SIZE, file)) == 0)
+		return 0;
+
+	if (count != CODEC_FRAME_SIZE || frame[0] != 'B' || frame[1] != 'K')
+		return -1;
+
+	block->records = get_le(frame + 2, 2);
+	block->first_time = (time_t) get_le(frame + 4, 4);
+	block->used = get_le(frame + 12, 4);
+
+	if (block->records > CODEC_BLOCK_RECORDS || block->used > CODEC_BLOCK_SIZE ||
+	    fread(block->data, 1, block->used, file) != (size_t) block->used)
+		return -1;
+
+	codec_block_rewind(block);
+
+	return 1;
+}
+
+
+/********************************************************************
+ * codec_seek skips the blocks that end before a given time using
+ * only the frames. The next codec_read_block returns the block that
+ * holds the first record at or after the time.
+ *
+ * Input:   file - stream positioned at a block frame
+ *          timestamp - time to find
+ *
+ * Returns: 0 on success, -1 if the stream is damaged
+ *
+ ********************************************************************/
+int codec_seek(FILE *file, time_t timestamp)
+{
+	unsigned char frame[CODEC_FRAME_SIZE];
+	long position;
+	size_t count;
+
+	while (1)
+	{
+		position = ftell(file);
+
+		if ((count = fread(frame, 1, CODEC_FRAME_SIZE, file)) == 0)
+			return 0;
+
+		if (count != CODEC_FRAME_SIZE || frame[0] != 'B' || frame[1] != 'K')
+			return -1;
+
+		if ((time_t) get_le(frame + 8, 4) >= timestamp)
+			return fseek(file, position, SEEK_SET);
+
+		if (fseek(file, get_le(frame + 12, 4), SEEK_CUR) != 0)
+			return -1;
+	}
+}
@@ -0,0 +1,106 @@
+/* open2300 - codec2300.h
+ * Include file for the time series codec.
+ *
+ * Records (a timestamp and a list of values) are encoded in blocks
+ * of up to CODEC_BLOCK_RECORDS records. Each block can be decoded on
+ * its own so a reader can skip to the block holding a given time.
+ *
+ * Inside a block the first timestamp is kept in the frame, the
+ * following ones are delta-of-delta zigzag varints. Each field uses
+ * one of two methods:
+ *   CODEC_DELTA  value * scale rounded to an integer, stored as the
+ *                zigzag varint of the difference to the previous value
+ *                plus one. 0 means the value is missing (NAN).
+ *   CODEC_XOR    the bits of the double XOR the previous value. One
+ *                control byte holds the number of leading zero bytes
+ *                (high nibble) and significant bytes (low nibble)
+ *                followed by the significant bytes. 0 means unchanged.
+ *
+ * Stream file layout (all integers little endian):
+ *   header   magic "WS2300TZ", version (2 bytes), field count (2)
+ *   fields   name (8 bytes, zero padded), method (1), reserved (1),
+ *            scale (2)
+ *   blocks   frame: sync "BK", record count (2), first time (4),
+ *            last time (4), data bytes (4), followed by the data
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_CODEC2300_H_
+#define _INCLUDE_CODEC2300_H_
+
+#include "record2300.h"
+
+#define CODEC_MAGIC           "WS2300TZ"
+#define CODEC_VERSION         1
+#define CODEC_DELTA           0
+#define CODEC_XOR             1
+#define CODEC_MAX_FIELDS      20
+#define CODEC_RECORD_FIELDS   15
+#define CODEC_BLOCK_RECORDS   1024
+#define CODEC_FRAME_SIZE      16
+#define CODEC_MAX_RECORD      (5 + CODEC_MAX_FIELDS * 10)
+#define CODEC_BLOCK_SIZE      (CODEC_BLOCK_RECORDS * CODEC_MAX_RECORD)
+
+struct codec_field
+{
+	char name[9];
+	int  method;
+	int  scale;
+};
+
+struct codec_block
+{
+	int    field_count;
+	struct codec_field field[CODEC_MAX_FIELDS];
+	int    records;
+	int    used;                   // bytes of data
+	int    position;               // decoder read position
+	int    decoded;                // records decoded so far
+	time_t first_time;
+	time_t last_time;
+	long   last_delta;
+	long   previous[CODEC_MAX_FIELDS];
+	unsigned long long previous_bits[CODEC_MAX_FIELDS];
+	unsigned char data[CODEC_BLOCK_SIZE];
+};
+
+unsigned char *varint_put(unsigned char *buffer, unsigned long value);
+
+const unsigned char *varint_get(const unsigned char *buffer,
+                                const unsigned char *end, unsigned long *value);
+
+unsigned long zigzag_encode(long value);
+
+long zigzag_decode(unsigned long value);
+
+int  codec_record_fields(struct codec_field *field, int method);
+
+void codec_record_values(struct log_record *record, double *values);
+
+void codec_values_record(time_t timestamp, const double *values,
+                         struct log_record *record);
+
+void codec_block_init(struct codec_block *block, struct codec_field *field,
+                      int field_count);
+
+void codec_block_reset(struct codec_block *block);
+
+int  codec_block_add(struct codec_block *block, time_t timestamp,
+                     const double *values);
+
+void codec_block_rewind(struct codec_block *block);
+
+int  codec_block_next(struct codec_block *block, time_t *timestamp,
+                      double *values);
+
+int  codec_write_header(FILE *file, struct codec_field *field, int field_count);
+
+int  codec_read_header(FILE *file, struct codec_field *field);
+
+int  codec_write_block(FILE *file, struct codec_block *block);
+
+int  codec_read_block(FILE *file, struct codec_block *block);
+
+int  codec_seek(FILE *file, time_t timestamp);
+
+#endif /* _INCLUDE_CODEC2300_H_ */
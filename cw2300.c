@@ -20,14 +20,52 @@
  *  1.3 2006 Jun 19 Kenneth Lavrsen  Rewritten to use safer strcat instead
  *                                   of sprintf over itself which may
  *                                   not always work.
+ *
+ *  1.4                              Packets that cannot be sent are
+ *                                   kept in the spool if configured.
+ *
+ *  1.5                              The APRS servers are connected to
+ *                                   in parallel, fastest known first.
+ *
+ *  1.6                              The record is made by
+ *                                   format_aprs_report as srv2300 does.
  */
 
-#include "rw2300.h"
+#include "spool2300.h"
+#include "net2300.h"
+#include "stats2300.h"
+#include "record2300.h"
 
-#define CW_SOFTWARETYPE   "open2300v"
 #define DEBUG 0  // wu2300 stops writing to standard out if setting this to 0
 
 
+/********************************************************************
+ * send_packets sends spooled packets to CWOP, oldest first. Used as
+ * spool sender.
+ *
+ * Returns: number of packets sent before the first failure
+ *
+ ********************************************************************/
+int send_packets(void *context, char **packets, int *sizes, int count)
+{
+	struct config_type *config = context;
+	char aprsline[3000];
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (sizes[i] >= (int) sizeof(aprsline))
+			continue;
+		memcpy(aprsline, packets[i], sizes[i]);
+		aprsline[sizes[i]] = '\0';
+		if (citizen_weather_send(config, aprsline) != 0)
+			break;
+	}
+
+	return i;
+}
+
+
 /********** MAIN PROGRAM ************************************************
  *
  * This program reads data from a WS2300 weather station formats and
@@ -42,14 +80,20 @@ int main(int argc, char *argv[])
 {
 	WEATHERSTATION ws2300;
 	char aprsline[3000] = "";
-	char tempstring[1000] = "";
-	char datestring[50];        //used to hold the date stamp for the log file
-	time_t basictime;
 	struct config_type config;
-	double tempfloat1, tempfloat2;
+	struct log_record reading;
+	struct spool spool;
+	int spooled = 0, failed = 0;
+
+	stats_option(&argc, argv);
 
 	get_configuration(&config, argv[1]);
 
+	net_cache_open(config.dns_cache_file, config.dns_cache_ttl);
+
+	if (config.aprs_latency_file[0] != '\0')
+		net_load_latency(config.aprs_latency_file, config.aprs_host, config.num_hosts);
+
 	/* Setup serial port to weather station */
 	if ( (ws2300 = open_weatherstation(config.serial_device_name)) < 0 )
 	{
@@ -57,65 +101,59 @@ int main(int argc, char *argv[])
  		exit(-1);
 	}
 
-	/* GET DATE AND TIME FOR the WX record in UTC */
-	time(&basictime);
-	basictime = basictime - atof(config.timezone) * 60 * 60;
-	strftime(datestring, sizeof(datestring), "@%d%H%Mz",localtime(&basictime));
-
-	/* BUILD THE DATA STRING, START WITH URL, ID AND PASSWORD */
-	sprintf(aprsline, "%s>APRS,TCPXX*,qAX,%s:%s%s/%s",
-	        config.citizen_weather_id, config.citizen_weather_id, // Build weather record
-	        datestring,                                           // Add date time 
-	        config.citizen_weather_latitude, config.citizen_weather_longitude); // Add Lat Lon
+	/* READ THE VALUES OF THE WX record */
+	memset(&reading, 0, sizeof(reading));
+	time(&reading.timestamp);
+	reading.windspeed = wind_current(ws2300, METERS_PER_SECOND, &reading.winddir_degrees);
+	reading.temperature_outdoor = temperature_outdoor(ws2300, CELCIUS);
+	reading.rain_1h = rain_1h(ws2300, MILLIMETERS);
+	reading.rain_24h = rain_24h(ws2300, MILLIMETERS);
+	reading.humidity_outdoor = humidity_outdoor(ws2300);
+	reading.rel_pressure = rel_pressure(ws2300, HECTOPASCAL);
 
+	/* WIND GUST is not sent. It requires that you reset the station regularly. */
+	/* RAIN SINCE MIDNIGHT P is not directly readable in LaCrosse */
 
-	/* READ WIND DIRECTION (_) AND SPEED (/) - wind data must be mph for CWOP  */
-	tempfloat1 = wind_current(ws2300, MILES_PER_HOUR, &tempfloat2); // Fetch current wind data
-	sprintf(tempstring,"_%03.0f/%03.0f", tempfloat2, tempfloat1);  // _wind dir degrees/wind speed mph
-	strcat(aprsline, tempstring);
-
-	/* WIND GUST */
-	/* This requires that you reset the station regularly */
-	/* Uncomment the two lines below to activate wind gust     */
-//	sprintf(aprsline, "%sg%03.0f", aprsline,
-//	        wind_minmax(ws2300, MILES_PER_HOUR, NULL, NULL, NULL, NULL));
-
-	/* READ TEMPERATURE OUTDOOR t - Force deg F for CWOP */
-	sprintf(tempstring, "t%03.0f", temperature_outdoor(ws2300, FAHRENHEIT));
-	strcat(aprsline, tempstring);
-
-	/* READ RAIN 1H r - force inches for CWOP*/
-	sprintf(tempstring,"r%03.0f", rain_1h(ws2300, INCHES) *100); // hundredths of an inch
-	strcat(aprsline, tempstring);
-
-	/* READ RAIN 24H p */
-	sprintf(tempstring,"p%03.0f", rain_24h(ws2300, INCHES) *100); // hundredths of an inch
-	strcat(aprsline, tempstring);
-
-	/* RAIN SINCE MIDNIGHT P */
-	// not directly readable in LaCrosse
-
-	/* READ RELATIVE HUMIDITY OUTDOOR */
-	sprintf(tempstring, "h%02d", humidity_outdoor(ws2300));
-	strcat(aprsline, tempstring);
-
-	/* READ BAROMETRIC PRESSURE b */
-	sprintf(tempstring,"b%05.0f", (rel_pressure(ws2300, MILLIBARS) *10)); // tenths of milibars
-	strcat(aprsline, tempstring);
-
-	/* ADD SOFTWARE TYPE AND ACTION  */
-	sprintf(tempstring,".%s%s", CW_SOFTWARETYPE, VERSION);
-	strcat(aprsline, tempstring);
+	/* BUILD THE DATA STRING in the units of CWOP, time in UTC */
+	format_aprs_report(&config, &reading, aprsline, sizeof(aprsline));
 
 	/* MAKE WEATHER STATION AVAILABLE FOR OTHER PROGRAMS */
 	close_weatherstation(ws2300);
 
+	/* KEEP THE RECORD IN THE SPOOL UNTIL IT IS SENT */
+	if (config.spool_directory[0] != '\0' &&
+	    spool_open(&spool, config.spool_directory, "cw2300") == 0)
+	{
+		if (spool_append(&spool, aprsline, strlen(aprsline)) == 0 &&
+		    spool_sync(&spool) == 0)
+		{
+			spool_drain(&spool, SPOOL_BATCH, send_packets, &config);
+			spooled = 1;
+			if (!spool_empty(&spool))
+			{
+				fprintf(stderr, "Record kept in spool %s\n", spool.dir);
+				failed = 1;
+			}
+		}
+		spool_close(&spool);
+	}
+
 	/* CONNECT TO SERVER AND SEND THE RECORD */
-	if (citizen_weather_send(&config, aprsline) != 0)
+	if (!spooled && citizen_weather_send(&config, aprsline) != 0)
 	{
 		perror("Could not send data to Citizen Weather!\n");
-		exit(-1);
+		failed = 1;
 	}
+
+	/* REMEMBER WHICH SERVER ANSWERED FASTEST */
+	if (config.aprs_latency_file[0] != '\0')
+		net_save_latency(config.aprs_latency_file, config.aprs_host, config.num_hosts);
+
+	net_cache_close();
+
+	if (failed)
+		exit(-1);
+
 	return(0);
 }
 
@@ -31,6 +31,11 @@ int main(int argc, char *argv[])
 	get_configuration(&config, config_path);
 
 	printf("serial_device_name\t%s\n",           config.serial_device_name);
+	printf("serial_trace\t%s\n",                 config.serial_trace);
+	printf("serial_replay_speed\t%g\n",          config.serial_replay_speed);
+	printf("metrics_file\t%s\n",                 config.metrics_file);
+	printf("link_profile_dir\t%s\n",             config.link_profile_dir);
+	printf("fetch_cache\t%s\n",                  config.fetch_cache);
 	printf("citizen_weather_id\t%s\n",           config.citizen_weather_id);
 	printf("citizen_weather_latitude\t%s\n",     config.citizen_weather_latitude);
 	printf("citizen_weather_longitude\t%s\n",    config.citizen_weather_longitude);
@@ -38,6 +43,13 @@ int main(int argc, char *argv[])
 	{
 		printf("aprs_host %d\t%s:%d\n", i, config.aprs_host[i].name, config.aprs_host[i].port);
 	}
+	printf("aprs_latency_file\t%s\n",            config.aprs_latency_file);
+	printf("dns_cache_file\t%s\n",               config.dns_cache_file);
+	printf("dns_cache_ttl\t%d\n",                config.dns_cache_ttl);
+	for(i = 0; i < config.num_stations; i++)
+	{
+		printf("station %d\t%s %s\n", i, config.stations[i].id, config.stations[i].config_file);
+	}
 	printf("weather_underground_id\t%s\n",       config.weather_underground_id);
 	printf("weather_underground_password\t%s\n", config.weather_underground_password);
 	printf("timezone\t%s\n",                     config.timezone);
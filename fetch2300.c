@@ -9,8 +9,43 @@
  */
 
 #include "rw2300.h"
+#include "stats2300.h"
+#include "metrics2300.h"
+
+
+/********************************************************************
+ * write_cache writes the output to FETCH_CACHE.txt as it is printed
+ * and to FETCH_CACHE.json as one JSON object, so a web page reads the
+ * values from a file instead of running fetch2300 for each view.
+ * Both are replaced atomically.
+ *
+ * Input:   prefix - FETCH_CACHE
+ *          output - lines of key, space and value
+ *          timestamp - time of the reading
+ *
+ * Returns: 0 on success, -1 if a file cannot be written
+ *
+ ********************************************************************/
+static int write_cache(const char *prefix, const char *output, time_t timestamp)
+{
+	char path[300], json[FETCH_JSON_SIZE];
+	int length;
+
+	if ((length = format_fetch_json(output, timestamp, json, sizeof(json))) < 0)
+		return -1;
+
+	snprintf(path, sizeof(path), "%s.txt", prefix);
+	if (publish_file(path, output, strlen(output), 0) < 0)
+		return -1;
+
+	snprintf(path, sizeof(path), "%s.json", prefix);
+	if (publish_file(path, json, length, 0) < 0)
+		return -1;
+
+	return 0;
+}
+
 
- 
 /********** MAIN PROGRAM ************************************************
  *
  * This program reads all current and min/max data from a WS2300
@@ -29,25 +64,31 @@ int main(int argc, char *argv[])
 	char logline[3000] = "";
 	char tempstring[1000] = "";
 	char datestring[50];     //used to hold the date stamp for the log file
+	char output[3100];       //date stamp and logline as printed
 	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
 	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
 	double winddir[6];
 	char tendency[15];
 	char forecast[15];
 	struct config_type config;
+	struct log_record record;   //current values for METRICS_FILE
 	double tempfloat_min, tempfloat_max;
 	int tempint, tempint_min, tempint_max;
 	struct timestamp time_min, time_max;
 	time_t basictime;
 
+	stats_option(&argc, argv);
+
 	get_configuration(&config, argv[1]);
 
 	ws2300 = open_weatherstation(config.serial_device_name);
 
+	record.format = LOG_FORMAT_CURRENT;
 
 	/* READ TEMPERATURE INDOOR */
 
-	sprintf(logline, "Ti %.1f\n", temperature_indoor(ws2300, config.temperature_conv) );
+	record.temperature_indoor = temperature_indoor(ws2300, config.temperature_conv);
+	sprintf(logline, "Ti %.1f\n", record.temperature_indoor);
 
 	temperature_indoor_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 	                          &tempfloat_max, &time_min, &time_max);
@@ -63,7 +104,8 @@ int main(int argc, char *argv[])
 
 	/* READ TEMPERATURE OUTDOOR */
 
-	sprintf(tempstring, "To %.1f\n", temperature_outdoor(ws2300, config.temperature_conv) );
+	record.temperature_outdoor = temperature_outdoor(ws2300, config.temperature_conv);
+	sprintf(tempstring, "To %.1f\n", record.temperature_outdoor);
 	strcat(logline, tempstring);
 
 	temperature_outdoor_minmax(ws2300, config.temperature_conv, &tempfloat_min,
@@ -80,7 +122,8 @@ int main(int argc, char *argv[])
 
 	/* READ DEWPOINT */
 
-	sprintf(tempstring, "DP %.1f\n", dewpoint(ws2300, config.temperature_conv) );
+	record.dewpoint = dewpoint(ws2300, config.temperature_conv);
+	sprintf(tempstring, "DP %.1f\n", record.dewpoint);
 	strcat(logline, tempstring);
 
 	dewpoint_minmax(ws2300, config.temperature_conv, &tempfloat_min,
@@ -97,8 +140,9 @@ int main(int argc, char *argv[])
 
 	/* READ RELATIVE HUMIDITY INDOOR */
 
-	sprintf(tempstring, "RHi %d\n", humidity_indoor_all(ws2300, &tempint_min, &tempint_max,
-	                                                    &time_min, &time_max) );
+	record.humidity_indoor = humidity_indoor_all(ws2300, &tempint_min, &tempint_max,
+	                                             &time_min, &time_max);
+	sprintf(tempstring, "RHi %d\n", record.humidity_indoor);
 	strcat(logline, tempstring);
 
 	sprintf(tempstring, "RHimin %d\nRHimax %d\n"
@@ -112,8 +156,9 @@ int main(int argc, char *argv[])
 
 	/* READ RELATIVE HUMIDITY OUTDOOR */
 
-	sprintf(tempstring, "RHo %d\n", humidity_outdoor_all(ws2300, &tempint_min, &tempint_max,
-	                                                  &time_min, &time_max) );
+	record.humidity_outdoor = humidity_outdoor_all(ws2300, &tempint_min, &tempint_max,
+	                                               &time_min, &time_max);
+	sprintf(tempstring, "RHo %d\n", record.humidity_outdoor);
 	strcat(logline, tempstring);
 
 	sprintf(tempstring, "RHomin %d\nRHomax %d\n"
@@ -127,8 +172,9 @@ int main(int argc, char *argv[])
 
 	/* READ WIND SPEED AND DIRECTION */
 
-	sprintf(tempstring,"WS %.1f\n",
-	       wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir));
+	record.windspeed = wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir);
+	record.winddir_degrees = winddir[0];
+	sprintf(tempstring,"WS %.1f\n", record.windspeed);
 	strcat(logline, tempstring);
 
 	sprintf(tempstring,"DIRtext %s\nDIR0 %.1f\nDIR1 %0.1f\n"
@@ -140,7 +186,8 @@ int main(int argc, char *argv[])
 
 	/* WINDCHILL */
 
-	sprintf(tempstring, "WC %.1f\n", windchill(ws2300, config.temperature_conv) );
+	record.windchill = windchill(ws2300, config.temperature_conv);
+	sprintf(tempstring, "WC %.1f\n", record.windchill);
 	strcat(logline, tempstring);
 
 	windchill_minmax(ws2300, config.temperature_conv, &tempfloat_min,
@@ -171,9 +218,9 @@ int main(int argc, char *argv[])
 
 	/* READ RAIN 1H */
 
-	sprintf(tempstring, "R1h %.2f\n",
-	        rain_1h_all(ws2300, config.rain_conv_factor,
-	                    &tempfloat_max, &time_max));
+	record.rain_1h = rain_1h_all(ws2300, config.rain_conv_factor,
+	                             &tempfloat_max, &time_max);
+	sprintf(tempstring, "R1h %.2f\n", record.rain_1h);
 	strcat(logline, tempstring);
 
 	sprintf(tempstring, "R1hmax %.2f\n"
@@ -185,9 +232,9 @@ int main(int argc, char *argv[])
 
 	/* READ RAIN 24H */
 
-	sprintf(tempstring,"R24h %.2f\n",
-	        rain_24h_all(ws2300, config.rain_conv_factor,
-	                     &tempfloat_max, &time_max));
+	record.rain_24h = rain_24h_all(ws2300, config.rain_conv_factor,
+	                               &tempfloat_max, &time_max);
+	sprintf(tempstring,"R24h %.2f\n", record.rain_24h);
 	strcat(logline, tempstring);
 
 	sprintf(tempstring,"R24hmax %.2f\n"
@@ -199,8 +246,8 @@ int main(int argc, char *argv[])
 
 	/* READ RAIN TOTAL */
 
-	sprintf(tempstring,"Rtot %.2f\n",
-	        rain_total_all(ws2300, config.rain_conv_factor, &time_max));
+	record.rain_total = rain_total_all(ws2300, config.rain_conv_factor, &time_max);
+	sprintf(tempstring,"Rtot %.2f\n", record.rain_total);
 	strcat(logline, tempstring);
 
 	sprintf(tempstring,"TRtot %02d:%02d\nDRtot %04d-%02d-%02d\n",
@@ -211,8 +258,8 @@ int main(int argc, char *argv[])
 
 	/* READ RELATIVE PRESSURE */
 
-	sprintf(tempstring,"RP %.3f\n",
-	        rel_pressure(ws2300, config.pressure_conv_factor) );
+	record.rel_pressure = rel_pressure(ws2300, config.pressure_conv_factor);
+	sprintf(tempstring,"RP %.3f\n", record.rel_pressure);
 	strcat(logline, tempstring);
 
 
@@ -233,6 +280,8 @@ int main(int argc, char *argv[])
 	/* READ TENDENCY AND FORECAST */
 
 	tendency_forecast(ws2300, tendency, forecast);
+	record.tendency = name_index(tendency_names, 3, tendency);
+	record.forecast = name_index(forecast_names, 3, forecast);
 	sprintf(tempstring, "Tendency %s\nForecast %s\n", tendency, forecast);
 	strcat(logline, tempstring);
 
@@ -245,10 +294,26 @@ int main(int argc, char *argv[])
 
 	// Print out and leave
 
-	printf("%s%s", datestring, logline);
+	snprintf(output, sizeof(output), "%s%s", datestring, logline);
+	printf("%s", output);
 
 	close_weatherstation(ws2300);
 
+	if (config.fetch_cache[0] != '\0' &&
+	    write_cache(config.fetch_cache, output, basictime) != 0)
+	{
+		printf("Cannot write file %s.txt or .json\n", config.fetch_cache);
+		exit(EXIT_FAILURE);
+	}
+
+	record.timestamp = basictime;
+	if (config.metrics_file[0] != '\0' &&
+	    metrics_write_file(config.metrics_file, &record, &config) != 0)
+	{
+		printf("Cannot write file %s\n", config.metrics_file);
+		exit(EXIT_FAILURE);
+	}
+
 	return(0);
 }
 
@@ -8,7 +8,8 @@
  *  This program is published under the GNU General Public license
  */
 
-#include "rw2300.h"
+#include "logindex2300.h"
+#include "stats2300.h"
 
 /********************************************************************
  * print_usage prints a short user guide
@@ -51,8 +52,7 @@ int main(int argc, char *argv[])
 	char tempstring[1000] = "";
 	int interval, countdown, no_records;
 	struct config_type config;
-	long counter;
-	char ch;
+	struct log_index index;
 	char datestring[50];        //used to hold the date stamp for the log file
 	struct timestamp time_last;
 	time_t time_lastlog, time_lastrecord;
@@ -72,7 +72,9 @@ int main(int argc, char *argv[])
 	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
 	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
 
-	int temp_int1, temp_int2, i;
+	int i;
+
+	stats_option(&argc, argv);
 
 	if (argc < 2 || argc > 3)
 	{
@@ -96,25 +98,12 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	fseek(fileptr, 1L, SEEK_END);
-	counter = 60;
+	// The time of the last record is kept in the index of the log
+	// so the log itself does not have to be read
 
-	do
-	{
-		counter++;
-		if (fseek(fileptr, -counter, SEEK_END) < 0 )
-			break;
-		ch = getc(fileptr);
-	} while (ch != '\n' && ch != '\r');
-	
-	if (fscanf(fileptr,"%4d%2d%2d%2d%2d", &temp_int1, &temp_int2,
-	           &time_lastlog_tm.tm_mday, &time_lastlog_tm.tm_hour,
-	           &time_lastlog_tm.tm_min) == 5)
+	if (log_index_open(&index, argv[1]) == 0 && index.records > 0)
 	{
-		time_lastlog_tm.tm_year = temp_int1 - 1900;
-		time_lastlog_tm.tm_mon = temp_int2 - 1;	
-		time_lastlog_tm.tm_sec = 0;
-		time_lastlog_tm.tm_isdst = -1;
+		time_lastlog = index.last_time;
 	}
 	else
 	{	//if no valid log we set the date to 1 Jan 1990 0:00
@@ -125,9 +114,8 @@ int main(int argc, char *argv[])
 		time_lastlog_tm.tm_min = 0;
 		time_lastlog_tm.tm_sec = 0;
 		time_lastlog_tm.tm_isdst = -1;
+		time_lastlog = mktime(&time_lastlog_tm);
 	}
-	
-	time_lastlog = mktime(&time_lastlog_tm);
 		
 	current_record = read_history_info(ws2300, &interval, &countdown, &time_last,
 	                           &no_records);
@@ -263,6 +251,11 @@ int main(int argc, char *argv[])
 	close_weatherstation(ws2300);
 	fclose(fileptr);
 
+	// Add the new lines to the index
+	if (new_records > 0 && log_index_sync(&index) == 0)
+		log_index_save(&index);
+	log_index_close(&index);
+
 	return(0);
 }
 
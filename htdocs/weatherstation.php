@@ -8,10 +8,23 @@
  *	Copyright 2003,2004, Kenneth Lavrsen
  *	This program is published under the GNU Public license
  */
-exec("/usr/local/bin/fetch2300",$fetcharray);
-foreach ($fetcharray as $value)
+// fetch2300 run from cron with FETCH_CACHE /var/cache/open2300/current
+// keeps the current values in this file. The page reads it and does
+// not wait for the station. Without the cache fetch2300 is run for
+// every page view.
+$cachefile = "/var/cache/open2300/current.txt";
+
+$fetch = @file_get_contents($cachefile);
+if ($fetch === false)
+{
+	exec("/usr/local/bin/fetch2300",$fetcharray);
+	$fetch = implode("\n", $fetcharray);
+}
+foreach (explode("\n", $fetch) as $value)
 {
-	list($parameter,$parvalue)=explode(" ", $value);
+	if ($value == "")
+		continue;
+	list($parameter,$parvalue)=explode(" ", $value, 2);
 	$ws["$parameter"]=$parvalue;
 }
 $forecastpic= strtolower($ws["Forecast"]) . ".jpg";
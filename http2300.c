@@ -0,0 +1,556 @@
+/*  open2300 - http2300.c
+ *
+ *  Version 1.11
+ *
+ *  HTTP/1.1 client with persistent connections and pipelining for the
+ *  uploads to weather services. See http2300.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include <ctype.h>
+#include "http2300.h"
+
+
+/********************************************************************
+ * wait_socket waits until a socket can be read or written
+ *
+ * Input:   sockfd - the socket
+ *          for_write - 1 to wait for room to write, 0 for data
+ *          deadline - give up at this time
+ *
+ * Returns: 0 when ready, -1 on timeout or error
+ *
+ ********************************************************************/
+static int wait_socket(SOCKET sockfd, int for_write, time_t deadline)
+{
+	fd_set set;
+	struct timeval timeout;
+	time_t now = time(NULL);
+
+	if (now >= deadline)
+		return -1;
+
+	FD_ZERO(&set);
+	FD_SET(sockfd, &set);
+	timeout.tv_sec = deadline - now;
+	timeout.tv_usec = 0;
+
+	if (select(sockfd + 1, for_write ? NULL : &set, for_write ? &set : NULL,
+	           NULL, &timeout) <= 0)
+		return -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * header_is tells if a header line has a given name (any case)
+ *
+ * Returns: pointer to the value after the colon, NULL if not the name
+ *
+ ********************************************************************/
+static const char *header_is(const char *line, const char *name)
+{
+	while (*name)
+	{
+		if (tolower((unsigned char) *line++) != tolower((unsigned char) *name++))
+			return NULL;
+	}
+
+	if (*line++ != ':')
+		return NULL;
+
+	while (*line == ' ' || *line == '\t')
+		line++;
+
+	return line;
+}
+
+
+/********************************************************************
+ * http_status_line parses the status line of a response and starts
+ * the header from it
+ *
+ * Input:   line - the line, with or without CR LF
+ *
+ * Output:  head - status, keep-alive of the version, no length
+ *
+ * Returns: 0 on success, -1 if it is not a status line
+ *
+ ********************************************************************/
+int http_status_line(struct http_head *head, const char *line)
+{
+	int minor;
+
+	if (sscanf(line, "HTTP/1.%d %d", &minor, &head->status) != 2)
+		return -1;
+
+	head->keep_alive = minor >= 1;
+	head->length = -1;
+	head->chunked = 0;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * http_header_line takes what matters from a header line
+ *
+ * Input:   line - the line without CR LF, zero terminated
+ *
+ * Output:  head - length, chunked and keep-alive
+ *
+ ********************************************************************/
+void http_header_line(struct http_head *head, const char *line)
+{
+	const char *value;
+
+	if ((value = header_is(line, "Content-Length")) != NULL)
+		head->length = atol(value);
+	else if ((value = header_is(line, "Transfer-Encoding")) != NULL)
+		head->chunked = strstr(value, "chunked") != NULL;
+	else if ((value = header_is(line, "Connection")) != NULL)
+		head->keep_alive = tolower((unsigned char) value[0]) != 'c';
+}
+
+
+/********************************************************************
+ * http_format_request makes a GET request
+ *
+ * Input:   host, port - of the server, for the Host header
+ *          path, size - path with query, not zero terminated
+ *          request_size - size of request
+ *
+ * Output:  request - the request line and header
+ *
+ * Returns: length, -1 if it did not fit
+ *
+ ********************************************************************/
+int http_format_request(const char *host, int port, const char *path, int size,
+                        char *request, int request_size)
+{
+	char host_port[120];
+	int length;
+
+	if (port == 80)
+		snprintf(host_port, sizeof(host_port), "%s", host);
+	else
+		snprintf(host_port, sizeof(host_port), "%s:%d", host, port);
+
+	length = snprintf(request, request_size,
+	                  "GET %.*s HTTP/1.1\r\nHost: %s\r\n"
+	                  "User-Agent: open2300/%s\r\nAccept: */*\r\n\r\n",
+	                  size, path, host_port, VERSION);
+
+	if (length < 0 || length >= request_size)
+		return -1;
+
+	return length;
+}
+
+
+/********************************************************************
+ * consume drops parsed bytes from the front of the receive buffer
+ *
+ ********************************************************************/
+static void consume(struct http_connection *http, int size)
+{
+	http->buffered -= size;
+	memmove(http->buffer, http->buffer + size, http->buffered);
+}
+
+
+/********************************************************************
+ * read_more receives what the server has sent into the buffer
+ *
+ * Returns: bytes received, 0 if the server closed the connection,
+ *          -1 on timeout, error or full buffer
+ *
+ ********************************************************************/
+static int read_more(struct http_connection *http, time_t deadline)
+{
+	int bytes_read;
+
+	if (http->buffered >= HTTP_BUFFER_SIZE ||
+	    wait_socket(http->sockfd, 0, deadline) != 0)
+		return -1;
+
+	bytes_read = recv(http->sockfd, http->buffer + http->buffered,
+	                  HTTP_BUFFER_SIZE - http->buffered, 0);
+
+	if (bytes_read > 0)
+		http->buffered += bytes_read;
+
+	return bytes_read;
+}
+
+
+/********************************************************************
+ * read_line reads a line of the response header (or chunk size)
+ *
+ * Output:  line - the line without CR LF, cut to size - 1 characters
+ *
+ * Returns: length of the line, -1 if fail
+ *
+ ********************************************************************/
+static int read_line(struct http_connection *http, time_t deadline,
+                     char *line, int size)
+{
+	char *end;
+	int length;
+
+	while ((end = memchr(http->buffer, '\n', http->buffered)) == NULL)
+	{
+		if (read_more(http, deadline) <= 0)
+			return -1;
+	}
+
+	length = end - http->buffer;
+	if (length > 0 && http->buffer[length - 1] == '\r')
+		length--;
+	if (length > size - 1)
+		length = size - 1;
+
+	memcpy(line, http->buffer, length);
+	line[length] = '\0';
+	consume(http, end - http->buffer + 1);
+
+	return length;
+}
+
+
+/********************************************************************
+ * skip_bytes reads and drops a part of the body
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+static int skip_bytes(struct http_connection *http, time_t deadline, long size)
+{
+	int part;
+
+	while (size > 0)
+	{
+		if (http->buffered == 0 && read_more(http, deadline) <= 0)
+			return -1;
+
+		part = size < http->buffered ? (int) size : http->buffered;
+		consume(http, part);
+		size -= part;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * read_response reads a response and drops its body. Interim (1xx)
+ * responses are skipped. Sets http->keep_alive from the response.
+ *
+ * Returns: status code, -1 if fail
+ *
+ ********************************************************************/
+static int read_response(struct http_connection *http, time_t deadline)
+{
+	char line[HTTP_BUFFER_SIZE];
+	struct http_head head;
+	long chunk;
+	int size;
+
+	do
+	{
+		if (read_line(http, deadline, line, sizeof(line)) < 0 ||
+		    http_status_line(&head, line) != 0)
+			return -1;
+
+		while ((size = read_line(http, deadline, line, sizeof(line))) > 0)
+			http_header_line(&head, line);
+
+		if (size < 0)
+			return -1;
+
+	} while (head.status >= 100 && head.status < 200);
+
+	http->keep_alive = head.keep_alive;
+
+	if (head.status == 204 || head.status == 304)
+		return head.status;
+
+	if (head.chunked)
+	{
+		do
+		{
+			if (read_line(http, deadline, line, sizeof(line)) < 0)
+				return -1;
+			chunk = strtol(line, NULL, 16);
+			if (chunk > 0 && (skip_bytes(http, deadline, chunk) != 0 ||
+			                  read_line(http, deadline, line, sizeof(line)) != 0))
+				return -1;
+		} while (chunk > 0);
+
+		// Trailer up to the empty line
+		while ((size = read_line(http, deadline, line, sizeof(line))) > 0)
+			;
+		if (size < 0)
+			return -1;
+	}
+	else if (head.length >= 0)
+	{
+		if (skip_bytes(http, deadline, head.length) != 0)
+			return -1;
+	}
+	else
+	{
+		// The body ends when the server closes the connection
+		do
+			http->buffered = 0;
+		while ((size = read_more(http, deadline)) > 0);
+		if (size < 0)
+			return -1;
+		http->keep_alive = 0;
+	}
+
+	return head.status;
+}
+
+
+/********************************************************************
+ * send_request sends a GET request
+ *
+ * Input:   path, size - path with query, not zero terminated
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+static int send_request(struct http_connection *http, const char *path, int size)
+{
+	char request[HTTP_BUFFER_SIZE];
+	time_t deadline = time(NULL) + http->timeout;
+	int length, sent, bytes_sent;
+
+	length = http_format_request(http->host, http->port, path, size,
+	                             request, sizeof(request));
+
+	if (length < 0)
+	{
+		fprintf(stderr, "HTTP request too long\n");
+		return -1;
+	}
+
+	for (sent = 0; sent < length; sent += bytes_sent)
+	{
+		if (wait_socket(http->sockfd, 1, deadline) != 0 ||
+		    (bytes_sent = send(http->sockfd, request + sent, length - sent,
+		                       MSG_NOSIGNAL)) <= 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * http_connect opens the connection to the server, to the first of
+ * its addresses that answers
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+static int http_connect(struct http_connection *http)
+{
+	SOCKET sockfd;
+
+	sockfd = net_connect(&http->server, 1, http->timeout, NULL);
+
+	if (sockfd == INVALID_SOCKET || socket_nonblocking(sockfd, 1) != 0)
+	{
+		fprintf(stderr, "Cannot connect to %s port %d\n", http->host, http->port);
+		if (sockfd != INVALID_SOCKET)
+			closesocket(sockfd);
+		return -1;
+	}
+
+	http->sockfd = sockfd;
+	http->keep_alive = 1;
+	http->responses = 0;
+	http->buffered = 0;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * connection_closed tells if an idle connection can not be used.
+ * Servers close idle keep-alive connections and may send a 408
+ * response first, so anything to read means it is gone.
+ *
+ ********************************************************************/
+static int connection_closed(struct http_connection *http)
+{
+	fd_set set;
+	struct timeval timeout = {0, 0};
+
+	FD_ZERO(&set);
+	FD_SET(http->sockfd, &set);
+
+	return select(http->sockfd + 1, &set, NULL, NULL, &timeout) != 0;
+}
+
+
+/********************************************************************
+ * http_init prepares a connection. It is opened by the first request.
+ *
+ * Input:   host - name or address of the server
+ *          port - normally 80
+ *          timeout - seconds to wait for each response, 0 = default
+ *
+ * Output:  http
+ *
+ * Returns: 0 on success, -1 if the network cannot be used
+ *
+ ********************************************************************/
+int http_init(struct http_connection *http, const char *host, int port, int timeout)
+{
+	memset(http, 0, sizeof(*http));
+	snprintf(http->host, sizeof(http->host), "%s", host);
+	http->port = port;
+	snprintf(http->server.name, sizeof(http->server.name), "%s", host);
+	http->server.port = port;
+	http->timeout = timeout > 0 ? timeout : HTTP_TIMEOUT;
+	http->sockfd = INVALID_SOCKET;
+
+	return network_startup();
+}
+
+
+/********************************************************************
+ * http_pipeline sends GET requests in order on the open connection
+ * (or a new one) without waiting for each response before sending
+ * the next.
+ *
+ * A request answered with a server error (5xx) or not answered
+ * stops the pipeline. Other answers count as done; a client error
+ * (4xx) is printed as sending the request again would not help.
+ *
+ * Input:   http - the connection
+ *          paths, sizes - path with query of each request
+ *          count - number of requests
+ *
+ * Returns: number of requests done before the first failure.
+ *          http->status is the status of the last response, -1 if
+ *          there was none.
+ *
+ ********************************************************************/
+int http_pipeline(struct http_connection *http, char **paths, int *sizes, int count)
+{
+	int done = 0, sent, answered, retried = 0, failed;
+
+	http->status = -1;
+
+	while (done < count)
+	{
+		if (http->sockfd != INVALID_SOCKET && connection_closed(http))
+			http_close(http);
+
+		if (http->sockfd == INVALID_SOCKET && http_connect(http) != 0)
+			break;
+
+		sent = done;
+		answered = 0;
+		failed = 0;
+
+		while (done < count)
+		{
+			// Keep up to HTTP_PIPELINE requests on the way
+			while (!failed && sent < count && sent - done < HTTP_PIPELINE)
+			{
+				if (send_request(http, paths[sent], sizes[sent]) != 0)
+					failed = 1;
+				else
+					sent++;
+			}
+
+			if (sent == done ||
+			    (http->status = read_response(http, time(NULL) + http->timeout)) < 0)
+			{
+				failed = 1;
+				break;
+			}
+
+			http->responses++;
+			answered++;
+
+			if (http->status >= 500)
+			{
+				// Drop the connection with the requests still on it
+				fprintf(stderr, "HTTP status %d from %s\n", http->status, http->host);
+				http_close(http);
+				return done;
+			}
+
+			if (http->status >= 400)
+				fprintf(stderr, "HTTP status %d from %s. Request dropped.\n",
+				        http->status, http->host);
+
+			done++;
+
+			// The rest must go on a new connection
+			if (!http->keep_alive)
+				break;
+		}
+
+		if (failed || !http->keep_alive)
+			http_close(http);
+
+		// The requests not answered go again on a new connection. A
+		// second connection without any answer means the server is
+		// not working.
+		if (failed && answered == 0 && retried++)
+		{
+			fprintf(stderr, "No HTTP response from %s\n", http->host);
+			break;
+		}
+	}
+
+	return done;
+}
+
+
+/********************************************************************
+ * http_get sends one GET request
+ *
+ * Input:   http - the connection
+ *          path - path with query
+ *
+ * Returns: status code of the response, -1 if there was none
+ *
+ ********************************************************************/
+int http_get(struct http_connection *http, const char *path)
+{
+	char *paths[1];
+	int sizes[1];
+
+	paths[0] = (char *) path;
+	sizes[0] = strlen(path);
+
+	http_pipeline(http, paths, sizes, 1);
+
+	return http->status;
+}
+
+
+/********************************************************************
+ * http_close closes the connection
+ *
+ ********************************************************************/
+void http_close(struct http_connection *http)
+{
+	if (http->sockfd != INVALID_SOCKET)
+	{
+		closesocket(http->sockfd);
+		http->sockfd = INVALID_SOCKET;
+	}
+	http->buffered = 0;
+	http->responses = 0;
+}
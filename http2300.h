@@ -0,0 +1,66 @@
+/* open2300 - http2300.h
+ * Include file for the HTTP/1.1 client.
+ *
+ * The client keeps its connection open between requests so a program
+ * that uploads every few seconds does one TCP handshake, not one per
+ * upload. Several requests can be sent before the responses are read
+ * (pipelining), at most HTTP_PIPELINE at a time. A connection the
+ * server has closed while idle is opened again and the requests that
+ * were not answered are sent again. Each request must be answered
+ * within the timeout. The server's IPv6 and IPv4 addresses are
+ * connected to as in net2300.c.
+ * Only GET is supported, which is all the weather services need.
+ * The request and the status and header lines are made and parsed by
+ * functions of their own, so srv2300 that does its uploads on the
+ * event loop speaks HTTP the same way.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_HTTP2300_H_
+#define _INCLUDE_HTTP2300_H_
+
+#include "net2300.h"
+
+#define HTTP_BUFFER_SIZE  4096     // longest status or header line
+#define HTTP_PIPELINE     16       // most requests waiting for a response
+#define HTTP_TIMEOUT      10       // seconds, default per request
+
+struct http_connection
+{
+	char   host[100];
+	int    port;
+	int    timeout;                // seconds per request
+	hostdata server;               // for net_connect
+	SOCKET sockfd;                 // INVALID_SOCKET when not connected
+	int    keep_alive;             // server keeps the connection open
+	int    responses;              // responses on this connection
+	int    status;                 // status of the last response
+	int    buffered;               // bytes received but not parsed
+	char   buffer[HTTP_BUFFER_SIZE];
+};
+
+/* What a response header says about the response */
+struct http_head
+{
+	int    status;
+	int    keep_alive;             // server keeps the connection open
+	long   length;                 // Content-Length, -1 if not given
+	int    chunked;                // Transfer-Encoding chunked
+};
+
+int  http_format_request(const char *host, int port, const char *path, int size,
+                         char *request, int request_size);
+
+int  http_status_line(struct http_head *head, const char *line);
+
+void http_header_line(struct http_head *head, const char *line);
+
+int  http_init(struct http_connection *http, const char *host, int port, int timeout);
+
+int  http_get(struct http_connection *http, const char *path);
+
+int  http_pipeline(struct http_connection *http, char **paths, int *sizes, int count);
+
+void http_close(struct http_connection *http);
+
+#endif /* _INCLUDE_HTTP2300_H_ */
@@ -9,6 +9,7 @@
  */
 
 #include "rw2300.h"
+#include "stats2300.h"
 
 /********************************************************************
  * print_usage prints a short user guide
@@ -62,6 +63,8 @@ int main(int argc, char *argv[])
 	int no_records;             //Number of valid records - reset when interval changes
 	struct timestamp time_last; //Timestamp of last record - ignored in this program
 
+	stats_option(&argc, argv);
+
 	if (argc < 2 || argc > 4)
 	{
 		print_usage();
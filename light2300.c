@@ -9,6 +9,7 @@
  */
 
 #include "rw2300.h"
+#include "stats2300.h"
 
 /********************************************************************
  * print_usage prints a short user guide
@@ -50,6 +51,8 @@ int main(int argc, char *argv[])
 	WEATHERSTATION ws2300;
 	struct config_type config;
 
+	stats_option(&argc, argv);
+
 	if (argc < 2 || argc > 3)
 	{
 		print_usage();
@@ -0,0 +1,161 @@
+/*  open2300 - link2300.c
+ *
+ *  Version 1.11
+ *
+ *  Timing profiles of the serial link. See link2300.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "link2300.h"
+
+static struct link_timing timing =
+	{LINK_TIMEOUT, LINK_BACKOFF, LINK_RETRIES, LINK_BYTE_DELAY, LINK_READ_SIZE};
+
+static char profile_dir[200];
+
+
+/********************************************************************
+ * link_timing gives the timing of the station opened last
+ *
+ ********************************************************************/
+struct link_timing *link_timing(void)
+{
+	return &timing;
+}
+
+
+/********************************************************************
+ * link_defaults gives the built-in timing
+ *
+ ********************************************************************/
+void link_defaults(struct link_timing *defaults)
+{
+	defaults->timeout = LINK_TIMEOUT;
+	defaults->backoff = LINK_BACKOFF;
+	defaults->retries = LINK_RETRIES;
+	defaults->byte_delay = LINK_BYTE_DELAY;
+	defaults->read_size = LINK_READ_SIZE;
+}
+
+
+/********************************************************************
+ * link_setup sets where the profiles are, from LINK_PROFILE_DIR
+ *
+ * Input:   directory - empty = no profiles, the built-in timing
+ *
+ ********************************************************************/
+void link_setup(const char *directory)
+{
+	snprintf(profile_dir, sizeof(profile_dir), "%s", directory);
+}
+
+
+/********************************************************************
+ * link_profile_path gives the file of the profile of a device: the
+ * last part of the device name with LINK_SUFFIX in LINK_PROFILE_DIR
+ *
+ * Input:   device - serial device name, /dev/ttyS0, COM1 ...
+ *          size - of path
+ *
+ * Output:  path - file name of the profile
+ *
+ * Returns: 0 on success, -1 if there is no LINK_PROFILE_DIR
+ *
+ ********************************************************************/
+int link_profile_path(const char *device, char *path, int size)
+{
+	const char *name = device;
+	int length;
+
+	if (profile_dir[0] == '\0')
+		return -1;
+
+	for (; *device != '\0'; device++)
+		if (*device == '/' || *device == '\\' || *device == ':')
+			name = device + 1;
+
+	length = snprintf(path, size, "%s/%s%s", profile_dir, name, LINK_SUFFIX);
+
+	return length < size ? 0 : -1;
+}
+
+
+/********************************************************************
+ * link_profile_load sets the timing of a device: its profile, the
+ * built-in timing for what the profile does not give
+ *
+ * Input:   device - serial device name
+ *
+ * Returns: 1 if a profile was loaded, 0 if there is none
+ *
+ ********************************************************************/
+int link_profile_load(const char *device)
+{
+	char path[300], inputline[200], token[50];
+	int value;
+	FILE *fptr;
+
+	link_defaults(&timing);
+
+	if (link_profile_path(device, path, sizeof(path)) != 0 ||
+	    (fptr = fopen(path, "r")) == NULL)
+		return 0;
+
+	while (fgets(inputline, sizeof(inputline), fptr) != NULL)
+	{
+		if (sscanf(inputline, "%49s %d", token, &value) != 2 || token[0] == '#')
+			continue;
+
+		if (strcmp(token, "TIMEOUT") == 0 && value > 0)
+			timing.timeout = value;
+		else if (strcmp(token, "RESET_BACKOFF") == 0 && value >= 0)
+			timing.backoff = value;
+		else if (strcmp(token, "RETRIES") == 0 && value > 0)
+			timing.retries = value;
+		else if (strcmp(token, "BYTE_DELAY") == 0 && value >= 0)
+			timing.byte_delay = value;
+		else if (strcmp(token, "READ_SIZE") == 0 && value >= 1 && value <= LINK_READ_SIZE)
+			timing.read_size = value;
+	}
+
+	fclose(fptr);
+
+	return 1;
+}
+
+
+/********************************************************************
+ * link_profile_save writes the profile of a device
+ *
+ * Input:   device - serial device name
+ *          profile - the timing
+ *          comment - line put at the top of the file, may be NULL
+ *
+ * Returns: 0 on success, -1 if there is no LINK_PROFILE_DIR or the
+ *          file cannot be written
+ *
+ ********************************************************************/
+int link_profile_save(const char *device, struct link_timing *profile,
+                      const char *comment)
+{
+	char path[300], text[1000];
+	int length;
+
+	if (link_profile_path(device, path, sizeof(path)) != 0)
+		return -1;
+
+	length = snprintf(text, sizeof(text),
+	                  "# open2300 link timing of %s\n%s%s%s"
+	                  "TIMEOUT %d\nRESET_BACKOFF %d\nRETRIES %d\n"
+	                  "BYTE_DELAY %d\nREAD_SIZE %d\n",
+	                  device, comment != NULL ? "# " : "",
+	                  comment != NULL ? comment : "", comment != NULL ? "\n" : "",
+	                  profile->timeout, profile->backoff, profile->retries,
+	                  profile->byte_delay, profile->read_size);
+
+	if (length >= (int) sizeof(text) || publish_file(path, text, length, 0) < 0)
+		return -1;
+
+	return 0;
+}
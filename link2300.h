@@ -0,0 +1,56 @@
+/* open2300 - link2300.h
+ * Include file for the timing of the serial link to the station.
+ *
+ * How long a read waits for the station, the pause between resets
+ * that are not answered, how often read_safe and write_safe try, a
+ * pause before each command byte and the most bytes asked for in one
+ * read are taken from a timing profile of the serial device.
+ * calibrate2300 measures them for a station, adapter and cable and
+ * writes the profile to LINK_PROFILE_DIR/<device>.link, which
+ * open_weatherstation loads. Without a profile the built-in timing
+ * is used.
+ * srv2300 (serial2300.c) uses the timeout, the reset pause and the
+ * tries of the profile; it does not pause between command bytes.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_LINK2300_H_
+#define _INCLUDE_LINK2300_H_
+
+#include "rw2300.h"
+
+#ifdef WIN32
+#define LINK_TIMEOUT     175       // ms a read waits for the station
+#define LINK_BACKOFF     5         // ms more pause after each unanswered reset
+#else
+#define LINK_TIMEOUT     1000      // VTIME, a multiple of 100 ms
+#define LINK_BACKOFF     50
+#endif
+#define LINK_RETRIES     MAXRETRIES
+#define LINK_BYTE_DELAY  0         // ms before each command byte
+#define LINK_READ_SIZE   15        // most bytes per read command
+#define LINK_SUFFIX      ".link"
+
+struct link_timing
+{
+	int timeout;                   // ms
+	int backoff;                   // ms
+	int retries;                   // tries of read_safe and write_safe
+	int byte_delay;                // ms
+	int read_size;                 // bytes, 1 - 15
+};
+
+struct link_timing *link_timing(void);
+
+void link_defaults(struct link_timing *timing);
+
+void link_setup(const char *directory);
+
+int  link_profile_path(const char *device, char *path, int size);
+
+int  link_profile_load(const char *device);
+
+int  link_profile_save(const char *device, struct link_timing *timing,
+                       const char *comment);
+
+#endif /* _INCLUDE_LINK2300_H_ */
@@ -15,40 +15,47 @@
 
 #include <errno.h>
 #include <sys/file.h>
-#include "rw2300.h"
+#include "net2300.h"
+#include "trace2300.h"
+#include "stats2300.h"
+#include "link2300.h"
 
 /********************************************************************
- * open_weatherstation, Linux version
+ * deciseconds converts a read timeout to VTIME
  *
- * Input:   devicename (/dev/tty0, /dev/tty1 etc)
- * 
- * Returns: Handle to the weatherstation (type WEATHERSTATION)
+ ********************************************************************/
+static cc_t deciseconds(int milliseconds)
+{
+	int vtime = (milliseconds + 99) / 100;
+
+	return vtime < 1 ? 1 : vtime > 255 ? 255 : vtime;
+}
+
+/********************************************************************
+ * setup_serial_device locks an open serial port and sets it up for the
+ * protocol. Unlike open_weatherstation it does not exit, so srv2300
+ * can try a device again later.
+ *
+ * Input:   ws2300 - serial port opened with O_NONBLOCK
+ *
+ * Returns: 0 on success, -1 if fail
  *
  ********************************************************************/
-WEATHERSTATION open_weatherstation(char *device)
+int setup_serial_device(int ws2300)
 {
-	WEATHERSTATION ws2300;
 	struct termios adtio;
 	int portstatus, fdflags;
 
-	//Setup serial port
-
-	if ((ws2300 = open(device, O_RDWR | O_NONBLOCK)) < 0)
-	{
-		printf("\nUnable to open serial device %s\n", device);
-		exit(EXIT_FAILURE);
-	}
-	
 	if ( flock(ws2300, LOCK_EX|LOCK_NB) < 0 ) {
 		perror("\nSerial device is locked by other program\n");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
-	
+
 	if ((fdflags = fcntl(ws2300, F_GETFL)) == -1 ||
 	     fcntl(ws2300, F_SETFL, fdflags & ~O_NONBLOCK) < 0)
 	{
 		perror("couldn't reset non-blocking mode");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
 	
 	//We want full control of what is set and simply reset the entire adtio struct
@@ -89,13 +96,13 @@ WEATHERSTATION open_weatherstation(char *device)
 	// Raw output should disable all other output options
 	adtio.c_oflag &= ~OPOST;
 
-	adtio.c_cc[VTIME] = 10;		// timer 1s
+	adtio.c_cc[VTIME] = deciseconds(link_timing()->timeout);	// timer 1s by default
 	adtio.c_cc[VMIN] = 0;		// blocking read until 1 char
 	
 	if (tcsetattr(ws2300, TCSANOW, &adtio) < 0)
 	{
 		printf("Unable to initialize serial device");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
 
 	tcflush(ws2300, TCIOFLUSH);
@@ -107,6 +114,45 @@ WEATHERSTATION open_weatherstation(char *device)
 	portstatus |= TIOCM_RTS;
 	ioctl(ws2300, TIOCMSET, &portstatus);	// set current port status
 
+	return 0;
+}
+
+/********************************************************************
+ * open_weatherstation, Linux version
+ *
+ * Input:   devicename (/dev/tty0, /dev/tty1 etc)
+ * 
+ * Returns: Handle to the weatherstation (type WEATHERSTATION)
+ *
+ ********************************************************************/
+WEATHERSTATION open_weatherstation(char *device)
+{
+	WEATHERSTATION ws2300;
+
+	link_profile_load(device);
+
+	// A recorded session instead of the station
+	if (strncmp(device, TRACE_REPLAY, strlen(TRACE_REPLAY)) == 0)
+	{
+		if (trace_replay_open(device + strlen(TRACE_REPLAY)) != 0 ||
+		    (ws2300 = open("/dev/null", O_RDWR)) < 0)
+			exit(EXIT_FAILURE);
+		return ws2300;
+	}
+
+	//Setup serial port
+
+	if ((ws2300 = open(device, O_RDWR | O_NONBLOCK)) < 0)
+	{
+		printf("\nUnable to open serial device %s\n", device);
+		exit(EXIT_FAILURE);
+	}
+
+	if (setup_serial_device(ws2300) != 0)
+		exit(EXIT_FAILURE);
+
+	trace_capture_open();
+
 	return ws2300;
 }
 
@@ -120,6 +166,7 @@ WEATHERSTATION open_weatherstation(char *device)
  ********************************************************************/
 void close_weatherstation(WEATHERSTATION ws)
 {
+	trace_close();
 	close(ws);
 	return;
 }
@@ -136,8 +183,11 @@ void reset_06(WEATHERSTATION serdevice)
 {
 	unsigned char command = 0x06;
 	unsigned char answer;
+	long long start = clock_microseconds();
 	int i;
 
+	stats_get()->resets++;
+
 	for (i = 0; i < 100; i++)
 	{
 
@@ -145,6 +195,7 @@ void reset_06(WEATHERSTATION serdevice)
 		tcflush(serdevice, TCIFLUSH);
 
 		write_device(serdevice, &command, 1);
+		stats_get()->reset_commands++;
 
 		// Occasionally 0, then 2 is returned.  If zero comes back, continue
 		// reading as this is more efficient than sending an out-of sync
@@ -157,11 +208,12 @@ void reset_06(WEATHERSTATION serdevice)
 		{
 			if (answer == 2)
 			{
+				stats_add(&stats_get()->reset, start);
 				return;
 			}
 		}
 
-		usleep(50000 * i);   //we sleep longer and longer for each retry
+		sleep_short(link_timing()->backoff * i);   //we sleep longer and longer for each retry
 	}
 	fprintf(stderr, "\nCould not reset\n");
 	exit(EXIT_FAILURE);
@@ -184,12 +236,22 @@ int read_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
 {
 	int ret;
 
-	for (;;) {
+	if (trace_replaying())
+		ret = trace_replay_read(buffer, size);
+	else for (;;) {
 		ret = read(serdevice, buffer, size);
 		if (ret == 0 && errno == EINTR)
 			continue;
-		return ret;
+		trace_record(TRACE_READ, buffer, ret);
+		break;
 	}
+
+	if (ret > 0)
+		stats_get()->bytes_received += ret;
+	else if (ret == 0)
+		stats_get()->timeouts++;
+
+	return ret;
 }
 
 /********************************************************************
@@ -205,11 +267,53 @@ int read_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
  ********************************************************************/
 int write_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
 {
-	int ret = write(serdevice, buffer, size);
-	tcdrain(serdevice);	// wait for all output written
+	long long start;
+	int ret;
+
+	if (trace_replaying())
+	{
+		ret = trace_replay_write(buffer, size);
+	}
+	else
+	{
+		ret = write(serdevice, buffer, size);
+		start = clock_microseconds();
+		tcdrain(serdevice);	// wait for all output written
+		stats_add(&stats_get()->drain, start);
+		trace_record(TRACE_WRITE, buffer, ret);
+	}
+
+	if (ret > 0)
+		stats_get()->bytes_sent += ret;
+
 	return ret;
 }
 
+/********************************************************************
+ * set_read_timeout - Linux version
+ *
+ * Inputs:  serdevice - opened file handle
+ *          milliseconds - how long read_device waits for a byte,
+ *                         rounded up to 100 ms (VTIME)
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int set_read_timeout(WEATHERSTATION serdevice, int milliseconds)
+{
+	struct termios adtio;
+
+	if (trace_replaying())
+		return 0;
+
+	if (tcgetattr(serdevice, &adtio) < 0)
+		return -1;
+
+	adtio.c_cc[VTIME] = deciseconds(milliseconds);
+
+	return tcsetattr(serdevice, TCSANOW, &adtio) < 0 ? -1 : 0;
+}
+
 /********************************************************************
  * sleep_short - Linux version
  * 
@@ -220,7 +324,7 @@ int write_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
  ********************************************************************/
 void sleep_short(int milliseconds)
 {
-	usleep(milliseconds/1000);
+	usleep(milliseconds*1000);
 }
 
 /********************************************************************
@@ -237,6 +341,191 @@ void sleep_long(int seconds)
 }
 
 
+/********************************************************************
+ * publish_file - Linux version
+ *
+ * Inputs: path - file name of the published document
+ *         data - complete document to publish
+ *         size - number of bytes in data
+ *         compare_from - offset from where the content is compared
+ *                        with the existing file (see file_unchanged)
+ *
+ * Returns: 1 if the file was replaced, 0 if the content was unchanged
+ *          and the file was left untouched, -1 if fail.
+ *
+ * Action: Writes the document to a temporary file next to the target
+ *         and renames it into place. Readers always see either the
+ *         old or the new complete document, never a partial one.
+ *
+ ********************************************************************/
+int publish_file(char *path, const char *data, int size, int compare_from)
+{
+	char temppath[300];
+	int fd;
+
+	if (file_unchanged(path, data, size, compare_from))
+		return 0;
+
+	snprintf(temppath, sizeof(temppath), "%s.tmp%d", path, (int) getpid());
+
+	if ((fd = open(temppath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	{
+		perror("Cannot create temporary file");
+		return -1;
+	}
+
+	if (write(fd, data, size) != size || fsync(fd) != 0)
+	{
+		perror("Cannot write temporary file");
+		close(fd);
+		unlink(temppath);
+		return -1;
+	}
+
+	close(fd);
+
+	if (rename(temppath, path) != 0)
+	{
+		perror("Cannot rename temporary file");
+		unlink(temppath);
+		return -1;
+	}
+
+	return 1;
+}
+
+/********************************************************************
+ * sync_file - Linux version
+ *
+ * Inputs: stream - file open for writing
+ *
+ * Returns: 0 on success, -1 if fail.
+ *
+ * Action: Writes the buffered data and waits until it is on disk.
+ *
+ ********************************************************************/
+int sync_file(FILE *stream)
+{
+	if (fflush(stream) != 0 || fsync(fileno(stream)) != 0)
+		return -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * lock_file - Linux version
+ *
+ * Inputs: stream - open file
+ *         seconds - longest wait for a lock held by another process
+ *
+ * Returns: 0 when locked, -1 if fail.
+ *
+ * Action: Takes an exclusive lock (flock) on the file. The lock ends
+ *         when the file is closed.
+ *
+ ********************************************************************/
+int lock_file(FILE *stream, int seconds)
+{
+	int waited;
+
+	for (waited = 0; flock(fileno(stream), LOCK_EX | LOCK_NB) != 0; waited += 100)
+	{
+		if (errno != EWOULDBLOCK || waited >= seconds * 1000)
+			return -1;
+		sleep_short(100);
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * make_directory - Linux version
+ *
+ * Inputs: path - directory to create
+ *
+ * Returns: 0 on success or if it exists, -1 if fail.
+ *
+ ********************************************************************/
+int make_directory(const char *path)
+{
+	if (mkdir(path, 0755) != 0 && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * network_startup - Linux version
+ *
+ * Returns: 0 - nothing to set up on Linux
+ *
+ ********************************************************************/
+int network_startup(void)
+{
+	return 0;
+}
+
+
+/********************************************************************
+ * socket_nonblocking - Linux version
+ *
+ * Inputs: sockfd - socket
+ *         nonblocking - 1 to make calls return at once, 0 to block
+ *
+ * Returns: 0 on success, -1 if fail.
+ *
+ ********************************************************************/
+int socket_nonblocking(SOCKET sockfd, int nonblocking)
+{
+	int flags;
+
+	if ((flags = fcntl(sockfd, F_GETFL, 0)) < 0)
+		return -1;
+
+	if (nonblocking)
+		flags |= O_NONBLOCK;
+	else
+		flags &= ~O_NONBLOCK;
+
+	return fcntl(sockfd, F_SETFL, flags) < 0 ? -1 : 0;
+}
+
+
+/********************************************************************
+ * clock_milliseconds - Linux version
+ *
+ * Returns: milliseconds of a monotonic clock, for measuring time
+ *
+ ********************************************************************/
+long clock_milliseconds(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+
+/********************************************************************
+ * clock_microseconds - Linux version
+ *
+ * Returns: microseconds of a monotonic clock, for timing serial bytes
+ *
+ ********************************************************************/
+long long clock_microseconds(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+
 /********************************************************************
  * http_request_url - Linux version
  * 
@@ -251,32 +540,13 @@ void sleep_long(int seconds)
 int http_request_url(char *urlline)
 {
 	int sockfd;
-	struct hostent *hostinfo;
-	struct sockaddr_in urladdress;
+	hostdata server = {WEATHER_UNDERGROUND_BASEURL, 80}; /*default HTTP Server port */
 	char buffer[1024];
 	int bytes_read;
 	
-	if ( (hostinfo = gethostbyname(WEATHER_UNDERGROUND_BASEURL)) == NULL )
+	if ( (sockfd = net_connect(&server, 1, NET_TIMEOUT, NULL)) == INVALID_SOCKET )
 	{
-		perror("Host not known by DNS server or DNS server not working");
-		return(-1);
-	}
-	
-	if ( (sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 )
-	{
-		perror("Cannot open socket");
-		return(-1);
-	}
-
-	memset(&urladdress, 0, sizeof(urladdress));
-	urladdress.sin_family = AF_INET;
-	urladdress.sin_port = htons(80); /*default HTTP Server port */
-
-	urladdress.sin_addr = *(struct in_addr *)*hostinfo->h_addr_list;
-
-	if (connect(sockfd,(struct sockaddr*)&urladdress,sizeof(urladdress)) != 0)
-	{
-		perror("Cannot connect to host");
+		fprintf(stderr, "Cannot connect to host\n");
 		return(-1);
 	}
 	
@@ -313,49 +583,18 @@ int http_request_url(char *urlline)
  ********************************************************************/
 int citizen_weather_send(struct config_type *config, char *aprsline)
 {
-	int sockfd = -1; // just to eliminate a warning we'll set this
+	int sockfd;
 	int bytes_read;
-	struct hostent *hostinfo;
-	struct sockaddr_in urladdress;
 	char buffer[1024];          //Enough to hold a response
 	int hostnum;
 	
 	// Connect to server and send the record
-	// loop trying all of the defined servers
-	for (hostnum = 0; hostnum <= config->num_hosts; hostnum++)
+	// all defined servers are tried at once, the first to answer wins
+	sockfd = net_connect(config->aprs_host, config->num_hosts, NET_TIMEOUT, &hostnum);
+	if (sockfd == INVALID_SOCKET)
 	{
-		if ( hostnum == config->num_hosts )
-			return(-1);          // tried 'em all, fail exit
-
-		if ( (hostinfo = gethostbyname(config->aprs_host[hostnum].name) ) == NULL )
-		{
-			sprintf(buffer,"Host, %s, not known ", config->aprs_host[hostnum].name);
-			perror(buffer);
-			continue;
-		}
-			
-		if ( (sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 )
-		{
-			sprintf(buffer,"Cannot open socket on %s ", config->aprs_host[hostnum].name);
-			perror(buffer);
-			continue;
-		}
-	
-		memset(&urladdress, 0, sizeof(urladdress)); // clear the structure
-		urladdress.sin_family = AF_INET;
-		urladdress.sin_port = htons(config->aprs_host[hostnum].port);
-		urladdress.sin_addr = *(struct in_addr *)*hostinfo->h_addr_list;
-
-		if ( connect(sockfd, (struct sockaddr*)&urladdress, sizeof(urladdress)) != 0 )
-		{
-			sprintf(buffer,"Cannot connect to host: %s ", config->aprs_host[hostnum].name);
-			perror(buffer);
-			continue;
-		}
-		else
-		{
-			break;   // success
-		}
+		fprintf(stderr, "Cannot connect to any APRS server\n");
+		return(-1);          // tried 'em all, fail exit
 	}
 
 	if (DEBUG) printf("%d: %s: ",hostnum, config->aprs_host[hostnum].name);
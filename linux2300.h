@@ -16,5 +16,12 @@
 #define DEFAULT_SERIAL_DEVICE "/dev/ttyS0"
 typedef int WEATHERSTATION;
 
+/* Sockets are handled with the Winsock names on both platforms */
+typedef int SOCKET;
+#define INVALID_SOCKET  (-1)
+#define closesocket(s)  close(s)
+
+int setup_serial_device(int ws2300);
+
 #endif /* _INCLUDE_LINUX2300_H_ */
 
@@ -8,7 +8,10 @@
  *  This program is published under the GNU General Public license
  */
 
-#include "rw2300.h"
+#include "binlog2300.h"
+#include "logindex2300.h"
+#include "stats2300.h"
+#include "metrics2300.h"
 
 /********************************************************************
  * print_usage prints a short user guide
@@ -29,6 +32,7 @@ void print_usage(void)
 	printf("This program is released under the GNU General Public License (GPL)\n\n");
 	printf("Usage:\n");
 	printf("Save current data to logfile:    log2300 filename config_filename\n");
+	printf("A filename ending in .bin selects the compact binary log format\n");
 	exit(0);
 }
  
@@ -41,6 +45,10 @@ void print_usage(void)
  * Timestamp Date Time Ti To DP RHi RHo Wind Dir-degree Dir-text WC
  *              Rain1h Rain24h Rain-tot Rel-Press Tendency Forecast
  *
+ * If the log filename ends in .bin the same values are appended as
+ * a fixed width binary record instead (see binlog2300.h).
+ * For a text log the sidecar index (see logindex2300.h) is updated.
+ *
  * Just run the program without parameters for usage.
  *
  * It takes two parameters. The first is the log filename with path
@@ -52,22 +60,19 @@ void print_usage(void)
 int main(int argc, char *argv[])
 {
 	WEATHERSTATION ws2300;
-	FILE *fileptr;
-	char logline[3000] = "";
-	char tempstring[1000] = "";
-	char datestring[50];        //used to hold the date stamp for the log file
-	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
-	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
+	FILE *fileptr = NULL;
+	struct binlog binlog;
+	struct log_index index;
+	struct log_record record;
+	char logline[LOG_LINE_SIZE];
 	double winddir[6];
 	int tempint;
 	char tendency[15];
 	char forecast[15];
 	struct config_type config;
-	time_t basictime;
-
-	get_configuration(&config, argv[2]);
+	int binary;
 
-	ws2300 = open_weatherstation(config.serial_device_name);
+	stats_option(&argc, argv);
 
 	/* Get log filename. */
 
@@ -76,105 +81,132 @@ int main(int argc, char *argv[])
 		print_usage();
 	}
 
-	fileptr = fopen(argv[1], "a+");
-	if (fileptr == NULL)
+	get_configuration(&config, argv[2]);
+
+	binary = is_binlog_name(argv[1]);
+
+	if (binary)
 	{
-		printf("Cannot open file %s\n",argv[1]);
-		exit(-1);
+		if (binlog_open(&binlog, argv[1], 1) != 0)
+		{
+			printf("Cannot open binary log file %s\n",argv[1]);
+			exit(-1);
+		}
+	}
+	else
+	{
+		fileptr = fopen(argv[1], "a+");
+		if (fileptr == NULL)
+		{
+			printf("Cannot open file %s\n",argv[1]);
+			exit(-1);
+		}
 	}
 
+	ws2300 = open_weatherstation(config.serial_device_name);
+
+	record.format = LOG_FORMAT_CURRENT;
+
 
 	/* READ TEMPERATURE INDOOR */
 
-	sprintf(logline,"%.1f ", temperature_indoor(ws2300, config.temperature_conv));
+	record.temperature_indoor = temperature_indoor(ws2300, config.temperature_conv);
 
 
 	/* READ TEMPERATURE OUTDOOR */
 
-	sprintf(tempstring,"%.1f ", temperature_outdoor(ws2300, config.temperature_conv));
-	strcat(logline, tempstring);
+	record.temperature_outdoor = temperature_outdoor(ws2300, config.temperature_conv);
 
 
 	/* READ DEWPOINT */
 
-	sprintf(tempstring,"%.1f ", dewpoint(ws2300, config.temperature_conv));
-	strcat(logline, tempstring);
+	record.dewpoint = dewpoint(ws2300, config.temperature_conv);
 
 
 	/* READ RELATIVE HUMIDITY INDOOR */
 
-	sprintf(tempstring,"%d ", humidity_indoor(ws2300));	
-	strcat(logline, tempstring);
+	record.humidity_indoor = humidity_indoor(ws2300);
 
 
 	/* READ RELATIVE HUMIDITY OUTDOOR */
 
-	sprintf(tempstring,"%d ", humidity_outdoor(ws2300));	 
-	strcat(logline, tempstring);
+	record.humidity_outdoor = humidity_outdoor(ws2300);
 
 
 	/* READ WIND SPEED AND DIRECTION */
 
-	sprintf(tempstring,"%.1f ",
-	       wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir));
-	strcat(logline, tempstring);
-	sprintf(tempstring,"%.1f %s ", winddir[0], directions[tempint]);
-	strcat(logline, tempstring);
+	record.windspeed = wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir);
+	record.winddir_degrees = winddir[0];
 
 
 	/* READ WINDCHILL */
 
-	sprintf(tempstring,"%.1f ", windchill(ws2300, config.temperature_conv));
-	strcat(logline, tempstring);
+	record.windchill = windchill(ws2300, config.temperature_conv);
 
 
 	/* READ RAIN 1H */
 
-	sprintf(tempstring,"%.2f ", rain_1h(ws2300, config.rain_conv_factor));
-	strcat(logline, tempstring);
+	record.rain_1h = rain_1h(ws2300, config.rain_conv_factor);
 
 
 	/* READ RAIN 24H */
 
-	sprintf(tempstring,"%.2f ", rain_24h(ws2300, config.rain_conv_factor));
-	strcat(logline, tempstring);
+	record.rain_24h = rain_24h(ws2300, config.rain_conv_factor);
 
 
 	/* READ RAIN TOTAL */
 
-	sprintf(tempstring,"%.2f ", rain_total(ws2300, config.rain_conv_factor));
-	strcat(logline, tempstring);
+	record.rain_total = rain_total(ws2300, config.rain_conv_factor);
 
 
 	/* READ RELATIVE PRESSURE */
 
-	sprintf(tempstring,"%.3f ", rel_pressure(ws2300, config.pressure_conv_factor));
-	strcat(logline, tempstring);
+	record.rel_pressure = rel_pressure(ws2300, config.pressure_conv_factor);
 
 
 	/* READ TENDENCY AND FORECAST */
 
 	tendency_forecast(ws2300, tendency, forecast);
-	sprintf(tempstring,"%s %s ", tendency, forecast);
-	strcat(logline, tempstring);
+	record.tendency = name_index(tendency_names, 3, tendency);
+	record.forecast = name_index(forecast_names, 3, forecast);
 
 
 	/* GET DATE AND TIME FOR LOG FILE, PLACE BEFORE ALL DATA IN LOG LINE */
 
-	time(&basictime);
-	strftime(datestring, sizeof(datestring), "%Y%m%d%H%M%S %Y-%b-%d %H:%M:%S",
-	         localtime(&basictime));
+	time(&record.timestamp);
 
+	close_weatherstation(ws2300);
 
-	// Print out and leave
+	if (config.metrics_file[0] != '\0' &&
+	    metrics_write_file(config.metrics_file, &record, &config) != 0)
+	{
+		printf("Cannot write file %s\n", config.metrics_file);
+		exit(-1);
+	}
 
-	// printf("%s %s\n",datestring, logline); //disabled to be used in cron job
-	fprintf(fileptr, "%s %s\n", datestring, logline);
 
-	close_weatherstation(ws2300);
-	
-	fclose(fileptr);
+	// Write out and leave
+
+	if (binary)
+	{
+		if (binlog_append(&binlog, &record) != 0)
+		{
+			printf("Cannot write to binary log file %s\n",argv[1]);
+			exit(-1);
+		}
+		binlog_close(&binlog);
+	}
+	else
+	{
+		format_log_line(&record, logline, sizeof(logline));
+		fputs(logline, fileptr);
+		fclose(fileptr);
+
+		// Opening the index adds the new line to it
+		if (log_index_open(&index, argv[1]) == 0)
+			log_index_save(&index);
+		log_index_close(&index);
+	}
 
 	return(0);
 }
-
@@ -0,0 +1,463 @@
+/*  open2300 - logconv2300.c
+ *
+ *  Version 1.11
+ *
+ *  Convert log files between the log2300/histlog2300 text format
+ *  the compact binary log format and the compressed stream format.
+ *  Optionally only a time range is converted which for binary and
+ *  compressed input is found without reading the records before it.
+ *  With -b the compression of a text log is measured.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "binlog2300.h"
+#include "codec2300.h"
+
+static struct codec_block block;
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("logconv2300 - Convert open2300 log files between text and binary format.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("logconv2300 input_file output_file [from_time [to_time]]\n");
+	printf("logconv2300 -b text_log_file\n");
+	printf("The input format is detected from the file contents.\n");
+	printf("An output_file ending in .bin is written in binary format, one ending\n");
+	printf("in .wsz is compressed, otherwise it is text. Use - as output_file to\n");
+	printf("print text to standard out.\n");
+	printf("Times are given as YYYYMMDDhhmmss. Trailing digits may be left out.\n");
+	printf("-b prints the compression ratio and speed of the codec methods.\n");
+	exit(0);
+}
+
+/********************************************************************
+ * parse_time_argument converts a command line time like
+ * 20070719 or 20070719153000 to time_t
+ *
+ * Input:   argument - the string from the command line
+ *
+ * Returns: time, -1 if not valid
+ *
+ ********************************************************************/
+time_t parse_time_argument(const char *argument)
+{
+	char key[] = "00000101000000";
+	int length = strlen(argument);
+
+	if (length > 14)
+		return -1;
+
+	memcpy(key, argument, length);
+
+	return parse_log_timestamp(key);
+}
+
+/********************************************************************
+ * is_stream_name checks if a file name ends in .wsz
+ *
+ ********************************************************************/
+int is_stream_name(const char *path)
+{
+	int length = strlen(path);
+
+	return length > 4 && strcmp(path + length - 4, ".wsz") == 0;
+}
+
+/********************************************************************
+ * add_stream_record adds a record to the current block and writes
+ * the block when it is full
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int add_stream_record(struct log_record *record, FILE *output)
+{
+	double values[CODEC_MAX_FIELDS];
+
+	codec_record_values(record, values);
+
+	if (codec_block_add(&block, record->timestamp, values) == 0)
+		return 0;
+
+	if (codec_write_block(output, &block) != 0)
+		return -1;
+
+	codec_block_reset(&block);
+
+	return codec_block_add(&block, record->timestamp, values);
+}
+
+/********************************************************************
+ * write_record writes one record to the output in the selected
+ * format
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int write_record(struct log_record *record, FILE *output, struct binlog *binary_output,
+                 int stream)
+{
+	char line[LOG_LINE_SIZE];
+	int length;
+
+	if (binary_output != NULL)
+		return binlog_append(binary_output, record);
+
+	if (stream)
+		return add_stream_record(record, output);
+
+	if ((length = format_log_line(record, line, sizeof(line))) < 0 ||
+	    fwrite(line, 1, length, output) != (size_t) length)
+		return -1;
+
+	return 0;
+}
+
+/********************************************************************
+ * elapsed returns the seconds since a start time
+ *
+ ********************************************************************/
+double elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/********************************************************************
+ * benchmark encodes and decodes all records of a text log with
+ * each codec method and prints the size and speed. The decoded
+ * records are then checked against the log.
+ *
+ * Input:   path - text log file
+ *
+ * Output:  prints to stdout
+ *
+ ********************************************************************/
+void benchmark(char *path)
+{
+	static const char *method_names[2] = { "delta", "xor" };
+	struct codec_field field[CODEC_MAX_FIELDS];
+	struct log_record *records = NULL, decoded;
+	struct timespec start;
+	char line[LOG_LINE_SIZE], check[LOG_LINE_SIZE];
+	double values[CODEC_MAX_FIELDS];
+	double parse_time, encode_time, decode_time;
+	long count = 0, allocated = 0, text_size = 0, number, errors;
+	int method, field_count;
+	time_t timestamp;
+	FILE *input, *stream;
+
+	if ((input = fopen(path, "r")) == NULL)
+	{
+		fprintf(stderr, "Cannot open file %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (fgets(line, sizeof(line), input) != NULL)
+	{
+		text_size += strlen(line);
+		if (count == allocated)
+		{
+			allocated = allocated ? 2 * allocated : 4096;
+			if ((records = realloc(records, allocated * sizeof(*records))) == NULL)
+			{
+				fprintf(stderr, "Out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		if (parse_log_line(line, strlen(line), &records[count]))
+			count++;
+	}
+	parse_time = elapsed(&start);
+	fclose(input);
+
+	printf("%ld records, text %ld bytes, parse %.1f Mrecords/s\n",
+	       count, text_size, count / parse_time / 1e6);
+
+	for (method = CODEC_DELTA; method <= CODEC_XOR; method++)
+	{
+		if ((stream = tmpfile()) == NULL)
+		{
+			fprintf(stderr, "Cannot create temporary file\n");
+			exit(EXIT_FAILURE);
+		}
+
+		field_count = codec_record_fields(field, method);
+		codec_block_init(&block, field, field_count);
+		codec_write_header(stream, field, field_count);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (number = 0; number < count; number++)
+		{
+			if (add_stream_record(&records[number], stream) != 0)
+			{
+				fprintf(stderr, "Cannot write temporary file\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		codec_write_block(stream, &block);
+		fflush(stream);
+		encode_time = elapsed(&start);
+
+		rewind(stream);
+		codec_read_header(stream, field);
+
+		number = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		while (codec_read_block(stream, &block) == 1)
+		{
+			while (codec_block_next(&block, &timestamp, values) == 1)
+				number++;
+		}
+		decode_time = elapsed(&start);
+
+		// Check the round trip outside the timing
+		rewind(stream);
+		codec_read_header(stream, field);
+
+		errors = 0;
+		number = 0;
+		while (codec_read_block(stream, &block) == 1)
+		{
+			while (codec_block_next(&block, &timestamp, values) == 1)
+			{
+				codec_values_record(timestamp, values, &decoded);
+				if (number < count)
+				{
+					format_log_line(&decoded, line, sizeof(line));
+					format_log_line(&records[number], check, sizeof(check));
+					if (strcmp(line, check) != 0)
+						errors++;
+				}
+				number++;
+			}
+		}
+
+		printf("%-5s %8ld bytes, ratio %5.1f, encode %.1f Mrecords/s, "
+		       "decode %.1f Mrecords/s",
+		       method_names[method], ftell(stream),
+		       (double) text_size / ftell(stream),
+		       count / encode_time / 1e6, number / decode_time / 1e6);
+		if (errors || number != count)
+			printf(", %ld records differ", errors + labs(number - count));
+		printf("\n");
+
+		fclose(stream);
+	}
+
+	free(records);
+	exit(0);
+}
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program converts a log file between the text, binary and
+ * compressed formats (or copies a range of a log in the same format).
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	struct binlog binary_input, binary_output;
+	struct binlog *output_log = NULL;
+	struct codec_field field[CODEC_MAX_FIELDS];
+	struct log_record record;
+	FILE *input = NULL, *output = NULL;
+	char line[LOG_LINE_SIZE];
+	char magic[8];
+	double values[CODEC_MAX_FIELDS];
+	time_t from = 0, to = -1;
+	long number, count = 0, skipped = 0;
+	int binary, compressed, stream_output = 0, field_count, result;
+
+	if (argc == 3 && strcmp(argv[1], "-b") == 0)
+		benchmark(argv[2]);
+
+	if (argc < 3 || argc > 5)
+		print_usage();
+
+	if (argc > 3 && (from = parse_time_argument(argv[3])) == -1)
+		print_usage();
+
+	if (argc > 4 && (to = parse_time_argument(argv[4])) == -1)
+		print_usage();
+
+	// Detect input format
+
+	if ((input = fopen(argv[1], "rb")) == NULL)
+	{
+		fprintf(stderr, "Cannot open file %s\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	binary = 0;
+	compressed = 0;
+	if (fread(magic, 1, 8, input) == 8)
+	{
+		binary = (memcmp(magic, BINLOG_MAGIC, 8) == 0);
+		compressed = (memcmp(magic, CODEC_MAGIC, 8) == 0);
+	}
+	rewind(input);
+
+	if (binary)
+	{
+		fclose(input);
+		if (binlog_open(&binary_input, argv[1], 0) != 0)
+		{
+			fprintf(stderr, "Not a valid binary log file %s\n", argv[1]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (compressed)
+	{
+		if ((field_count = codec_read_header(input, field)) < 0 ||
+		    codec_seek(input, from) != 0)
+		{
+			fprintf(stderr, "Not a valid compressed log file %s\n", argv[1]);
+			exit(EXIT_FAILURE);
+		}
+		codec_block_init(&block, field, field_count);
+	}
+
+	// Create output
+
+	if (strcmp(argv[2], "-") == 0)
+	{
+		output = stdout;
+	}
+	else if (is_binlog_name(argv[2]))
+	{
+		remove(argv[2]);
+		if (binlog_open(&binary_output, argv[2], 1) != 0)
+		{
+			fprintf(stderr, "Cannot create file %s\n", argv[2]);
+			exit(EXIT_FAILURE);
+		}
+		output_log = &binary_output;
+	}
+	else if ((output = fopen(argv[2], is_stream_name(argv[2]) ? "wb" : "w")) == NULL)
+	{
+		fprintf(stderr, "Cannot create file %s\n", argv[2]);
+		exit(EXIT_FAILURE);
+	}
+	else if (is_stream_name(argv[2]))
+	{
+		stream_output = 1;
+		if (compressed)
+		{
+			fprintf(stderr, "Compressed input cannot be written compressed\n");
+			exit(EXIT_FAILURE);
+		}
+		field_count = codec_record_fields(field, CODEC_DELTA);
+		codec_block_init(&block, field, field_count);
+		codec_write_header(output, field, field_count);
+	}
+
+	// Copy the records
+
+	if (binary)
+	{
+		for (number = binlog_find(&binary_input, from);
+		     binlog_read(&binary_input, number, &record); number++)
+		{
+			if (to != -1 && record.timestamp > to)
+				break;
+			if (write_record(&record, output, output_log, stream_output) != 0)
+			{
+				fprintf(stderr, "Cannot write to %s\n", argv[2]);
+				exit(EXIT_FAILURE);
+			}
+			count++;
+		}
+		binlog_close(&binary_input);
+	}
+	else if (compressed)
+	{
+		while ((result = codec_read_block(input, &block)) == 1)
+		{
+			while ((result = codec_block_next(&block, &record.timestamp, values)) == 1)
+			{
+				if (record.timestamp < from)
+					continue;
+				if (to != -1 && record.timestamp > to)
+					break;
+				codec_values_record(record.timestamp, values, &record);
+				if (write_record(&record, output, output_log, 0) != 0)
+				{
+					fprintf(stderr, "Cannot write to %s\n", argv[2]);
+					exit(EXIT_FAILURE);
+				}
+				count++;
+			}
+			if (result != 0)
+				break;
+		}
+		if (result < 0)
+		{
+			fprintf(stderr, "Damaged compressed log file %s\n", argv[1]);
+			exit(EXIT_FAILURE);
+		}
+		fclose(input);
+	}
+	else
+	{
+		while (fgets(line, sizeof(line), input) != NULL)
+		{
+			if (!parse_log_line(line, strlen(line), &record))
+			{
+				skipped++;
+				continue;
+			}
+			if (record.timestamp < from)
+				continue;
+			if (to != -1 && record.timestamp > to)
+				break;
+			if (write_record(&record, output, output_log, stream_output) != 0)
+			{
+				fprintf(stderr, "Cannot write to %s\n", argv[2]);
+				exit(EXIT_FAILURE);
+			}
+			count++;
+		}
+		fclose(input);
+	}
+
+	if (stream_output && codec_write_block(output, &block) != 0)
+	{
+		fprintf(stderr, "Cannot write to %s\n", argv[2]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (output_log != NULL)
+		binlog_close(output_log);
+	else if (output != stdout)
+		fclose(output);
+
+	if (output != stdout)
+	{
+		printf("%ld records converted", count);
+		if (skipped)
+			printf(", %ld invalid lines skipped", skipped);
+		printf("\n");
+	}
+
+	return(0);
+}
@@ -0,0 +1,369 @@
+/*  open2300 - logindex2300.c
+ *
+ *  Version 1.11
+ *
+ *  Sidecar index for log2300/histlog2300 text logs. See
+ *  logindex2300.h for the file layout.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "logindex2300.h"
+
+
+/********************************************************************
+ * put_le / get_le store and load little endian integers
+ *
+ ********************************************************************/
+static void put_le(unsigned char *buffer, unsigned long value, int width)
+{
+	int i;
+
+	for (i = 0; i < width; i++)
+		buffer[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static unsigned long get_le(const unsigned char *buffer, int width)
+{
+	unsigned long value = 0;
+	int i;
+
+	for (i = width - 1; i >= 0; i--)
+		value = (value << 8) | buffer[i];
+
+	return value;
+}
+
+
+/********************************************************************
+ * reset_index empties the index (keeps the file names)
+ *
+ ********************************************************************/
+static void reset_index(struct log_index *index)
+{
+	index->records = 0;
+	index->log_size = 0;
+	index->last_offset = -1;
+	index->last_time = 0;
+	index->checkpoint_count = 0;
+}
+
+
+/********************************************************************
+ * load_index reads the index file
+ *
+ * Returns: 0 on success, -1 if missing or not valid
+ *
+ ********************************************************************/
+static int load_index(struct log_index *index)
+{
+	unsigned char header[LOGINDEX_HEADER_SIZE];
+	unsigned char entry[8];
+	FILE *file;
+	int i, count;
+
+	if ((file = fopen(index->path, "rb")) == NULL)
+		return -1;
+
+	if (fread(header, 1, LOGINDEX_HEADER_SIZE, file) != LOGINDEX_HEADER_SIZE ||
+	    memcmp(header, LOGINDEX_MAGIC, 8) != 0 ||
+	    get_le(header + 8, 2) != LOGINDEX_VERSION ||
+	    get_le(header + 10, 2) != LOGINDEX_INTERVAL)
+	{
+		fclose(file);
+		return -1;
+	}
+
+	index->records = get_le(header + 12, 4);
+	index->log_size = get_le(header + 16, 4);
+	index->last_offset = index->records ? (long) get_le(header + 20, 4) : -1;
+	index->last_time = (time_t) get_le(header + 24, 4);
+	count = get_le(header + 28, 4);
+
+	if (count != (index->records + LOGINDEX_INTERVAL - 1) / LOGINDEX_INTERVAL)
+	{
+		fclose(file);
+		return -1;
+	}
+
+	if (count > index->checkpoint_allocated)
+	{
+		struct log_checkpoint *checkpoint;
+
+		checkpoint = realloc(index->checkpoint, count * sizeof(struct log_checkpoint));
+		if (checkpoint == NULL)
+		{
+			fclose(file);
+			return -1;
+		}
+		index->checkpoint = checkpoint;
+		index->checkpoint_allocated = count;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (fread(entry, 1, 8, file) != 8)
+		{
+			fclose(file);
+			return -1;
+		}
+		index->checkpoint[i].timestamp = (time_t) get_le(entry, 4);
+		index->checkpoint[i].offset = get_le(entry + 4, 4);
+	}
+	index->checkpoint_count = count;
+
+	fclose(file);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * log_index_open loads the index of a log file and brings it up to
+ * date with the log. The index file is not written, call
+ * log_index_save for that.
+ *
+ * Input:   log_path - the text log file
+ *
+ * Output:  index - the index
+ *
+ * Returns: 0 on success, -1 if the log cannot be read
+ *
+ ********************************************************************/
+int log_index_open(struct log_index *index, const char *log_path)
+{
+	memset(index, 0, sizeof(*index));
+	snprintf(index->log_path, sizeof(index->log_path), "%s", log_path);
+	snprintf(index->path, sizeof(index->path), "%s.idx", log_path);
+
+	if (load_index(index) != 0)
+		reset_index(index);
+
+	return log_index_sync(index);
+}
+
+
+/********************************************************************
+ * log_index_add adds a record that has been appended to the log
+ *
+ * Input:   index - the index
+ *          offset - file offset of the new line
+ *          timestamp - time of the record
+ *
+ ********************************************************************/
+void log_index_add(struct log_index *index, long offset, time_t timestamp)
+{
+	struct log_checkpoint *checkpoint;
+	int allocated;
+
+	if (index->records % LOGINDEX_INTERVAL == 0)
+	{
+		if (index->checkpoint_count == index->checkpoint_allocated)
+		{
+			allocated = index->checkpoint_allocated ? 2 * index->checkpoint_allocated : 64;
+			checkpoint = realloc(index->checkpoint, allocated * sizeof(struct log_checkpoint));
+
+			// Without memory the index is just not saved complete
+			// and is rebuilt next time
+			if (checkpoint == NULL)
+				return;
+
+			index->checkpoint = checkpoint;
+			index->checkpoint_allocated = allocated;
+		}
+
+		index->checkpoint[index->checkpoint_count].timestamp = timestamp;
+		index->checkpoint[index->checkpoint_count].offset = offset;
+		index->checkpoint_count++;
+	}
+
+	index->records++;
+	index->last_offset = offset;
+	index->last_time = timestamp;
+}
+
+
+/********************************************************************
+ * index_lines adds all complete lines of the log from the end of
+ * the index
+ *
+ ********************************************************************/
+static int index_lines(struct log_index *index, FILE *log)
+{
+	struct time_cache cache;
+	char line[LOG_LINE_SIZE];
+	time_t timestamp;
+	long offset;
+	int length;
+
+	memset(&cache, 0, sizeof(cache));
+
+	if (fseek(log, index->log_size, SEEK_SET) != 0)
+		return -1;
+
+	while (1)
+	{
+		offset = ftell(log);
+		if (fgets(line, sizeof(line), log) == NULL)
+			break;
+
+		length = strlen(line);
+
+		// A line still being written is left for next time
+		if (line[length - 1] != '\n')
+		{
+			if (length < (int) sizeof(line) - 1)
+				break;
+			continue;
+		}
+
+		if ((timestamp = parse_log_timestamp_cached(line, &cache)) != -1)
+			log_index_add(index, offset, timestamp);
+
+		index->log_size = offset + length;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * log_index_sync brings the index up to date after lines were
+ * appended to the log by someone else. If the index does not match
+ * the log (log replaced or truncated) it is rebuilt.
+ *
+ * Returns: 0 on success, -1 if the log cannot be read
+ *
+ ********************************************************************/
+int log_index_sync(struct log_index *index)
+{
+	struct stat filestat;
+	char line[LOG_LINE_SIZE];
+	FILE *log;
+
+	if (stat(index->log_path, &filestat) != 0)
+	{
+		reset_index(index);
+		return 0;
+	}
+
+	if ((log = fopen(index->log_path, "rb")) == NULL)
+		return -1;
+
+	// The indexed part must still be there. Checking the last
+	// record costs one read and catches a replaced log.
+	if (filestat.st_size < index->log_size ||
+	    (index->last_offset >= 0 &&
+	     (fseek(log, index->last_offset, SEEK_SET) != 0 ||
+	      fgets(line, sizeof(line), log) == NULL ||
+	      parse_log_timestamp(line) != index->last_time)))
+		reset_index(index);
+
+	if (filestat.st_size != index->log_size)
+		index_lines(index, log);
+
+	fclose(log);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * log_index_rebuild builds the index from the log
+ *
+ * Returns: 0 on success, -1 if the log cannot be read
+ *
+ ********************************************************************/
+int log_index_rebuild(struct log_index *index)
+{
+	reset_index(index);
+
+	return log_index_sync(index);
+}
+
+
+/********************************************************************
+ * log_index_save writes the index file. The old index is replaced
+ * atomically so a reader never sees a partial index.
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int log_index_save(struct log_index *index)
+{
+	unsigned char *buffer, *p;
+	int size, i, result;
+
+	size = LOGINDEX_HEADER_SIZE + index->checkpoint_count * 8;
+	if ((buffer = malloc(size)) == NULL)
+		return -1;
+
+	memset(buffer, 0, LOGINDEX_HEADER_SIZE);
+	memcpy(buffer, LOGINDEX_MAGIC, 8);
+	put_le(buffer + 8, LOGINDEX_VERSION, 2);
+	put_le(buffer + 10, LOGINDEX_INTERVAL, 2);
+	put_le(buffer + 12, index->records, 4);
+	put_le(buffer + 16, index->log_size, 4);
+	put_le(buffer + 20, index->last_offset < 0 ? 0 : index->last_offset, 4);
+	put_le(buffer + 24, (unsigned long) index->last_time, 4);
+	put_le(buffer + 28, index->checkpoint_count, 4);
+
+	for (i = 0, p = buffer + LOGINDEX_HEADER_SIZE; i < index->checkpoint_count; i++, p += 8)
+	{
+		put_le(p, (unsigned long) index->checkpoint[i].timestamp, 4);
+		put_le(p + 4, index->checkpoint[i].offset, 4);
+	}
+
+	result = publish_file(index->path, (char *) buffer, size, 0);
+	free(buffer);
+
+	return result < 0 ? -1 : 0;
+}
+
+
+/********************************************************************
+ * log_index_find gives where to start reading the log to find the
+ * first record at or after a time. At most LOGINDEX_INTERVAL lines
+ * have to be read from there.
+ *
+ * Input:   index - the index
+ *          timestamp - time to find
+ *
+ * Returns: file offset to start reading from
+ *
+ ********************************************************************/
+long log_index_find(struct log_index *index, time_t timestamp)
+{
+	int low = 0, high = index->checkpoint_count, middle;
+
+	if (index->records == 0)
+		return 0;
+
+	if (timestamp > index->last_time)
+		return index->log_size;
+
+	// Last checkpoint before the time
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+		if (index->checkpoint[middle].timestamp < timestamp)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low == 0 ? 0 : index->checkpoint[low - 1].offset;
+}
+
+
+/********************************************************************
+ * log_index_close releases the memory of the index
+ *
+ ********************************************************************/
+void log_index_close(struct log_index *index)
+{
+	free(index->checkpoint);
+	index->checkpoint = NULL;
+	index->checkpoint_count = 0;
+	index->checkpoint_allocated = 0;
+}
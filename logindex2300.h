@@ -0,0 +1,61 @@
+/* open2300 - logindex2300.h
+ * Include file for the sidecar index of text log files.
+ *
+ * log2300 and histlog2300 keep an index next to a text log
+ * (log name + ".idx") so the last record and any time can be found
+ * without reading the log. File layout (all integers little endian):
+ *   header       magic "WS2300IX", version (2 bytes), checkpoint
+ *                interval (2), record count (4), indexed log size (4),
+ *                offset of the last record (4), time of the last
+ *                record (4), checkpoint count (4), reserved (4)
+ *   checkpoints  time (4) and offset (4) of every interval'th record
+ * The index is replaced atomically when saved. If it is missing or
+ * does not match the log it is rebuilt, if the log has grown the new
+ * lines are added.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_LOGINDEX2300_H_
+#define _INCLUDE_LOGINDEX2300_H_
+
+#include "record2300.h"
+
+#define LOGINDEX_MAGIC        "WS2300IX"
+#define LOGINDEX_VERSION      1
+#define LOGINDEX_HEADER_SIZE  32
+#define LOGINDEX_INTERVAL     256
+
+struct log_checkpoint
+{
+	time_t timestamp;
+	long   offset;
+};
+
+struct log_index
+{
+	char   path[300];              // the index file
+	char   log_path[300];
+	long   records;
+	long   log_size;               // bytes of the log covered
+	long   last_offset;            // -1 if the log is empty
+	time_t last_time;
+	int    checkpoint_count;
+	int    checkpoint_allocated;
+	struct log_checkpoint *checkpoint;
+};
+
+int  log_index_open(struct log_index *index, const char *log_path);
+
+void log_index_add(struct log_index *index, long offset, time_t timestamp);
+
+int  log_index_sync(struct log_index *index);
+
+int  log_index_rebuild(struct log_index *index);
+
+int  log_index_save(struct log_index *index);
+
+long log_index_find(struct log_index *index, time_t timestamp);
+
+void log_index_close(struct log_index *index);
+
+#endif /* _INCLUDE_LOGINDEX2300_H_ */
@@ -0,0 +1,261 @@
+/*  open2300 - logparse2300.c
+ *
+ *  Version 1.11
+ *
+ *  Parses whole log2300/histlog2300 text logs using all processor
+ *  cores. See logparse2300.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include "logparse2300.h"
+
+// Shortest possible log line, used to size the record arrays
+#define MIN_LINE_LENGTH  40
+
+struct parse_chunk
+{
+	const char *start;
+	const char *end;
+	struct log_record *records;
+	long count;
+	long invalid;
+	int  failed;
+};
+
+
+/********************************************************************
+ * log_parse_threads returns the number of threads to use by
+ * default, one per online processor
+ *
+ ********************************************************************/
+int log_parse_threads(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (cpus < 1)
+		return 1;
+	if (cpus > LOGPARSE_MAX_THREADS)
+		return LOGPARSE_MAX_THREADS;
+
+	return (int) cpus;
+}
+
+
+/********************************************************************
+ * parse_chunk_thread parses all lines of one chunk
+ *
+ ********************************************************************/
+static void *parse_chunk_thread(void *argument)
+{
+	struct parse_chunk *chunk = argument;
+	struct time_cache cache;
+	const char *p = chunk->start;
+	const char *line_end;
+	struct log_record *records;
+	long allocated;
+
+	memset(&cache, 0, sizeof(cache));
+
+	allocated = (chunk->end - chunk->start) / MIN_LINE_LENGTH + 1;
+	if ((chunk->records = malloc(allocated * sizeof(struct log_record))) == NULL)
+	{
+		chunk->failed = 1;
+		return NULL;
+	}
+
+	while (p < chunk->end)
+	{
+		if ((line_end = memchr(p, '\n', chunk->end - p)) == NULL)
+			line_end = chunk->end;
+
+		if (chunk->count == allocated)
+		{
+			allocated *= 2;
+			records = realloc(chunk->records, allocated * sizeof(struct log_record));
+			if (records == NULL)
+			{
+				chunk->failed = 1;
+				return NULL;
+			}
+			chunk->records = records;
+		}
+
+		if (parse_log_record(p, line_end - p, &chunk->records[chunk->count], &cache))
+			chunk->count++;
+		else if (line_end > p)
+			chunk->invalid++;
+
+		p = line_end + 1;
+	}
+
+	return NULL;
+}
+
+
+/********************************************************************
+ * log_parse_buffer parses log lines held in memory
+ *
+ * Input:   data - the log file contents
+ *          size - number of bytes
+ *          threads - number of threads, 0 = one per processor
+ *
+ * Output:  result - the records in the order of the lines
+ *
+ * Returns: 0 on success, -1 if out of memory or threads
+ *
+ ********************************************************************/
+int log_parse_buffer(const char *data, size_t size, int threads,
+                     struct log_parse_result *result)
+{
+	struct parse_chunk chunk[LOGPARSE_MAX_THREADS];
+	pthread_t thread[LOGPARSE_MAX_THREADS];
+	int started[LOGPARSE_MAX_THREADS];
+	const char *p, *end = data + size;
+	long count = 0;
+	int i, failed = 0;
+
+	memset(result, 0, sizeof(*result));
+	memset(chunk, 0, sizeof(chunk));
+
+	if (threads <= 0)
+		threads = log_parse_threads();
+	if (threads > LOGPARSE_MAX_THREADS)
+		threads = LOGPARSE_MAX_THREADS;
+
+	// Small files are not worth the thread start up
+	if (size < (size_t) threads * 65536)
+		threads = size / 65536 + 1;
+
+	// Each chunk ends after a newline so no line is split
+	p = data;
+	for (i = 0; i < threads; i++)
+	{
+		chunk[i].start = p;
+		if (i == threads - 1)
+		{
+			p = end;
+		}
+		else
+		{
+			p = data + size / threads * (i + 1);
+			if (p < chunk[i].start)
+				p = chunk[i].start;
+			while (p < end && *p != '\n')
+				p++;
+			if (p < end)
+				p++;
+		}
+		chunk[i].end = p;
+	}
+
+	for (i = 1; i < threads; i++)
+	{
+		started[i] = (pthread_create(&thread[i], NULL, parse_chunk_thread, &chunk[i]) == 0);
+
+		// Parse it here instead
+		if (!started[i])
+			parse_chunk_thread(&chunk[i]);
+	}
+
+	parse_chunk_thread(&chunk[0]);
+
+	for (i = 1; i < threads; i++)
+	{
+		if (started[i])
+			pthread_join(thread[i], NULL);
+	}
+
+	for (i = 0; i < threads; i++)
+	{
+		count += chunk[i].count;
+		result->invalid += chunk[i].invalid;
+		failed |= chunk[i].failed;
+	}
+
+	if (!failed && (result->records = malloc((count + 1) * sizeof(struct log_record))) != NULL)
+	{
+		for (i = 0; i < threads; i++)
+		{
+			memcpy(result->records + result->count, chunk[i].records,
+			       chunk[i].count * sizeof(struct log_record));
+			result->count += chunk[i].count;
+		}
+	}
+	else
+	{
+		failed = 1;
+	}
+
+	for (i = 0; i < threads; i++)
+		free(chunk[i].records);
+
+	result->bytes = size;
+	result->threads = threads;
+
+	return failed ? -1 : 0;
+}
+
+
+/********************************************************************
+ * log_parse_file maps a log file into memory and parses it
+ *
+ * Input:   path - log file
+ *          threads - number of threads, 0 = one per processor
+ *
+ * Output:  result - the records in the order of the lines
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int log_parse_file(const char *path, int threads, struct log_parse_result *result)
+{
+	struct stat filestat;
+	void *map;
+	int fd, status;
+
+	memset(result, 0, sizeof(*result));
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	if (fstat(fd, &filestat) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	if (filestat.st_size == 0)
+	{
+		close(fd);
+		return log_parse_buffer("", 0, threads, result);
+	}
+
+	map = mmap(NULL, filestat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return -1;
+
+	madvise(map, filestat.st_size, MADV_WILLNEED);
+
+	status = log_parse_buffer(map, filestat.st_size, threads, result);
+
+	munmap(map, filestat.st_size);
+
+	return status;
+}
+
+
+/********************************************************************
+ * log_parse_free releases the records of a parse result
+ *
+ ********************************************************************/
+void log_parse_free(struct log_parse_result *result)
+{
+	free(result->records);
+	result->records = NULL;
+	result->count = 0;
+}
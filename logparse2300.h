@@ -0,0 +1,37 @@
+/* open2300 - logparse2300.h
+ * Include file for the parallel log file parser.
+ *
+ * A log2300 or histlog2300 text log is mapped into memory and split
+ * into newline aligned chunks, one per thread. Each thread parses
+ * its chunk with parse_log_record and the results are joined in file
+ * order.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_LOGPARSE2300_H_
+#define _INCLUDE_LOGPARSE2300_H_
+
+#include "record2300.h"
+
+#define LOGPARSE_MAX_THREADS  64
+
+struct log_parse_result
+{
+	struct log_record *records;    // malloc'ed, free with log_parse_free
+	long   count;
+	long   invalid;                // lines that are not log lines
+	size_t bytes;                  // size of the log file
+	int    threads;                // threads used
+};
+
+int  log_parse_threads(void);
+
+int  log_parse_buffer(const char *data, size_t size, int threads,
+                      struct log_parse_result *result);
+
+int  log_parse_file(const char *path, int threads,
+                    struct log_parse_result *result);
+
+void log_parse_free(struct log_parse_result *result);
+
+#endif /* _INCLUDE_LOGPARSE2300_H_ */
@@ -0,0 +1,175 @@
+/*  open2300 - logsearch2300.c
+ *
+ *  Version 1.11
+ *
+ *  Binary search for a time in log2300/histlog2300 text logs.
+ *  See logsearch2300.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "logsearch2300.h"
+
+
+/********************************************************************
+ * log_make_key turns a time given as YYYYMMDDhhmmss, where trailing
+ * digits may be left out, into a full 14 digit key
+ * (2007 -> 20070000000000, 200707191530 -> 20070719153000)
+ *
+ * Input:   argument - the time as text
+ *
+ * Output:  key - 15 characters incl the terminating zero
+ *
+ * Returns: 0 on success, -1 if the argument is not a valid time
+ *
+ ********************************************************************/
+int log_make_key(const char *argument, char *key)
+{
+	int length = strlen(argument);
+	int i;
+
+	if (length == 0 || length > LOG_KEY_LENGTH)
+		return -1;
+
+	for (i = 0; i < LOG_KEY_LENGTH; i++)
+	{
+		if (i >= length)
+			key[i] = '0';
+		else if (argument[i] >= '0' && argument[i] <= '9')
+			key[i] = argument[i];
+		else
+			return -1;
+	}
+	key[LOG_KEY_LENGTH] = '\0';
+
+	return 0;
+}
+
+
+/********************************************************************
+ * log_line_key gets the key of a log line
+ *
+ * Input:   line - zero terminated log line
+ *
+ * Output:  key - 15 characters incl the terminating zero
+ *
+ * Returns: 0 on success, -1 if the line does not start with a key
+ *
+ ********************************************************************/
+int log_line_key(const char *line, char *key)
+{
+	int i;
+
+	for (i = 0; i < LOG_KEY_LENGTH; i++)
+	{
+		if (line[i] < '0' || line[i] > '9')
+			return -1;
+		key[i] = line[i];
+	}
+
+	if (line[i] != ' ' && line[i] != '\t')
+		return -1;
+
+	key[LOG_KEY_LENGTH] = '\0';
+
+	return 0;
+}
+
+
+/********************************************************************
+ * next_line_key reads lines from the current position until a line
+ * with a key is found
+ *
+ * Output:  key - key of the line
+ *          start - offset of the line
+ *
+ * Returns: length of the line, 0 at end of file
+ *
+ ********************************************************************/
+static int next_line_key(FILE *file, char *key, long *start)
+{
+	char line[LOG_LINE_SIZE];
+	int length;
+
+	while (1)
+	{
+		*start = ftell(file);
+		if (fgets(line, sizeof(line), file) == NULL)
+			return 0;
+
+		length = strlen(line);
+
+		// Skip the rest of lines too long for the buffer
+		if (length > 0 && line[length - 1] != '\n')
+		{
+			int c;
+
+			while ((c = getc(file)) != EOF && c != '\n')
+				length++;
+			if (c == '\n')
+				length++;
+		}
+
+		if (log_line_key(line, key) == 0)
+			return length;
+	}
+}
+
+
+/********************************************************************
+ * log_search finds the first line with a key at or after a given
+ * key. Only O(log n) seeks and a few short reads are done.
+ *
+ * Input:   file - log file opened for reading in binary mode
+ *          key - 14 digit key to find
+ *
+ * Returns: offset of the line, the file size if all lines are
+ *          before the key, -1 if the file cannot be read.
+ *          The file is left positioned at the returned offset.
+ *
+ ********************************************************************/
+long log_search(FILE *file, const char *key)
+{
+	char line_key[LOG_KEY_LENGTH + 1];
+	long low = 0, high, middle, start;
+	int length, c;
+
+	if (fseek(file, 0L, SEEK_END) != 0 || (high = ftell(file)) < 0)
+		return -1;
+
+	// The first line at or after key starts in [low, high]. low is
+	// always the start of a line.
+	while (high - low > LOG_SEARCH_LINEAR)
+	{
+		middle = low + (high - low) / 2;
+
+		// Resync to the start of the next line
+		fseek(file, middle - 1, SEEK_SET);
+		while ((c = getc(file)) != EOF && c != '\n')
+			;
+
+		if ((length = next_line_key(file, line_key, &start)) == 0 || start >= high)
+		{
+			high = middle;
+			continue;
+		}
+
+		if (strcmp(line_key, key) < 0)
+			low = start + length;
+		else
+			high = start;
+	}
+
+	// Finish with a short linear scan
+	fseek(file, low, SEEK_SET);
+	while ((length = next_line_key(file, line_key, &start)) > 0)
+	{
+		if (strcmp(line_key, key) >= 0)
+		{
+			fseek(file, start, SEEK_SET);
+			return start;
+		}
+	}
+
+	return ftell(file);
+}
@@ -0,0 +1,25 @@
+/* open2300 - logsearch2300.h
+ * Include file for searching log2300/histlog2300 text logs by time.
+ *
+ * Every log line starts with a YYYYMMDDhhmmss key so the lines of a
+ * log are sorted as text. A time is found by binary search on byte
+ * offsets, resyncing to the next line start after each seek.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_LOGSEARCH2300_H_
+#define _INCLUDE_LOGSEARCH2300_H_
+
+#include "record2300.h"
+
+#define LOG_KEY_LENGTH        14
+// Below this distance the search reads lines instead of seeking
+#define LOG_SEARCH_LINEAR     4096
+
+int  log_make_key(const char *argument, char *key);
+
+int  log_line_key(const char *line, char *key);
+
+long log_search(FILE *file, const char *key);
+
+#endif /* _INCLUDE_LOGSEARCH2300_H_ */
@@ -0,0 +1,306 @@
+/*  open2300 - loop2300.c
+ *
+ *  Version 1.11
+ *
+ *  Event loop with epoll and a timer heap. See loop2300.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include "loop2300.h"
+
+
+/********************************************************************
+ * heap_swap / heap_up / heap_down keep the timer heap in order of
+ * due time, the first timer to expire at index 0
+ *
+ ********************************************************************/
+static void heap_swap(struct event_loop *loop, int a, int b)
+{
+	struct loop_timer *timer = loop->heap[a];
+
+	loop->heap[a] = loop->heap[b];
+	loop->heap[b] = timer;
+	loop->heap[a]->index = a;
+	loop->heap[b]->index = b;
+}
+
+static void heap_up(struct event_loop *loop, int index)
+{
+	int parent;
+
+	while (index > 0)
+	{
+		parent = (index - 1) / 2;
+		if (loop->heap[parent]->due <= loop->heap[index]->due)
+			break;
+		heap_swap(loop, parent, index);
+		index = parent;
+	}
+}
+
+static void heap_down(struct event_loop *loop, int index)
+{
+	int child;
+
+	while ((child = 2 * index + 1) < loop->timers)
+	{
+		if (child + 1 < loop->timers &&
+		    loop->heap[child + 1]->due < loop->heap[child]->due)
+			child++;
+		if (loop->heap[index]->due <= loop->heap[child]->due)
+			break;
+		heap_swap(loop, index, child);
+		index = child;
+	}
+}
+
+
+/********************************************************************
+ * loop_init creates an event loop
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int loop_init(struct event_loop *loop)
+{
+	memset(loop, 0, sizeof(*loop));
+
+	if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	{
+		perror("epoll_create1");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * loop_close frees the loop. The watched descriptors are not closed.
+ *
+ ********************************************************************/
+void loop_close(struct event_loop *loop)
+{
+	if (loop->epfd >= 0)
+		close(loop->epfd);
+	loop->epfd = -1;
+}
+
+
+/********************************************************************
+ * loop_watch_init prepares a watch of a file descriptor
+ *
+ * Input:   fd - descriptor, should be non-blocking
+ *          handler - called with the events that are ready
+ *          context - for the handler
+ *
+ ********************************************************************/
+void loop_watch_init(struct loop_watch *watch, int fd, loop_handler handler, void *context)
+{
+	watch->fd = fd;
+	watch->events = 0;
+	watch->added = 0;
+	watch->handler = handler;
+	watch->context = context;
+}
+
+
+/********************************************************************
+ * loop_watch_set sets the events a watch waits for
+ *
+ * Input:   events - LOOP_READ and/or LOOP_WRITE, 0 to pause the watch
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int loop_watch_set(struct event_loop *loop, struct loop_watch *watch, int events)
+{
+	struct epoll_event event;
+
+	if (watch->added && events == watch->events)
+		return 0;
+
+	memset(&event, 0, sizeof(event));
+	event.events = (events & LOOP_READ ? EPOLLIN : 0) | (events & LOOP_WRITE ? EPOLLOUT : 0);
+	event.data.ptr = watch;
+
+	if (epoll_ctl(loop->epfd, watch->added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+	              watch->fd, &event) != 0)
+		return -1;
+
+	watch->added = 1;
+	watch->events = events;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * loop_watch_remove takes a watch out of the loop. Events of it that
+ * are already waiting to be handled are dropped, so a handler may
+ * remove (and free) other watches.
+ *
+ ********************************************************************/
+void loop_watch_remove(struct event_loop *loop, struct loop_watch *watch)
+{
+	int i;
+
+	if (watch->added)
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, watch->fd, NULL);
+
+	watch->added = 0;
+	watch->events = 0;
+
+	for (i = 0; i < loop->ready_count; i++)
+	{
+		if (loop->ready[i] == watch)
+			loop->ready[i] = NULL;
+	}
+}
+
+
+/********************************************************************
+ * loop_timer_init prepares a timer
+ *
+ ********************************************************************/
+void loop_timer_init(struct loop_timer *timer, loop_timer_handler handler, void *context)
+{
+	timer->index = -1;
+	timer->due = 0;
+	timer->handler = handler;
+	timer->context = context;
+}
+
+
+/********************************************************************
+ * loop_timer_start starts a timer, or moves it if it is running
+ *
+ * Input:   milliseconds - from now
+ *
+ * Returns: 0 on success, -1 if LOOP_TIMERS are running
+ *
+ ********************************************************************/
+int loop_timer_start(struct event_loop *loop, struct loop_timer *timer, long milliseconds)
+{
+	timer->due = clock_milliseconds() + milliseconds;
+
+	if (timer->index < 0)
+	{
+		if (loop->timers >= LOOP_TIMERS)
+			return -1;
+		timer->index = loop->timers;
+		loop->heap[loop->timers++] = timer;
+	}
+
+	heap_up(loop, timer->index);
+	heap_down(loop, timer->index);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * loop_timer_stop stops a timer if it is running
+ *
+ ********************************************************************/
+void loop_timer_stop(struct event_loop *loop, struct loop_timer *timer)
+{
+	int index = timer->index;
+
+	if (index < 0)
+		return;
+
+	timer->index = -1;
+
+	if (--loop->timers == index)
+		return;
+
+	loop->heap[index] = loop->heap[loop->timers];
+	loop->heap[index]->index = index;
+	heap_up(loop, index);
+	heap_down(loop, index);
+}
+
+
+/********************************************************************
+ * loop_run waits for events and timers and calls their handlers until
+ * loop_stop is called
+ *
+ * Returns: 0 when stopped, -1 if the wait fails
+ *
+ ********************************************************************/
+int loop_run(struct event_loop *loop)
+{
+	struct epoll_event events[LOOP_EVENTS];
+	struct loop_watch *watch;
+	struct loop_timer *timer;
+	long wait, now;
+	int count, flags, i;
+
+	loop->running = 1;
+
+	while (loop->running)
+	{
+		wait = -1;
+		if (loop->timers > 0)
+		{
+			wait = loop->heap[0]->due - clock_milliseconds();
+			if (wait < 0)
+				wait = 0;
+		}
+
+		if ((count = epoll_wait(loop->epfd, events, LOOP_EVENTS, (int) wait)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			return -1;
+		}
+
+		for (i = 0; i < count; i++)
+			loop->ready[i] = events[i].data.ptr;
+		loop->ready_count = count;
+
+		for (i = 0; i < count && loop->running; i++)
+		{
+			if ((watch = loop->ready[i]) == NULL)
+				continue;
+
+			flags = (events[i].events & EPOLLIN ? LOOP_READ : 0) |
+			        (events[i].events & EPOLLOUT ? LOOP_WRITE : 0);
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+				flags |= LOOP_ERROR | (watch->events & (LOOP_READ | LOOP_WRITE));
+
+			watch->handler(loop, watch, flags);
+		}
+
+		loop->ready_count = 0;
+
+		// At most the timers running now are handled, so a handler
+		// that starts a timer due at once cannot keep the loop here
+		now = clock_milliseconds();
+		for (count = loop->timers; count > 0 && loop->timers > 0 && loop->running; count--)
+		{
+			timer = loop->heap[0];
+			if (timer->due > now)
+				break;
+			loop_timer_stop(loop, timer);
+			timer->handler(loop, timer);
+		}
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * loop_stop makes loop_run return after the current handler
+ *
+ ********************************************************************/
+void loop_stop(struct event_loop *loop)
+{
+	loop->running = 0;
+}
@@ -0,0 +1,81 @@
+/* open2300 - loop2300.h
+ * Include file for the event loop of the daemon (Linux, epoll).
+ *
+ * One thread waits for all file descriptors (serial port, sockets)
+ * and timers at once and calls a handler for each that is ready, so
+ * nothing blocks: the serial protocol, uploads and local clients all
+ * make progress while the others wait for their I/O.
+ *
+ * The caller owns the watch and timer structures and keeps them
+ * alive while they are in the loop. Timers are kept in a binary heap
+ * ordered by due time. Times are clock_milliseconds() values.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_LOOP2300_H_
+#define _INCLUDE_LOOP2300_H_
+
+#include "rw2300.h"
+
+#define LOOP_READ        1
+#define LOOP_WRITE       2
+#define LOOP_ERROR       4         // error or hang up, given with READ/WRITE
+#define LOOP_EVENTS      64        // events handled per wait
+#define LOOP_TIMERS      256       // most timers running
+
+struct event_loop;
+struct loop_watch;
+struct loop_timer;
+
+typedef void (*loop_handler)(struct event_loop *loop, struct loop_watch *watch, int events);
+
+typedef void (*loop_timer_handler)(struct event_loop *loop, struct loop_timer *timer);
+
+struct loop_watch
+{
+	int          fd;
+	int          events;           // LOOP_READ / LOOP_WRITE wanted
+	int          added;            // known by epoll
+	loop_handler handler;
+	void        *context;
+};
+
+struct loop_timer
+{
+	long               due;        // clock_milliseconds
+	int                index;      // in the heap, -1 when not running
+	loop_timer_handler handler;
+	void              *context;
+};
+
+struct event_loop
+{
+	int    epfd;
+	int    running;
+	int    timers;
+	struct loop_timer *heap[LOOP_TIMERS];
+	void  *ready[LOOP_EVENTS];     // watches of the events being handled
+	int    ready_count;
+};
+
+int  loop_init(struct event_loop *loop);
+
+void loop_close(struct event_loop *loop);
+
+void loop_watch_init(struct loop_watch *watch, int fd, loop_handler handler, void *context);
+
+int  loop_watch_set(struct event_loop *loop, struct loop_watch *watch, int events);
+
+void loop_watch_remove(struct event_loop *loop, struct loop_watch *watch);
+
+void loop_timer_init(struct loop_timer *timer, loop_timer_handler handler, void *context);
+
+int  loop_timer_start(struct event_loop *loop, struct loop_timer *timer, long milliseconds);
+
+void loop_timer_stop(struct event_loop *loop, struct loop_timer *timer);
+
+int  loop_run(struct event_loop *loop);
+
+void loop_stop(struct event_loop *loop);
+
+#endif /* _INCLUDE_LOOP2300_H_ */
@@ -0,0 +1,487 @@
+/*  open2300 - metrics2300.c
+ *
+ *  Version 1.11
+ *
+ *  Prometheus / OpenMetrics text of the readings and the protocol
+ *  statistics. See metrics2300.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include "metrics2300.h"
+
+#define FIELD_TEMPERATURE_INDOOR  0
+#define FIELD_TEMPERATURE_OUTDOOR 1
+#define FIELD_DEWPOINT            2
+#define FIELD_WINDCHILL           3
+#define FIELD_HUMIDITY_INDOOR     4
+#define FIELD_HUMIDITY_OUTDOOR    5
+#define FIELD_WINDSPEED           6
+#define FIELD_WINDDIR             7
+#define FIELD_RAIN_1H             8
+#define FIELD_RAIN_24H            9
+#define FIELD_RAIN_TOTAL          10
+#define FIELD_PRESSURE            11
+
+/* The gauges of a reading. Entries of one metric follow each other. */
+static const struct
+{
+	const char *name;
+	const char *help;
+	const char *label;             // label telling the entries apart
+	const char *value;
+	int         field;
+} gauges[] = {
+	{"open2300_temperature_celsius", "Temperature", "location", "indoor", FIELD_TEMPERATURE_INDOOR},
+	{"open2300_temperature_celsius", "Temperature", "location", "outdoor", FIELD_TEMPERATURE_OUTDOOR},
+	{"open2300_dewpoint_celsius", "Dewpoint outdoor", NULL, NULL, FIELD_DEWPOINT},
+	{"open2300_windchill_celsius", "Windchill outdoor", NULL, NULL, FIELD_WINDCHILL},
+	{"open2300_humidity_percent", "Relative humidity", "location", "indoor", FIELD_HUMIDITY_INDOOR},
+	{"open2300_humidity_percent", "Relative humidity", "location", "outdoor", FIELD_HUMIDITY_OUTDOOR},
+	{"open2300_wind_speed_meters_per_second", "Wind speed", NULL, NULL, FIELD_WINDSPEED},
+	{"open2300_wind_direction_degrees", "Wind direction", NULL, NULL, FIELD_WINDDIR},
+	{"open2300_rain_millimeters", "Rain", "period", "1h", FIELD_RAIN_1H},
+	{"open2300_rain_millimeters", "Rain", "period", "24h", FIELD_RAIN_24H},
+	{"open2300_rain_millimeters", "Rain", "period", "total", FIELD_RAIN_TOTAL},
+	{"open2300_pressure_hectopascals", "Relative air pressure", NULL, NULL, FIELD_PRESSURE}
+};
+
+#define GAUGES ((int) (sizeof(gauges) / sizeof(gauges[0])))
+
+
+/********************************************************************
+ * add appends to a text. What does not fit is left out.
+ *
+ * Input:   length - of the text so far
+ *
+ * Returns: new length
+ *
+ ********************************************************************/
+static int add(char *text, int size, int length, const char *format, ...)
+{
+	va_list args;
+	int added;
+
+	if (length >= size - 1)
+		return length;
+
+	va_start(args, format);
+	added = vsnprintf(text + length, size - length, format, args);
+	va_end(args);
+
+	if (added < 0)
+		return length;
+
+	return length + added < size ? length + added : size - 1;
+}
+
+
+/********************************************************************
+ * add_family appends the HELP and TYPE lines of a metric. Counters
+ * are named without _total in OpenMetrics and with it in 0.0.4.
+ *
+ * Returns: new length
+ *
+ ********************************************************************/
+static int add_family(char *text, int size, int length, const char *name,
+                      const char *type, const char *help, int openmetrics)
+{
+	const char *total = "";
+
+	if (!openmetrics && strcmp(type, "counter") == 0)
+		total = "_total";
+
+	return add(text, size, length, "# HELP %s%s %s\n# TYPE %s%s %s\n",
+	           name, total, help, name, total, type);
+}
+
+
+/********************************************************************
+ * labels gives the labels of a sample: the station (when it has an
+ * id) and another label (when name is not NULL)
+ *
+ * Output:  buffer - {...} or empty
+ *
+ ********************************************************************/
+static void labels(char *buffer, int size, const char *id,
+                   const char *name, const char *value)
+{
+	if (id[0] != '\0' && name != NULL)
+		snprintf(buffer, size, "{station=\"%s\",%s=\"%s\"}", id, name, value);
+	else if (id[0] != '\0')
+		snprintf(buffer, size, "{station=\"%s\"}", id);
+	else if (name != NULL)
+		snprintf(buffer, size, "{%s=\"%s\"}", name, value);
+	else
+		buffer[0] = '\0';
+}
+
+
+/********************************************************************
+ * field_value gives a value of a reading
+ *
+ * Returns: the value, or 0 and *missing = 1 if the reading has none
+ *
+ ********************************************************************/
+static double field_value(struct log_record *record, int field, int *missing)
+{
+	*missing = 0;
+
+	switch (field)
+	{
+	case FIELD_TEMPERATURE_INDOOR:  return record->temperature_indoor;
+	case FIELD_TEMPERATURE_OUTDOOR: return record->temperature_outdoor;
+	case FIELD_DEWPOINT:            return record->dewpoint;
+	case FIELD_WINDCHILL:           return record->windchill;
+	case FIELD_HUMIDITY_INDOOR:     return record->humidity_indoor;
+	case FIELD_HUMIDITY_OUTDOOR:    return record->humidity_outdoor;
+	case FIELD_WINDSPEED:           return record->windspeed;
+	case FIELD_WINDDIR:             return record->winddir_degrees;
+	case FIELD_RAIN_TOTAL:          return record->rain_total;
+	case FIELD_PRESSURE:            return record->rel_pressure;
+	case FIELD_RAIN_1H:
+	case FIELD_RAIN_24H:
+		if (record->format == LOG_FORMAT_CURRENT)
+			return field == FIELD_RAIN_1H ? record->rain_1h : record->rain_24h;
+		break;
+	}
+
+	*missing = 1;
+	return 0;
+}
+
+
+/********************************************************************
+ * add_states appends the tendency or forecast of the stations as a
+ * gauge that is 1 for the current state and 0 for the others
+ *
+ * Returns: new length
+ *
+ ********************************************************************/
+static int add_states(char *text, int size, int length,
+                      struct metrics_station *stations, int count,
+                      const char *name, const char *help, const char **names,
+                      int tendency, int openmetrics)
+{
+	char label[100];
+	char stamp[30] = "";
+	int state, i, j;
+
+	length = add_family(text, size, length, name, "gauge", help, openmetrics);
+
+	for (i = 0; i < count; i++)
+	{
+		if (stations[i].record == NULL)
+			continue;
+
+		state = tendency ? stations[i].record->tendency : stations[i].record->forecast;
+		if (state < 0)
+			continue;
+
+		if (openmetrics)
+			snprintf(stamp, sizeof(stamp), " %ld", (long) stations[i].record->timestamp);
+
+		for (j = 0; j < 3; j++)
+		{
+			labels(label, sizeof(label), stations[i].id,
+			       tendency ? "tendency" : "forecast", names[j]);
+			length = add(text, size, length, "%s%s %d%s\n", name, label,
+			             j == state, stamp);
+		}
+	}
+
+	return length;
+}
+
+
+/********************************************************************
+ * add_counter appends a protocol counter of each station
+ *
+ * Input:   offset - of the counter in struct protocol_stats
+ *
+ * Returns: new length
+ *
+ ********************************************************************/
+static int add_counter(char *text, int size, int length,
+                       struct metrics_station *stations, int count, const char *name,
+                       const char *help, size_t offset, int openmetrics)
+{
+	char label[100];
+	int i;
+
+	length = add_family(text, size, length, name, "counter", help, openmetrics);
+
+	for (i = 0; i < count; i++)
+	{
+		if (stations[i].stats == NULL)
+			continue;
+		labels(label, sizeof(label), stations[i].id, NULL, NULL);
+		length = add(text, size, length, "%s_total%s %lu\n", name, label,
+		             *(unsigned long *) ((char *) stations[i].stats + offset));
+	}
+
+	return length;
+}
+
+
+/********************************************************************
+ * add_histogram appends the samples of one latency histogram
+ *
+ * Input:   id - station label, "" for none
+ *
+ * Returns: new length
+ *
+ ********************************************************************/
+static int add_histogram(char *text, int size, int length, const char *name,
+                         const char *id, const char *operation,
+                         struct stats_histogram *histogram)
+{
+	char station[60] = "";
+	unsigned long cumulative = 0;
+	int i;
+
+	if (id[0] != '\0')
+		snprintf(station, sizeof(station), "station=\"%s\",", id);
+
+	for (i = 0; i < STATS_BUCKETS; i++)
+	{
+		cumulative += histogram->bucket[i];
+		if (i < METRICS_BUCKET_FIRST || i > METRICS_BUCKET_LAST)
+			continue;
+		length = add(text, size, length, "%s_bucket{%soperation=\"%s\",le=\"%g\"} %lu\n",
+		             name, station, operation, (2LL << i) / 1e6, cumulative);
+	}
+
+	return add(text, size, length,
+	           "%s_bucket{%soperation=\"%s\",le=\"+Inf\"} %lu\n"
+	           "%s_count{%soperation=\"%s\"} %lu\n"
+	           "%s_sum{%soperation=\"%s\"} %.6f\n",
+	           name, station, operation, histogram->count,
+	           name, station, operation, histogram->count,
+	           name, station, operation, histogram->total / 1e6);
+}
+
+
+/********************************************************************
+ * metrics_metric_units converts a reading from the units of a
+ * configuration to the metric units of the metrics
+ *
+ ********************************************************************/
+void metrics_metric_units(struct log_record *record, struct config_type *config)
+{
+	if (config->temperature_conv)
+	{
+		record->temperature_indoor = (record->temperature_indoor - 32) * 5 / 9;
+		record->temperature_outdoor = (record->temperature_outdoor - 32) * 5 / 9;
+		record->dewpoint = (record->dewpoint - 32) * 5 / 9;
+		record->windchill = (record->windchill - 32) * 5 / 9;
+	}
+
+	record->windspeed /= config->wind_speed_conv_factor;
+	record->rain_1h *= config->rain_conv_factor;
+	record->rain_24h *= config->rain_conv_factor;
+	record->rain_total *= config->rain_conv_factor;
+	record->rel_pressure *= config->pressure_conv_factor;
+}
+
+
+/********************************************************************
+ * metrics_format writes the metrics of the readings and of the
+ * protocol statistics of stations. It is done once per reading and the
+ * text is served with metrics_format_age after it.
+ *
+ * Input:   stations, count - the stations, readings in metric units
+ *                            and statistics
+ *          openmetrics - METRICS_OPENMETRICS with sample timestamps,
+ *                        METRICS_TEXTFILE without
+ *
+ * Output:  text - zero terminated
+ *
+ * Returns: length of the text
+ *
+ ********************************************************************/
+int metrics_format(char *text, int size, struct metrics_station *stations,
+                   int count, int openmetrics)
+{
+	struct protocol_stats *stats;
+	char label[100];
+	char address[10];
+	char stamp[30] = "";
+	double value;
+	int missing, length = 0, i, j;
+
+	text[0] = '\0';
+
+	for (i = 0; i < GAUGES; i++)
+	{
+		if (i == 0 || strcmp(gauges[i].name, gauges[i - 1].name) != 0)
+			length = add_family(text, size, length, gauges[i].name, "gauge",
+			                    gauges[i].help, openmetrics);
+
+		for (j = 0; j < count; j++)
+		{
+			if (stations[j].record == NULL)
+				continue;
+
+			value = field_value(stations[j].record, gauges[i].field, &missing);
+			if (missing)
+				continue;
+
+			if (openmetrics)
+				snprintf(stamp, sizeof(stamp), " %ld", (long) stations[j].record->timestamp);
+
+			labels(label, sizeof(label), stations[j].id, gauges[i].label, gauges[i].value);
+			length = add(text, size, length, "%s%s %.10g%s\n",
+			             gauges[i].name, label, value, stamp);
+		}
+	}
+
+	length = add_states(text, size, length, stations, count, "open2300_pressure_tendency",
+	                    "Pressure tendency of the station", tendency_names, 1, openmetrics);
+	length = add_states(text, size, length, stations, count, "open2300_forecast",
+	                    "Forecast of the station", forecast_names, 0, openmetrics);
+
+	length = add_family(text, size, length, "open2300_reading_timestamp_seconds", "gauge",
+	                    "Time of the last reading", openmetrics);
+	for (j = 0; j < count; j++)
+	{
+		if (stations[j].record == NULL)
+			continue;
+		labels(label, sizeof(label), stations[j].id, NULL, NULL);
+		length = add(text, size, length, "open2300_reading_timestamp_seconds%s %ld\n",
+		             label, (long) stations[j].record->timestamp);
+	}
+
+	length = add_counter(text, size, length, stations, count, "open2300_serial_transactions",
+	                     "Reads and writes of station memory",
+	                     offsetof(struct protocol_stats, transactions), openmetrics);
+	length = add_counter(text, size, length, stations, count, "open2300_serial_failed_transactions",
+	                     "Reads and writes that failed",
+	                     offsetof(struct protocol_stats, failed), openmetrics);
+	length = add_counter(text, size, length, stations, count, "open2300_serial_sent_bytes",
+	                     "Bytes sent to the station",
+	                     offsetof(struct protocol_stats, bytes_sent), openmetrics);
+	length = add_counter(text, size, length, stations, count, "open2300_serial_received_bytes",
+	                     "Bytes received from the station",
+	                     offsetof(struct protocol_stats, bytes_received), openmetrics);
+	length = add_counter(text, size, length, stations, count, "open2300_serial_echo_mismatches",
+	                     "Commands not answered as expected",
+	                     offsetof(struct protocol_stats, echo_mismatches), openmetrics);
+	length = add_counter(text, size, length, stations, count, "open2300_serial_checksum_failures",
+	                     "Reads with a wrong checksum",
+	                     offsetof(struct protocol_stats, checksum_failures), openmetrics);
+	length = add_counter(text, size, length, stations, count, "open2300_serial_timeouts",
+	                     "Reads that got no answer in time",
+	                     offsetof(struct protocol_stats, timeouts), openmetrics);
+	length = add_counter(text, size, length, stations, count, "open2300_serial_resets",
+	                     "Resets of the protocol",
+	                     offsetof(struct protocol_stats, resets), openmetrics);
+	length = add_counter(text, size, length, stations, count, "open2300_serial_reset_commands",
+	                     "Reset commands sent",
+	                     offsetof(struct protocol_stats, reset_commands), openmetrics);
+
+	length = add_family(text, size, length, "open2300_serial_retries", "counter",
+	                    "Reads and writes tried again", openmetrics);
+	for (j = 0; j < count; j++)
+	{
+		if ((stats = stations[j].stats) == NULL)
+			continue;
+		for (i = 0; i < STATS_RANGES; i++)
+		{
+			if (stats->retries[i] == 0)
+				continue;
+			snprintf(address, sizeof(address), "%04X", i << 8);
+			labels(label, sizeof(label), stations[j].id, "address", address);
+			length = add(text, size, length, "open2300_serial_retries_total%s %lu\n",
+			             label, stats->retries[i]);
+		}
+	}
+
+	length = add_family(text, size, length, "open2300_serial_latency_seconds", "histogram",
+	                    "Time of protocol operations", openmetrics);
+	for (j = 0; j < count; j++)
+	{
+		if ((stats = stations[j].stats) == NULL)
+			continue;
+		length = add_histogram(text, size, length, "open2300_serial_latency_seconds",
+		                       stations[j].id, "read_data", &stats->read_data);
+		length = add_histogram(text, size, length, "open2300_serial_latency_seconds",
+		                       stations[j].id, "write_data", &stats->write_data);
+		length = add_histogram(text, size, length, "open2300_serial_latency_seconds",
+		                       stations[j].id, "read_safe", &stats->read_safe);
+		length = add_histogram(text, size, length, "open2300_serial_latency_seconds",
+		                       stations[j].id, "write_safe", &stats->write_safe);
+		length = add_histogram(text, size, length, "open2300_serial_latency_seconds",
+		                       stations[j].id, "reset_06", &stats->reset);
+		length = add_histogram(text, size, length, "open2300_serial_latency_seconds",
+		                       stations[j].id, "tcdrain", &stats->drain);
+	}
+
+	return length;
+}
+
+
+/********************************************************************
+ * metrics_format_age writes what goes after the text of
+ * metrics_format when it is served: the age of the readings and the
+ * end of an OpenMetrics exposition
+ *
+ * Input:   now - time of the scrape
+ *
+ * Output:  text - zero terminated
+ *
+ * Returns: length of the text
+ *
+ ********************************************************************/
+int metrics_format_age(char *text, int size, struct metrics_station *stations,
+                       int count, time_t now, int openmetrics)
+{
+	char label[100];
+	int length, i;
+
+	text[0] = '\0';
+	length = add_family(text, size, 0, "open2300_reading_age_seconds", "gauge",
+	                    "Seconds since the last reading", openmetrics);
+
+	for (i = 0; i < count; i++)
+	{
+		if (stations[i].record == NULL)
+			continue;
+		labels(label, sizeof(label), stations[i].id, NULL, NULL);
+		length = add(text, size, length, "open2300_reading_age_seconds%s %ld\n",
+		             label, (long) (now - stations[i].record->timestamp));
+	}
+
+	if (openmetrics)
+		length = add(text, size, length, "# EOF\n");
+
+	return length;
+}
+
+
+/********************************************************************
+ * metrics_write_file writes a reading and the protocol statistics to
+ * a file for the textfile collector of node_exporter. The file is
+ * replaced in one step so the collector never reads half of it.
+ *
+ * Input:   path - file, usually name.prom in the collector directory
+ *          record - reading in the units of config
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int metrics_write_file(const char *path, struct log_record *record,
+                       struct config_type *config)
+{
+	char text[METRICS_TEXT_SIZE];
+	struct log_record metric = *record;
+	struct metrics_station station = {"", &metric, stats_get()};
+	int length;
+
+	metrics_metric_units(&metric, config);
+	length = metrics_format(text, sizeof(text), &station, 1, METRICS_TEXTFILE);
+
+	return publish_file((char *) path, text, length, 0) < 0 ? -1 : 0;
+}
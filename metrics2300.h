@@ -0,0 +1,48 @@
+/* open2300 - metrics2300.h
+ * Include file for the Prometheus exposition of the readings and the
+ * protocol statistics of stats2300.h.
+ *
+ * The current values (metric units), the time of the reading and the
+ * protocol counters and latency histograms of each station (labelled
+ * station="id" when there are several) are written as OpenMetrics
+ * 1.0 text for a scrape of srv2300, or as Prometheus text 0.0.4 without
+ * sample timestamps for a node_exporter textfile collector file
+ * (METRICS_FILE). The text is built once per reading; only the age
+ * of the readings is added when it is served.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_METRICS2300_H_
+#define _INCLUDE_METRICS2300_H_
+
+#include "record2300.h"
+#include "stats2300.h"
+
+#define METRICS_TEXT_SIZE    131072    // MAX_STATIONS with statistics
+#define METRICS_OPENMETRICS  1         // OpenMetrics 1.0, sample timestamps
+#define METRICS_TEXTFILE     0         // Prometheus 0.0.4, no timestamps
+#define METRICS_BUCKET_FIRST 3         // histogram buckets 16 us ..
+#define METRICS_BUCKET_LAST  23        // .. 16.8 s, see STATS_BUCKETS
+#define METRICS_CONTENT_OPENMETRICS \
+	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+#define METRICS_CONTENT_TEXT "text/plain; version=0.0.4; charset=utf-8"
+
+struct metrics_station
+{
+	const char            *id;     // station label, "" for none
+	struct log_record     *record; // metric units, NULL if not read yet
+	struct protocol_stats *stats;  // of its serial link, NULL for none
+};
+
+void metrics_metric_units(struct log_record *record, struct config_type *config);
+
+int  metrics_format(char *text, int size, struct metrics_station *stations,
+                    int count, int openmetrics);
+
+int  metrics_format_age(char *text, int size, struct metrics_station *stations,
+                        int count, time_t now, int openmetrics);
+
+int  metrics_write_file(const char *path, struct log_record *record,
+                        struct config_type *config);
+
+#endif /* _INCLUDE_METRICS2300_H_ */
@@ -34,10 +34,88 @@
  *  1.6  2007 Jul 19  Emiliano Parasassi
  *       http://www.lavrsen.dk/twiki/bin/view/Open2300/MysqlPatch2
  *       Plus updates in ALTER TABLE to match patch from Rolan Yang
+ *
+ *  1.7  Store-and-forward. With SPOOL_DIRECTORY set a reading that
+ *       cannot be inserted is kept in a spool and inserted by a later
+ *       run, many rows per INSERT. The time of the reading is now
+ *       sent instead of NOW().
  */
 
 #include <mysql.h>
-#include "rw2300.h"
+#include "spool2300.h"
+#include "stats2300.h"
+
+#define ROW_SIZE  300                 // room for one row of VALUES
+
+
+/********************************************************************
+ * insert_rows inserts rows with one INSERT. Used as spool sender.
+ * Rows already stored (same datetime) are ignored so a row sent
+ * twice after a crash does no harm. If MySQL rejects the batch the
+ * rows are sent one by one and a row that is rejected again is
+ * dropped, so one bad row does not hold up the spool. If the
+ * connection is lost the rest are left in the spool.
+ *
+ * Input:   context - the MySQL connection
+ *          rows - "(...)" VALUES of each row
+ *          sizes - length of each row
+ *          count - number of rows
+ *
+ * Returns: number of rows inserted or dropped, 0 if none
+ *
+ ********************************************************************/
+int insert_rows(void *context, char **rows, int *sizes, int count)
+{
+	MYSQL *mysql = context;
+	char *query;
+	size_t length;
+	int i, size;
+
+	if ((query = malloc(100 + (size_t) count * (ROW_SIZE + 1))) == NULL)
+		return 0;
+
+	length = sprintf(query, "INSERT IGNORE INTO weather VALUES ");
+	for (i = 0; i < count; i++)
+	{
+		if (i > 0)
+			query[length++] = ',';
+		memcpy(query + length, rows[i], sizes[i] < ROW_SIZE ? sizes[i] : ROW_SIZE);
+		length += sizes[i] < ROW_SIZE ? sizes[i] : ROW_SIZE;
+	}
+	query[length] = '\0';
+
+	if (mysql_real_query(mysql, query, length) == 0)
+	{
+		free(query);
+		return count;
+	}
+
+	fprintf(stderr, "Could not insert %d rows. %d: %s\n",
+	        count, mysql_errno(mysql), mysql_error(mysql));
+
+	for (i = 0; i < count; i++)
+	{
+		size = sizes[i] < ROW_SIZE ? sizes[i] : ROW_SIZE;
+		length = sprintf(query, "INSERT IGNORE INTO weather VALUES %.*s",
+		                 size, rows[i]);
+
+		if (mysql_real_query(mysql, query, length) == 0)
+			continue;
+
+		fprintf(stderr, "Could not insert %.*s. %d: %s\n",
+		        size, rows[i], mysql_errno(mysql), mysql_error(mysql));
+
+		// Keep this row and the rest if the server is gone
+		if (mysql_ping(mysql) != 0)
+			break;
+
+		fprintf(stderr, "Row dropped\n");
+	}
+
+	free(query);
+
+	return i;
+}
 
  
 /********** MAIN PROGRAM ************************************************
@@ -74,74 +152,92 @@ int main(int argc, char *argv[])
 {
 	WEATHERSTATION ws2300;
 	MYSQL mysql;
-	char logline[3000] = "";
-	char tempstring[1000] = "";
 	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
 	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
 	double winddir[6];
-	int tempint;
+	double value[10];
+	int tempint, humidity_in, humidity_out, i;
 	char tendency[15];
 	char forecast[15];
 	struct config_type config;
-	char query[4096];
+	char row[ROW_SIZE];
+	char datestring[50];
+	char *rows[1];
+	int sizes[1];
+	time_t basictime;
+	struct spool spool;
+	int spooled = 0, valid = 1, failed = 0;
+
+	stats_option(&argc, argv);
 
 	get_configuration(&config, argv[1]);
 	ws2300 = open_weatherstation(config.serial_device_name);
 
-	/* READ TEMPERATURE INDOOR */
-	sprintf(logline,"\'%.1f\',", temperature_indoor(ws2300, config.temperature_conv) );
-	
-	/* READ TEMPERATURE OUTDOOR */
-	sprintf(tempstring,"\'%.1f\',", temperature_outdoor(ws2300, config.temperature_conv) );
-	strcat(logline, tempstring);
-	
-	/* READ DEWPOINT */
-	sprintf(tempstring,"\'%.1f\',", dewpoint(ws2300, config.temperature_conv) );
-	strcat(logline, tempstring);
-	
-	/* READ RELATIVE HUMIDITY INDOOR */
-	sprintf(tempstring,"\'%d\',", humidity_indoor(ws2300) );
-	strcat(logline, tempstring);
-	
-	/* READ RELATIVE HUMIDITY OUTDOOR */
-	sprintf(tempstring,"\'%d\',", humidity_outdoor(ws2300) );
-	strcat(logline, tempstring);
-
-	/* READ WIND SPEED AND DIRECTION aND WINDCHILL */
-	sprintf(tempstring,"\'%.1f\',",
-	        wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir) );
-	strcat(logline, tempstring);
-	sprintf(tempstring,"\'%.1f\',\'%s\',", winddir[0], directions[tempint]);
-	strcat(logline, tempstring);
-	
+	time(&basictime);
+	strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S",
+	         localtime(&basictime));
+
+	/* READ TEMPERATURE INDOOR, OUTDOOR AND DEWPOINT */
+	value[0] = temperature_indoor(ws2300, config.temperature_conv);
+	value[1] = temperature_outdoor(ws2300, config.temperature_conv);
+	value[2] = dewpoint(ws2300, config.temperature_conv);
+
+	/* READ RELATIVE HUMIDITY INDOOR AND OUTDOOR */
+	humidity_in = humidity_indoor(ws2300);
+	humidity_out = humidity_outdoor(ws2300);
+
+	/* READ WIND SPEED AND DIRECTION */
+	value[3] = wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir);
+	value[4] = winddir[0];
+
 	/* READ WINDCHILL */
-	sprintf(tempstring,"\'%.1f\',", windchill(ws2300, config.temperature_conv) );
-	strcat(logline, tempstring);
-
-	/* READ RAIN 1H */
-	sprintf(tempstring,"\'%.1f\',", rain_1h(ws2300, config.rain_conv_factor) );
-	strcat(logline, tempstring);
-	
-	/* READ RAIN 24H */
-	sprintf(tempstring,"\'%.1f\',", rain_24h(ws2300, config.rain_conv_factor) );
-	strcat(logline, tempstring);
-	
-	/* READ RAIN TOTAL */
-	sprintf(tempstring,"\'%.1f\',", rain_total(ws2300, config.rain_conv_factor) );
-	strcat(logline, tempstring);
+	value[5] = windchill(ws2300, config.temperature_conv);
+
+	/* READ RAIN 1H, 24H AND TOTAL */
+	value[6] = rain_1h(ws2300, config.rain_conv_factor);
+	value[7] = rain_24h(ws2300, config.rain_conv_factor);
+	value[8] = rain_total(ws2300, config.rain_conv_factor);
 
 	/* READ RELATIVE PRESSURE */
-	sprintf(tempstring,"\'%.1f\',", rel_pressure(ws2300, config.pressure_conv_factor) );
-	strcat(logline, tempstring);
+	value[9] = rel_pressure(ws2300, config.pressure_conv_factor);
 
 	/* READ TENDENCY AND FORECAST */
 	tendency_forecast(ws2300, tendency, forecast);
-	sprintf(tempstring,"\'%s\',\'%s\'", tendency, forecast);
-	strcat(logline, tempstring);
 
 	/* CLOSE THE WEATHER STATION TO ENABLE OTHER PROGRAMS TO ACCESS */
 	close_weatherstation(ws2300);
 
+	// A value that is not a number would be rejected by MySQL
+	for (i = 0; i < 10; i++)
+	{
+		if (!isfinite(value[i]))
+			valid = 0;
+	}
+
+	if (!valid)
+		fprintf(stderr, "Invalid value. Reading for %s skipped.\n", datestring);
+
+	sizes[0] = snprintf(row, sizeof(row),
+	                    "('%s','%.1f','%.1f','%.1f','%d','%d','%.1f','%.1f','%s',"
+	                    "'%.1f','%.1f','%.1f','%.1f','%.1f','%s','%s')",
+	                    datestring, value[0], value[1], value[2],
+	                    humidity_in, humidity_out, value[3], value[4],
+	                    directions[tempint], value[5], value[6], value[7],
+	                    value[8], value[9], tendency, forecast);
+	if (sizes[0] >= (int) sizeof(row))
+		sizes[0] = sizeof(row) - 1;
+	rows[0] = row;
+
+	/* KEEP THE READING IN THE SPOOL UNTIL IT IS INSERTED */
+	if (config.spool_directory[0] != '\0' &&
+	    spool_open(&spool, config.spool_directory, "mysql2300") == 0)
+	{
+		spooled = (!valid || spool_append(&spool, row, sizes[0]) == 0) &&
+		          spool_sync(&spool) == 0;
+		if (!spooled)
+			spool_close(&spool);
+	}
+
 	/* INIT MYSQL AND CONNECT */
 	if (!mysql_init(&mysql))
 	{
@@ -155,20 +251,32 @@ int main(int argc, char *argv[])
 	{
 		fprintf(stderr, "%d: %s \n",
 		mysql_errno(&mysql), mysql_error(&mysql));
+		if (spooled)
+			fprintf(stderr, "Reading kept in spool %s\n", spool.dir);
 		exit(EXIT_FAILURE);
 	}
 
-	sprintf(query, "INSERT INTO weather VALUES ( NOW(), %s )", logline);
-
-	if (mysql_query(&mysql, query))
+	/* INSERT THE READING - AND ALL READINGS SPOOLED BEFORE */
+	if (spooled)
+	{
+		spool_drain(&spool, SPOOL_BATCH, insert_rows, &mysql);
+		if (!spool_empty(&spool))
+		{
+			fprintf(stderr, "Reading kept in spool %s\n", spool.dir);
+			failed = 1;
+		}
+		spool_close(&spool);
+	}
+	else if (valid && insert_rows(&mysql, rows, sizes, 1) != 1)
 	{
-		fprintf(stderr, "Could not insert row. %s %d: \%s \n",
-		        query, mysql_errno(&mysql), mysql_error(&mysql));
 		mysql_close(&mysql);
 		exit(EXIT_FAILURE);
 	}
 
 	mysql_close(&mysql);
 
+	if (!valid || failed)
+		exit(EXIT_FAILURE);
+
 	return(0);
 }
@@ -19,5 +19,117 @@ CREATE TABLE `weather` (
   `rel_pressure` decimal(5,1) NOT NULL default '0.0',
   `tendency` varchar(7) NOT NULL default '',
   `forecast` varchar(6) NOT NULL default '',
-  UNIQUE KEY `timestamp` (`timestamp`)
+  UNIQUE KEY `datetime` (`datetime`)
 ) TYPE=MyISAM;
+
+#
+# Rollup of the weather table per hour (period 'h'), day ('d') and
+# month ('m'). start is the first second of the period. For each
+# column there is the minimum, maximum, sum (mean = sum / count) and
+# the value of the last reading in the period. The rain in a period is
+# its rain_total_last minus the rain_total_last of the period before.
+#
+# The trigger keeps the rollup up to date as readings are inserted.
+# mysqlrollup2300 rebuilds it from the weather table.
+#
+
+CREATE TABLE `weather_rollup` (
+  `period` char(1) NOT NULL default '',
+  `start` datetime NOT NULL default '0000-00-00 00:00:00',
+  `count` int(11) NOT NULL default '0',
+  `last_time` datetime NOT NULL default '0000-00-00 00:00:00',
+  `temp_in_min` decimal(4,1) NOT NULL default '0',
+  `temp_in_max` decimal(4,1) NOT NULL default '0',
+  `temp_in_sum` double NOT NULL default '0',
+  `temp_in_last` decimal(4,1) NOT NULL default '0',
+  `temp_out_min` decimal(4,1) NOT NULL default '0',
+  `temp_out_max` decimal(4,1) NOT NULL default '0',
+  `temp_out_sum` double NOT NULL default '0',
+  `temp_out_last` decimal(4,1) NOT NULL default '0',
+  `dewpoint_min` decimal(4,1) NOT NULL default '0',
+  `dewpoint_max` decimal(4,1) NOT NULL default '0',
+  `dewpoint_sum` double NOT NULL default '0',
+  `dewpoint_last` decimal(4,1) NOT NULL default '0',
+  `rel_hum_in_min` tinyint(3) NOT NULL default '0',
+  `rel_hum_in_max` tinyint(3) NOT NULL default '0',
+  `rel_hum_in_sum` double NOT NULL default '0',
+  `rel_hum_in_last` tinyint(3) NOT NULL default '0',
+  `rel_hum_out_min` tinyint(3) NOT NULL default '0',
+  `rel_hum_out_max` tinyint(3) NOT NULL default '0',
+  `rel_hum_out_sum` double NOT NULL default '0',
+  `rel_hum_out_last` tinyint(3) NOT NULL default '0',
+  `wind_speed_min` decimal(3,1) NOT NULL default '0',
+  `wind_speed_max` decimal(3,1) NOT NULL default '0',
+  `wind_speed_sum` double NOT NULL default '0',
+  `wind_speed_last` decimal(3,1) NOT NULL default '0',
+  `wind_chill_min` decimal(4,1) NOT NULL default '0',
+  `wind_chill_max` decimal(4,1) NOT NULL default '0',
+  `wind_chill_sum` double NOT NULL default '0',
+  `wind_chill_last` decimal(4,1) NOT NULL default '0',
+  `rel_pressure_min` decimal(5,1) NOT NULL default '0',
+  `rel_pressure_max` decimal(5,1) NOT NULL default '0',
+  `rel_pressure_sum` double NOT NULL default '0',
+  `rel_pressure_last` decimal(5,1) NOT NULL default '0',
+  `rain_total_min` decimal(5,1) NOT NULL default '0',
+  `rain_total_max` decimal(5,1) NOT NULL default '0',
+  `rain_total_sum` double NOT NULL default '0',
+  `rain_total_last` decimal(5,1) NOT NULL default '0',
+  PRIMARY KEY (`period`,`start`)
+) ENGINE=MyISAM;
+
+CREATE TRIGGER `weather_rollup_insert` AFTER INSERT ON `weather`
+FOR EACH ROW
+  INSERT INTO `weather_rollup`
+  SELECT p.period, p.start, 1, NEW.datetime,
+         NEW.temp_in, NEW.temp_in, NEW.temp_in, NEW.temp_in,
+         NEW.temp_out, NEW.temp_out, NEW.temp_out, NEW.temp_out,
+         NEW.dewpoint, NEW.dewpoint, NEW.dewpoint, NEW.dewpoint,
+         NEW.rel_hum_in, NEW.rel_hum_in, NEW.rel_hum_in, NEW.rel_hum_in,
+         NEW.rel_hum_out, NEW.rel_hum_out, NEW.rel_hum_out, NEW.rel_hum_out,
+         NEW.wind_speed, NEW.wind_speed, NEW.wind_speed, NEW.wind_speed,
+         NEW.wind_chill, NEW.wind_chill, NEW.wind_chill, NEW.wind_chill,
+         NEW.rel_pressure, NEW.rel_pressure, NEW.rel_pressure, NEW.rel_pressure,
+         NEW.rain_total, NEW.rain_total, NEW.rain_total, NEW.rain_total
+  FROM (SELECT 'h' AS period, DATE_FORMAT(NEW.datetime, '%Y-%m-%d %H:00:00') AS start
+        UNION ALL SELECT 'd', DATE_FORMAT(NEW.datetime, '%Y-%m-%d 00:00:00')
+        UNION ALL SELECT 'm', DATE_FORMAT(NEW.datetime, '%Y-%m-01 00:00:00')) AS p
+  ON DUPLICATE KEY UPDATE
+    `temp_in_min` = LEAST(`temp_in_min`, VALUES(`temp_in_min`)),
+    `temp_in_max` = GREATEST(`temp_in_max`, VALUES(`temp_in_max`)),
+    `temp_in_sum` = `temp_in_sum` + VALUES(`temp_in_sum`),
+    `temp_in_last` = IF(VALUES(`last_time`) >= `last_time`, VALUES(`temp_in_last`), `temp_in_last`),
+    `temp_out_min` = LEAST(`temp_out_min`, VALUES(`temp_out_min`)),
+    `temp_out_max` = GREATEST(`temp_out_max`, VALUES(`temp_out_max`)),
+    `temp_out_sum` = `temp_out_sum` + VALUES(`temp_out_sum`),
+    `temp_out_last` = IF(VALUES(`last_time`) >= `last_time`, VALUES(`temp_out_last`), `temp_out_last`),
+    `dewpoint_min` = LEAST(`dewpoint_min`, VALUES(`dewpoint_min`)),
+    `dewpoint_max` = GREATEST(`dewpoint_max`, VALUES(`dewpoint_max`)),
+    `dewpoint_sum` = `dewpoint_sum` + VALUES(`dewpoint_sum`),
+    `dewpoint_last` = IF(VALUES(`last_time`) >= `last_time`, VALUES(`dewpoint_last`), `dewpoint_last`),
+    `rel_hum_in_min` = LEAST(`rel_hum_in_min`, VALUES(`rel_hum_in_min`)),
+    `rel_hum_in_max` = GREATEST(`rel_hum_in_max`, VALUES(`rel_hum_in_max`)),
+    `rel_hum_in_sum` = `rel_hum_in_sum` + VALUES(`rel_hum_in_sum`),
+    `rel_hum_in_last` = IF(VALUES(`last_time`) >= `last_time`, VALUES(`rel_hum_in_last`), `rel_hum_in_last`),
+    `rel_hum_out_min` = LEAST(`rel_hum_out_min`, VALUES(`rel_hum_out_min`)),
+    `rel_hum_out_max` = GREATEST(`rel_hum_out_max`, VALUES(`rel_hum_out_max`)),
+    `rel_hum_out_sum` = `rel_hum_out_sum` + VALUES(`rel_hum_out_sum`),
+    `rel_hum_out_last` = IF(VALUES(`last_time`) >= `last_time`, VALUES(`rel_hum_out_last`), `rel_hum_out_last`),
+    `wind_speed_min` = LEAST(`wind_speed_min`, VALUES(`wind_speed_min`)),
+    `wind_speed_max` = GREATEST(`wind_speed_max`, VALUES(`wind_speed_max`)),
+    `wind_speed_sum` = `wind_speed_sum` + VALUES(`wind_speed_sum`),
+    `wind_speed_last` = IF(VALUES(`last_time`) >= `last_time`, VALUES(`wind_speed_last`), `wind_speed_last`),
+    `wind_chill_min` = LEAST(`wind_chill_min`, VALUES(`wind_chill_min`)),
+    `wind_chill_max` = GREATEST(`wind_chill_max`, VALUES(`wind_chill_max`)),
+    `wind_chill_sum` = `wind_chill_sum` + VALUES(`wind_chill_sum`),
+    `wind_chill_last` = IF(VALUES(`last_time`) >= `last_time`, VALUES(`wind_chill_last`), `wind_chill_last`),
+    `rel_pressure_min` = LEAST(`rel_pressure_min`, VALUES(`rel_pressure_min`)),
+    `rel_pressure_max` = GREATEST(`rel_pressure_max`, VALUES(`rel_pressure_max`)),
+    `rel_pressure_sum` = `rel_pressure_sum` + VALUES(`rel_pressure_sum`),
+    `rel_pressure_last` = IF(VALUES(`last_time`) >= `last_time`, VALUES(`rel_pressure_last`), `rel_pressure_last`),
+    `rain_total_min` = LEAST(`rain_total_min`, VALUES(`rain_total_min`)),
+    `rain_total_max` = GREATEST(`rain_total_max`, VALUES(`rain_total_max`)),
+    `rain_total_sum` = `rain_total_sum` + VALUES(`rain_total_sum`),
+    `rain_total_last` = IF(VALUES(`last_time`) >= `last_time`, VALUES(`rain_total_last`), `rain_total_last`),
+    `count` = `count` + 1,
+    # last_time last as MySQL assigns from left to right
+    `last_time` = GREATEST(`last_time`, VALUES(`last_time`));
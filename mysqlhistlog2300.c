@@ -15,8 +15,19 @@
  *  1.15 2007  July 19  EmilianoParasassi
  *             http://www.lavrsen.dk/twiki/bin/view/Open2300/MysqlPatch2 
  */
+#include <math.h>
 #include <mysql.h>
 #include "rw2300.h"
+#include "stats2300.h"
+
+// Room for one row of VALUES. Numbers are printed with a bounded
+// precision so a row is well below this.
+#define MYSQL_ROW_SIZE 200
+
+static const char mysql_insert_stmt[] =
+	"INSERT IGNORE INTO weather(datetime, temp_in, temp_out, dewpoint, rel_hum_in, "
+	"rel_hum_out, wind_speed, wind_angle, wind_direction, wind_chill, rain_total, "
+	"rel_pressure) VALUES ";
 
 
 /********************************************************************
@@ -41,6 +52,60 @@ void print_usage(void)
 }
 
  
+/********************************************************************
+ * flush_rows sends the rows collected in a multi-row INSERT. Rows
+ * already in the database are skipped by INSERT IGNORE. If MySQL
+ * rejects the batch the rows are sent one by one, so only the row
+ * that is rejected is lost.
+ *
+ * Input:   mysql - the connection
+ *          statement - INSERT with the rows
+ *          length - of statement
+ *          starts - offset of each row in statement, incl the comma
+ *          rows - number of rows in statement
+ *
+ * Returns: number of rows inserted
+ *
+ ********************************************************************/
+long flush_rows(MYSQL *mysql, const char *statement, size_t length,
+                const size_t *starts, int rows)
+{
+	char single[sizeof(mysql_insert_stmt) + MYSQL_ROW_SIZE];
+	size_t start, end;
+	long inserted = 0;
+	int i;
+
+	if (rows == 0)
+		return 0;
+
+	if (mysql_query(mysql, statement) == 0)
+		return (long) mysql_affected_rows(mysql);
+
+	fprintf(stderr, "Could not insert %d rows. %d: %s\n",
+	        rows, mysql_errno(mysql), mysql_error(mysql));
+
+	for (i = 0; i < rows; i++)
+	{
+		start = starts[i] + (i > 0);
+		end = i + 1 < rows ? starts[i + 1] : length;
+		snprintf(single, sizeof(single), "%s%.*s", mysql_insert_stmt,
+		         (int) (end - start), statement + start);
+
+		if (mysql_query(mysql, single) == 0)
+		{
+			inserted += (long) mysql_affected_rows(mysql);
+			continue;
+		}
+
+		// Just print error message and move ahead
+		fprintf(stderr, "Could not insert %.*s. %d: %s\n", (int) (end - start),
+		        statement + start, mysql_errno(mysql), mysql_error(mysql));
+	}
+
+	return inserted;
+}
+
+ 
 /********** MAIN PROGRAM ************************************************
  *
  * This program reads the history records from a WS2300
@@ -56,11 +121,9 @@ int main(int argc, char *argv[])
 {
 	WEATHERSTATION ws2300;
 	MYSQL mysql, *mysql_connection;
-	int mysql_state;
-	char mysql_insert_stmt[512] = 
-		"INSERT INTO weather(datetime, temp_in, temp_out, dewpoint, rel_hum_in, "
-		"rel_hum_out, wind_speed, wind_angle, wind_direction,wind_chill, rain_total, rel_pressure)";
-	char mysql_values_stmt[512], mysql_stmt[1024];
+	char *mysql_stmt;
+	size_t mysql_length, *row_starts;
+	int batch_rows = 0, row_length;
 
 	int interval, countdown, no_records;
 	struct config_type config;
@@ -85,6 +148,7 @@ int main(int argc, char *argv[])
 
 	int i;
 
+	stats_option(&argc, argv);
 	
 	// Get serial port from config file. Use first command line parameter
 
@@ -115,6 +179,19 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	// Room for a full batch of rows
+
+	mysql_stmt = malloc(sizeof(mysql_insert_stmt) +
+	                    (size_t) config.mysql_batch_size * MYSQL_ROW_SIZE);
+	row_starts = malloc(config.mysql_batch_size * sizeof(size_t));
+	if (mysql_stmt == NULL || row_starts == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(mysql_stmt, mysql_insert_stmt);
+	mysql_length = sizeof(mysql_insert_stmt) - 1;
+
 	// By default read all records
 	// We set the date to 1 Jan 1990 0:00
 	time_lastlog_tm.tm_year = 90;
@@ -127,6 +204,9 @@ int main(int argc, char *argv[])
 
 	time_lastlog = mktime(&time_lastlog_tm);
 
+	// The whole ring is sent every run. mysql2300 writes live rows to
+	// the same table, so the newest row there does not tell which
+	// history records are stored; INSERT IGNORE skips those that are.
 
 	// Start reading the history from the WS2300
 		
@@ -160,6 +240,13 @@ int main(int argc, char *argv[])
 
 	time_lastrecord_tm.tm_min -= new_records * interval;
 
+	// With the default batch size all rows go in one INSERT. Rows
+	// already stored are ignored, so a run that stops half way is
+	// completed by the next one. The weather table of mysql2300.sql
+	// is MyISAM, which has no transactions; the commit only counts
+	// if the table was changed to InnoDB.
+	mysql_autocommit(mysql_connection, 0);
+
 	// Run through the records read
 	for (i = 1; i <= new_records; i++)
 	{
@@ -181,51 +268,65 @@ int main(int argc, char *argv[])
 		time_lastrecord_tm.tm_min += interval;
 		mktime(&time_lastrecord_tm);                 //normalize time_lastlog_tm
 		
+		strftime(datestring,sizeof(datestring),"%Y-%m-%d %H:%M:%S",
+		         &time_lastrecord_tm);
+
 		// If humidity is > 100 the record is skipped
-		if(humidity_out < 100)
+		if (humidity_out >= 100)
 		{
-			strftime(datestring,sizeof(datestring),"\"%Y-%m-%d %H:%M:%S\"",
-			         &time_lastrecord_tm);
-			// Line up all value in order of appearance in the database
-			sprintf(mysql_values_stmt," VALUES(%s", datestring);
-			sprintf(mysql_values_stmt,"%s,%.1f",mysql_values_stmt, temperature_in);
-			sprintf(mysql_values_stmt,"%s,%.1f",mysql_values_stmt, temperature_out);
-			sprintf(mysql_values_stmt,"%s,%.1f",mysql_values_stmt, dewpoint);
-			sprintf(mysql_values_stmt,"%s,%d",mysql_values_stmt, humidity_in);
-			sprintf(mysql_values_stmt,"%s,%d",mysql_values_stmt, humidity_out);
-			sprintf(mysql_values_stmt,"%s,%.1f ",mysql_values_stmt, windspeed);
-			sprintf(mysql_values_stmt,"%s,%.1f,\"%s\"",mysql_values_stmt,
-			        winddir_degrees, directions[(int)(winddir_degrees/22.5)]);
-			sprintf(mysql_values_stmt,"%s,%.1f",mysql_values_stmt, windchill);
-			sprintf(mysql_values_stmt,"%s,%.2f",mysql_values_stmt, rain);
-			sprintf(mysql_values_stmt,"%s,%.3f)",mysql_values_stmt, pressure + pressure_term);
-
-			// Build SQL string
-			sprintf(mysql_stmt,"%s %s",mysql_insert_stmt, mysql_values_stmt);
-
-			// Push to database	
-			mysql_state = mysql_query(mysql_connection, mysql_stmt);
-
-			// Error no 1062 means record is already stored
-			// We only report other errors
-			if((mysql_state != 0) && (mysql_errno(&mysql) != 1062))
-			{
-				// Something went wrong
-				// Just print error message and move ahead
-				fprintf(stderr, "Could not insert row. %d: \%s \nStatement was : %s\n",
-				        mysql_errno(&mysql), mysql_error(&mysql),mysql_stmt);
-			}
+			fprintf(stderr, "Humidity is %d. Dataset for %s skipped.\n",humidity_out, datestring);
+			continue;
 		}
-		else
+
+		// A bad record can decode to nan or inf, which MySQL rejects
+		if (!isfinite(temperature_in) || !isfinite(temperature_out) ||
+		    !isfinite(dewpoint) || !isfinite(windspeed) ||
+		    !isfinite(winddir_degrees) || !isfinite(windchill) ||
+		    !isfinite(rain) || !isfinite(pressure + pressure_term))
 		{
-			strftime(datestring,sizeof(datestring),"%Y-%m-%d %H:%M:%S",
-			         &time_lastrecord_tm);
-			fprintf(stderr, "Humidity is %d. Dataset for %s skipped.\n",humidity_out, datestring);
+			fprintf(stderr, "Invalid value. Dataset for %s skipped.\n", datestring);
+			continue;
 		}
 
-	
+		// Line up all value in order of appearance in the database
+		row_length = snprintf(mysql_stmt + mysql_length, MYSQL_ROW_SIZE,
+		        "%s('%s',%.1f,%.1f,%.1f,%d,%d,%.1f,%.1f,'%s',%.1f,%.2f,%.3f)",
+		        batch_rows ? "," : "", datestring,
+		        temperature_in, temperature_out, dewpoint,
+		        humidity_in, humidity_out, windspeed, winddir_degrees,
+		        directions[((int)(winddir_degrees/22.5)) & 0xF], windchill, rain,
+		        pressure + pressure_term);
+
+		if (row_length < 0 || row_length >= MYSQL_ROW_SIZE)
+		{
+			mysql_stmt[mysql_length] = '\0';
+			fprintf(stderr, "Values out of range. Dataset for %s skipped.\n", datestring);
+			continue;
+		}
+
+		row_starts[batch_rows] = mysql_length;
+		mysql_length += row_length;
+
+		// Push a full batch to the database
+		if (++batch_rows == config.mysql_batch_size)
+		{
+			flush_rows(mysql_connection, mysql_stmt, mysql_length, row_starts, batch_rows);
+			mysql_length = sizeof(mysql_insert_stmt) - 1;
+			batch_rows = 0;
+		}
 	}
 
+	flush_rows(mysql_connection, mysql_stmt, mysql_length, row_starts, batch_rows);
+
+	if (mysql_commit(mysql_connection) != 0)
+	{
+		fprintf(stderr, "Could not commit. %d: %s\n",
+		        mysql_errno(&mysql), mysql_error(&mysql));
+	}
+
+	free(mysql_stmt);
+	free(row_starts);
+
 	// Goodbye and Goodnight
 	close_weatherstation(ws2300);
 	mysql_close(&mysql);
@@ -0,0 +1,258 @@
+/*  open2300 - mysqlrollup2300.c
+ *
+ *  Version 1.11
+ *
+ *  Rebuild the weather_rollup table of the MySQL database from its
+ *  weather table
+ *
+ *  The weather table is read once in time order, ROLLUP_CHUNK rows at
+ *  a time. Only those rows and the open hour, day and month are held
+ *  in memory and the rollup rows are written with multi-row INSERTs
+ *  of MYSQL_BATCH_SIZE rows. Both tables are locked while the rollup
+ *  is rebuilt, so a reading a logger inserts meanwhile waits and is
+ *  then added by the trigger to the rebuilt rollup.
+ *
+ *  This program is published under the GNU General Public license
+ */
+#include <mysql.h>
+#include "rollup2300.h"
+
+// Room for one row of VALUES
+#define MYSQL_ROW_SIZE 700
+// Rows of the weather table read per SELECT
+#define ROLLUP_CHUNK   10000
+
+/* Columns of the weather table that are rolled up, in the order of
+   the weather_rollup table */
+static const char *rollup_columns[ROLLUP_FIELDS] = {
+	"temp_in", "temp_out", "dewpoint", "rel_hum_in", "rel_hum_out",
+	"wind_speed", "wind_chill", "rel_pressure", "rain_total"
+};
+
+static const char mysql_insert_stmt[] = "INSERT INTO weather_rollup VALUES ";
+
+struct rollup_batch
+{
+	MYSQL  *mysql;
+	char   *stmt;
+	size_t length;
+	int    rows;
+	int    size;                   // rows per INSERT
+};
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ * 
+ * Output:  prints to stdout
+ * 
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("mysqlrollup2300 - Rebuild the hourly, daily and monthly rollup.\n");
+	printf("Version %s (C)2007 Kenneth Lavrsen, Lars Hinrichsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("mysqlrollup2300 [config_filename]\n");
+	printf("The database must have the tables of mysql2300.sql.\n");
+	printf("The trigger keeps the rollup up to date after that.\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * connect_database opens a connection with the settings of the
+ * config file or exits the program
+ *
+ ********************************************************************/
+MYSQL *connect_database(MYSQL *mysql, struct config_type *config)
+{
+	if (!mysql_init(mysql))
+	{
+		fprintf(stderr, "Cannot initialize MySQL");
+		exit(EXIT_FAILURE);
+	}
+
+	if (mysql_real_connect(mysql, config->mysql_host, config->mysql_user,
+	                       config->mysql_passwd, config->mysql_database,
+	                       config->mysql_port, NULL, 0) == NULL)
+	{
+		fprintf(stderr, "%d: %s \n", mysql_errno(mysql), mysql_error(mysql));
+		exit(EXIT_FAILURE);
+	}
+
+	return mysql;
+}
+
+
+/********************************************************************
+ * flush_batch sends the rows collected in a multi-row INSERT
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int flush_batch(struct rollup_batch *batch)
+{
+	if (batch->rows == 0)
+		return 0;
+
+	if (mysql_query(batch->mysql, batch->stmt) != 0)
+	{
+		fprintf(stderr, "Could not insert %d rows. %d: %s\n", batch->rows,
+		        mysql_errno(batch->mysql), mysql_error(batch->mysql));
+		return -1;
+	}
+
+	batch->length = sizeof(mysql_insert_stmt) - 1;
+	batch->rows = 0;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * write_rollup is the rollup_writer. It adds a finished period to
+ * the batch and sends the batch when it is full.
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int write_rollup(void *context, const struct rollup *rollup)
+{
+	struct rollup_batch *batch = context;
+	char *row;
+	int i;
+
+	row = batch->stmt + batch->length;
+	row += sprintf(row, "%s('%c','%s',%ld,'%s'", batch->rows ? "," : "",
+	               rollup->period, rollup->start, rollup->count, rollup->last_time);
+
+	for (i = 0; i < ROLLUP_FIELDS; i++)
+		row += sprintf(row, ",%.3f,%.3f,%.3f,%.3f", rollup->min[i],
+		               rollup->max[i], rollup->sum[i], rollup->last[i]);
+
+	row += sprintf(row, ")");
+	batch->length = row - batch->stmt;
+
+	if (++batch->rows == batch->size)
+		return flush_batch(batch);
+
+	return 0;
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program empties weather_rollup and fills it again from all
+ * rows of the weather table, with both tables locked. A connection
+ * that holds table locks can only use the locked tables and cannot
+ * write while it streams a result, so the rows are read in chunks
+ * that follow on from the last datetime read.
+ *
+ * It uses the config file for the database settings.
+ * Config file locations - see open2300.conf-dist
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	MYSQL mysql;
+	MYSQL_RES *mysql_result;
+	MYSQL_ROW mysql_row;
+	struct config_type config;
+	struct rollup_batch batch;
+	struct rollup_set set;
+	char query[400], columns[300], last[30] = "";
+	double values[ROLLUP_FIELDS];
+	long readings = 0;
+	int rows, i;
+
+	if (argc > 2)
+		print_usage();
+
+	get_configuration(&config, argv[1]);
+
+	connect_database(&mysql, &config);
+
+	batch.mysql = &mysql;
+	batch.size = config.mysql_batch_size;
+	batch.rows = 0;
+	batch.length = sizeof(mysql_insert_stmt) - 1;
+	batch.stmt = malloc(sizeof(mysql_insert_stmt) +
+	                    (size_t) config.mysql_batch_size * MYSQL_ROW_SIZE);
+	if (batch.stmt == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(batch.stmt, mysql_insert_stmt);
+
+	// Loggers wait until the rollup is complete, their readings are
+	// then added by the trigger. The locks end with the connection
+	// if the program exits on an error.
+	if (mysql_query(&mysql, "LOCK TABLES weather READ, weather_rollup WRITE") != 0 ||
+	    mysql_query(&mysql, "DELETE FROM weather_rollup") != 0)
+	{
+		fprintf(stderr, "Could not empty weather_rollup. %d: %s\n",
+		        mysql_errno(&mysql), mysql_error(&mysql));
+		exit(EXIT_FAILURE);
+	}
+
+	strcpy(columns, "datetime");
+	for (i = 0; i < ROLLUP_FIELDS; i++)
+	{
+		strcat(columns, ", ");
+		strcat(columns, rollup_columns[i]);
+	}
+
+	rollup_init(&set, write_rollup, &batch);
+
+	// The unique key on datetime gives the rows in time order
+	do
+	{
+		snprintf(query, sizeof(query), "SELECT %s FROM weather%s%s%s ORDER BY datetime LIMIT %d",
+		         columns, last[0] ? " WHERE datetime > '" : "", last, last[0] ? "'" : "",
+		         ROLLUP_CHUNK);
+
+		if (mysql_query(&mysql, query) != 0 ||
+		    (mysql_result = mysql_store_result(&mysql)) == NULL)
+		{
+			fprintf(stderr, "Could not read weather. %d: %s\n",
+			        mysql_errno(&mysql), mysql_error(&mysql));
+			exit(EXIT_FAILURE);
+		}
+
+		rows = 0;
+		while ((mysql_row = mysql_fetch_row(mysql_result)) != NULL)
+		{
+			for (i = 0; i < ROLLUP_FIELDS; i++)
+				values[i] = atof(mysql_row[i + 1]);
+
+			if (rollup_add(&set, mysql_row[0], values) != 0)
+				exit(EXIT_FAILURE);
+
+			snprintf(last, sizeof(last), "%s", mysql_row[0]);
+			readings++;
+			rows++;
+		}
+
+		mysql_free_result(mysql_result);
+	} while (rows == ROLLUP_CHUNK);
+
+	if (rollup_finish(&set) != 0 || flush_batch(&batch) != 0)
+		exit(EXIT_FAILURE);
+
+	mysql_query(&mysql, "UNLOCK TABLES");
+
+	printf("%ld readings, %ld rollup rows\n", readings, set.written);
+
+	// Goodbye and Goodnight
+	free(batch.stmt);
+	mysql_close(&mysql);
+
+	return(0);
+}
@@ -0,0 +1,725 @@
+/*  open2300 - net2300.c
+ *
+ *  Version 1.11
+ *
+ *  Resolver cache and parallel (staggered) connect to the first of
+ *  several servers. See net2300.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "net2300.h"
+
+#ifdef WIN32
+#define CONNECT_PENDING() (WSAGetLastError() == WSAEWOULDBLOCK)
+#define CACHE_LOCK()
+#define CACHE_UNLOCK()
+#else
+#include <errno.h>
+#include <pthread.h>
+#define CONNECT_PENDING() (errno == EINPROGRESS)
+#define CACHE_LOCK()      pthread_mutex_lock(&cache_mutex)
+#define CACHE_UNLOCK()    pthread_mutex_unlock(&cache_mutex)
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+struct cache_entry
+{
+	char   name[100];
+	int    port;
+	time_t resolved;               // 0 = free
+	time_t used;                   // oldest is replaced when full
+	int    count;
+	struct net_address address[NET_CACHE_ADDRESSES];
+};
+
+static struct cache_entry cache[NET_CACHE];
+static int  cache_ttl = NET_DNS_TTL;
+static int  cache_changed;
+static int  cache_refreshing;      // a thread keeps the entries fresh
+static char cache_path[200];
+
+struct candidate
+{
+	struct net_address address;
+	int                host;
+};
+
+struct attempt
+{
+	SOCKET sockfd;
+	int    host;
+	long   start;                  // ms
+	long   deadline;
+};
+
+
+/********************************************************************
+ * lookup asks the resolver for the addresses of a host. It may take
+ * long, so it is called without the cache locked.
+ *
+ * Output:  addresses - up to NET_CACHE_ADDRESSES in the order of the
+ *          resolver (preferred family first)
+ *
+ * Returns: number of addresses, -1 if the host is not known
+ *
+ ********************************************************************/
+static int lookup(const char *name, int port, struct net_address *addresses)
+{
+	struct addrinfo hints, *list, *address;
+	char service[10];
+	int count = 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port);
+
+	if (getaddrinfo(name, service, &hints, &list) != 0)
+		return -1;
+
+	for (address = list; address != NULL && count < NET_CACHE_ADDRESSES;
+	     address = address->ai_next)
+	{
+		if (address->ai_addrlen > sizeof(addresses[count].address))
+			continue;
+		memcpy(&addresses[count].address, address->ai_addr, address->ai_addrlen);
+		addresses[count].length = address->ai_addrlen;
+		addresses[count].family = address->ai_family;
+		count++;
+	}
+
+	freeaddrinfo(list);
+
+	return count > 0 ? count : -1;
+}
+
+
+/********************************************************************
+ * cache_find finds the entry of a host. Call with the cache locked.
+ *
+ * Input:   create - 1 to give a free (or the least used) entry if
+ *          the host is not there
+ *
+ * Returns: the entry, NULL if not found
+ *
+ ********************************************************************/
+static struct cache_entry *cache_find(const char *name, int port, int create)
+{
+	struct cache_entry *oldest = &cache[0];
+	int i;
+
+	for (i = 0; i < NET_CACHE; i++)
+	{
+		if (cache[i].resolved != 0 && cache[i].port == port &&
+		    strcmp(cache[i].name, name) == 0)
+			return &cache[i];
+		if (cache[i].used < oldest->used)
+			oldest = &cache[i];
+	}
+
+	if (!create)
+		return NULL;
+
+	memset(oldest, 0, sizeof(*oldest));
+	snprintf(oldest->name, sizeof(oldest->name), "%s", name);
+	oldest->port = port;
+
+	return oldest;
+}
+
+
+/********************************************************************
+ * cache_store puts the result of a lookup in the cache. Call with
+ * the cache locked.
+ *
+ ********************************************************************/
+static void cache_store(const char *name, int port, time_t resolved,
+                        struct net_address *addresses, int count)
+{
+	struct cache_entry *entry = cache_find(name, port, 1);
+
+	memcpy(entry->address, addresses, count * sizeof(*addresses));
+	entry->count = count;
+	entry->resolved = resolved;
+	entry->used = resolved;
+	cache_changed = 1;
+}
+
+
+/********************************************************************
+ * net_resolve gives the addresses of a host from the cache, or from
+ * the resolver when the cached ones are older than the TTL. If the
+ * resolver fails, addresses up to NET_DNS_STALE seconds old are used,
+ * so a resolver hiccup does not stop an upload. While net_refresh_start
+ * keeps the cache fresh, cached addresses are always used at once.
+ *
+ * Input:   name, port - the host
+ *          max - room in addresses
+ *
+ * Output:  addresses
+ *
+ * Returns: number of addresses, -1 if the host is not known
+ *
+ ********************************************************************/
+int net_resolve(const char *name, int port, struct net_address *addresses, int max)
+{
+	struct net_address found[NET_CACHE_ADDRESSES];
+	struct cache_entry *entry;
+	time_t now = time(NULL);
+	int count = -1;
+
+	CACHE_LOCK();
+	entry = cache_find(name, port, 0);
+	if (entry != NULL && (now - entry->resolved < cache_ttl ||
+	                      (cache_refreshing && now - entry->resolved < NET_DNS_STALE)))
+	{
+		count = entry->count < max ? entry->count : max;
+		memcpy(addresses, entry->address, count * sizeof(*addresses));
+		entry->used = now;
+	}
+	CACHE_UNLOCK();
+
+	if (count >= 0)
+		return count;
+
+	count = lookup(name, port, found);
+
+	CACHE_LOCK();
+	if (count > 0)
+	{
+		cache_store(name, port, now, found, count);
+	}
+	else if ((entry = cache_find(name, port, 0)) != NULL &&
+	         now - entry->resolved < NET_DNS_STALE)
+	{
+		fprintf(stderr, "Resolver failed, using old address of %s\n", name);
+		count = entry->count;
+		memcpy(found, entry->address, count * sizeof(*found));
+		entry->used = now;
+	}
+	CACHE_UNLOCK();
+
+	if (count <= 0)
+		return -1;
+
+	if (count > max)
+		count = max;
+	memcpy(addresses, found, count * sizeof(*addresses));
+
+	return count;
+}
+
+
+/********************************************************************
+ * net_cache_open sets the TTL of the resolver cache and loads the
+ * addresses saved by an earlier run
+ *
+ * Input:   path - cache file, "" to keep the cache in memory only.
+ *                 Lines of "name port resolved address".
+ *          ttl - seconds addresses are used, 0 = NET_DNS_TTL
+ *
+ * Returns: 0 on success, -1 if the file cannot be read
+ *
+ ********************************************************************/
+int net_cache_open(const char *path, int ttl)
+{
+	struct addrinfo hints, *address;
+	struct net_address found;
+	struct cache_entry *entry;
+	char name[100], text[100], service[10];
+	long resolved;
+	int port;
+	FILE *file;
+
+	cache_ttl = ttl > 0 ? ttl : NET_DNS_TTL;
+	snprintf(cache_path, sizeof(cache_path), "%s", path);
+
+	if (cache_path[0] == '\0' || (file = fopen(cache_path, "r")) == NULL)
+		return -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_NUMERICHOST;
+	hints.ai_socktype = SOCK_STREAM;
+
+	CACHE_LOCK();
+	while (fscanf(file, "%99s %d %ld %99s", name, &port, &resolved, text) == 4)
+	{
+		snprintf(service, sizeof(service), "%d", port);
+		if (time(NULL) - resolved >= NET_DNS_STALE ||
+		    getaddrinfo(text, service, &hints, &address) != 0)
+			continue;
+
+		if (address->ai_addrlen <= sizeof(found.address))
+		{
+			memcpy(&found.address, address->ai_addr, address->ai_addrlen);
+			found.length = address->ai_addrlen;
+			found.family = address->ai_family;
+
+			entry = cache_find(name, port, 0);
+			if (entry == NULL || entry->resolved != (time_t) resolved)
+				cache_store(name, port, (time_t) resolved, &found, 1);
+			else if (entry->count < NET_CACHE_ADDRESSES)
+				entry->address[entry->count++] = found;
+		}
+
+		freeaddrinfo(address);
+	}
+	cache_changed = 0;
+	CACHE_UNLOCK();
+
+	fclose(file);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * net_cache_close saves the cache to the file of net_cache_open if
+ * an address was looked up
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int net_cache_close(void)
+{
+	char text[NET_CACHE * NET_CACHE_ADDRESSES * 200];
+	char address[100];
+	int length = 0, i, j;
+
+	if (cache_path[0] == '\0' || !cache_changed)
+		return 0;
+
+	CACHE_LOCK();
+	for (i = 0; i < NET_CACHE; i++)
+	{
+		for (j = 0; cache[i].resolved != 0 && j < cache[i].count; j++)
+		{
+			if (getnameinfo((struct sockaddr *) &cache[i].address[j].address,
+			                cache[i].address[j].length, address, sizeof(address),
+			                NULL, 0, NI_NUMERICHOST) != 0)
+				continue;
+			length += snprintf(text + length, sizeof(text) - length, "%s %d %ld %s\n",
+			                   cache[i].name, cache[i].port,
+			                   (long) cache[i].resolved, address);
+		}
+	}
+	cache_changed = 0;
+	CACHE_UNLOCK();
+
+	return publish_file(cache_path, text, length, 0) < 0 ? -1 : 0;
+}
+
+
+#ifndef WIN32
+/********************************************************************
+ * refresh_thread looks up the cached hosts again when half their TTL
+ * has passed, so the uploads of a daemon never wait for the resolver
+ *
+ ********************************************************************/
+static void *refresh_thread(void *unused)
+{
+	struct net_address found[NET_CACHE_ADDRESSES];
+	char name[100];
+	time_t now;
+	int port, count, i;
+
+	while (1)
+	{
+		sleep_long(cache_ttl / 4 > 0 ? cache_ttl / 4 : 1);
+
+		for (i = 0; i < NET_CACHE; i++)
+		{
+			now = time(NULL);
+			CACHE_LOCK();
+			port = 0;
+			if (cache[i].resolved != 0 && now - cache[i].resolved >= cache_ttl / 2)
+			{
+				strcpy(name, cache[i].name);
+				port = cache[i].port;
+			}
+			CACHE_UNLOCK();
+
+			if (port == 0)
+				continue;
+
+			// On failure the old addresses stay in use
+			if ((count = lookup(name, port, found)) > 0)
+			{
+				CACHE_LOCK();
+				cache_store(name, port, now, found, count);
+				CACHE_UNLOCK();
+			}
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+
+/********************************************************************
+ * net_refresh_start starts refreshing the cache in the background.
+ * For programs that run as daemons. On Windows the addresses are
+ * looked up when they expire instead.
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int net_refresh_start(void)
+{
+#ifndef WIN32
+	pthread_t thread;
+
+	if (cache_refreshing)
+		return 0;
+
+	if (pthread_create(&thread, NULL, refresh_thread, NULL) != 0)
+		return -1;
+
+	pthread_detach(thread);
+	cache_refreshing = 1;
+
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+
+/********************************************************************
+ * rank gives the preference group of a host: 0 connected before,
+ * 1 not tried, 2 failed
+ *
+ ********************************************************************/
+static int rank(int latency)
+{
+	if (latency > 0)
+		return 0;
+
+	return latency == 0 ? 1 : 2;
+}
+
+
+/********************************************************************
+ * host_order sorts the hosts by preference: the fastest known first,
+ * then those not tried yet, then those that failed, each in the
+ * order of the configuration
+ *
+ * Output:  order - host indexes
+ *
+ ********************************************************************/
+static void host_order(hostdata *hosts, int count, int *order)
+{
+	int i, j, key, a, b;
+
+	for (i = 0; i < count; i++)
+		order[i] = i;
+
+	// Insertion sort keeps the configuration order of equals
+	for (i = 1; i < count; i++)
+	{
+		key = order[i];
+		b = hosts[key].latency;
+		for (j = i - 1; j >= 0; j--)
+		{
+			a = hosts[order[j]].latency;
+			if (rank(a) < rank(b) || (rank(a) == rank(b) && (rank(a) != 0 || a <= b)))
+				break;
+			order[j + 1] = order[j];
+		}
+		order[j + 1] = key;
+	}
+}
+
+
+/********************************************************************
+ * add_host resolves a host and adds its addresses to the candidates,
+ * alternating between the address families
+ *
+ * Returns: number of candidates added
+ *
+ ********************************************************************/
+static int add_host(hostdata *host, int index, struct candidate *candidates)
+{
+	struct net_address addresses[NET_CACHE_ADDRESSES];
+	int first[NET_ADDRESSES], other[NET_ADDRESSES];
+	int count, firsts = 0, others = 0, added = 0, i;
+
+	if ((count = net_resolve(host->name, host->port, addresses, NET_CACHE_ADDRESSES)) < 0)
+	{
+		fprintf(stderr, "Host %s not known by DNS server or DNS server "
+		        "not working\n", host->name);
+		host->latency = NET_FAILED;
+		return 0;
+	}
+
+	// The resolver puts the preferred family first
+	for (i = 0; i < count; i++)
+	{
+		if (addresses[i].family == addresses[0].family)
+		{
+			if (firsts < NET_ADDRESSES)
+				first[firsts++] = i;
+		}
+		else if (others < NET_ADDRESSES)
+		{
+			other[others++] = i;
+		}
+	}
+
+	for (i = 0; added < NET_ADDRESSES && (i < firsts || i < others); i++)
+	{
+		if (i < firsts)
+		{
+			candidates[added].address = addresses[first[i]];
+			candidates[added++].host = index;
+		}
+		if (i < others && added < NET_ADDRESSES)
+		{
+			candidates[added].address = addresses[other[i]];
+			candidates[added++].host = index;
+		}
+	}
+
+	return added;
+}
+
+
+/********************************************************************
+ * start_attempt starts a non-blocking connect
+ *
+ * Returns: 1 if connected at once, 0 if in progress, -1 if fail
+ *
+ ********************************************************************/
+static int start_attempt(struct candidate *candidate, struct attempt *attempt)
+{
+	struct net_address *address = &candidate->address;
+
+	attempt->host = candidate->host;
+	attempt->sockfd = socket(address->family, SOCK_STREAM, 0);
+
+	if (attempt->sockfd == INVALID_SOCKET)
+		return -1;
+
+	if (socket_nonblocking(attempt->sockfd, 1) != 0)
+	{
+		closesocket(attempt->sockfd);
+		return -1;
+	}
+
+	if (connect(attempt->sockfd, (struct sockaddr *) &address->address,
+	            address->length) == 0)
+		return 1;
+
+	if (CONNECT_PENDING())
+		return 0;
+
+	closesocket(attempt->sockfd);
+	return -1;
+}
+
+
+/********************************************************************
+ * net_connect connects to the first of the hosts that answers
+ *
+ * Input:   hosts - names, ports and latency of the servers
+ *          count - number of hosts
+ *          timeout - seconds for each attempt, 0 = NET_TIMEOUT
+ *
+ * Output:  hosts - latency of the hosts tried
+ *          winner - index of the host connected to (may be NULL)
+ *
+ * Returns: blocking socket connected to the winner, INVALID_SOCKET
+ *          if no host could be reached
+ *
+ ********************************************************************/
+SOCKET net_connect(hostdata *hosts, int count, int timeout, int *winner)
+{
+	struct candidate candidates[NET_ADDRESSES];
+	struct attempt attempts[NET_HOSTS * NET_ADDRESSES];
+	int order[NET_HOSTS];
+	int resolved = 0, candidate_count = 0, next = 0, active = 0;
+	int i, rc, error;
+	socklen_t length;
+	long now, next_start, wait;
+	SOCKET sockfd = INVALID_SOCKET, highest;
+	fd_set write_set, error_set;
+	struct timeval tv;
+
+	if (count > NET_HOSTS)
+		count = NET_HOSTS;
+	if (timeout <= 0)
+		timeout = NET_TIMEOUT;
+
+	host_order(hosts, count, order);
+	next_start = clock_milliseconds();
+
+	while (sockfd == INVALID_SOCKET)
+	{
+		now = clock_milliseconds();
+
+		// Resolve the next host when its addresses are needed, so a
+		// slow DNS lookup overlaps the connects already started
+		while (next == candidate_count && resolved < count)
+		{
+			candidate_count = add_host(&hosts[order[resolved]], order[resolved],
+			                           candidates);
+			resolved++;
+			next = 0;
+		}
+
+		if (next < candidate_count && (active == 0 || now >= next_start))
+		{
+			rc = start_attempt(&candidates[next++], &attempts[active]);
+
+			if (rc == 1)
+			{
+				sockfd = attempts[active].sockfd;
+				if (winner != NULL)
+					*winner = attempts[active].host;
+				hosts[attempts[active].host].latency = 1;
+				break;
+			}
+
+			if (rc == 0)
+			{
+				attempts[active].start = now;
+				attempts[active].deadline = now + timeout * 1000L;
+				active++;
+				next_start = now + NET_STAGGER;
+			}
+			else
+			{
+				hosts[candidates[next - 1].host].latency = NET_FAILED;
+			}
+			continue;
+		}
+
+		if (active == 0)
+			break;
+
+		// Wait for an attempt to finish, time out, or the next start
+		FD_ZERO(&write_set);
+		FD_ZERO(&error_set);
+		highest = 0;
+		wait = attempts[0].deadline - now;
+		for (i = 0; i < active; i++)
+		{
+			FD_SET(attempts[i].sockfd, &write_set);
+			FD_SET(attempts[i].sockfd, &error_set);
+			if (attempts[i].sockfd > highest)
+				highest = attempts[i].sockfd;
+			if (attempts[i].deadline - now < wait)
+				wait = attempts[i].deadline - now;
+		}
+		if ((next < candidate_count || resolved < count) && next_start - now < wait)
+			wait = next_start - now;
+		if (wait < 0)
+			wait = 0;
+
+		tv.tv_sec = wait / 1000;
+		tv.tv_usec = (wait % 1000) * 1000;
+
+		if (select(highest + 1, NULL, &write_set, &error_set, &tv) < 0)
+		{
+			FD_ZERO(&write_set);
+			FD_ZERO(&error_set);
+		}
+
+		now = clock_milliseconds();
+
+		for (i = 0; i < active; i++)
+		{
+			if (FD_ISSET(attempts[i].sockfd, &write_set) ||
+			    FD_ISSET(attempts[i].sockfd, &error_set))
+			{
+				error = 0;
+				length = sizeof(error);
+				if (getsockopt(attempts[i].sockfd, SOL_SOCKET, SO_ERROR,
+				               (char *) &error, &length) == 0 && error == 0 &&
+				    FD_ISSET(attempts[i].sockfd, &write_set))
+				{
+					sockfd = attempts[i].sockfd;
+					if (winner != NULL)
+						*winner = attempts[i].host;
+					hosts[attempts[i].host].latency =
+						now - attempts[i].start > 0 ? now - attempts[i].start : 1;
+					attempts[i] = attempts[--active];
+					break;
+				}
+			}
+			else if (now < attempts[i].deadline)
+			{
+				continue;
+			}
+
+			// Refused or timed out - the next address goes at once
+			hosts[attempts[i].host].latency = NET_FAILED;
+			closesocket(attempts[i].sockfd);
+			attempts[i--] = attempts[--active];
+			next_start = now;
+		}
+	}
+
+	// Close the attempts that lost
+	for (i = 0; i < active; i++)
+		closesocket(attempts[i].sockfd);
+
+	if (sockfd != INVALID_SOCKET)
+		socket_nonblocking(sockfd, 0);
+
+	return sockfd;
+}
+
+
+/********************************************************************
+ * net_load_latency reads the latency of the hosts saved by an
+ * earlier run. Hosts not in the file keep their latency.
+ *
+ * Input:   path - the file, lines of "name port latency"
+ *
+ * Returns: 0 on success, -1 if the file cannot be read
+ *
+ ********************************************************************/
+int net_load_latency(const char *path, hostdata *hosts, int count)
+{
+	FILE *file;
+	char name[50];
+	int port, latency, i;
+
+	if ((file = fopen(path, "r")) == NULL)
+		return -1;
+
+	while (fscanf(file, "%49s %d %d", name, &port, &latency) == 3)
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (strcmp(hosts[i].name, name) == 0 && hosts[i].port == port)
+				hosts[i].latency = latency;
+		}
+	}
+
+	fclose(file);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * net_save_latency writes the latency of the hosts for the next run
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int net_save_latency(const char *path, hostdata *hosts, int count)
+{
+	char text[NET_HOSTS * 80];
+	int length = 0, i;
+
+	for (i = 0; i < count && i < NET_HOSTS; i++)
+		length += snprintf(text + length, sizeof(text) - length, "%s %d %d\n",
+		                   hosts[i].name, hosts[i].port, hosts[i].latency);
+
+	return publish_file((char *) path, text, length, 0) < 0 ? -1 : 0;
+}
@@ -0,0 +1,60 @@
+/* open2300 - net2300.h
+ * Include file for the resolver cache and for connecting to the
+ * first of several servers.
+ *
+ * net_connect starts a non-blocking connect to the addresses (IPv6 and
+ * IPv4 alternately) of the hosts one after the other, NET_STAGGER ms
+ * apart or at once when an attempt fails, without waiting for the
+ * earlier attempts to finish. The first attempt that succeeds wins and
+ * the others are closed. This way an unreachable server costs a
+ * fraction of a second instead of a TCP timeout.
+ *
+ * Addresses come from a resolver cache (getaddrinfo, IPv6 and IPv4).
+ * getaddrinfo gives no TTL so a fixed one is used (DNS_CACHE_TTL).
+ * The cache can be kept in a file for programs run from cron, and a
+ * daemon can refresh it in the background (net_refresh_start).
+ *
+ * The connect time of each host is kept in its hostdata so the fastest
+ * host is tried first next time. net_load_latency / net_save_latency
+ * keep it in a file between runs.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_NET2300_H_
+#define _INCLUDE_NET2300_H_
+
+#include "rw2300.h"
+
+#define NET_STAGGER      250       // ms before the next attempt starts
+#define NET_TIMEOUT      10        // seconds per attempt
+#define NET_HOSTS        16        // most hosts tried
+#define NET_ADDRESSES    4         // most addresses tried per host
+#define NET_FAILED       (-1)      // latency of a host that failed
+#define NET_CACHE        16        // hosts in the resolver cache
+#define NET_CACHE_ADDRESSES 8      // addresses kept per host
+#define NET_DNS_TTL      300       // seconds, default
+#define NET_DNS_STALE    86400     // seconds an address is used when
+                                   // the resolver fails
+
+struct net_address
+{
+	struct sockaddr_storage address;
+	socklen_t               length;
+	int                     family;
+};
+
+int    net_resolve(const char *name, int port, struct net_address *addresses, int max);
+
+int    net_cache_open(const char *path, int ttl);
+
+int    net_cache_close(void);
+
+int    net_refresh_start(void);
+
+SOCKET net_connect(hostdata *hosts, int count, int timeout, int *winner);
+
+int    net_load_latency(const char *path, hostdata *hosts, int count);
+
+int    net_save_latency(const char *path, hostdata *hosts, int count);
+
+#endif /* _INCLUDE_NET2300_H_ */
@@ -9,6 +9,7 @@
  */
 
 #include "rw2300.h"
+#include "stats2300.h"
 
 #define READMODE 0
 
@@ -60,6 +61,8 @@ int main(int argc, char *argv[])
 	int nibbles = 0;
 	int writemode = 0;
 	struct config_type config;
+
+	stats_option(&argc, argv);
 	
 	// Get serial port from connfig file.
 	// Note: There is no command line config file path feature!
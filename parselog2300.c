@@ -0,0 +1,170 @@
+/*  open2300 - parselog2300.c
+ *
+ *  Version 1.11
+ *
+ *  Parses a log2300 or histlog2300 text log using all processor
+ *  cores and writes the records as CSV, as a binary log or into a
+ *  columnar archive. Without output only the parse speed is shown.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "logparse2300.h"
+#include "binlog2300.h"
+#include "archive2300.h"
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("parselog2300 - Fast parser for open2300 text log files.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("parselog2300 [-t threads] log_file [output]\n");
+	printf("Without output the number of records and the parse speed are shown.\n");
+	printf("output - prints CSV to standard out\n");
+	printf("output ending in .bin writes a binary log file\n");
+	printf("any other output is a columnar archive directory (see wxarchive2300)\n");
+	printf("threads defaults to the number of processors.\n");
+	exit(0);
+}
+
+/********************************************************************
+ * write_csv prints the records as CSV with a header line
+ *
+ ********************************************************************/
+void write_csv(struct log_parse_result *result)
+{
+	struct log_record *record;
+	char buffer[65536 + LOG_LINE_SIZE];
+	int length = 0;
+	long i;
+
+	printf("time,Ti,To,DP,RHi,RHo,WS,DIR,WC,R1h,R24h,Rtot,RP,Tendency,Forecast\n");
+
+	for (i = 0; i < result->count; i++)
+	{
+		record = &result->records[i];
+		length += snprintf(buffer + length, LOG_LINE_SIZE,
+		                   "%ld,%.1f,%.1f,%.1f,%d,%d,%.1f,%.1f,%.1f,%.2f,%.2f,%.2f,%.3f,%s,%s\n",
+		                   (long) record->timestamp,
+		                   record->temperature_indoor, record->temperature_outdoor,
+		                   record->dewpoint, record->humidity_indoor,
+		                   record->humidity_outdoor, record->windspeed,
+		                   record->winddir_degrees, record->windchill,
+		                   record->rain_1h, record->rain_24h, record->rain_total,
+		                   record->rel_pressure,
+		                   record->tendency >= 0 ? tendency_names[record->tendency] : "",
+		                   record->forecast >= 0 ? forecast_names[record->forecast] : "");
+		if (length >= 65536)
+		{
+			fwrite(buffer, 1, length, stdout);
+			length = 0;
+		}
+	}
+
+	fwrite(buffer, 1, length, stdout);
+}
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program parses a text log file in parallel.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	struct log_parse_result result;
+	struct binlog binary_output;
+	struct archive archive;
+	struct timespec start, now;
+	double seconds;
+	time_t last;
+	long i, written = 0;
+	int threads = 0;
+	int arg = 1;
+	FILE *report = stdout;
+
+	if (argc > 2 && strcmp(argv[1], "-t") == 0)
+	{
+		threads = atoi(argv[2]);
+		arg = 3;
+	}
+
+	if (argc - arg < 1 || argc - arg > 2)
+		print_usage();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (log_parse_file(argv[arg], threads, &result) != 0)
+	{
+		fprintf(stderr, "Cannot parse log file %s\n", argv[arg]);
+		exit(EXIT_FAILURE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	seconds = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+
+	if (argc - arg == 2)
+	{
+		if (strcmp(argv[arg + 1], "-") == 0)
+		{
+			report = stderr;
+			write_csv(&result);
+			written = result.count;
+		}
+		else if (is_binlog_name(argv[arg + 1]))
+		{
+			remove(argv[arg + 1]);
+			if (binlog_open(&binary_output, argv[arg + 1], 1) != 0)
+			{
+				fprintf(stderr, "Cannot create file %s\n", argv[arg + 1]);
+				exit(EXIT_FAILURE);
+			}
+			for (i = 0; i < result.count; i++)
+			{
+				if (binlog_append(&binary_output, &result.records[i]) == 0)
+					written++;
+			}
+			binlog_close(&binary_output);
+		}
+		else
+		{
+			if (archive_open(&archive, argv[arg + 1], 1) != 0)
+			{
+				fprintf(stderr, "Cannot open archive %s\n", argv[arg + 1]);
+				exit(EXIT_FAILURE);
+			}
+			last = archive_last_time(&archive);
+			for (i = 0; i < result.count; i++)
+			{
+				if (last && result.records[i].timestamp <= last)
+					continue;
+				if (archive_append(&archive, &result.records[i]) == 0)
+					written++;
+			}
+			archive_close(&archive);
+		}
+	}
+
+	fprintf(report, "%ld records, %ld invalid lines, %.1f MB parsed in %.3f s "
+	        "(%.0f MB/s, %d threads)",
+	        result.count, result.invalid, result.bytes / 1e6, seconds,
+	        seconds > 0 ? result.bytes / 1e6 / seconds : 0, result.threads);
+	if (argc - arg == 2)
+		fprintf(report, ", %ld records written", written);
+	fprintf(report, "\n");
+
+	log_parse_free(&result);
+
+	return(0);
+}
@@ -11,147 +11,404 @@
  *
  *	1.1  2004 Nov 25  Przemyslaw Sztoch
  *	Creates pgsql2300. A Rewrite of mysql2300.
+ *
+ *	1.2  Values are sent as parameters of one INSERT statement. With
+ *	-d the program keeps running with one connection and a prepared
+ *	statement.
+ *
+ *	1.3  Store-and-forward. With SPOOL_DIRECTORY set a reading that
+ *	cannot be inserted is kept in a spool and inserted by a later
+ *	run, a batch per transaction. The time of the reading is sent
+ *	instead of current_timestamp.
  */
 
 #include <libpq-fe.h>
-#include "rw2300.h"
+#include "spool2300.h"
+#include "stats2300.h"
 
- 
-/********** MAIN PROGRAM ************************************************
+#define PGSQL_VALUES  15                // values read from the station
+#define ENTRY_SIZE    400               // time and values, tab separated
+
+struct pgsql_target
+{
+	PGconn     *conn;
+	const char *query;                  // INSERT with $1 (station) to $17
+	const char *station;
+	int        prepared;                // query prepared as "insert_current"
+};
+
+/********************************************************************
+ * print_usage prints a short user guide
  *
- * This program reads current weather data from a WS2300
- * and writes the data to a PgSQL database.
+ * Input:   none
  *
- * The open2300.conf config file must contain the following parameters
- * 
- * It takes one parameters. The config file name with path
- * If this parameter is omitted the program will look at the default paths
- * See the open2300.conf-dist file for info
+ * Output:  prints to stdout
  *
- ***********************************************************************/
-int main(int argc, char *argv[])
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("pgsql2300 - Log current data from WS-2300 to PostgreSQL.\n");
+	printf("Version %s (C)2004-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("pgsql2300 [-d seconds] [config_filename]\n");
+	printf("-d keeps running and logs a record every seconds using one\n");
+	printf("   connection and a prepared statement\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * read_current reads the current values from the weather station as
+ * text parameters of the INSERT statement
+ *
+ * Input:   ws2300 - open weather station
+ *          config - the configuration
+ *
+ * Output:  values - PGSQL_VALUES strings in the order of the table
+ *
+ * Returns: 0 on success, -1 if a value is not a number
+ *
+ ********************************************************************/
+int read_current(WEATHERSTATION ws2300, struct config_type *config,
+                 char values[PGSQL_VALUES][20])
 {
-	WEATHERSTATION ws2300;
-	PGconn *conn;
-	PGresult *res;
-	int retval = 1;
-	unsigned char logline[200] = "";
 	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
 	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
 	double winddir[6];
-	int tempint;
-	char tendency[15];
-	char forecast[15];
-	struct config_type config;
-	char query[4096];
+	double value[PGSQL_VALUES];
+	int tempint, i;
+
+	value[0] = temperature_indoor(ws2300, config->temperature_conv);
+	value[1] = temperature_outdoor(ws2300, config->temperature_conv);
+	value[2] = dewpoint(ws2300, config->temperature_conv);
+	value[3] = humidity_indoor(ws2300);
+	value[4] = humidity_outdoor(ws2300);
+	value[5] = wind_all(ws2300, config->wind_speed_conv_factor, &tempint, winddir);
+	value[6] = winddir[0];
+	value[8] = windchill(ws2300, config->temperature_conv);
+	value[9] = rain_1h(ws2300, config->rain_conv_factor);
+	value[10] = rain_24h(ws2300, config->rain_conv_factor);
+	value[11] = rain_total(ws2300, config->rain_conv_factor);
+	value[12] = rel_pressure(ws2300, config->pressure_conv_factor);
+	tendency_forecast(ws2300, values[13], values[14]);
+
+	for (i = 0; i < 13; i++)
+	{
+		if (i == 7)
+			sprintf(values[i], "%s", directions[tempint]);
+		else if (!isfinite(value[i]))
+			return -1;
+		else if (i == 3 || i == 4)
+			sprintf(values[i], "%d", (int) value[i]);
+		else
+			sprintf(values[i], "%.1f", value[i]);
+	}
 
-	get_configuration(&config, argv[1]);
+	return 0;
+}
+
+
+/********************************************************************
+ * insert_row inserts one spooled row
+ *
+ * Input:   target - the database
+ *          row - time and values, tab separated
+ *          size - length of row
+ *
+ * Returns: 0 on success or if the row is damaged and skipped,
+ *          -1 if the row was not inserted
+ *
+ ********************************************************************/
+int insert_row(struct pgsql_target *target, const char *row, int size)
+{
+	PGresult *res;
+	char entry[ENTRY_SIZE];
+	const char *params[PGSQL_VALUES + 2];
+	char *p;
+	int n, length, retval = 0;
+
+	length = size < ENTRY_SIZE ? size : ENTRY_SIZE - 1;
+	memcpy(entry, row, length);
+	entry[length] = '\0';
+
+	params[0] = target->station;
+	for (n = 1, p = entry; n < PGSQL_VALUES + 2 && p != NULL; n++)
+	{
+		params[n] = p;
+		if ((p = strchr(p, '\t')) != NULL)
+			*p++ = '\0';
+	}
+
+	// A damaged entry is skipped
+	if (n != PGSQL_VALUES + 2)
+		return 0;
+
+	if (target->prepared)
+		res = PQexecPrepared(target->conn, "insert_current", PGSQL_VALUES + 2,
+		                     params, NULL, NULL, 0);
+	else
+		res = PQexecParams(target->conn, target->query, PGSQL_VALUES + 2, NULL,
+		                   params, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		fprintf(stderr, "Could not insert row. %s:\n%s\n",
+		        PQresultErrorMessage(res), target->query);
+		retval = -1;
+	}
+
+	PQclear(res);
+
+	return retval;
+}
+
+
+/********************************************************************
+ * insert_rows inserts spooled rows, a batch in one transaction. Used
+ * as spool sender. Rows already stored are skipped so a row sent
+ * twice after a crash does no harm. If a row fails the batch is
+ * rolled back and the rows are inserted one by one. A row that is
+ * rejected again is dropped, so one bad row does not hold up the
+ * spool. If the connection is lost the rest are left in the spool.
+ *
+ * Input:   context - the pgsql_target
+ *          rows - time and values of each row, tab separated
+ *          sizes - length of each row
+ *          count - number of rows
+ *
+ * Returns: number of rows inserted or dropped, 0 if none
+ *
+ ********************************************************************/
+int insert_rows(void *context, char **rows, int *sizes, int count)
+{
+	struct pgsql_target *target = context;
+	PGresult *res;
+	int i, ok = 1;
+
+	if (count > 1)
+	{
+		res = PQexec(target->conn, "BEGIN");
+		PQclear(res);
 
-	ws2300 = open_weatherstation(config.serial_device_name);
+		for (i = 0; i < count && ok; i++)
+		{
+			if (insert_row(target, rows[i], sizes[i]) != 0)
+				ok = 0;
+		}
 
-	/* READ TEMPERATURE INDOOR */
+		res = PQexec(target->conn, ok ? "COMMIT" : "ROLLBACK");
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			ok = 0;
+		PQclear(res);
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        temperature_indoor(ws2300, config.temperature_conv) );
-	
+		if (ok)
+			return count;
 
-	/* READ TEMPERATURE OUTDOOR */
+		fprintf(stderr, "Could not insert %d rows. Inserting one by one.\n", count);
+	}
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        temperature_outdoor(ws2300, config.temperature_conv) );
-	
+	for (i = 0; i < count; i++)
+	{
+		if (insert_row(target, rows[i], sizes[i]) == 0)
+			continue;
 
-	/* READ DEWPOINT */
+		// Keep this row and the rest if the server is gone
+		if (PQstatus(target->conn) != CONNECTION_OK)
+			break;
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        dewpoint(ws2300, config.temperature_conv) );
-	
+		fprintf(stderr, "Row dropped\n");
+	}
 
-	/* READ RELATIVE HUMIDITY INDOOR */
+	return i;
+}
 
-	sprintf(logline,"%s\'%d\',", logline, humidity_indoor(ws2300) );
-	
-	
-	/* READ RELATIVE HUMIDITY OUTDOOR */
 
-	sprintf(logline,"%s\'%d\',", logline, humidity_outdoor(ws2300) );
+/********************************************************************
+ * log_current reads the station and inserts the reading. With a
+ * spool the reading is spooled first and all spooled readings are
+ * inserted if the database can be reached.
+ *
+ * Input:   target - the database, conn may be down
+ *          config - the configuration
+ *          spool - open spool or NULL
+ *
+ * Returns: 0 on success, -1 if the reading was not inserted
+ *
+ ********************************************************************/
+int log_current(struct pgsql_target *target, struct config_type *config,
+                struct spool *spool)
+{
+	WEATHERSTATION ws2300;
+	char values[PGSQL_VALUES][20];
+	char entry[ENTRY_SIZE];
+	int i, length, valid;
 
+	ws2300 = open_weatherstation(config->serial_device_name);
+	valid = (read_current(ws2300, config, values) == 0);
 
-	/* READ WIND SPEED AND DIRECTION aND WINDCHILL */
+	/* CLOSE THE WEATHER STATION TO ENABLE OTHER PROGRAMS TO ACCESS */
+	close_weatherstation(ws2300);
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        wind_all(ws2300, config.wind_speed_conv_factor,
-	                 &tempint, winddir) );
+	if (!valid)
+	{
+		fprintf(stderr, "Invalid value. Reading skipped.\n");
+		if (spool != NULL && PQstatus(target->conn) == CONNECTION_OK)
+			spool_drain(spool, SPOOL_BATCH, insert_rows, target);
+		return -1;
+	}
 
-	sprintf(logline,"%s\'%.1f\',\'%s\',", logline,
-	        winddir[0], directions[tempint]);
-	
+	length = sprintf(entry, "%ld", (long) time(NULL));
+	for (i = 0; i < PGSQL_VALUES; i++)
+		length += sprintf(entry + length, "\t%s", values[i]);
 
-	/* READ WINDCHILL */
+	if (spool != NULL && spool_append(spool, entry, length) == 0 &&
+	    spool_sync(spool) == 0)
+	{
+		if (PQstatus(target->conn) != CONNECTION_OK)
+		{
+			fprintf(stderr, "Reading kept in spool %s\n", spool->dir);
+			return -1;
+		}
+		spool_drain(spool, SPOOL_BATCH, insert_rows, target);
+		if (!spool_empty(spool))
+		{
+			fprintf(stderr, "Reading kept in spool %s\n", spool->dir);
+			return -1;
+		}
+		return 0;
+	}
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        windchill(ws2300, config.temperature_conv) );
+	if (PQstatus(target->conn) != CONNECTION_OK)
+		return -1;
 
-	
-	/* READ RAIN 1H */
+	return insert_row(target, entry, length);
+}
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        rain_1h(ws2300, config.rain_conv_factor) );
-	
-	
-	/* READ RAIN 24H */
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        rain_24h(ws2300, config.rain_conv_factor) );
+/********************************************************************
+ * prepare_insert prepares the INSERT statement on a connection
+ *
+ * Returns: 0 on success, -1 on error
+ *
+ ********************************************************************/
+int prepare_insert(PGconn *conn, const char *query)
+{
+	PGresult *res;
+	int retval = 0;
 
-	
-	/* READ RAIN TOTAL */
+	res = PQprepare(conn, "insert_current", query, PGSQL_VALUES + 2, NULL);
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        rain_total(ws2300, config.rain_conv_factor) );
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		fprintf(stderr, "Could not prepare statement. %s:\n%s\n",
+		        PQresultErrorMessage(res), query);
+		retval = -1;
+	}
 
-	
-	/* READ RELATIVE PRESSURE */
+	PQclear(res);
 
-	sprintf(logline,"%s\'%.1f\',", logline,	
-	        rel_pressure(ws2300, config.pressure_conv_factor) );
+	return retval;
+}
 
+ 
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program reads current weather data from a WS2300
+ * and writes the data to a PgSQL database.
+ *
+ * The open2300.conf config file must contain the following parameters
+ * 
+ * It takes one parameters. The config file name with path
+ * If this parameter is omitted the program will look at the default paths
+ * See the open2300.conf-dist file for info
+ *
+ * Schema for the table is shown in pgsql2300.sql file
+ *
+ * With -d the connection is kept open and the INSERT is prepared
+ * once. If the connection is lost it is reset and the statement
+ * prepared again.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	struct pgsql_target target;
+	struct spool spool, *spool_used = NULL;
+	int retval;
+	int interval = 0;
+	int arg = 1;
+	struct config_type config;
+	char query[4096];
 
-	/* READ TENDENCY AND FORECAST */
-	
-	tendency_forecast(ws2300, tendency, forecast);
-	sprintf(logline,"%s\'%s\',\'%s\'", logline, tendency, forecast);
+	stats_option(&argc, argv);
 
+	if (argc > 2 && strcmp(argv[1], "-d") == 0)
+	{
+		if ((interval = atoi(argv[2])) <= 0)
+			print_usage();
+		arg = 3;
+	}
+	else if (argc > 1 && argv[1][0] == '-')
+	{
+		print_usage();
+	}
 
-	/* CLOSE THE WEATHER STATION TO ENABLE OTHER PROGRAMS TO ACCESS */
-	close_weatherstation(ws2300);
+	get_configuration(&config, argv[arg]);
 
-	sprintf(query, "INSERT INTO %s VALUES ('%s', current_timestamp, %s)", config.pgsql_table, config.pgsql_station, logline);
+	snprintf(query, sizeof(query), "INSERT INTO %s VALUES ($1, to_timestamp($2), "
+	         "$3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13, $14, $15, $16, $17) "
+	         "ON CONFLICT DO NOTHING", config.pgsql_table);
 
 	//printf("%s\n",query);  //disabled to be used in cron job
 	//printf("%s\n",config.pgsql_connect); //debug
 
+	if (config.spool_directory[0] != '\0' &&
+	    spool_open(&spool, config.spool_directory, "pgsql2300") == 0)
+		spool_used = &spool;
+
 	/* INIT PQ AND EXECUTE QUERY */
-	conn = PQconnectdb(config.pgsql_connect);
+	target.conn = PQconnectdb(config.pgsql_connect);
+	target.query = query;
+	target.station = config.pgsql_station;
+	target.prepared = 0;
 
-	if (PQstatus(conn) == CONNECTION_BAD)
+	if (PQstatus(target.conn) == CONNECTION_BAD)
 	{
 		fprintf(stderr, "Connection to PgSQL failed:\n%s\n", config.pgsql_connect);
-		fprintf(stderr, "%s", PQerrorMessage(conn));
+		fprintf(stderr, "%s", PQerrorMessage(target.conn));
 	}
-	else
+
+	if (interval == 0)
 	{
-		res = PQexec(conn, query);
-	
-		if (PQresultStatus(res) == PGRES_COMMAND_OK)
-			retval = 0;
-		else
-			fprintf(stderr, "Could not insert row. %s:\n%s\n", PQresultErrorMessage(res), query);
-				
-		PQclear(res);
+		retval = log_current(&target, &config, spool_used) == 0 ? 0 : 1;
+		if (spool_used)
+			spool_close(spool_used);
+		PQfinish(target.conn);
+		return retval;
 	}
-		
-	PQfinish(conn);
 
-	return retval;
+	/* DAEMON MODE - ONE CONNECTION, PREPARED ONCE */
+	while (1)
+	{
+		if (PQstatus(target.conn) != CONNECTION_OK)
+		{
+			PQreset(target.conn);
+			target.prepared = 0;
+		}
+
+		if (PQstatus(target.conn) == CONNECTION_OK && !target.prepared)
+			target.prepared = (prepare_insert(target.conn, query) == 0);
+
+		if (log_current(&target, &config, spool_used) != 0)
+			fprintf(stderr, "%s", PQerrorMessage(target.conn));
+
+		sleep_long(interval);
+	}
+
+	PQfinish(target.conn);
+
+	return 0;
 }
@@ -0,0 +1,34 @@
+-- Schema for the PostgreSQL weather table of pgsql2300 and pgsqlhistlog2300
+-- Load with: psql open2300 -f pgsql2300.sql
+-- The table name is PGSQL_TABLE in open2300.conf. pgsql2300 inserts
+-- the columns in this order, so other names may be used.
+CREATE TABLE weather (
+  station_id varchar(25) NOT NULL,
+  timestamp timestamp with time zone NOT NULL,
+  temp_in decimal(4,1) NOT NULL,
+  temp_out decimal(4,1) NOT NULL,
+  dewpoint decimal(4,1) NOT NULL,
+  rel_hum_in smallint NOT NULL,
+  rel_hum_out smallint NOT NULL,
+  wind_speed decimal(4,1) NOT NULL,
+  wind_angle decimal(4,1) NOT NULL,
+  wind_direction char(3) NOT NULL,
+  wind_chill decimal(4,1) NOT NULL,
+  rain_1h decimal(5,1) NOT NULL,
+  rain_24h decimal(5,1) NOT NULL,
+  rain_total decimal(6,1) NOT NULL,
+  rel_pressure decimal(5,1) NOT NULL,
+  tendency varchar(7) NOT NULL,
+  forecast varchar(6) NOT NULL,
+  PRIMARY KEY (station_id, timestamp)
+);
+
+-- Where pgsqlhistlog2300 stopped for each station and source
+-- (the station history or the full path of a log file). Created by
+-- pgsqlhistlog2300 if missing.
+CREATE TABLE weather_cursor (
+  station_id varchar(25) NOT NULL,
+  source varchar(255) NOT NULL,
+  last_time timestamp with time zone NOT NULL,
+  PRIMARY KEY (station_id, source)
+);
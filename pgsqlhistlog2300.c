@@ -0,0 +1,650 @@
+/*  open2300 - pgsqlhistlog2300.c
+ *
+ *  Version 1.11
+ *
+ *  Copies history records to a PostgreSQL database, either from the
+ *  history memory of a WS2300 weather station or from a log2300,
+ *  histlog2300 or binary (.bin) log file.
+ *
+ *  The records are streamed with COPY in binary format into a
+ *  temporary table and moved to the weather table with one INSERT,
+ *  all in one transaction. Where each source stopped is kept in the
+ *  table <PGSQL_TABLE>_cursor and updated in the same transaction,
+ *  so a run that fails leaves nothing behind and the next run
+ *  starts from the same place.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include <libpq-fe.h>
+#include "record2300.h"
+#include "binlog2300.h"
+#include "logsearch2300.h"
+#include "stats2300.h"
+
+#define COPY_FLUSH_SIZE   65536       // bytes sent per PQputCopyData
+#define COPY_FIELDS       17
+#define SECONDS_1970_2000 946684800L  // PostgreSQL times count from 2000
+#define CURSOR_SOURCE_SIZE 255        // longest source of the cursor table
+
+// Binary COPY file header: signature, flags and header extension length
+static const char copy_header[19] = "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0";
+
+struct copy_buffer
+{
+	char   *data;
+	size_t length;
+	size_t allocated;
+	long   rows;
+	time_t last_time;                 // newest record copied
+};
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("pgsqlhistlog2300 - Copy history data to PostgreSQL.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("pgsqlhistlog2300 [config_filename]\n");
+	printf("pgsqlhistlog2300 -f log_file [config_filename]\n");
+	printf("Without -f the history records of the weather station are copied.\n");
+	printf("-f copies the records of a log2300, histlog2300 or .bin log file.\n");
+	printf("Only records newer than those copied from the same station or log\n");
+	printf("file before are copied. Rows already in the table are skipped.\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * fail prints the last PostgreSQL error and exits. The transaction
+ * is rolled back by the server when the connection is closed.
+ *
+ ********************************************************************/
+void fail(PGconn *conn, const char *what)
+{
+	fprintf(stderr, "%s: %s", what, PQerrorMessage(conn));
+	PQfinish(conn);
+	exit(EXIT_FAILURE);
+}
+
+
+/********************************************************************
+ * exec_command runs an SQL command without result. Exits on error.
+ *
+ ********************************************************************/
+void exec_command(PGconn *conn, const char *command)
+{
+	PGresult *res;
+
+	res = PQexec(conn, command);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		PQclear(res);
+		fail(conn, command);
+	}
+	PQclear(res);
+}
+
+
+/********************************************************************
+ * read_cursor gets where the last copy from a source stopped. The
+ * cursor table is created if it does not exist, or widened for full
+ * paths.
+ *
+ * Input:   conn - open connection
+ *          config - the configuration
+ *          source - "station" or the full path of the log file
+ *
+ * Returns: time of the newest record copied, 0 if none
+ *
+ ********************************************************************/
+time_t read_cursor(PGconn *conn, struct config_type *config, const char *source)
+{
+	PGresult *res;
+	const char *params[2];
+	char query[300];
+	time_t last = 0;
+
+	snprintf(query, sizeof(query),
+	         "CREATE TABLE IF NOT EXISTS %s_cursor (station_id varchar(25) NOT NULL, "
+	         "source varchar(255) NOT NULL, last_time timestamp with time zone NOT NULL, "
+	         "PRIMARY KEY (station_id, source))", config->pgsql_table);
+	exec_command(conn, query);
+
+	// Tables of older versions keyed log files by name, varchar(100).
+	// ALTER TABLE locks the table, so it is only done if the catalog
+	// shows the short column.
+	snprintf(query, sizeof(query),
+	         "SELECT atttypmod - 4 FROM pg_attribute WHERE attrelid = "
+	         "'%s_cursor'::regclass AND attname = 'source'", config->pgsql_table);
+	res = PQexec(conn, query);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+	{
+		PQclear(res);
+		fail(conn, "Could not read cursor table");
+	}
+	if (PQntuples(res) == 1 && atoi(PQgetvalue(res, 0, 0)) < 255)
+	{
+		snprintf(query, sizeof(query),
+		         "ALTER TABLE %s_cursor ALTER COLUMN source TYPE varchar(255)",
+		         config->pgsql_table);
+		exec_command(conn, query);
+	}
+	PQclear(res);
+
+	snprintf(query, sizeof(query),
+	         "SELECT extract(epoch FROM last_time)::bigint FROM %s_cursor "
+	         "WHERE station_id = $1 AND source = $2", config->pgsql_table);
+	params[0] = config->pgsql_station;
+	params[1] = source;
+
+	res = PQexecParams(conn, query, 2, NULL, params, NULL, NULL, 0);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+	{
+		PQclear(res);
+		fail(conn, "Could not read cursor");
+	}
+	if (PQntuples(res) == 1)
+		last = (time_t) atol(PQgetvalue(res, 0, 0));
+	PQclear(res);
+
+	return last;
+}
+
+
+/********************************************************************
+ * put_bytes appends to the copy buffer. put_int16/32/64 and
+ * put_float8 append in network byte order as binary COPY wants.
+ *
+ ********************************************************************/
+static void put_bytes(struct copy_buffer *buffer, const void *data, size_t size)
+{
+	char *grown;
+
+	if (buffer->length + size > buffer->allocated)
+	{
+		buffer->allocated = 2 * (buffer->length + size);
+		if ((grown = realloc(buffer->data, buffer->allocated)) == NULL)
+		{
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		buffer->data = grown;
+	}
+
+	memcpy(buffer->data + buffer->length, data, size);
+	buffer->length += size;
+}
+
+static void put_integer(struct copy_buffer *buffer, unsigned long long value, int width)
+{
+	unsigned char bytes[8];
+	int i;
+
+	for (i = 0; i < width; i++)
+		bytes[i] = (value >> (8 * (width - 1 - i))) & 0xFF;
+
+	put_bytes(buffer, bytes, width);
+}
+
+static void put_int16(struct copy_buffer *buffer, int value)
+{
+	put_integer(buffer, (unsigned long long) value, 2);
+}
+
+static void put_int32(struct copy_buffer *buffer, long value)
+{
+	put_integer(buffer, (unsigned long long) value, 4);
+}
+
+static void put_int64(struct copy_buffer *buffer, long long value)
+{
+	put_integer(buffer, (unsigned long long) value, 8);
+}
+
+static void put_float8(struct copy_buffer *buffer, double value)
+{
+	unsigned long long bits;
+
+	memcpy(&bits, &value, 8);
+	put_int32(buffer, 8);
+	put_integer(buffer, bits, 8);
+}
+
+static void put_text(struct copy_buffer *buffer, const char *text)
+{
+	put_int32(buffer, strlen(text));
+	put_bytes(buffer, text, strlen(text));
+}
+
+
+/********************************************************************
+ * flush_copy sends the buffered COPY data to the server
+ *
+ ********************************************************************/
+static void flush_copy(PGconn *conn, struct copy_buffer *buffer)
+{
+	if (buffer->length > 0 &&
+	    PQputCopyData(conn, buffer->data, buffer->length) != 1)
+		fail(conn, "Could not send COPY data");
+
+	buffer->length = 0;
+}
+
+
+/********************************************************************
+ * copy_begin starts the transaction and the COPY into a temporary
+ * table. The temporary table has fixed column types so the binary
+ * data does not depend on the column types of the weather table.
+ *
+ ********************************************************************/
+void copy_begin(PGconn *conn, struct copy_buffer *buffer)
+{
+	PGresult *res;
+
+	exec_command(conn, "BEGIN");
+	exec_command(conn,
+	             "CREATE TEMP TABLE weather_load (station_id text, timestamp timestamptz, "
+	             "temp_in float8, temp_out float8, dewpoint float8, rel_hum_in int4, "
+	             "rel_hum_out int4, wind_speed float8, wind_angle float8, "
+	             "wind_direction text, wind_chill float8, rain_1h float8, rain_24h float8, "
+	             "rain_total float8, rel_pressure float8, tendency text, forecast text) "
+	             "ON COMMIT DROP");
+
+	res = PQexec(conn, "COPY weather_load FROM STDIN (FORMAT binary)");
+	if (PQresultStatus(res) != PGRES_COPY_IN)
+	{
+		PQclear(res);
+		fail(conn, "Could not start COPY");
+	}
+	PQclear(res);
+
+	memset(buffer, 0, sizeof(*buffer));
+	put_bytes(buffer, copy_header, sizeof(copy_header));
+}
+
+
+/********************************************************************
+ * copy_record adds one record to the COPY. A record with a value
+ * that is not a number is skipped: the weather table cannot store it
+ * and the whole COPY would fail.
+ *
+ * Input:   conn - connection in COPY state
+ *          buffer - the copy buffer
+ *          station - station id
+ *          record - the record
+ *
+ ********************************************************************/
+void copy_record(PGconn *conn, struct copy_buffer *buffer, const char *station,
+                 struct log_record *record)
+{
+	int direction;
+	char datestring[50];
+
+	if (!isfinite(record->temperature_indoor) || !isfinite(record->temperature_outdoor) ||
+	    !isfinite(record->dewpoint) || !isfinite(record->windspeed) ||
+	    !isfinite(record->winddir_degrees) || !isfinite(record->windchill) ||
+	    !isfinite(record->rain_1h) || !isfinite(record->rain_24h) ||
+	    !isfinite(record->rain_total) || !isfinite(record->rel_pressure) ||
+	    record->humidity_indoor == HUMIDITY_MISSING ||
+	    record->humidity_outdoor == HUMIDITY_MISSING)
+	{
+		strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S",
+		         localtime(&record->timestamp));
+		fprintf(stderr, "Invalid value. Dataset for %s skipped.\n", datestring);
+		return;
+	}
+
+	direction = (int)(record->winddir_degrees / 22.5) & 15;
+
+	put_int16(buffer, COPY_FIELDS);
+	put_text(buffer, station);
+	put_int32(buffer, 8);
+	put_int64(buffer, ((long long) record->timestamp - SECONDS_1970_2000) * 1000000);
+	put_float8(buffer, record->temperature_indoor);
+	put_float8(buffer, record->temperature_outdoor);
+	put_float8(buffer, record->dewpoint);
+	put_int32(buffer, 4);
+	put_int32(buffer, record->humidity_indoor);
+	put_int32(buffer, 4);
+	put_int32(buffer, record->humidity_outdoor);
+	put_float8(buffer, record->windspeed);
+	put_float8(buffer, record->winddir_degrees);
+	put_text(buffer, wind_directions[direction]);
+	put_float8(buffer, record->windchill);
+	put_float8(buffer, record->rain_1h);
+	put_float8(buffer, record->rain_24h);
+	put_float8(buffer, record->rain_total);
+	put_float8(buffer, record->rel_pressure);
+	put_text(buffer, record->tendency >= 0 ? tendency_names[record->tendency] : "");
+	put_text(buffer, record->forecast >= 0 ? forecast_names[record->forecast] : "");
+
+	buffer->rows++;
+	if (record->timestamp > buffer->last_time)
+		buffer->last_time = record->timestamp;
+
+	if (buffer->length >= COPY_FLUSH_SIZE)
+		flush_copy(conn, buffer);
+}
+
+
+/********************************************************************
+ * copy_finish ends the COPY, moves the new rows to the weather table,
+ * moves the cursor and commits
+ *
+ * Input:   conn - connection in COPY state
+ *          buffer - the copy buffer
+ *          config - the configuration
+ *          source - the cursor to move
+ *
+ * Returns: number of rows added to the weather table
+ *
+ ********************************************************************/
+long copy_finish(PGconn *conn, struct copy_buffer *buffer,
+                 struct config_type *config, const char *source)
+{
+	PGresult *res;
+	const char *params[3];
+	char query[300], last_time[20];
+	long added;
+
+	put_int16(buffer, -1);
+	flush_copy(conn, buffer);
+	free(buffer->data);
+	buffer->data = NULL;
+
+	if (PQputCopyEnd(conn, NULL) != 1)
+		fail(conn, "Could not end COPY");
+
+	while ((res = PQgetResult(conn)) != NULL)
+	{
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		{
+			PQclear(res);
+			fail(conn, "COPY failed");
+		}
+		PQclear(res);
+	}
+
+	// Rows already in the table (e.g. logged by pgsql2300) are skipped
+	snprintf(query, sizeof(query),
+	         "INSERT INTO %s SELECT * FROM weather_load ON CONFLICT DO NOTHING",
+	         config->pgsql_table);
+	res = PQexec(conn, query);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		PQclear(res);
+		fail(conn, "Could not insert rows");
+	}
+	added = atol(PQcmdTuples(res));
+	PQclear(res);
+
+	if (buffer->rows > 0)
+	{
+		snprintf(query, sizeof(query),
+		         "INSERT INTO %s_cursor VALUES ($1, $2, to_timestamp($3)) "
+		         "ON CONFLICT (station_id, source) DO UPDATE SET last_time = EXCLUDED.last_time",
+		         config->pgsql_table);
+		snprintf(last_time, sizeof(last_time), "%ld", (long) buffer->last_time);
+		params[0] = config->pgsql_station;
+		params[1] = source;
+		params[2] = last_time;
+
+		res = PQexecParams(conn, query, 3, NULL, params, NULL, NULL, 0);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		{
+			PQclear(res);
+			fail(conn, "Could not update cursor");
+		}
+		PQclear(res);
+	}
+
+	exec_command(conn, "COMMIT");
+
+	return added;
+}
+
+
+/********************************************************************
+ * copy_station copies the history records of the weather station
+ * that are newer than the cursor
+ *
+ ********************************************************************/
+void copy_station(PGconn *conn, struct copy_buffer *buffer,
+                  struct config_type *config, time_t time_lastlog)
+{
+	WEATHERSTATION ws2300;
+	struct log_record record;
+	struct timestamp time_last;
+	struct tm time_lastrecord_tm;
+	time_t time_lastrecord;
+	int interval, countdown, no_records;
+	int current_record, next_record, lastlog_record, new_records;
+	double pressure, pressure_term;
+	char datestring[50];
+	int i;
+
+	ws2300 = open_weatherstation(config->serial_device_name);
+
+	current_record = read_history_info(ws2300, &interval, &countdown, &time_last,
+	                                   &no_records);
+
+	time_lastrecord_tm.tm_year = time_last.year - 1900;
+	time_lastrecord_tm.tm_mon  = time_last.month - 1;
+	time_lastrecord_tm.tm_mday = time_last.day;
+	time_lastrecord_tm.tm_hour = time_last.hour;
+	time_lastrecord_tm.tm_min  = time_last.minute;
+	time_lastrecord_tm.tm_sec  = 0;
+	time_lastrecord_tm.tm_isdst = -1;
+
+	time_lastrecord = mktime(&time_lastrecord_tm);
+
+	pressure_term = pressure_correction(ws2300, config->pressure_conv_factor);
+
+	new_records = (int)difftime(time_lastrecord, time_lastlog) / (60 * interval);
+
+	if (new_records > 0xAF)
+		new_records = 0xAF;
+
+	if (new_records > no_records)
+		new_records = no_records;
+
+	lastlog_record = current_record - new_records;
+
+	if (lastlog_record < 0)
+		lastlog_record = 0xAE + lastlog_record + 1;
+
+	time_lastrecord_tm.tm_min -= new_records * interval;
+
+	for (i = 1; i <= new_records; i++)
+	{
+		next_record = (i + lastlog_record) % 0xAF;
+
+		read_history_record(ws2300, next_record, config,
+		                    &record.temperature_indoor,
+		                    &record.temperature_outdoor,
+		                    &pressure,
+		                    &record.humidity_indoor,
+		                    &record.humidity_outdoor,
+		                    &record.rain_total,
+		                    &record.windspeed,
+		                    &record.winddir_degrees,
+		                    &record.dewpoint,
+		                    &record.windchill);
+
+		time_lastrecord_tm.tm_min += interval;
+		record.timestamp = mktime(&time_lastrecord_tm);
+
+		// If humidity is > 100 the record is skipped
+		if (record.humidity_outdoor >= 100)
+		{
+			strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S",
+			         &time_lastrecord_tm);
+			fprintf(stderr, "Humidity is %d. Dataset for %s skipped.\n",
+			        record.humidity_outdoor, datestring);
+			continue;
+		}
+
+		record.format = LOG_FORMAT_HISTORY;
+		record.rel_pressure = pressure + pressure_term;
+		record.rain_1h = 0;
+		record.rain_24h = 0;
+		record.tendency = -1;
+		record.forecast = -1;
+
+		copy_record(conn, buffer, config->pgsql_station, &record);
+	}
+
+	close_weatherstation(ws2300);
+}
+
+
+/********************************************************************
+ * copy_log copies the records of a log file that are newer than the
+ * cursor. Text logs are searched for the first new record so only
+ * the new part of the log is read.
+ *
+ ********************************************************************/
+void copy_log(PGconn *conn, struct copy_buffer *buffer,
+              struct config_type *config, char *path, time_t time_lastlog)
+{
+	struct binlog binary_input;
+	struct log_record record;
+	struct time_cache cache;
+	char line[LOG_LINE_SIZE];
+	char key[LOG_KEY_LENGTH + 1];
+	time_t first = time_lastlog + 1;
+	long number;
+	FILE *input;
+
+	if (is_binlog_name(path))
+	{
+		if (binlog_open(&binary_input, path, 0) != 0)
+		{
+			fprintf(stderr, "Not a valid binary log file %s\n", path);
+			PQfinish(conn);
+			exit(EXIT_FAILURE);
+		}
+
+		for (number = binlog_find(&binary_input, first);
+		     binlog_read(&binary_input, number, &record); number++)
+		{
+			if (record.timestamp > time_lastlog)
+				copy_record(conn, buffer, config->pgsql_station, &record);
+		}
+
+		binlog_close(&binary_input);
+		return;
+	}
+
+	if ((input = fopen(path, "rb")) == NULL)
+	{
+		fprintf(stderr, "Cannot open file %s\n", path);
+		PQfinish(conn);
+		exit(EXIT_FAILURE);
+	}
+
+	if (time_lastlog > 0)
+	{
+		strftime(key, sizeof(key), "%Y%m%d%H%M%S", localtime(&first));
+		log_search(input, key);
+	}
+
+	memset(&cache, 0, sizeof(cache));
+
+	while (fgets(line, sizeof(line), input) != NULL)
+	{
+		if (parse_log_record(line, strlen(line), &record, &cache) &&
+		    record.timestamp > time_lastlog)
+			copy_record(conn, buffer, config->pgsql_station, &record);
+	}
+
+	fclose(input);
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program copies history records to a PostgreSQL database.
+ * Just run the program with -h for usage.
+ *
+ * It uses the config file for device name and database settings.
+ * Config file locations - see open2300.conf-dist
+ * Schema for the tables is shown in pgsql2300.sql file
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	PGconn *conn;
+	struct copy_buffer buffer;
+	struct config_type config;
+	const char *source = "station";
+	char *log_path = NULL;
+	time_t time_lastlog;
+	long copied, added;
+	int arg = 1;
+
+	stats_option(&argc, argv);
+
+	if (argc > 2 && strcmp(argv[1], "-f") == 0)
+	{
+		log_path = argv[2];
+		// The cursor of a log file is kept by its full path, so logs
+		// with the same name in different directories are not mixed up
+		if ((source = realpath(log_path, NULL)) == NULL)
+		{
+			fprintf(stderr, "Cannot open file %s\n", log_path);
+			exit(EXIT_FAILURE);
+		}
+		if (strlen(source) > CURSOR_SOURCE_SIZE)
+		{
+			fprintf(stderr, "Path of %s is longer than %d characters\n",
+			        log_path, CURSOR_SOURCE_SIZE);
+			exit(EXIT_FAILURE);
+		}
+		arg = 3;
+	}
+	else if (argc > 1 && argv[1][0] == '-')
+	{
+		print_usage();
+	}
+
+	get_configuration(&config, argv[arg]);
+
+	conn = PQconnectdb(config.pgsql_connect);
+
+	if (PQstatus(conn) == CONNECTION_BAD)
+	{
+		fprintf(stderr, "Connection to PgSQL failed:\n%s\n", config.pgsql_connect);
+		fail(conn, "Connect");
+	}
+
+	time_lastlog = read_cursor(conn, &config, source);
+
+	copy_begin(conn, &buffer);
+
+	if (log_path)
+		copy_log(conn, &buffer, &config, log_path, time_lastlog);
+	else
+		copy_station(conn, &buffer, &config, time_lastlog);
+
+	copied = buffer.rows;
+	added = copy_finish(conn, &buffer, &config, source);
+	printf("%ld records copied, %ld added\n", copied, added);
+
+	PQfinish(conn);
+
+	return(0);
+}
@@ -0,0 +1,298 @@
+/*  open2300 - query2300.c
+ *
+ *  Version 1.11
+ *
+ *  Prints the records of a time range from a log2300/histlog2300
+ *  log file. Text logs are searched with their sidecar index if
+ *  they have one, otherwise with a binary search on the file, so
+ *  only the lines in the range are read. Binary logs (.bin) are
+ *  searched with their time index.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "logsearch2300.h"
+#include "logindex2300.h"
+#include "binlog2300.h"
+
+#define MAX_COLUMNS 20
+
+// Field names of the two log line formats
+static const char *current_names[18] = {
+	"key", "Date", "Time", "Ti", "To", "DP", "RHi", "RHo", "WS", "DIR",
+	"DIRtext", "WC", "R1h", "R24h", "Rtot", "RP", "Tendency", "Forecast"
+};
+
+static const char *history_names[14] = {
+	"key", "Date", "Time", "Ti", "To", "DP", "RHi", "RHo", "WS", "DIR",
+	"DIRtext", "WC", "Rtot", "RP"
+};
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("query2300 - Print a time range from an open2300 log file.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("query2300 [-f field,field...] [-i seconds] log_file from_time [to_time]\n");
+	printf("query2300 [-f field,field...] log_file last\n");
+	printf("Times are given as YYYYMMDDhhmmss. Trailing digits may be left out.\n");
+	printf("last prints the last record of a text log that has an index.\n");
+	printf("to_time is included. Without to_time the rest of the log is printed.\n");
+	printf("-f prints only the given fields, separated by space. Fields are\n");
+	printf("   key Date Time Ti To DP RHi RHo WS DIR DIRtext WC R1h R24h Rtot RP\n");
+	printf("   Tendency Forecast (R1h, R24h, Tendency and Forecast are - for\n");
+	printf("   histlog2300 logs)\n");
+	printf("-i prints at most one record per interval of seconds\n");
+	exit(0);
+}
+
+/********************************************************************
+ * field_number finds a field name in a list of names
+ *
+ * Returns: index, -1 if not found
+ *
+ ********************************************************************/
+int field_number(const char **names, int count, const char *name)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (strcmp(names[i], name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/********************************************************************
+ * parse_projection splits the -f argument into field names
+ *
+ * Output:  columns - pointers into argument (which is modified)
+ *
+ * Returns: number of columns, -1 if a name is not known
+ *
+ ********************************************************************/
+int parse_projection(char *argument, char **columns)
+{
+	int count = 0;
+	char *name;
+
+	for (name = strtok(argument, ","); name != NULL && count < MAX_COLUMNS;
+	     name = strtok(NULL, ","))
+	{
+		if (field_number(current_names, 18, name) < 0)
+			return -1;
+		columns[count++] = name;
+	}
+
+	return count;
+}
+
+/********************************************************************
+ * print_line prints a log line, or the selected fields of it
+ *
+ ********************************************************************/
+void print_line(char *line, char **columns, int column_count)
+{
+	char *field[MAX_COLUMNS];
+	int field_length[MAX_COLUMNS];
+	const char **names;
+	char *p = line;
+	int fields = 0, names_count, i, n;
+
+	if (column_count == 0)
+	{
+		fputs(line, stdout);
+		return;
+	}
+
+	while (*p && fields < MAX_COLUMNS)
+	{
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '\0' || *p == '\n' || *p == '\r')
+			break;
+		field[fields] = p;
+		while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+			p++;
+		field_length[fields] = p - field[fields];
+		fields++;
+	}
+
+	names = (fields == 14) ? history_names : current_names;
+	names_count = (fields == 14) ? 14 : 18;
+
+	for (i = 0; i < column_count; i++)
+	{
+		if (i > 0)
+			putchar(' ');
+		n = field_number(names, names_count, columns[i]);
+		if (n < 0 || n >= fields)
+			putchar('-');
+		else
+			fwrite(field[n], 1, field_length[n], stdout);
+	}
+	putchar('\n');
+}
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program prints a time range of a log file.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	struct binlog binary_input;
+	struct log_index index;
+	struct stat filestat;
+	struct log_record record;
+	struct time_cache cache;
+	char *columns[MAX_COLUMNS];
+	char line[LOG_LINE_SIZE];
+	char from_key[LOG_KEY_LENGTH + 1], to_key[LOG_KEY_LENGTH + 1];
+	char line_key[LOG_KEY_LENGTH + 1];
+	char index_path[300];
+	char magic[8];
+	time_t timestamp, next_time = 0;
+	long interval = 0, number;
+	int column_count = 0;
+	int arg = 1;
+	FILE *input;
+
+	memset(&cache, 0, sizeof(cache));
+
+	while (arg < argc - 1 && argv[arg][0] == '-' && argv[arg][1] != '\0')
+	{
+		if (strcmp(argv[arg], "-f") == 0)
+		{
+			if ((column_count = parse_projection(argv[arg + 1], columns)) <= 0)
+				print_usage();
+		}
+		else if (strcmp(argv[arg], "-i") == 0)
+		{
+			if ((interval = atol(argv[arg + 1])) <= 0)
+				print_usage();
+		}
+		else
+		{
+			print_usage();
+		}
+		arg += 2;
+	}
+
+	if (argc - arg < 2 || argc - arg > 3)
+		print_usage();
+
+	if (strcmp(argv[arg + 1], "last") == 0)
+	{
+		if (argc - arg != 2 || log_index_open(&index, argv[arg]) != 0 ||
+		    index.records == 0 || (input = fopen(argv[arg], "rb")) == NULL ||
+		    fseek(input, index.last_offset, SEEK_SET) != 0 ||
+		    fgets(line, sizeof(line), input) == NULL)
+		{
+			fprintf(stderr, "No records in %s\n", argv[arg]);
+			exit(EXIT_FAILURE);
+		}
+		print_line(line, columns, column_count);
+		return(0);
+	}
+
+	if (log_make_key(argv[arg + 1], from_key) != 0)
+		print_usage();
+
+	if (argc - arg == 3)
+	{
+		if (log_make_key(argv[arg + 2], to_key) != 0)
+			print_usage();
+	}
+	else
+	{
+		strcpy(to_key, "99999999999999");
+	}
+
+	if ((input = fopen(argv[arg], "rb")) == NULL)
+	{
+		fprintf(stderr, "Cannot open file %s\n", argv[arg]);
+		exit(EXIT_FAILURE);
+	}
+
+	// Binary log - use the time index
+
+	if (fread(magic, 1, 8, input) == 8 && memcmp(magic, BINLOG_MAGIC, 8) == 0)
+	{
+		fclose(input);
+		if (binlog_open(&binary_input, argv[arg], 0) != 0)
+		{
+			fprintf(stderr, "Not a valid binary log file %s\n", argv[arg]);
+			exit(EXIT_FAILURE);
+		}
+
+		for (number = binlog_find(&binary_input, parse_log_timestamp(from_key));
+		     binlog_read(&binary_input, number, &record); number++)
+		{
+			format_log_line(&record, line, sizeof(line));
+			log_line_key(line, line_key);
+			if (strcmp(line_key, to_key) > 0)
+				break;
+			if (interval)
+			{
+				if (record.timestamp < next_time)
+					continue;
+				next_time = record.timestamp - record.timestamp % interval + interval;
+			}
+			print_line(line, columns, column_count);
+		}
+
+		binlog_close(&binary_input);
+		return(0);
+	}
+
+	// Text log - use the index if there is one, otherwise binary
+	// search for the start of the range
+
+	snprintf(index_path, sizeof(index_path), "%s.idx", argv[arg]);
+
+	if (stat(index_path, &filestat) == 0 && log_index_open(&index, argv[arg]) == 0)
+	{
+		fseek(input, log_index_find(&index, parse_log_timestamp(from_key)), SEEK_SET);
+		log_index_close(&index);
+	}
+	else if (log_search(input, from_key) < 0)
+	{
+		fprintf(stderr, "Cannot read file %s\n", argv[arg]);
+		exit(EXIT_FAILURE);
+	}
+
+	while (fgets(line, sizeof(line), input) != NULL)
+	{
+		if (log_line_key(line, line_key) != 0 || strcmp(line_key, from_key) < 0)
+			continue;
+		if (strcmp(line_key, to_key) > 0)
+			break;
+		if (interval)
+		{
+			timestamp = parse_log_timestamp_cached(line_key, &cache);
+			if (timestamp < next_time)
+				continue;
+			next_time = timestamp - timestamp % interval + interval;
+		}
+		print_line(line, columns, column_count);
+	}
+
+	fclose(input);
+
+	return(0);
+}
@@ -0,0 +1,651 @@
+/*  open2300 - record2300.c
+ *
+ *  Version 1.11
+ *
+ *  Log record functions. Converts between the text lines written
+ *  by log2300/histlog2300 and a struct log_record holding the
+ *  values as numbers.
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include <ctype.h>
+#include "record2300.h"
+
+const char *wind_directions[16] = {"N","NNE","NE","ENE","E","ESE","SE","SSE",
+                                   "S","SSW","SW","WSW","W","WNW","NW","NNW"};
+const char *tendency_names[3] = { "Steady", "Rising", "Falling" };
+const char *forecast_names[3] = { "Rainy", "Cloudy", "Sunny" };
+
+/* The current values of a log line, for decode_current */
+const struct current_item current_items[CURRENT_ITEMS] = {
+	{0x346, 2},                    // temperature indoor
+	{0x373, 2},                    // temperature outdoor
+	{0x3CE, 2},                    // dewpoint
+	{0x3FB, 1},                    // humidity indoor
+	{0x419, 1},                    // humidity outdoor
+	{0x527, 3},                    // wind speed and direction
+	{0x3A0, 2},                    // windchill
+	{0x4B4, 3},                    // rain 1h
+	{0x497, 3},                    // rain 24h
+	{0x4D2, 3},                    // rain total
+	{0x5E2, 3},                    // relative pressure
+	{0x26B, 1}                     // tendency and forecast
+};
+
+
+/********************************************************************
+ * name_index finds a string in a table of names
+ *
+ * Input:   names - table of strings
+ *          count - number of strings in table
+ *          name - the string to find
+ *
+ * Returns: index in table, -1 if not found
+ *
+ ********************************************************************/
+int name_index(const char **names, int count, const char *name)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (strcmp(names[i], name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+
+/********************************************************************
+ * bcd_temperature / bcd_rain decode the station's BCD values
+ *
+ ********************************************************************/
+static double bcd_temperature(unsigned char *data)
+{
+	return ((data[1] >> 4) * 10 + (data[1] & 0xF) +
+	        (data[0] >> 4) / 10.0 + (data[0] & 0xF) / 100.0) - 30.0;
+}
+
+static double bcd_rain(unsigned char *data)
+{
+	return (data[2] >> 4) * 1000 + (data[2] & 0xF) * 100 +
+	       (data[1] >> 4) * 10 + (data[1] & 0xF) +
+	       (data[0] >> 4) / 10.0 + (data[0] & 0xF) / 100.0;
+}
+
+
+/********************************************************************
+ * decode_current stores a value read from the station in a reading.
+ * Units are Celsius, m/s, mm and hPa as in the station.
+ *
+ * Input:   address, data - one of current_items and its bytes
+ *
+ ********************************************************************/
+void decode_current(struct log_record *reading, int address, unsigned char *data)
+{
+	switch (address)
+	{
+	case 0x346:
+		reading->temperature_indoor = bcd_temperature(data);
+		break;
+	case 0x373:
+		reading->temperature_outdoor = bcd_temperature(data);
+		break;
+	case 0x3CE:
+		reading->dewpoint = bcd_temperature(data);
+		break;
+	case 0x3FB:
+		reading->humidity_indoor = (data[0] >> 4) * 10 + (data[0] & 0xF);
+		break;
+	case 0x419:
+		reading->humidity_outdoor = (data[0] >> 4) * 10 + (data[0] & 0xF);
+		break;
+	case 0x527:
+		// Invalid while the station is measuring; keep the last value
+		if (data[0] != 0x00 ||
+		    (data[1] == 0xFF && ((data[2] & 0xF) == 0 || (data[2] & 0xF) == 1)))
+			break;
+		reading->winddir_degrees = (data[2] >> 4) * 22.5;
+		reading->windspeed = (((data[2] & 0xF) << 8) + data[1]) / 10.0;
+		break;
+	case 0x3A0:
+		reading->windchill = bcd_temperature(data);
+		break;
+	case 0x4B4:
+		reading->rain_1h = bcd_rain(data);
+		break;
+	case 0x497:
+		reading->rain_24h = bcd_rain(data);
+		break;
+	case 0x4D2:
+		reading->rain_total = bcd_rain(data);
+		break;
+	case 0x5E2:
+		reading->rel_pressure = (data[2] & 0xF) * 1000 + (data[1] >> 4) * 100 +
+		                        (data[1] & 0xF) * 10 + (data[0] >> 4) +
+		                        (data[0] & 0xF) / 10.0;
+		break;
+	case 0x26B:
+		reading->tendency = (data[0] >> 4) < 3 ? data[0] >> 4 : -1;
+		reading->forecast = (data[0] & 0xF) < 3 ? data[0] & 0xF : -1;
+		break;
+	}
+}
+
+
+/********************************************************************
+ * format_log_line renders a record as a log line in the format
+ * used by log2300 (LOG_FORMAT_CURRENT) or histlog2300
+ * (LOG_FORMAT_HISTORY). The line is newline terminated.
+ *
+ * Input:   record - the record to render
+ *          size - size of line buffer
+ *
+ * Output:  line - the zero terminated log line
+ *
+ * Returns: length of the line, -1 if it did not fit
+ *
+ ********************************************************************/
+int format_log_line(struct log_record *record, char *line, int size)
+{
+	char datestring[50];
+	int direction;
+	int length;
+
+	strftime(datestring, sizeof(datestring), "%Y%m%d%H%M%S %Y-%b-%d %H:%M:%S",
+	         localtime(&record->timestamp));
+
+	direction = ((int)(record->winddir_degrees / 22.5)) & 0xF;
+
+	if (record->format == LOG_FORMAT_HISTORY)
+	{
+		length = snprintf(line, size,
+		                  "%s %.1f %.1f %.1f %d %d %.1f %.1f %s %.1f %.2f %.3f \n",
+		                  datestring, record->temperature_indoor,
+		                  record->temperature_outdoor, record->dewpoint,
+		                  record->humidity_indoor, record->humidity_outdoor,
+		                  record->windspeed, record->winddir_degrees,
+		                  wind_directions[direction], record->windchill,
+		                  record->rain_total, record->rel_pressure);
+	}
+	else
+	{
+		length = snprintf(line, size,
+		                  "%s %.1f %.1f %.1f %d %d %.1f %.1f %s %.1f "
+		                  "%.2f %.2f %.2f %.3f %s %s \n",
+		                  datestring, record->temperature_indoor,
+		                  record->temperature_outdoor, record->dewpoint,
+		                  record->humidity_indoor, record->humidity_outdoor,
+		                  record->windspeed, record->winddir_degrees,
+		                  wind_directions[direction], record->windchill,
+		                  record->rain_1h, record->rain_24h,
+		                  record->rain_total, record->rel_pressure,
+		                  record->tendency >= 0 ? tendency_names[record->tendency] : "-",
+		                  record->forecast >= 0 ? forecast_names[record->forecast] : "-");
+	}
+
+	if (length < 0 || length >= size)
+		return -1;
+
+	return length;
+}
+
+
+/********************************************************************
+ * format_fetch_text writes a current reading as the lines of key,
+ * space and value that fetch2300 prints, with the keys a current
+ * reading has (no min/max and only the last wind direction)
+ *
+ * Input:   record - LOG_FORMAT_CURRENT record, units as printed
+ *          size - of text
+ *
+ * Output:  text - zero terminated
+ *
+ * Returns: length of the text, -1 if it did not fit
+ *
+ ********************************************************************/
+int format_fetch_text(struct log_record *record, char *text, int size)
+{
+	char datestring[50];
+	int length;
+
+	strftime(datestring, sizeof(datestring), "Date %Y-%b-%d\nTime %H:%M:%S\n",
+	         localtime(&record->timestamp));
+
+	length = snprintf(text, size,
+	                  "%sTi %.1f\nTo %.1f\nDP %.1f\nRHi %d\nRHo %d\nWS %.1f\n"
+	                  "DIRtext %s\nDIR0 %.1f\nWC %.1f\nR1h %.2f\nR24h %.2f\n"
+	                  "Rtot %.2f\nRP %.3f\nTendency %s\nForecast %s\n",
+	                  datestring, record->temperature_indoor,
+	                  record->temperature_outdoor, record->dewpoint,
+	                  record->humidity_indoor, record->humidity_outdoor,
+	                  record->windspeed,
+	                  wind_directions[((int)(record->winddir_degrees / 22.5)) & 0xF],
+	                  record->winddir_degrees, record->windchill,
+	                  record->rain_1h, record->rain_24h,
+	                  record->rain_total, record->rel_pressure,
+	                  record->tendency >= 0 ? tendency_names[record->tendency] : "-",
+	                  record->forecast >= 0 ? forecast_names[record->forecast] : "-");
+
+	if (length < 0 || length >= size)
+		return -1;
+
+	return length;
+}
+
+
+/********************************************************************
+ * json_number tells if a value can be written as a JSON number
+ *
+ ********************************************************************/
+static int json_number(const char *value)
+{
+	const char *digits = value + (value[0] == '-');
+	const char *point = strchr(digits, '.');
+
+	// Digits with at most one point inside, no leading zeros
+	if (!isdigit((unsigned char) digits[0]) ||
+	    (digits[0] == '0' && isdigit((unsigned char) digits[1])))
+		return 0;
+	if (point != NULL && (!isdigit((unsigned char) point[1]) || strchr(point + 1, '.') != NULL))
+		return 0;
+
+	return strspn(digits, "0123456789.") == strlen(digits);
+}
+
+
+/********************************************************************
+ * format_fetch_json writes the lines of fetch2300 as one JSON object
+ * with a member per key, numbers as numbers and the rest as strings,
+ * after "Timestamp"
+ *
+ * Input:   text - lines of key, space and value
+ *          timestamp - time of the reading
+ *          size - of json
+ *
+ * Output:  json - zero terminated, ends with a newline
+ *
+ * Returns: length of the JSON text, -1 if it did not fit
+ *
+ ********************************************************************/
+int format_fetch_json(const char *text, time_t timestamp, char *json, int size)
+{
+	char value[100];
+	const char *line, *end, *space;
+	int length, i;
+
+	length = snprintf(json, size, "{\"Timestamp\":%ld", (long) timestamp);
+
+	for (line = text; *line != '\0' && length < size; line = end + (*end == '\n'))
+	{
+		end = line + strcspn(line, "\n");
+		if ((space = memchr(line, ' ', end - line)) == NULL)
+			continue;
+
+		snprintf(value, sizeof(value), "%.*s", (int) (end - space - 1), space + 1);
+		length += snprintf(json + length, size - length, ",\"%.*s\":",
+		                   (int) (space - line), line);
+
+		if (length >= size)
+			break;
+
+		if (json_number(value))
+		{
+			length += snprintf(json + length, size - length, "%s", value);
+			continue;
+		}
+
+		length += snprintf(json + length, size - length, "\"");
+		for (i = 0; value[i] != '\0' && length < size - 2; i++)
+		{
+			if (value[i] == '"' || value[i] == '\\')
+				json[length++] = '\\';
+			json[length++] = value[i];
+		}
+		if (length < size)
+			length += snprintf(json + length, size - length, "\"");
+	}
+
+	if (length < size)
+		length += snprintf(json + length, size - length, "}\n");
+
+	return length < size ? length : -1;
+}
+
+
+/********************************************************************
+ * format_wu_query writes a reading as the path and query of a Weather
+ * Underground upload, in its units (deg F, miles/hour, inches and
+ * inches of Hg)
+ *
+ * Input:   config - ID, password and time zone
+ *          record - the reading, metric units. rain_total and the
+ *                   indoor values are not sent.
+ *          gust - wind gust in m/s, below 0 to leave it out
+ *          rapidfire - period in seconds of realtime updates,
+ *                      0 for a normal upload
+ *          size - of query
+ *
+ * Output:  query - zero terminated
+ *
+ * Returns: length, -1 if it did not fit
+ *
+ ********************************************************************/
+int format_wu_query(struct config_type *config, struct log_record *record,
+                    double gust, double rapidfire, char *query, int size)
+{
+	char datestring[50];
+	char gustline[50] = "";
+	char realtime[50] = "";
+	time_t basictime;
+	int length;
+
+	basictime = record->timestamp - atof(config->timezone) * 60 * 60;
+	strftime(datestring, sizeof(datestring), "&dateutc=%Y-%m-%d+%H%%3A%M%%3A%S",
+	         localtime(&basictime));
+
+	if (gust >= 0)
+		snprintf(gustline, sizeof(gustline), "&windgustmph=%.2f", gust * MILES_PER_HOUR);
+
+	if (rapidfire > 0)
+		snprintf(realtime, sizeof(realtime), "&realtime=1&rtfreq=%.1f", rapidfire);
+
+	length = snprintf(query, size,
+	                  "%s?ID=%s&PASSWORD=%s%s&tempf=%.2f&dewptf=%.2f&humidity=%d"
+	                  "&windspeedmph=%.2f&winddir=%.1f%s&rainin=%.2f&dailyrainin=%.2f"
+	                  "&baromin=%.3f&softwaretype=open2300-%s&action=updateraw%s",
+	                  WEATHER_UNDERGROUND_PATH, config->weather_underground_id,
+	                  config->weather_underground_password, datestring,
+	                  record->temperature_outdoor * 9 / 5 + 32,
+	                  record->dewpoint * 9 / 5 + 32, record->humidity_outdoor,
+	                  record->windspeed * MILES_PER_HOUR, record->winddir_degrees,
+	                  gustline, record->rain_1h / INCHES, record->rain_24h / INCHES,
+	                  record->rel_pressure / INCHES_HG, VERSION, realtime);
+
+	if (length < 0 || length >= size)
+		return -1;
+
+	return length;
+}
+
+
+/********************************************************************
+ * format_aprs_report writes a reading as the APRS weather report of
+ * Citizen Weather, in its units (deg F, miles/hour, hundredths of an
+ * inch and tenths of millibars)
+ *
+ * Input:   config - call sign, position and time zone
+ *          record - the reading, metric units
+ *          size - of report
+ *
+ * Output:  report - zero terminated, without line end
+ *
+ * Returns: length, -1 if it did not fit
+ *
+ ********************************************************************/
+int format_aprs_report(struct config_type *config, struct log_record *record,
+                       char *report, int size)
+{
+	char datestring[50];
+	time_t basictime;
+	int length;
+
+	basictime = record->timestamp - atof(config->timezone) * 60 * 60;
+	strftime(datestring, sizeof(datestring), "@%d%H%Mz", localtime(&basictime));
+
+	length = snprintf(report, size,
+	                  "%s>APRS,TCPXX*,qAX,%s:%s%s/%s_%03.0f/%03.0ft%03.0fr%03.0fp%03.0f"
+	                  "h%02db%05.0f.%s%s",
+	                  config->citizen_weather_id, config->citizen_weather_id, datestring,
+	                  config->citizen_weather_latitude, config->citizen_weather_longitude,
+	                  record->winddir_degrees, record->windspeed * MILES_PER_HOUR,
+	                  record->temperature_outdoor * 9 / 5 + 32,
+	                  record->rain_1h / INCHES * 100, record->rain_24h / INCHES * 100,
+	                  record->humidity_outdoor, record->rel_pressure / MILLIBARS * 10,
+	                  CW_SOFTWARETYPE, VERSION);
+
+	if (length < 0 || length >= size)
+		return -1;
+
+	return length;
+}
+
+
+/********************************************************************
+ * parse_number converts a decimal number like -12.345 without
+ * using the C library (no locale lookups). Anything that is not
+ * a plain decimal number (e.g. nan) gives NAN.
+ *
+ * Input:   p - first character of the number
+ *          end - first character after the number
+ *
+ * Returns: the value
+ *
+ ********************************************************************/
+static double parse_number(const char *p, const char *end)
+{
+	long mantissa = 0;
+	long divisor = 1;
+	int negative = 0;
+	int digits = 0;
+	int decimals = -1;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = (*p++ == '-');
+
+	for (; p < end; p++)
+	{
+		if (*p >= '0' && *p <= '9')
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			digits++;
+			if (decimals >= 0)
+			{
+				divisor *= 10;
+				decimals++;
+			}
+		}
+		else if (*p == '.' && decimals < 0)
+		{
+			decimals = 0;
+		}
+		else
+		{
+			return NAN;
+		}
+	}
+
+	if (digits == 0 || digits > 18)
+		return NAN;
+
+	return (negative ? -mantissa : mantissa) / (double) divisor;
+}
+
+
+/********************************************************************
+ * parse_humidity converts a humidity field of a log line
+ *
+ * Returns: humidity, HUMIDITY_MISSING if the field is not a number
+ *          or out of range
+ *
+ ********************************************************************/
+static int parse_humidity(const char *p, const char *end)
+{
+	double value = parse_number(p, end);
+
+	if (!isfinite(value) || value < 0 || value > 255)
+		return HUMIDITY_MISSING;
+
+	return (int) value;
+}
+
+
+/********************************************************************
+ * parse_log_timestamp converts the 14 digit YYYYMMDDhhmmss key
+ * that starts every log line to a time_t (local time).
+ *
+ * Input:   key - pointer to the first digit
+ *
+ * Returns: time, -1 if the key is not valid
+ *
+ ********************************************************************/
+time_t parse_log_timestamp(const char *key)
+{
+	struct time_cache cache;
+
+	memset(&cache, 0, sizeof(cache));
+
+	return parse_log_timestamp_cached(key, &cache);
+}
+
+
+/********************************************************************
+ * parse_log_timestamp_cached is parse_log_timestamp with a cache
+ * of the start of the last hour seen. mktime is by far the slowest
+ * part of parsing a log line and consecutive lines are nearly always
+ * in the same hour. Daylight saving changes are on whole hours so
+ * adding minutes and seconds to the hour start is exact.
+ *
+ * Input:   key - pointer to the first digit
+ *          cache - cache owned by the caller, zeroed before first use
+ *
+ * Returns: time, -1 if the key is not valid
+ *
+ ********************************************************************/
+time_t parse_log_timestamp_cached(const char *key, struct time_cache *cache)
+{
+	struct tm time_tm;
+	int value[14];
+	int i;
+
+	for (i = 0; i < 14; i++)
+	{
+		if (key[i] < '0' || key[i] > '9')
+			return -1;
+		value[i] = key[i] - '0';
+	}
+
+	if (!cache->valid || memcmp(cache->hour, key, 10) != 0)
+	{
+		memset(&time_tm, 0, sizeof(time_tm));
+		time_tm.tm_year = value[0]*1000 + value[1]*100 + value[2]*10 + value[3] - 1900;
+		time_tm.tm_mon  = value[4]*10 + value[5] - 1;
+		time_tm.tm_mday = value[6]*10 + value[7];
+		time_tm.tm_hour = value[8]*10 + value[9];
+		time_tm.tm_isdst = -1;
+
+		if ((cache->hour_start = mktime(&time_tm)) == -1)
+			return -1;
+
+		memcpy(cache->hour, key, 10);
+		cache->valid = 1;
+	}
+
+	return cache->hour_start + (value[10]*10 + value[11]) * 60 + value[12]*10 + value[13];
+}
+
+
+/********************************************************************
+ * parse_log_line reads one line from a log2300 or histlog2300 log
+ * file. The format is detected from the number of fields.
+ * Uses a static time cache so it is not thread safe, threads must
+ * call parse_log_record with a cache each.
+ *
+ * Input:   line - the text line, need not be zero terminated
+ *          length - number of characters in line (newline optional)
+ *
+ * Output:  record - the values of the line
+ *
+ * Returns: 1 on success, 0 if the line is not a valid log line
+ *
+ ********************************************************************/
+int parse_log_line(const char *line, int length, struct log_record *record)
+{
+	static struct time_cache cache;
+
+	return parse_log_record(line, length, record, &cache);
+}
+
+
+/********************************************************************
+ * parse_log_record is parse_log_line with a time cache owned by
+ * the caller
+ *
+ ********************************************************************/
+int parse_log_record(const char *line, int length, struct log_record *record,
+                     struct time_cache *cache)
+{
+	const char *field[20];
+	const char *field_end[20];
+	const char *p = line;
+	const char *end = line + length;
+	char name[10];
+	int fields = 0;
+	int n;
+
+	// Split line in space separated fields
+	while (p < end && fields < 20)
+	{
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		if (p >= end || *p == '\n' || *p == '\r')
+			break;
+		field[fields] = p;
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+			p++;
+		field_end[fields++] = p;
+	}
+
+	if (fields == 18)
+		record->format = LOG_FORMAT_CURRENT;
+	else if (fields == 14)
+		record->format = LOG_FORMAT_HISTORY;
+	else
+		return 0;
+
+	if (field_end[0] - field[0] != 14 ||
+	    (record->timestamp = parse_log_timestamp_cached(field[0], cache)) == -1)
+		return 0;
+
+	// field 1 and 2 are the human readable date and time
+	record->temperature_indoor  = parse_number(field[3], field_end[3]);
+	record->temperature_outdoor = parse_number(field[4], field_end[4]);
+	record->dewpoint            = parse_number(field[5], field_end[5]);
+	record->humidity_indoor     = parse_humidity(field[6], field_end[6]);
+	record->humidity_outdoor    = parse_humidity(field[7], field_end[7]);
+	record->windspeed           = parse_number(field[8], field_end[8]);
+	record->winddir_degrees     = parse_number(field[9], field_end[9]);
+	// field 10 is the direction text which follows from the degrees
+	record->windchill           = parse_number(field[11], field_end[11]);
+
+	if (record->format == LOG_FORMAT_HISTORY)
+	{
+		record->rain_1h      = 0;
+		record->rain_24h     = 0;
+		record->rain_total   = parse_number(field[12], field_end[12]);
+		record->rel_pressure = parse_number(field[13], field_end[13]);
+		record->tendency     = -1;
+		record->forecast     = -1;
+		return 1;
+	}
+
+	record->rain_1h      = parse_number(field[12], field_end[12]);
+	record->rain_24h     = parse_number(field[13], field_end[13]);
+	record->rain_total   = parse_number(field[14], field_end[14]);
+	record->rel_pressure = parse_number(field[15], field_end[15]);
+
+	n = field_end[16] - field[16] < 9 ? field_end[16] - field[16] : 9;
+	memcpy(name, field[16], n);
+	name[n] = '\0';
+	record->tendency = name_index(tendency_names, 3, name);
+
+	n = field_end[17] - field[17] < 9 ? field_end[17] - field[17] : 9;
+	memcpy(name, field[17], n);
+	name[n] = '\0';
+	record->forecast = name_index(forecast_names, 3, name);
+
+	return 1;
+}
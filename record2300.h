@@ -0,0 +1,92 @@
+/* open2300 - record2300.h
+ * Include file for the log record functions.
+ * A log record is one line of the log2300 or histlog2300 log files
+ * held as numbers so it can be stored in other formats.
+ * A current reading can also be written as the key and value lines
+ * of fetch2300, and those lines as a JSON object, and as the uploads
+ * of wu2300 and cw2300.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_RECORD2300_H_
+#define _INCLUDE_RECORD2300_H_
+
+#include "rw2300.h"
+
+#define LOG_FORMAT_CURRENT   0   // log2300 line - incl rain 1h/24h, tendency, forecast
+#define LOG_FORMAT_HISTORY   1   // histlog2300 line - rain total and pressure only
+
+#define LOG_LINE_SIZE        300
+#define FETCH_TEXT_SIZE      512   // format_fetch_text of a current reading
+#define FETCH_JSON_SIZE      8192  // format_fetch_json of all fetch2300 lines
+
+#define CW_SOFTWARETYPE      "open2300v"   // in the APRS report
+
+#define HUMIDITY_MISSING     -1  // humidity of a log line that has none
+
+#define CURRENT_ITEMS        12  // station reads of a LOG_FORMAT_CURRENT record
+
+struct log_record
+{
+	time_t timestamp;
+	int    format;                 // LOG_FORMAT_CURRENT or LOG_FORMAT_HISTORY
+	double temperature_indoor;
+	double temperature_outdoor;
+	double dewpoint;
+	int    humidity_indoor;        // HUMIDITY_MISSING if not valid
+	int    humidity_outdoor;       // HUMIDITY_MISSING if not valid
+	double windspeed;
+	double winddir_degrees;
+	double windchill;
+	double rain_1h;                // not in LOG_FORMAT_HISTORY
+	double rain_24h;               // not in LOG_FORMAT_HISTORY
+	double rain_total;
+	double rel_pressure;
+	int    tendency;               // index in tendency_names, -1 if not logged
+	int    forecast;               // index in forecast_names, -1 if not logged
+};
+
+struct current_item
+{
+	int    address;
+	int    bytes;
+};
+
+struct time_cache
+{
+	int    valid;
+	char   hour[10];               // YYYYMMDDhh of hour_start
+	time_t hour_start;
+};
+
+extern const char *wind_directions[16];
+extern const char *tendency_names[3];
+extern const char *forecast_names[3];
+extern const struct current_item current_items[CURRENT_ITEMS];
+
+int name_index(const char **names, int count, const char *name);
+
+void decode_current(struct log_record *reading, int address, unsigned char *data);
+
+int format_log_line(struct log_record *record, char *line, int size);
+
+int format_fetch_text(struct log_record *record, char *text, int size);
+
+int format_fetch_json(const char *text, time_t timestamp, char *json, int size);
+
+int format_wu_query(struct config_type *config, struct log_record *record,
+                    double gust, double rapidfire, char *query, int size);
+
+int format_aprs_report(struct config_type *config, struct log_record *record,
+                       char *report, int size);
+
+int parse_log_line(const char *line, int length, struct log_record *record);
+
+int parse_log_record(const char *line, int length, struct log_record *record,
+                     struct time_cache *cache);
+
+time_t parse_log_timestamp(const char *key);
+
+time_t parse_log_timestamp_cached(const char *key, struct time_cache *cache);
+
+#endif /* _INCLUDE_RECORD2300_H_ */
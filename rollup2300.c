@@ -0,0 +1,147 @@
+/*  open2300 - rollup2300.c
+ *
+ *  Version 1.11
+ *
+ *  Hourly, daily and monthly rollup of readings. See rollup2300.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "rollup2300.h"
+
+const char rollup_periods[ROLLUP_PERIODS] = {'h', 'd', 'm'};
+
+
+/********************************************************************
+ * period_start gives the first second of the period of a time.
+ * Same as the start computed by the weather_rollup triggers.
+ *
+ * Input:   period - 'h', 'd' or 'm'
+ *          datetime - "YYYY-MM-DD HH:MM:SS"
+ *
+ * Output:  start - room for ROLLUP_TIME characters
+ *
+ ********************************************************************/
+static void period_start(char period, const char *datetime, char *start)
+{
+	switch (period)
+	{
+	case 'h':
+		snprintf(start, ROLLUP_TIME, "%.13s:00:00", datetime);
+		break;
+	case 'd':
+		snprintf(start, ROLLUP_TIME, "%.10s 00:00:00", datetime);
+		break;
+	default:
+		snprintf(start, ROLLUP_TIME, "%.7s-01 00:00:00", datetime);
+		break;
+	}
+}
+
+
+/********************************************************************
+ * rollup_init prepares an empty set of periods
+ *
+ * Input:   write - called with each finished period
+ *          context - passed to write
+ *
+ * Output:  set
+ *
+ ********************************************************************/
+void rollup_init(struct rollup_set *set, rollup_writer write, void *context)
+{
+	int i;
+
+	memset(set, 0, sizeof(*set));
+
+	for (i = 0; i < ROLLUP_PERIODS; i++)
+		set->period[i].period = rollup_periods[i];
+
+	set->write = write;
+	set->context = context;
+}
+
+
+/********************************************************************
+ * rollup_add adds a reading. Readings must come in time order.
+ * Periods that the reading is past are written and started over.
+ *
+ * Input:   set
+ *          datetime - time of the reading
+ *          values - ROLLUP_FIELDS values in the order of the columns
+ *
+ * Returns: 0 on success, -1 if a period could not be written
+ *
+ ********************************************************************/
+int rollup_add(struct rollup_set *set, const char *datetime, const double *values)
+{
+	struct rollup *rollup;
+	char start[ROLLUP_TIME];
+	int i, j;
+
+	for (i = 0; i < ROLLUP_PERIODS; i++)
+	{
+		rollup = &set->period[i];
+		period_start(rollup->period, datetime, start);
+
+		if (rollup->count > 0 && strcmp(start, rollup->start) != 0)
+		{
+			if (set->write(set->context, rollup) != 0)
+				return -1;
+			set->written++;
+			rollup->count = 0;
+		}
+
+		if (rollup->count == 0)
+		{
+			strcpy(rollup->start, start);
+			for (j = 0; j < ROLLUP_FIELDS; j++)
+			{
+				rollup->min[j] = values[j];
+				rollup->max[j] = values[j];
+				rollup->sum[j] = 0;
+			}
+		}
+
+		for (j = 0; j < ROLLUP_FIELDS; j++)
+		{
+			if (values[j] < rollup->min[j])
+				rollup->min[j] = values[j];
+			if (values[j] > rollup->max[j])
+				rollup->max[j] = values[j];
+			rollup->sum[j] += values[j];
+			rollup->last[j] = values[j];
+		}
+
+		snprintf(rollup->last_time, ROLLUP_TIME, "%s", datetime);
+		rollup->count++;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * rollup_finish writes the periods still open after the last reading
+ *
+ * Returns: 0 on success, -1 if a period could not be written
+ *
+ ********************************************************************/
+int rollup_finish(struct rollup_set *set)
+{
+	int i;
+
+	for (i = 0; i < ROLLUP_PERIODS; i++)
+	{
+		if (set->period[i].count == 0)
+			continue;
+
+		if (set->write(set->context, &set->period[i]) != 0)
+			return -1;
+
+		set->written++;
+		set->period[i].count = 0;
+	}
+
+	return 0;
+}
@@ -0,0 +1,53 @@
+/* open2300 - rollup2300.h
+ * Include file for the hourly, daily and monthly rollup of readings.
+ *
+ * The weather tables of mysql2300.sql and sqlitelog2300.sql have a
+ * weather_rollup table that a trigger keeps up to date. The functions
+ * here rebuild it in one pass over readings sorted by time: only the
+ * open hour, day and month are kept in memory and a period is handed
+ * to the writer when the first reading after it arrives.
+ * Times are text "YYYY-MM-DD HH:MM:SS" as stored in the databases.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_ROLLUP2300_H_
+#define _INCLUDE_ROLLUP2300_H_
+
+#include "rw2300.h"
+
+#define ROLLUP_FIELDS   9          // columns rolled up, see the .sql files
+#define ROLLUP_PERIODS  3          // hour, day, month
+#define ROLLUP_TIME     20         // room for a time text
+
+struct rollup
+{
+	char   period;                 // 'h', 'd' or 'm'
+	char   start[ROLLUP_TIME];     // first second of the period
+	char   last_time[ROLLUP_TIME];
+	long   count;                  // 0 = no reading yet
+	double min[ROLLUP_FIELDS];
+	double max[ROLLUP_FIELDS];
+	double sum[ROLLUP_FIELDS];
+	double last[ROLLUP_FIELDS];
+};
+
+/* Stores a finished period. Returns 0 on success, -1 if fail. */
+typedef int (*rollup_writer)(void *context, const struct rollup *rollup);
+
+struct rollup_set
+{
+	struct rollup period[ROLLUP_PERIODS];
+	rollup_writer write;
+	void          *context;
+	long          written;         // periods handed to write
+};
+
+extern const char rollup_periods[ROLLUP_PERIODS];
+
+void rollup_init(struct rollup_set *set, rollup_writer write, void *context);
+
+int  rollup_add(struct rollup_set *set, const char *datetime, const double *values);
+
+int  rollup_finish(struct rollup_set *set);
+
+#endif /* _INCLUDE_ROLLUP2300_H_ */
@@ -10,6 +10,9 @@
  */
 
 #include "rw2300.h"
+#include "trace2300.h"
+#include "stats2300.h"
+#include "link2300.h"
 
 /********************************************************************/
 /* temperature_indoor
@@ -2198,55 +2201,33 @@ int read_history_info(WEATHERSTATION ws2300, int *interval, int *countdown,
 
 
 /********************************************************************
- * read_history_record
- * Read the history information like interval, countdown, time
- * of last record, pointer to last record.
- * 
- * Input:  Handle to weatherstation
+ * decode_history_record
+ * Converts the 10 bytes of a history record into values, see
+ * read_history_record.
+ *
+ * Input:  data - the bytes read at 0x6C6 + record*19
  *         config structure with conversion factors
- *         record - record index number to be read [0x00-0xAE]
- *        
- * Output: temperature_indoor (double)
- *         temperature_indoor (double)
- *         pressure (double)
- *         humidity_indoor (integer)
- *         humidity_outdoor (integer)
- *         raincount (double)
- *         windspeed (double)
- *         windir_degrees (double)
- *         dewpoint (double) - calculated
- *         windchill (double) - calculated, new post 2001 formula
  *
- * Returns: interger index number pointing to next record 
+ * Output: as read_history_record
  *
  ********************************************************************/
-int read_history_record(WEATHERSTATION ws2300,
-                        int record,
-                        struct config_type *config,
-                        double *temperature_indoor,
-                        double *temperature_outdoor,
-                        double *pressure,
-                        int *humidity_indoor,
-                        int *humidity_outdoor,
-                        double *raincount,
-                        double *windspeed,
-                        double *winddir_degrees,
-                        double *dewpoint,
-                        double *windchill)
+void decode_history_record(unsigned char *data,
+                           struct config_type *config,
+                           double *temperature_indoor,
+                           double *temperature_outdoor,
+                           double *pressure,
+                           int *humidity_indoor,
+                           int *humidity_outdoor,
+                           double *raincount,
+                           double *windspeed,
+                           double *winddir_degrees,
+                           double *dewpoint,
+                           double *windchill)
 {
-	unsigned char data[20];
-	unsigned char command[25];
-	int address;
-	int bytes=10;
 	long int tempint;
 	double A, B, C; // Intermediate values used for dewpoint calculation
 	double wind_kmph;
 
-	address = 0x6C6 + record*19;
-
-	if (read_safe(ws2300, address, bytes, data, command) != bytes)
-	    read_error_exit();
-	
 	tempint = (data[4]<<12) + (data[3]<<4) + (data[2] >> 4);
 	
 	*pressure = 1000 + (tempint % 10000)/10.0;
@@ -2303,7 +2284,60 @@ int read_history_record(WEATHERSTATION ws2300,
 	}
 	
 	*windspeed *= config->wind_speed_conv_factor;
-	
+}
+
+
+/********************************************************************
+ * read_history_record
+ * Read the history information like interval, countdown, time
+ * of last record, pointer to last record.
+ * 
+ * Input:  Handle to weatherstation
+ *         config structure with conversion factors
+ *         record - record index number to be read [0x00-0xAE]
+ *        
+ * Output: temperature_indoor (double)
+ *         temperature_indoor (double)
+ *         pressure (double)
+ *         humidity_indoor (integer)
+ *         humidity_outdoor (integer)
+ *         raincount (double)
+ *         windspeed (double)
+ *         windir_degrees (double)
+ *         dewpoint (double) - calculated
+ *         windchill (double) - calculated, new post 2001 formula
+ *
+ * Returns: interger index number pointing to next record 
+ *
+ ********************************************************************/
+int read_history_record(WEATHERSTATION ws2300,
+                        int record,
+                        struct config_type *config,
+                        double *temperature_indoor,
+                        double *temperature_outdoor,
+                        double *pressure,
+                        int *humidity_indoor,
+                        int *humidity_outdoor,
+                        double *raincount,
+                        double *windspeed,
+                        double *winddir_degrees,
+                        double *dewpoint,
+                        double *windchill)
+{
+	unsigned char data[20];
+	unsigned char command[25];
+	int address;
+	int bytes=10;
+
+	address = 0x6C6 + record*19;
+
+	if (read_safe(ws2300, address, bytes, data, command) != bytes)
+	    read_error_exit();
+
+	decode_history_record(data, config, temperature_indoor, temperature_outdoor,
+	                      pressure, humidity_indoor, humidity_outdoor, raincount,
+	                      windspeed, winddir_degrees, dewpoint, windchill);
+
 	return (++record)%0xAF;
 }
 
@@ -2362,6 +2396,79 @@ void write_error_exit(void)
 }
 
 
+/********************************************************************
+ * buffer_printf
+ * printf style append to a zero terminated string buffer.
+ * Used to render a complete document in memory before it is
+ * written anywhere. The buffer is never overrun.
+ *
+ * Input:   buffer - zero terminated string to append to
+ *          size - total size of buffer including terminator
+ *          format and arguments as for printf
+ *
+ * Returns: length of the string in the buffer after appending,
+ *          -1 if the text did not fit (buffer is then truncated)
+ *
+ ********************************************************************/
+int buffer_printf(char *buffer, int size, const char *format, ...)
+{
+	va_list args;
+	int length = strlen(buffer);
+	int written;
+
+	va_start(args, format);
+	written = vsnprintf(buffer + length, size - length, format, args);
+	va_end(args);
+
+	if (written < 0 || length + written >= size)
+		return -1;
+
+	return length + written;
+}
+
+
+/********************************************************************
+ * file_unchanged
+ * Compares a rendered document with the file already on disk.
+ * Bytes before compare_from (e.g. a timestamp header of fixed
+ * length) are ignored so a new timestamp alone does not count
+ * as a change.
+ *
+ * Input:   path - file to compare with
+ *          data - the new document
+ *          size - length of the new document
+ *          compare_from - offset where the comparison starts
+ *
+ * Returns: 1 if the file exists and has the same content,
+ *          0 otherwise
+ *
+ ********************************************************************/
+int file_unchanged(char *path, const char *data, int size, int compare_from)
+{
+	FILE *fptr;
+	char *old;
+	int old_size;
+	int unchanged = 0;
+
+	if ((fptr = fopen(path, "rb")) == NULL)
+		return 0;
+
+	old = malloc(size + 1);
+	if (old != NULL)
+	{
+		old_size = fread(old, 1, size + 1, fptr);
+		if (old_size == size && compare_from <= size &&
+		    memcmp(old + compare_from, data + compare_from, size - compare_from) == 0)
+			unchanged = 1;
+		free(old);
+	}
+
+	fclose(fptr);
+
+	return unchanged;
+}
+
+
 /********************************************************************
  * get_configuration()
  *
@@ -2390,6 +2497,7 @@ int get_configuration(struct config_type *config, char *path)
 	char token[100] = "";
 	char val[100] = "";
 	char val2[100] = "";
+	int i;
 	
 	// First we set everything to defaults - faster than many if statements
 	strcpy(config->serial_device_name, DEFAULT_SERIAL_DEVICE);  // Name of serial device
@@ -2404,6 +2512,8 @@ int get_configuration(struct config_type *config, char *path)
 	strcpy(config->aprs_host[2].name, "second.aprs.net");       // host2 name
 	config->aprs_host[2].port = 14580;                          // host2 port
 	config->num_hosts = 0;                                      // will not count yet
+	for (i = 0; i < MAX_APRS_HOSTS; i++)
+		config->aprs_host[i].latency = 0;                       // not tried yet
 	strcpy(config->weather_underground_id, "WUID");             // Weather Underground ID 
 	strcpy(config->weather_underground_password, "WUPassword"); // Weather Underground Password
 	strcpy(config->timezone, "1");                              // Timezone, default CET
@@ -2416,9 +2526,22 @@ int get_configuration(struct config_type *config, char *path)
 	strcpy(config->mysql_passwd, "mysql2300");          // Password for MySQL database user
 	strcpy(config->mysql_database, "open2300");         // Name of MySQL database
 	config->mysql_port = 0;                             // MySQL port. 0 means default port/socket
+	config->mysql_batch_size = 0xAF;                    // Whole history in one INSERT
 	strcpy(config->pgsql_connect, "hostaddr='127.0.0.1'dbname='open2300'user='postgres'"); // connection string
 	strcpy(config->pgsql_table, "weather");             // PgSQL table name
 	strcpy(config->pgsql_station, "open2300");          // Unique station id
+	strcpy(config->sqlite_journal_mode, "WAL");         // SQLite journal mode
+	strcpy(config->sqlite_synchronous, "NORMAL");       // SQLite sync on commit
+	strcpy(config->spool_directory, "");                // No store-and-forward
+	strcpy(config->aprs_latency_file, "");              // APRS host latency not kept
+	strcpy(config->dns_cache_file, "");                 // Addresses not kept between runs
+	config->dns_cache_ttl = 300;                        // Look up hosts every 5 minutes
+	config->num_stations = 0;                           // Only the station of this file
+	strcpy(config->serial_trace, "");                   // Serial session not recorded
+	config->serial_replay_speed = 1.0;                  // Replay with the recorded timing
+	strcpy(config->metrics_file, "");                   // No Prometheus textfile
+	strcpy(config->link_profile_dir, "");               // Built-in serial timing
+	strcpy(config->fetch_cache, "");                    // fetch2300 only prints
 
 	// open the config file
 
@@ -2573,6 +2696,12 @@ int get_configuration(struct config_type *config, char *path)
 			continue;
 		}
 
+		if ( (strcmp(token,"MYSQL_BATCH_SIZE") == 0) && (atoi(val) > 0) )
+		{
+			config->mysql_batch_size = atoi(val);
+			continue;
+		}
+
 		if ( (strcmp(token,"PGSQL_CONNECT") == 0) && (strlen(val) != 0) )
 		{
 			strcpy(config->pgsql_connect, val);
@@ -2590,6 +2719,89 @@ int get_configuration(struct config_type *config, char *path)
 			strcpy(config->pgsql_station, val);
 			continue;
 		}
+
+		if ( (strcmp(token,"SQLITE_JOURNAL_MODE") == 0) && (strlen(val) != 0) &&
+		     (strlen(val) < sizeof(config->sqlite_journal_mode)) )
+		{
+			strcpy(config->sqlite_journal_mode, val);
+			continue;
+		}
+
+		if ( (strcmp(token,"SQLITE_SYNCHRONOUS") == 0) && (strlen(val) != 0) &&
+		     (strlen(val) < sizeof(config->sqlite_synchronous)) )
+		{
+			strcpy(config->sqlite_synchronous, val);
+			continue;
+		}
+
+		if ( (strcmp(token,"SPOOL_DIRECTORY") == 0) && (strlen(val) != 0) &&
+		     (strlen(val) < sizeof(config->spool_directory)) )
+		{
+			strcpy(config->spool_directory, val);
+			continue;
+		}
+
+		if ( (strcmp(token,"APRS_LATENCY_FILE") == 0) && (strlen(val) != 0) &&
+		     (strlen(val) < sizeof(config->aprs_latency_file)) )
+		{
+			strcpy(config->aprs_latency_file, val);
+			continue;
+		}
+
+		if ( (strcmp(token,"DNS_CACHE_FILE") == 0) && (strlen(val) != 0) &&
+		     (strlen(val) < sizeof(config->dns_cache_file)) )
+		{
+			strcpy(config->dns_cache_file, val);
+			continue;
+		}
+
+		if ( (strcmp(token,"DNS_CACHE_TTL") == 0) && (atoi(val) > 0) )
+		{
+			config->dns_cache_ttl = atoi(val);
+			continue;
+		}
+
+		if ((strcmp(token,"SERIAL_TRACE")==0) && (strlen(val)!=0))
+		{
+			snprintf(config->serial_trace, sizeof(config->serial_trace), "%s", val);
+			continue;
+		}
+
+		if ((strcmp(token,"SERIAL_REPLAY_SPEED")==0) && (atof(val) >= 0))
+		{
+			config->serial_replay_speed = atof(val);
+			continue;
+		}
+
+		if ((strcmp(token,"METRICS_FILE")==0) && (strlen(val)!=0))
+		{
+			snprintf(config->metrics_file, sizeof(config->metrics_file), "%s", val);
+			continue;
+		}
+
+		if ((strcmp(token,"FETCH_CACHE")==0) && (strlen(val)!=0))
+		{
+			snprintf(config->fetch_cache, sizeof(config->fetch_cache), "%s", val);
+			continue;
+		}
+
+		if ((strcmp(token,"LINK_PROFILE_DIR")==0) && (strlen(val)!=0))
+		{
+			snprintf(config->link_profile_dir, sizeof(config->link_profile_dir), "%s", val);
+			continue;
+		}
+
+		if ((strcmp(token,"STATION")==0) && (strlen(val)!=0) && (strlen(val2)!=0))
+		{
+			if (config->num_stations >= MAX_STATIONS)
+				continue;           // ignore stations over the defined max
+			snprintf(config->stations[config->num_stations].id,
+			         sizeof(config->stations[0].id), "%s", val);
+			snprintf(config->stations[config->num_stations].config_file,
+			         sizeof(config->stations[0].config_file), "%s", val2);
+			config->num_stations++;
+			continue;
+		}
 		
 	}
 	
@@ -2599,6 +2811,13 @@ int get_configuration(struct config_type *config, char *path)
 		config->num_hosts = 3;
 	}
 
+	fclose(fptr);
+
+	// read_device and write_device record or replay with these
+	trace_setup(config->serial_trace, config->serial_replay_speed);
+	// open_weatherstation loads the timing profile of the device from here
+	link_setup(config->link_profile_dir);
+
 	return (0);
 }
 
@@ -2786,6 +3005,40 @@ int initialize(WEATHERSTATION ws2300)
 }
 
 
+/********************************************************************
+ * transaction_failed counts a failed read_data or write_data
+ *
+ * Input:   histogram - of the transaction
+ *          start - clock_microseconds when it started
+ *
+ * Returns: -1
+ *
+ ********************************************************************/
+static int transaction_failed(struct stats_histogram *histogram, long long start)
+{
+	stats_get()->failed++;
+	stats_add(histogram, start);
+
+	return -1;
+}
+
+
+/********************************************************************
+ * send_command sends one command byte, after the pause between
+ * command bytes of the link timing
+ *
+ * Returns: number of bytes written
+ *
+ ********************************************************************/
+static int send_command(WEATHERSTATION ws2300, unsigned char *command)
+{
+	if (link_timing()->byte_delay > 0)
+		sleep_short(link_timing()->byte_delay);
+
+	return write_device(ws2300, command, 1);
+}
+
+
 /********************************************************************
  * read_data reads data from the WS2300 based on a given address,
  * number of data read, and a an already open serial port
@@ -2805,10 +3058,13 @@ int initialize(WEATHERSTATION ws2300)
 int read_data(WEATHERSTATION ws2300, int address, int number,
 			  unsigned char *readdata, unsigned char *commanddata)
 {
-
+	struct protocol_stats *stats = stats_get();
+	long long start = clock_microseconds();
 	unsigned char answer;
 	int i;
 
+	stats->transactions++;
+
 	// First 4 bytes are populated with converted address range 0000-13B0
 	address_encoder(address, commanddata);
 	// Last populate the 5th byte with the converted number of bytes
@@ -2816,35 +3072,46 @@ int read_data(WEATHERSTATION ws2300, int address, int number,
 
 	for (i = 0; i < 4; i++)
 	{
-		if (write_device(ws2300, commanddata + i, 1) != 1)
-			return -1;
+		if (send_command(ws2300, commanddata + i) != 1)
+			return transaction_failed(&stats->read_data, start);
 		if (read_device(ws2300, &answer, 1) != 1)
-			return -1;
+			return transaction_failed(&stats->read_data, start);
 		if (answer != command_check0123(commanddata + i, i))
-			return -1;
+		{
+			stats->echo_mismatches++;
+			return transaction_failed(&stats->read_data, start);
+		}
 	}
 
 	//Send the final command that asks for 'number' of bytes, check answer
-	if (write_device(ws2300, commanddata + 4, 1) != 1)
-		return -1;
+	if (send_command(ws2300, commanddata + 4) != 1)
+		return transaction_failed(&stats->read_data, start);
 	if (read_device(ws2300, &answer, 1) != 1)
-		return -1;
+		return transaction_failed(&stats->read_data, start);
 	if (answer != command_check4(number))
-		return -1;
+	{
+		stats->echo_mismatches++;
+		return transaction_failed(&stats->read_data, start);
+	}
 
 	//Read the data bytes
 	for (i = 0; i < number; i++)
 	{
 		if (read_device(ws2300, readdata + i, 1) != 1)
-			return -1;
+			return transaction_failed(&stats->read_data, start);
 	}
 
 	//Read and verify checksum
 	if (read_device(ws2300, &answer, 1) != 1)
-		return -1;
+		return transaction_failed(&stats->read_data, start);
 	if (answer != data_checksum(readdata, number))
-		return -1;
-		
+	{
+		stats->checksum_failures++;
+		return transaction_failed(&stats->read_data, start);
+	}
+
+	stats_add(&stats->read_data, start);
+
 	return i;
 
 }
@@ -2877,10 +3144,14 @@ int write_data(WEATHERSTATION ws2300, int address, int number,
 			   unsigned char encode_constant, unsigned char *writedata,
 			   unsigned char *commanddata)
 {
+	struct protocol_stats *stats = stats_get();
+	long long start = clock_microseconds();
 	unsigned char answer;
 	unsigned char encoded_data[80];
 	int i = 0;
 	unsigned char ack_constant = WRITEACK;
+
+	stats->transactions++;
 	
 	if (encode_constant == SETBIT)
 	{
@@ -2899,26 +3170,34 @@ int write_data(WEATHERSTATION ws2300, int address, int number,
 	//Write the 4 address bytes
 	for (i = 0; i < 4; i++)
 	{
-		if (write_device(ws2300, commanddata + i, 1) != 1)
-			return -1;
+		if (send_command(ws2300, commanddata + i) != 1)
+			return transaction_failed(&stats->write_data, start);
 		if (read_device(ws2300, &answer, 1) != 1)
-			return -1;
+			return transaction_failed(&stats->write_data, start);
 		if (answer != command_check0123(commanddata + i, i))
-			return -1;
+		{
+			stats->echo_mismatches++;
+			return transaction_failed(&stats->write_data, start);
+		}
 	}
 
 	//Write the data nibbles or set/unset the bits
 	for (i = 0; i < number; i++)
 	{
-		if (write_device(ws2300, encoded_data + i, 1) != 1)
-			return -1;
+		if (send_command(ws2300, encoded_data + i) != 1)
+			return transaction_failed(&stats->write_data, start);
 		if (read_device(ws2300, &answer, 1) != 1)
-			return -1;
+			return transaction_failed(&stats->write_data, start);
 		if (answer != (writedata[i] + ack_constant))
-			return -1;
+		{
+			stats->echo_mismatches++;
+			return transaction_failed(&stats->write_data, start);
+		}
 		commanddata[i + 4] = encoded_data[i];
 	}
 
+	stats_add(&stats->write_data, start);
+
 	return i;
 }
 
@@ -2928,6 +3207,8 @@ int write_data(WEATHERSTATION ws2300, int address, int number,
  * Reads data from the WS2300 based on a given address,
  * number of data read, and a an already open serial port
  * Uses the read_data function and has same interface
+ * The tries and the most bytes per read_data are those of the link
+ * timing (link2300.h)
  *
  * Inputs:  ws2300 - device number of the already open serial port
  *          address (interger - 16 bit)
@@ -2944,22 +3225,39 @@ int write_data(WEATHERSTATION ws2300, int address, int number,
 int read_safe(WEATHERSTATION ws2300, int address, int number,
 			  unsigned char *readdata, unsigned char *commanddata)
 {
-	int j;
+	struct link_timing *timing = link_timing();
+	long long start = clock_microseconds();
+	int done, part, j;
 
-	for (j = 0; j < MAXRETRIES; j++)
+	// In parts of at most read_size bytes, each tried on its own
+	for (done = 0; done < number; done += part)
 	{
-		reset_06(ws2300);
-		
-		// Read the data. If expected number of bytes read break out of loop.
-		if (read_data(ws2300, address, number, readdata, commanddata)==number)
+		part = number - done < timing->read_size ? number - done : timing->read_size;
+
+		for (j = 0; j < timing->retries; j++)
 		{
-			break;
+			if (j > 0)
+				stats_retry(stats_get(), address + 2 * done);
+
+			reset_06(ws2300);
+
+			// Read the data. If expected number of bytes read break out of loop.
+			if (read_data(ws2300, address + 2 * done, part, readdata + done,
+			              commanddata) == part)
+			{
+				break;
+			}
 		}
+
+		// If we have tried retries times to read we expect not to
+		// have valid data
+		if (j == timing->retries)
+			break;
 	}
 
-	// If we have tried MAXRETRIES times to read we expect not to
-	// have valid data
-	if (j == MAXRETRIES)
+	stats_add(&stats_get()->read_safe, start);
+
+	if (done < number)
 	{
 		return -1;
 	}
@@ -2997,10 +3295,14 @@ int write_safe(WEATHERSTATION ws2300, int address, int number,
                unsigned char encode_constant, unsigned char *writedata,
                unsigned char *commanddata)
 {
+	long long start = clock_microseconds();
 	int j;
 
-	for (j = 0; j < MAXRETRIES; j++)
+	for (j = 0; j < link_timing()->retries; j++)
 	{
+		if (j > 0)
+			stats_retry(stats_get(), address);
+
 		// printf("Iteration = %d\n",j); // debug
 		reset_06(ws2300);
 
@@ -3012,9 +3314,11 @@ int write_safe(WEATHERSTATION ws2300, int address, int number,
 		}
 	}
 
-	// If we have tried MAXRETRIES times to read we expect not to
+	stats_add(&stats_get()->write_safe, start);
+
+	// If we have tried retries times to write we expect not to
 	// have valid data
-	if (j == MAXRETRIES)
+	if (j == link_timing()->retries)
 	{
 		return -1;
 	}
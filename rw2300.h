@@ -21,6 +21,7 @@
 #include <time.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdarg.h>
 #include <math.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -50,17 +51,25 @@
 
 /* ONLY EDIT THESE IF WEATHER UNDERGROUND CHANGES URL */
 #define WEATHER_UNDERGROUND_BASEURL "weatherstation.wunderground.com"
+#define WEATHER_UNDERGROUND_RAPIDFIRE_URL "rtupdate.wunderground.com"
 #define WEATHER_UNDERGROUND_PATH "/weatherstation/updateweatherstation.php"
 
 #define WEATHER_UNDERGROUND_SOFTWARETYPE   "open2300"
 
 #define MAX_APRS_HOSTS	6
+#define MAX_STATIONS	8
 
 typedef struct {
 	char name[50];
 	int port;
+	int latency;        // ms of the last connect, 0 not tried, -1 failed
 } hostdata;
 
+typedef struct {
+	char id[25];
+	char config_file[100];  // config of the station: device, units, uploads
+} stationdata;
+
 struct config_type
 {
 	char   serial_device_name[50];
@@ -82,9 +91,23 @@ struct config_type
 	char   mysql_passwd[25];
 	char   mysql_database[30];
 	int    mysql_port;                 //0 works for local connection
+	int    mysql_batch_size;           //rows per INSERT of mysqlhistlog2300
 	char   pgsql_connect[128];
 	char   pgsql_table[25];
 	char   pgsql_station[25];
+	char   sqlite_journal_mode[10];    //DELETE, WAL ...
+	char   sqlite_synchronous[10];     //FULL, NORMAL, OFF
+	char   spool_directory[200];       //empty = no spool
+	char   aprs_latency_file[200];     //empty = not kept between runs
+	char   dns_cache_file[200];        //empty = not kept between runs
+	int    dns_cache_ttl;              //seconds
+	char   serial_trace[200];          //empty = serial session not recorded
+	double serial_replay_speed;        //1 = recorded timing, 0 = no waiting
+	char   metrics_file[200];          //empty = no Prometheus textfile
+	char   link_profile_dir[200];      //empty = built-in serial timing
+	char   fetch_cache[200];           //empty = fetch2300 keeps no cache
+	stationdata stations[MAX_STATIONS]; // read by srv2300, none = this config
+	int    num_stations;
 };
 
 struct timestamp
@@ -238,6 +261,19 @@ void tendency_forecast(WEATHERSTATION ws2300, char *tendency, char *forecast);
 int read_history_info(WEATHERSTATION ws2300, int *interval, int *countdown,
                       struct timestamp *time_last, int *no_records);
 
+void decode_history_record(unsigned char *data,
+                           struct config_type *config,
+                           double *temperature_indoor,
+                           double *temperature_outdoor,
+                           double *pressure,
+                           int *humidity_indoor,
+                           int *humidity_outdoor,
+                           double *raincount,
+                           double *windspeed,
+                           double *winddir_degrees,
+                           double *dewpoint,
+                           double *windchill);
+
 int read_history_record(WEATHERSTATION ws2300,
                         int record,
                         struct config_type *config,
@@ -265,6 +301,10 @@ void print_usage(void);
 
 int get_configuration(struct config_type *, char *path);
 
+int buffer_printf(char *buffer, int size, const char *format, ...);
+
+int file_unchanged(char *path, const char *data, int size, int compare_from);
+
 WEATHERSTATION open_weatherstation(char *device);
 
 void close_weatherstation(WEATHERSTATION ws);
@@ -308,5 +348,15 @@ void sleep_short(int milliseconds);
 void sleep_long(int seconds);
 int http_request_url(char *urlline);
 int citizen_weather_send(struct config_type *config, char *datastring);
+int publish_file(char *path, const char *data, int size, int compare_from);
+int sync_file(FILE *stream);
+int make_directory(const char *path);
+int lock_file(FILE *stream, int seconds);
+int network_startup(void);
+int socket_nonblocking(SOCKET sockfd, int nonblocking);
+long clock_milliseconds(void);
+int set_read_timeout(WEATHERSTATION serdevice, int milliseconds);
+
+long long clock_microseconds(void);
 
 #endif /* _INCLUDE_RW2300_H_ */ 
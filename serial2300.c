@@ -0,0 +1,456 @@
+/*  open2300 - serial2300.c
+ *
+ *  Version 1.11
+ *
+ *  Non-blocking WS2300 protocol on the event loop. See serial2300.h
+ *  and read_safe / read_data / reset_06 in rw2300.c and linux2300.c
+ *  for the same protocol done with blocking reads.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include "serial2300.h"
+#include "trace2300.h"
+
+#define STATE_IDLE     0           // nothing queued
+#define STATE_RESET    1           // 0x06 sent, waiting for 0x02
+#define STATE_BACKOFF  2           // waiting before sending 0x06 again
+#define STATE_ADDRESS  3           // address byte step sent
+#define STATE_COUNT    4           // byte count sent
+#define STATE_DATA     5           // receiving data and checksum
+
+static void start_read(struct serial_link *link);
+
+
+/********************************************************************
+ * send_byte sends one command byte and waits the link timeout for the
+ * answer. The port is not drained as write_device does; the timeout
+ * covers the 4 ms the byte takes at 2400 baud.
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+static int send_byte(struct serial_link *link, unsigned char byte, int state)
+{
+	link->state = state;
+	loop_timer_start(link->loop, &link->timer, link->timing.timeout);
+
+	if (write(link->fd, &byte, 1) != 1)
+		return -1;
+
+	link->stats.bytes_sent++;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * finish ends the running read and starts the next in the queue
+ *
+ * Input:   number - bytes read, -1 if the read failed
+ *
+ ********************************************************************/
+static void finish(struct serial_link *link, int number)
+{
+	struct serial_request request = link->queue[link->first];
+
+	loop_timer_stop(link->loop, &link->timer);
+
+	if (number >= 0)
+		stats_add(&link->stats.read_data, link->attempt_start);
+	stats_add(&link->stats.read_safe, link->request_start);
+
+	link->first = (link->first + 1) % SERIAL_QUEUE;
+	link->count--;
+	link->state = STATE_IDLE;
+	link->retries = 0;
+
+	if (number < 0)
+		link->failed++;
+	else
+		link->reads++;
+
+	// The handler may queue the next read, which then starts
+	request.done(request.context, request.address, link->data, number);
+
+	if (link->state == STATE_IDLE && link->count > 0)
+		start_read(link);
+}
+
+
+/********************************************************************
+ * send_reset sends the 0x06 reset command
+ *
+ ********************************************************************/
+static void send_reset(struct serial_link *link)
+{
+	link->resets++;
+	link->stats.reset_commands++;
+
+	if (send_byte(link, 0x06, STATE_RESET) != 0)
+		finish(link, -1);
+}
+
+
+/********************************************************************
+ * start_read starts (or tries again) the oldest read in the queue
+ * with a reset, as read_safe does
+ *
+ ********************************************************************/
+static void start_read(struct serial_link *link)
+{
+	struct serial_request *request = &link->queue[link->first];
+
+	if (link->retries++ > 0)
+	{
+		link->retried++;
+		stats_retry(&link->stats, request->address);
+	}
+	else
+	{
+		link->request_start = clock_microseconds();
+	}
+
+	if (link->retries > link->timing.retries)
+	{
+		finish(link, -1);
+		return;
+	}
+
+	address_encoder(request->address, link->command);
+	link->command[4] = numberof_encoder(request->number);
+	link->resets = 0;
+	link->reset_start = clock_microseconds();
+	link->stats.resets++;
+
+	tcflush(link->fd, TCIFLUSH);
+	send_reset(link);
+}
+
+
+/********************************************************************
+ * retry counts the failed try of a read and starts it over
+ *
+ ********************************************************************/
+static void retry(struct serial_link *link)
+{
+	link->stats.failed++;
+	stats_add(&link->stats.read_data, link->attempt_start);
+
+	start_read(link);
+}
+
+
+/********************************************************************
+ * receive_byte moves the protocol on with a byte from the station
+ *
+ ********************************************************************/
+static void receive_byte(struct serial_link *link, unsigned char answer)
+{
+	struct serial_request *request = &link->queue[link->first];
+
+	switch (link->state)
+	{
+	case STATE_RESET:
+		// Anything but 2 is left over from an earlier command
+		if (answer != 2)
+			return;
+		stats_add(&link->stats.reset, link->reset_start);
+		link->stats.transactions++;
+		link->attempt_start = clock_microseconds();
+		link->step = 0;
+		if (send_byte(link, link->command[0], STATE_ADDRESS) != 0)
+			retry(link);
+		return;
+
+	case STATE_ADDRESS:
+		if (answer != command_check0123(link->command + link->step, link->step))
+		{
+			link->stats.echo_mismatches++;
+			retry(link);
+			return;
+		}
+		if (++link->step < 4)
+		{
+			if (send_byte(link, link->command[link->step], STATE_ADDRESS) != 0)
+				retry(link);
+		}
+		else if (send_byte(link, link->command[4], STATE_COUNT) != 0)
+		{
+			retry(link);
+		}
+		return;
+
+	case STATE_COUNT:
+		if (answer != command_check4(request->number))
+		{
+			link->stats.echo_mismatches++;
+			retry(link);
+			return;
+		}
+		link->step = 0;
+		link->state = STATE_DATA;
+		loop_timer_start(link->loop, &link->timer, link->timing.timeout);
+		return;
+
+	case STATE_DATA:
+		link->data[link->step++] = answer;
+		if (link->step <= request->number)
+		{
+			loop_timer_start(link->loop, &link->timer, link->timing.timeout);
+			return;
+		}
+		if (answer != data_checksum(link->data, request->number))
+		{
+			link->stats.checksum_failures++;
+			retry(link);
+		}
+		else
+			finish(link, request->number);
+		return;
+
+	default:
+		// Not waiting for anything
+		return;
+	}
+}
+
+
+/********************************************************************
+ * hang_up closes a device that hung up or failed and fails the
+ * queued reads. The trace being recorded is kept for the reopen.
+ *
+ * Input:   reason - for the message
+ *
+ ********************************************************************/
+static void hang_up(struct serial_link *link, const char *reason)
+{
+	struct serial_request request;
+
+	fprintf(stderr, "Serial device %s: %s, closed until it can be reopened\n",
+	        link->device, reason);
+
+	loop_timer_stop(link->loop, &link->timer);
+	loop_watch_remove(link->loop, &link->watch);
+	close(link->fd);
+	link->closed = 1;
+	link->state = STATE_IDLE;
+	link->retries = 0;
+
+	// serial_read refuses new reads now, so the handlers cannot
+	// queue more
+	while (link->count > 0)
+	{
+		request = link->queue[link->first];
+		link->first = (link->first + 1) % SERIAL_QUEUE;
+		link->count--;
+		link->failed++;
+		request.done(request.context, request.address, link->data, -1);
+	}
+}
+
+
+/********************************************************************
+ * serial_event reads the bytes the station has sent. A device that
+ * hung up reads 0 bytes or fails with EIO instead of blocking.
+ *
+ ********************************************************************/
+static void serial_event(struct event_loop *loop, struct loop_watch *watch, int events)
+{
+	struct serial_link *link = watch->context;
+	unsigned char buffer[64];
+	int bytes_read, i;
+
+	bytes_read = read(link->fd, buffer, sizeof(buffer));
+
+	if (bytes_read == 0)
+	{
+		hang_up(link, "hung up");
+		return;
+	}
+
+	if (bytes_read < 0)
+	{
+		if (errno != EAGAIN && errno != EINTR)
+			hang_up(link, strerror(errno));
+		else if (events & LOOP_ERROR)
+			hang_up(link, "error on the line");
+		return;
+	}
+
+	link->stats.bytes_received += bytes_read;
+
+	for (i = 0; i < bytes_read; i++)
+		receive_byte(link, buffer[i]);
+}
+
+
+/********************************************************************
+ * serial_timeout handles a station that did not answer in time. A
+ * reset is sent again after a growing pause (as reset_06), any other
+ * step starts the read over.
+ *
+ ********************************************************************/
+static void serial_timeout(struct event_loop *loop, struct loop_timer *timer)
+{
+	struct serial_link *link = timer->context;
+
+	switch (link->state)
+	{
+	case STATE_RESET:
+		link->stats.timeouts++;
+		if (link->resets >= SERIAL_RESETS)
+		{
+			fprintf(stderr, "Could not reset\n");
+			finish(link, -1);
+			return;
+		}
+		link->state = STATE_BACKOFF;
+		loop_timer_start(loop, timer, (long) link->timing.backoff * (link->resets - 1));
+		return;
+
+	case STATE_BACKOFF:
+		send_reset(link);
+		return;
+
+	case STATE_ADDRESS:
+	case STATE_COUNT:
+	case STATE_DATA:
+		link->stats.timeouts++;
+		retry(link);
+		return;
+	}
+}
+
+
+/********************************************************************
+ * watch_device makes the open device non-blocking and watches it on
+ * the loop
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+static int watch_device(struct serial_link *link)
+{
+	int flags;
+
+	if ((flags = fcntl(link->fd, F_GETFL)) == -1 ||
+	    fcntl(link->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+	{
+		perror("Cannot make serial device non-blocking");
+		return -1;
+	}
+
+	loop_watch_init(&link->watch, link->fd, serial_event, link);
+
+	return loop_watch_set(link->loop, &link->watch, LOOP_READ);
+}
+
+
+/********************************************************************
+ * serial_open opens the weather station for reads on the loop
+ *
+ * Input:   loop - the event loop
+ *          device - serial device name
+ *
+ * Output:  link
+ *
+ * Returns: 0 on success, -1 if fail. Exits if the device cannot be
+ *          opened, as open_weatherstation.
+ *
+ ********************************************************************/
+int serial_open(struct serial_link *link, struct event_loop *loop, const char *device)
+{
+	memset(link, 0, sizeof(*link));
+	link->loop = loop;
+	link->device = device;
+	link->fd = open_weatherstation((char *) device);
+	link->timing = *link_timing();
+
+	loop_timer_init(&link->timer, serial_timeout, link);
+
+	return watch_device(link);
+}
+
+
+/********************************************************************
+ * serial_reopen opens a device again after it hung up. A device that
+ * is not there (yet) is left closed to be tried again later.
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int serial_reopen(struct serial_link *link)
+{
+	// Not open_weatherstation, which exits if the device is locked
+	if ((link->fd = open(link->device, O_RDWR | O_NONBLOCK | O_NOCTTY)) < 0)
+		return -1;
+
+	if (setup_serial_device(link->fd) != 0 || watch_device(link) != 0)
+	{
+		close(link->fd);
+		return -1;
+	}
+
+	link->closed = 0;
+	fprintf(stderr, "Serial device %s: reopened\n", link->device);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * serial_read queues a read. It starts at once if the link is idle.
+ *
+ * Input:   address - of the first nibble
+ *          number - bytes to read, at most SERIAL_MAX_BYTES
+ *          done - called with the data when the read is done
+ *          context - for done
+ *
+ * Returns: 0 on success, -1 if the queue is full or the device is
+ *          closed
+ *
+ ********************************************************************/
+int serial_read(struct serial_link *link, int address, int number,
+                serial_done done, void *context)
+{
+	struct serial_request *request;
+
+	if (link->closed || link->count >= SERIAL_QUEUE ||
+	    number < 1 || number > SERIAL_MAX_BYTES)
+		return -1;
+
+	request = &link->queue[(link->first + link->count) % SERIAL_QUEUE];
+	request->address = address;
+	request->number = number;
+	request->done = done;
+	request->context = context;
+
+	if (link->count++ == 0)
+		start_read(link);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * serial_close closes the station. Queued reads are dropped.
+ *
+ ********************************************************************/
+void serial_close(struct serial_link *link)
+{
+	loop_timer_stop(link->loop, &link->timer);
+	if (link->closed)
+	{
+		trace_close();
+	}
+	else
+	{
+		loop_watch_remove(link->loop, &link->watch);
+		close_weatherstation(link->fd);
+	}
+	link->count = 0;
+	link->state = STATE_IDLE;
+}
@@ -0,0 +1,77 @@
+/* open2300 - serial2300.h
+ * Include file for the non-blocking WS2300 protocol on the event loop.
+ *
+ * The reads of rw2300.c (read_safe: reset with 0x06, four address
+ * bytes, the byte count, then data and checksum, each byte answered
+ * by the station) are run as a state machine driven by the bytes that
+ * arrive and by timeouts, so the loop is free while the station
+ * answers. Reads are queued and run one after the other without
+ * gaps, and a failed read is tried again from the reset. The timeout,
+ * the pause between resets and the tries are those of the link timing
+ * profile of the device (link2300.h). The reads count into the
+ * statistics of the link (stats2300.h) as read_safe, read_data and
+ * reset_06 count into those of the process.
+ * When the device hangs up or fails (a USB adapter pulled out) it is
+ * closed and the queued reads fail; serial_reopen opens it again.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_SERIAL2300_H_
+#define _INCLUDE_SERIAL2300_H_
+
+#include "loop2300.h"
+#include "link2300.h"
+#include "stats2300.h"
+
+#define SERIAL_QUEUE     32        // reads waiting
+#define SERIAL_RESETS    100       // 0x06 sent before a read fails
+#define SERIAL_MAX_BYTES 15        // most bytes in one read
+
+/* Called when a read is done. number is -1 if it failed. */
+typedef void (*serial_done)(void *context, int address, unsigned char *data, int number);
+
+struct serial_request
+{
+	int         address;
+	int         number;
+	serial_done done;
+	void       *context;
+};
+
+struct serial_link
+{
+	WEATHERSTATION    fd;
+	const char       *device;
+	int               closed;      // hung up, until serial_reopen
+	struct event_loop *loop;
+	struct loop_watch watch;
+	struct loop_timer timer;
+	struct link_timing timing;     // of this device, loaded at open
+	int               state;
+	int               step;        // address byte sent or data byte received
+	int               retries;     // tries of the current read
+	int               resets;      // 0x06 sent in the current reset
+	long long         request_start;   // clock_microseconds of the read
+	long long         attempt_start;   // of the try after the reset
+	long long         reset_start;
+	unsigned char     command[5];
+	unsigned char     data[SERIAL_MAX_BYTES + 1];   // data and checksum
+	struct serial_request queue[SERIAL_QUEUE];
+	int               first;       // oldest in queue
+	int               count;       // in queue, the oldest is running
+	unsigned long     reads;       // done
+	unsigned long     failed;      // given up
+	unsigned long     retried;     // tried again
+	struct protocol_stats stats;   // of this link since serial_open
+};
+
+int  serial_open(struct serial_link *link, struct event_loop *loop, const char *device);
+
+int  serial_reopen(struct serial_link *link);
+
+int  serial_read(struct serial_link *link, int address, int number,
+                 serial_done done, void *context);
+
+void serial_close(struct serial_link *link);
+
+#endif /* _INCLUDE_SERIAL2300_H_ */
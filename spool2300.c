@@ -0,0 +1,450 @@
+/*  open2300 - spool2300.c
+ *
+ *  Version 1.11
+ *
+ *  Store-and-forward spool for readings that are sent to databases
+ *  and web services. See spool2300.h for the layout.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "spool2300.h"
+
+
+/********************************************************************
+ * crc32 computes the CRC-32 (as used by zip) of a buffer
+ *
+ ********************************************************************/
+static unsigned long crc32(const unsigned char *data, int size)
+{
+	unsigned long crc = 0xFFFFFFFFUL;
+	int i, bit;
+
+	for (i = 0; i < size; i++)
+	{
+		crc ^= data[i];
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+	}
+
+	return crc ^ 0xFFFFFFFFUL;
+}
+
+
+/********************************************************************
+ * put_le / get_le store and load 4 byte little endian integers
+ *
+ ********************************************************************/
+static void put_le(unsigned char *buffer, unsigned long value)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		buffer[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static unsigned long get_le(const unsigned char *buffer)
+{
+	return (unsigned long) buffer[0] | ((unsigned long) buffer[1] << 8) |
+	       ((unsigned long) buffer[2] << 16) | ((unsigned long) buffer[3] << 24);
+}
+
+
+/********************************************************************
+ * segment_path gives the file name of a segment
+ *
+ ********************************************************************/
+static void segment_path(struct spool *spool, unsigned long segment,
+                         char *path, int size)
+{
+	snprintf(path, size, "%s/%08lu.seg", spool->dir, segment);
+}
+
+
+/********************************************************************
+ * segment_exists tells if a segment file is there
+ *
+ ********************************************************************/
+static int segment_exists(struct spool *spool, unsigned long segment)
+{
+	struct stat filestat;
+	char path[300];
+
+	segment_path(spool, segment, path, sizeof(path));
+
+	return stat(path, &filestat) == 0;
+}
+
+
+/********************************************************************
+ * read_entry reads the next entry of a segment
+ *
+ * Input:   file - segment positioned at an entry
+ *          buffer - room for SPOOL_ENTRY_MAX bytes
+ *
+ * Returns: size of the entry, -1 at the end of the segment or if the
+ *          entry is incomplete or damaged
+ *
+ ********************************************************************/
+static int read_entry(FILE *file, char *buffer)
+{
+	unsigned char header[8];
+	unsigned long size;
+
+	if (fread(header, 1, 8, file) != 8)
+		return -1;
+
+	size = get_le(header);
+
+	if (size > SPOOL_ENTRY_MAX ||
+	    fread(buffer, 1, size, file) != size ||
+	    crc32((unsigned char *) buffer, size) != get_le(header + 4))
+		return -1;
+
+	return (int) size;
+}
+
+
+/********************************************************************
+ * save_cursor writes the cursor file
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+static int save_cursor(struct spool *spool)
+{
+	char path[300], text[50];
+
+	snprintf(path, sizeof(path), "%s/cursor", spool->dir);
+	snprintf(text, sizeof(text), "%lu %ld\n", spool->read_segment, spool->read_offset);
+
+	return publish_file(path, text, strlen(text), 0) < 0 ? -1 : 0;
+}
+
+
+/********************************************************************
+ * next_segment moves the cursor to the start of the next segment and
+ * deletes the delivered one
+ *
+ ********************************************************************/
+static int next_segment(struct spool *spool)
+{
+	char path[300];
+
+	segment_path(spool, spool->read_segment, path, sizeof(path));
+
+	spool->read_segment++;
+	spool->read_offset = 0;
+
+	if (save_cursor(spool) != 0)
+		return -1;
+
+	remove(path);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * spool_open opens or creates a spool
+ *
+ * Input:   directory - the spool directory of the configuration
+ *          name - sub directory of this spool (program name)
+ *
+ * Output:  spool - the open spool
+ *
+ * Returns: 0 on success, -1 if the directory cannot be created or
+ *          another program keeps the spool open
+ *
+ ********************************************************************/
+int spool_open(struct spool *spool, const char *directory, const char *name)
+{
+	char path[300];
+	char buffer[SPOOL_ENTRY_MAX];
+	FILE *file;
+	long valid_size;
+
+	memset(spool, 0, sizeof(*spool));
+	snprintf(spool->dir, sizeof(spool->dir), "%s/%s", directory, name);
+
+	if (make_directory(directory) != 0 || make_directory(spool->dir) != 0)
+	{
+		fprintf(stderr, "Cannot create spool directory %s\n", spool->dir);
+		return -1;
+	}
+
+	// The cursor and the segments are read below, so the lock is
+	// held from here until spool_close
+	snprintf(path, sizeof(path), "%s/lock", spool->dir);
+	if ((spool->lock = fopen(path, "a")) == NULL ||
+	    lock_file(spool->lock, SPOOL_LOCK_WAIT) != 0)
+	{
+		fprintf(stderr, "Spool %s is in use by another program\n", spool->dir);
+		if (spool->lock != NULL)
+			fclose(spool->lock);
+		spool->lock = NULL;
+		return -1;
+	}
+
+	spool->read_segment = 1;
+	spool->read_offset = 0;
+
+	snprintf(path, sizeof(path), "%s/cursor", spool->dir);
+	if ((file = fopen(path, "r")) != NULL)
+	{
+		if (fscanf(file, "%lu %ld", &spool->read_segment, &spool->read_offset) != 2)
+		{
+			spool->read_segment = 1;
+			spool->read_offset = 0;
+		}
+		fclose(file);
+	}
+
+	// Append to the last segment
+	spool->write_segment = spool->read_segment;
+	while (segment_exists(spool, spool->write_segment + 1))
+		spool->write_segment++;
+
+	// If its tail was not completely written (power loss) new
+	// entries go to a new segment so they can be read
+	segment_path(spool, spool->write_segment, path, sizeof(path));
+	if ((file = fopen(path, "rb")) != NULL)
+	{
+		valid_size = 0;
+		while (read_entry(file, buffer) >= 0)
+			valid_size = ftell(file);
+		fseek(file, 0L, SEEK_END);
+		spool->write_size = ftell(file);
+		fclose(file);
+
+		if (valid_size != spool->write_size ||
+		    spool->write_size >= SPOOL_SEGMENT_SIZE)
+		{
+			spool->write_segment++;
+			spool->write_size = 0;
+		}
+		else if (spool->write_segment == spool->read_segment &&
+		         spool->read_offset >= spool->write_size)
+		{
+			// All delivered - start over with a new segment
+			if (next_segment(spool) == 0)
+			{
+				spool->write_segment = spool->read_segment;
+				spool->write_size = 0;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * spool_append adds an entry to the spool. The data is on disk after
+ * SPOOL_SYNC_COUNT appends or after spool_sync / spool_close.
+ *
+ * Input:   spool - the spool
+ *          data, size - the entry
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int spool_append(struct spool *spool, const char *data, int size)
+{
+	unsigned char header[8];
+	char path[300];
+
+	if (size < 0 || size > SPOOL_ENTRY_MAX)
+		return -1;
+
+	if (spool->write != NULL && spool->write_size >= SPOOL_SEGMENT_SIZE)
+	{
+		spool_sync(spool);
+		fclose(spool->write);
+		spool->write = NULL;
+		spool->write_segment++;
+		spool->write_size = 0;
+	}
+
+	if (spool->write == NULL)
+	{
+		segment_path(spool, spool->write_segment, path, sizeof(path));
+		if ((spool->write = fopen(path, "ab")) == NULL)
+		{
+			fprintf(stderr, "Cannot open spool file %s\n", path);
+			return -1;
+		}
+	}
+
+	put_le(header, size);
+	put_le(header + 4, crc32((const unsigned char *) data, size));
+
+	if (fwrite(header, 1, 8, spool->write) != 8 ||
+	    fwrite(data, 1, size, spool->write) != (size_t) size)
+	{
+		fprintf(stderr, "Cannot write to spool %s\n", spool->dir);
+		return -1;
+	}
+
+	spool->write_size += 8 + size;
+
+	if (++spool->unsynced >= SPOOL_SYNC_COUNT)
+		return spool_sync(spool);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * spool_sync puts appended entries on disk
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int spool_sync(struct spool *spool)
+{
+	if (spool->write == NULL || spool->unsynced == 0)
+		return 0;
+
+	spool->unsynced = 0;
+
+	return sync_file(spool->write);
+}
+
+
+/********************************************************************
+ * spool_drain sends the spooled entries in batches, oldest first,
+ * until the spool is empty or the target fails. The cursor is saved
+ * after each delivered batch so an entry is sent again only if the
+ * program stops between sending and saving.
+ *
+ * Input:   spool - the spool
+ *          batch - most entries per call of send
+ *          send - delivers a batch
+ *          context - passed to send
+ *
+ * Returns: number of entries delivered, -1 if the spool cannot be
+ *          read
+ *
+ ********************************************************************/
+long spool_drain(struct spool *spool, int batch, spool_sender send, void *context)
+{
+	char path[300];
+	char *data, *entries[SPOOL_BATCH];
+	int sizes[SPOOL_BATCH];
+	long delivered = 0, offsets[SPOOL_BATCH + 1];
+	long used;
+	int count, sent, size;
+	FILE *file;
+
+	if (batch > SPOOL_BATCH)
+		batch = SPOOL_BATCH;
+
+	if (spool->write != NULL)
+		fflush(spool->write);
+
+	// A batch holds up to SPOOL_BATCH_BYTES, plus the entry that
+	// goes over
+	if ((data = malloc(SPOOL_BATCH_BYTES + SPOOL_ENTRY_MAX)) == NULL)
+		return -1;
+
+	while (1)
+	{
+		segment_path(spool, spool->read_segment, path, sizeof(path));
+
+		if ((file = fopen(path, "rb")) == NULL ||
+		    fseek(file, spool->read_offset, SEEK_SET) != 0)
+		{
+			if (file != NULL)
+				fclose(file);
+			// A segment removed or never written - skip to the next
+			if (spool->read_segment < spool->write_segment)
+			{
+				next_segment(spool);
+				continue;
+			}
+			break;
+		}
+
+		offsets[0] = spool->read_offset;
+		for (count = 0, used = 0; count < batch && used < SPOOL_BATCH_BYTES; count++)
+		{
+			entries[count] = data + used;
+			if ((size = read_entry(file, entries[count])) < 0)
+				break;
+			sizes[count] = size;
+			used += size;
+			offsets[count + 1] = offsets[count] + 8 + size;
+		}
+		fclose(file);
+
+		if (count == 0)
+		{
+			// End of the segment (or a damaged tail). Move on if the
+			// writer has gone on to a later segment.
+			if (spool->read_segment < spool->write_segment ||
+			    segment_exists(spool, spool->read_segment + 1))
+			{
+				if (next_segment(spool) != 0)
+					break;
+				continue;
+			}
+			break;
+		}
+
+		sent = send(context, entries, sizes, count);
+
+		if (sent > 0)
+		{
+			spool->read_offset = offsets[sent];
+			delivered += sent;
+			if (save_cursor(spool) != 0)
+				break;
+		}
+
+		if (sent < count)
+			break;
+	}
+
+	free(data);
+
+	return delivered;
+}
+
+
+/********************************************************************
+ * spool_empty tells if every entry appended has been delivered. Used
+ * after spool_drain to see if the newest reading got through.
+ *
+ * Returns: 1 if nothing is left to send, 0 otherwise
+ *
+ ********************************************************************/
+int spool_empty(struct spool *spool)
+{
+	if (spool->read_segment != spool->write_segment)
+		return spool->read_segment > spool->write_segment;
+
+	return spool->read_offset >= spool->write_size;
+}
+
+
+/********************************************************************
+ * spool_close puts appended entries on disk, closes the spool and
+ * lets the next program open it
+ *
+ ********************************************************************/
+void spool_close(struct spool *spool)
+{
+	if (spool->write != NULL)
+	{
+		spool_sync(spool);
+		fclose(spool->write);
+		spool->write = NULL;
+	}
+
+	if (spool->lock != NULL)
+	{
+		fclose(spool->lock);
+		spool->lock = NULL;
+	}
+}
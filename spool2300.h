@@ -0,0 +1,65 @@
+/* open2300 - spool2300.h
+ * Include file for the store-and-forward spool.
+ *
+ * A program that sends readings somewhere (database, Weather
+ * Underground, CWOP) appends each reading to its spool and then
+ * drains the spool to the target. If the target cannot be reached
+ * the readings stay in the spool until a later run gets through.
+ *
+ * A spool is a directory with
+ *   NNNNNNNN.seg  append only segment files. Each entry is its
+ *                 length (4 bytes little endian), CRC-32 (4) and data.
+ *                 A new segment is started at SPOOL_SEGMENT_SIZE.
+ *   cursor        segment number and offset of the first entry not
+ *                 yet delivered, replaced atomically.
+ *   lock          locked by the program that has the spool open.
+ * Delivered segments are deleted, so the disk use follows the
+ * backlog and memory use is one batch.
+ * Only one program at a time has a spool open: spool_open waits up
+ * to SPOOL_LOCK_WAIT seconds for another run (overlapping cron runs
+ * during an outage) to close it, so entries are neither interleaved
+ * nor sent twice.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_SPOOL2300_H_
+#define _INCLUDE_SPOOL2300_H_
+
+#include "rw2300.h"
+
+#define SPOOL_SEGMENT_SIZE   1048576   // start a new segment after this
+#define SPOOL_ENTRY_MAX      65536     // largest entry
+#define SPOOL_SYNC_COUNT     16        // appends per fsync
+#define SPOOL_BATCH          500       // most entries per send
+#define SPOOL_BATCH_BYTES    1048576   // most data per send
+#define SPOOL_LOCK_WAIT      60        // seconds to wait for another run
+
+struct spool
+{
+	char          dir[256];
+	unsigned long read_segment;        // cursor
+	long          read_offset;
+	unsigned long write_segment;
+	FILE          *write;              // NULL until the first append
+	long          write_size;
+	int           unsynced;            // appends since the last fsync
+	FILE          *lock;               // holds the lock while open
+};
+
+/* Delivers count entries in order. Returns how many were delivered,
+   which is less than count if the target failed. */
+typedef int (*spool_sender)(void *context, char **entries, int *sizes, int count);
+
+int  spool_open(struct spool *spool, const char *directory, const char *name);
+
+int  spool_append(struct spool *spool, const char *data, int size);
+
+int  spool_sync(struct spool *spool);
+
+long spool_drain(struct spool *spool, int batch, spool_sender send, void *context);
+
+int  spool_empty(struct spool *spool);
+
+void spool_close(struct spool *spool);
+
+#endif /* _INCLUDE_SPOOL2300_H_ */
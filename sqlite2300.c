@@ -0,0 +1,63 @@
+/*  open2300 - sqlite2300.c
+ *
+ *  Version 1.11
+ *
+ *  Setup shared by the SQLite programs. See sqlite2300.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "sqlite2300.h"
+
+
+/********************************************************************
+ * set_pragma sets an SQLite pragma to a value from the config file.
+ * The value is a keyword so anything but letters is refused.
+ *
+ * Input:   Open database
+ *          Name and value of the pragma
+ *
+ * Returns: SQLITE_OK or an SQLite error code
+ *
+ ********************************************************************/
+int set_pragma(sqlite3 *db, const char *name, const char *value)
+{
+	char query[100];
+	const char *p;
+
+	for (p = value; *p; p++)
+	{
+		if (!((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')))
+			return SQLITE_MISUSE;
+	}
+
+	snprintf(query, sizeof(query), "PRAGMA %s = %s", name, value);
+	return sqlite3_exec(db, query, NULL, NULL, NULL);
+}
+
+
+/********************************************************************
+ * setup_database makes a writer wait for a lock held by another
+ * program instead of failing, and sets the journal mode and sync
+ * level of the config file. WAL lets readers work while we write and
+ * with synchronous=NORMAL a commit does not have to wait for the
+ * disk. A pragma that cannot be set is reported and the defaults of
+ * SQLite are used.
+ *
+ * Input:   Open database
+ *          An open2300 configuration
+ *
+ * Returns: void
+ *
+ ********************************************************************/
+void setup_database(sqlite3 *db, struct config_type *config)
+{
+	sqlite3_busy_timeout(db, DB_LOCK_WAIT);
+
+	if (set_pragma(db, "journal_mode", config->sqlite_journal_mode) != SQLITE_OK ||
+	    set_pragma(db, "synchronous", config->sqlite_synchronous) != SQLITE_OK)
+	{
+		fprintf(stderr, "Unable to set journal mode %s and synchronous %s\n",
+		        config->sqlite_journal_mode, config->sqlite_synchronous);
+	}
+}
@@ -0,0 +1,24 @@
+/* open2300 - sqlite2300.h
+ * Include file for the setup shared by the SQLite programs.
+ *
+ * sqlitelog2300 and sqlitehistlog2300 may write to the same database
+ * at the same time. A writer that finds the database locked waits
+ * up to DB_LOCK_WAIT milliseconds before it gives up.
+ * Not part of lib2300, which does not link with SQLite. The programs
+ * are built with sqlite2300.c.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_SQLITE2300_H_
+#define _INCLUDE_SQLITE2300_H_
+
+#include <sqlite3.h>
+#include "rw2300.h"
+
+#define DB_LOCK_WAIT  10000            // ms to wait for a lock
+
+int  set_pragma(sqlite3 *db, const char *name, const char *value);
+
+void setup_database(sqlite3 *db, struct config_type *config);
+
+#endif /* _INCLUDE_SQLITE2300_H_ */
@@ -0,0 +1,232 @@
+/*		 sqlitehistlog2300.c
+ *
+ *		 Open2300 1.11
+ *
+ *		 Get the history records from a WS2300 weather station
+ *		 and add those that are not yet in an SQLite database
+ *
+ *		 All records are inserted with one prepared statement
+ *		 in a single transaction, so the database is synced once
+ *		 for the whole ring buffer instead of once per record.
+ *
+ *		 This program is published under the GNU General Public license
+ *
+ */
+
+#include "sqlite2300.h"
+#include "stats2300.h"
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:	none
+ *
+ * Output:	prints to stderr
+ *
+ * Returns: void
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	fprintf(stderr, "\n");
+	fprintf(stderr, "sqlitehistlog2300 - Log history data from WS-2300 to SQLite.\n");
+	fprintf(stderr, "Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	fprintf(stderr, "This program is released under the GNU General Public License (GPL)\n\n");
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "sqlitehistlog2300 sqlite_db_filename [config_filename]\n");
+	fprintf(stderr, "The database must have the table of sqlitelog2300.sql.\n");
+	fprintf(stderr, "Times are stored in UTC like sqlitelog2300 does.\n");
+}
+
+/* The history records have no 1h/24h rain, tendency and forecast.
+   They are stored as 0 and empty text as the columns are NOT NULL. */
+#define HISTORY_INSERT \
+	"INSERT OR IGNORE INTO weather (datetime, temperature_in, temperature_out, " \
+	"dewpoint, rel_humidity_in, rel_humidity_out, wind_speed, wind_angle, " \
+	"wind_direction, wind_chill, rain_1h, rain_24h, rain_total, rel_pressure, " \
+	"tendency, forecast) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 0, 0, ?, ?, '', '')"
+
+
+/********************************************************************
+ * fail prints the current SQLite error, rolls back what is not
+ * committed and exits the program
+ *
+ * Input:	Open database
+ *			What was being done
+ *
+ * Returns: does not return
+ *
+ ********************************************************************/
+void fail(sqlite3 *db, const char *what)
+{
+	fprintf(stderr, "%s: %s\n", what, sqlite3_errmsg(db));
+	if(!sqlite3_get_autocommit(db))
+		sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+	sqlite3_close(db);
+	exit(EXIT_FAILURE);
+}
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program reads the history records from a WS2300 weather
+ * station and writes those not yet in the database to the database.
+ *
+ * Schema for table `weather` is shown in sqlitelog2300.sql file
+ *
+ * It takes two parameters. The path to the SQLite database and an
+ * optional path to the open2300 config file.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	WEATHERSTATION ws2300;
+	sqlite3 *db;
+	sqlite3_stmt *statement;
+	struct config_type config;
+	char datestring[50];
+	struct timestamp time_last;
+	time_t time_record;
+	struct tm time_lastrecord_tm;
+	int interval, countdown, no_records;
+	int current_record, next_record, lastlog_record, new_records;
+	int inserted = 0;
+	double temperature_in;
+	double temperature_out;
+	double dewpoint;
+	double windchill;
+	double pressure;
+	double pressure_term;
+	int humidity_in;
+	int humidity_out;
+	double rain;
+	double windspeed;
+	double winddir_degrees;
+	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
+	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
+	int i, rc;
+
+	stats_option(&argc, argv);
+
+	if(argc < 2 || argc > 3) {
+		print_usage();
+		exit(2);
+	}
+
+	get_configuration(&config, argc == 3 ? argv[2] : NULL);
+
+	// Open the database
+
+	if(sqlite3_open(argv[1], &db) != SQLITE_OK)
+		fail(db, "Unable to open database");
+
+	setup_database(db, &config);
+
+	if(sqlite3_prepare_v2(db, HISTORY_INSERT, -1, &statement, NULL) != SQLITE_OK)
+		fail(db, "Unable to prepare query");
+
+	// The whole ring is inserted every run. sqlitelog2300 writes live
+	// rows to the same table, so the newest row there does not tell
+	// which history records are stored; INSERT OR IGNORE skips those
+	// that are.
+
+	// Start reading the history from the WS2300
+
+	ws2300 = open_weatherstation(config.serial_device_name);
+
+	current_record = read_history_info(ws2300, &interval, &countdown, &time_last,
+	                                   &no_records);
+
+	time_lastrecord_tm.tm_year = time_last.year - 1900;
+	time_lastrecord_tm.tm_mon  = time_last.month - 1;
+	time_lastrecord_tm.tm_mday = time_last.day;
+	time_lastrecord_tm.tm_hour = time_last.hour;
+	time_lastrecord_tm.tm_min  = time_last.minute;
+	time_lastrecord_tm.tm_sec  = 0;
+	time_lastrecord_tm.tm_isdst = -1;
+
+	pressure_term = pressure_correction(ws2300, config.pressure_conv_factor);
+
+	new_records = no_records;
+
+	if (new_records > 0xAF)
+		new_records = 0xAF;
+
+	lastlog_record = current_record - new_records;
+
+	if (lastlog_record < 0)
+		lastlog_record = 0xAE + lastlog_record + 1;
+
+	time_lastrecord_tm.tm_min -= new_records * interval;
+
+	// The whole import is one transaction: one sync at COMMIT and
+	// an interrupted run leaves no partial import behind
+
+	if(sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+		fail(db, "Unable to begin transaction");
+
+	for (i = 1; i <= new_records; i++)
+	{
+		next_record = (i + lastlog_record) % 0xAF;
+
+		read_history_record(ws2300, next_record, &config,
+		                    &temperature_in,
+		                    &temperature_out,
+		                    &pressure,
+		                    &humidity_in,
+		                    &humidity_out,
+		                    &rain,
+		                    &windspeed,
+		                    &winddir_degrees,
+		                    &dewpoint,
+		                    &windchill);
+
+		time_lastrecord_tm.tm_min += interval;
+		time_record = mktime(&time_lastrecord_tm);     //normalize time_lastrecord_tm
+
+		// If humidity is > 100 the record is skipped
+		if (humidity_out >= 100)
+		{
+			strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S",
+			         &time_lastrecord_tm);
+			fprintf(stderr, "Humidity is %d. Dataset for %s skipped.\n",
+			        humidity_out, datestring);
+			continue;
+		}
+
+		strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S",
+		         gmtime(&time_record));
+
+		sqlite3_bind_text(statement, 1, datestring, -1, SQLITE_STATIC);
+		sqlite3_bind_double(statement, 2, temperature_in);
+		sqlite3_bind_double(statement, 3, temperature_out);
+		sqlite3_bind_double(statement, 4, dewpoint);
+		sqlite3_bind_int(statement, 5, humidity_in);
+		sqlite3_bind_int(statement, 6, humidity_out);
+		sqlite3_bind_double(statement, 7, windspeed);
+		sqlite3_bind_double(statement, 8, winddir_degrees);
+		sqlite3_bind_text(statement, 9, directions[(int)(winddir_degrees/22.5)],
+		                  -1, SQLITE_STATIC);
+		sqlite3_bind_double(statement, 10, windchill);
+		sqlite3_bind_double(statement, 11, rain);
+		sqlite3_bind_double(statement, 12, pressure + pressure_term);
+
+		rc = sqlite3_step(statement);
+		sqlite3_reset(statement);
+		if (rc != SQLITE_DONE)
+			fail(db, "Could not insert row");
+
+		inserted += sqlite3_changes(db);
+	}
+
+	if(sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+		fail(db, "Unable to commit");
+
+	printf("%d records added\n", inserted);
+
+	// Goodbye and Goodnight
+	sqlite3_finalize(statement);
+	sqlite3_close(db);
+	close_weatherstation(ws2300);
+
+	return(0);
+}
@@ -11,8 +11,11 @@
  *
  */
 
-#include <sqlite3.h>
-#include "rw2300.h"
+#include <signal.h>
+#include "sqlite2300.h"
+#include "stats2300.h"
+
+static volatile sig_atomic_t stop_requested = 0;
 
 /********************************************************************
  * print_usage prints a short user guide
@@ -31,7 +34,12 @@ void print_usage(void)
 	fprintf(stderr, "Version %s (C)2010 Wesley Moore.\n", VERSION);
 	fprintf(stderr, "This program is released under the GNU General Public License (GPL)\n\n");
 	fprintf(stderr, "Usage:\n");
-	fprintf(stderr, "sqlitelog2300 sqlite_db_filename [config_filename]\n");
+	fprintf(stderr, "sqlitelog2300 [-d seconds] [-b rows] sqlite_db_filename [config_filename]\n");
+	fprintf(stderr, "-d keeps running and logs a record every seconds\n");
+	fprintf(stderr, "-b with -d keeps rows records in memory and writes them\n");
+	fprintf(stderr, "   in one transaction (default 1)\n");
+	fprintf(stderr, "SQLITE_JOURNAL_MODE and SQLITE_SYNCHRONOUS in the config file\n");
+	fprintf(stderr, "set the journal mode and sync level (default WAL and NORMAL)\n");
 }
 
 /********************************************************************
@@ -45,6 +53,29 @@ struct state {
 	sqlite3_stmt *statement;
 };
 
+/********************************************************************
+ * A reading holds the values of one record until it is written.
+ *
+ ********************************************************************/
+struct reading {
+	char datetime[20];                  /* UTC like datetime('now') */
+	double temperature_in;
+	double temperature_out;
+	double dewpoint;
+	int rel_humidity_in;
+	int rel_humidity_out;
+	double wind_speed;
+	double wind_angle;
+	const char *wind_direction;
+	double wind_chill;
+	double rain_1h;
+	double rain_24h;
+	double rain_total;
+	double rel_pressure;
+	char tendency[15];
+	char forecast[15];
+};
+
 /* QUERY_BUF_SIZE specifies the size in bytes for the SQL INSERT statement
  * that is built */
 #define QUERY_BUF_SIZE 4096
@@ -80,6 +111,10 @@ void state_init(struct state* state, struct config_type *config, const char *db_
 		exit(EXIT_FAILURE);
 	}
 
+	/* Wait for sqlitehistlog2300 instead of failing, WAL and
+	   synchronous=NORMAL */
+	setup_database(state->db, config);
+
 	/* Ensure there's always a NUL char at the end of the buffer.
 	   strncat won't override this char as its beyond QUERY_BUF_SIZE */
 	query[QUERY_BUF_SIZE] = '\0';
@@ -92,15 +127,8 @@ void state_init(struct state* state, struct config_type *config, const char *db_
 	}
 	strncat(query, ") VALUES (", QUERY_BUF_SIZE);
 	for(i = 0; column_names[i] != NULL; i++) {
-		if(strcmp(column_names[i], "datetime") == 0)
-		{
-			strncat(query, "datetime('now')", QUERY_BUF_SIZE);
-		}
-		else
-		{
-			strncat(query, ":", QUERY_BUF_SIZE);
-			strncat(query, column_names[i], QUERY_BUF_SIZE);
-		}
+		strncat(query, ":", QUERY_BUF_SIZE);
+		strncat(query, column_names[i], QUERY_BUF_SIZE);
 		if(column_names[i + 1] != NULL) strncat(query, ", ", QUERY_BUF_SIZE);
 	}
 	strncat(query, ")", QUERY_BUF_SIZE);
@@ -156,6 +184,157 @@ void check_rc(struct state* state, int rc)
 	}
 }
 
+/********************************************************************
+ * read_current reads the current values from the weather station
+ *
+ * Input:	Pointer to state structure
+ *			An open2300 configuration
+ *
+ * Output:	The reading, stamped with the current time
+ *
+ * Returns: 0 on success, -1 if a value is not a number. SQLite
+ *			would store it as NULL, which the table does not allow.
+ *
+ ********************************************************************/
+int read_current(struct state* state, struct config_type *config, struct reading *reading)
+{
+	double winddir[6];
+	int winddir_index;
+	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
+							   "S","SSW","SW","WSW","W","WNW","NW","NNW"};
+	time_t now;
+
+	time(&now);
+	strftime(reading->datetime, sizeof(reading->datetime), "%Y-%m-%d %H:%M:%S",
+	         gmtime(&now));
+
+	/* TODO: add contraints to values and error out if invalid E.g. temp over 60 */
+	reading->temperature_in = temperature_indoor(state->station, config->temperature_conv);
+	reading->temperature_out = temperature_outdoor(state->station, config->temperature_conv);
+	reading->dewpoint = dewpoint(state->station, config->temperature_conv);
+	reading->rel_humidity_in = humidity_indoor(state->station);
+	reading->rel_humidity_out = humidity_outdoor(state->station);
+	reading->wind_speed = wind_all(state->station, config->wind_speed_conv_factor, &winddir_index, winddir);
+	reading->wind_angle = winddir[0];
+	reading->wind_direction = directions[winddir_index];
+	reading->wind_chill = windchill(state->station, config->temperature_conv);
+	reading->rain_1h = rain_1h(state->station, config->rain_conv_factor);
+	reading->rain_24h = rain_24h(state->station, config->rain_conv_factor);
+	reading->rain_total = rain_total(state->station, config->rain_conv_factor);
+	reading->rel_pressure = rel_pressure(state->station, config->pressure_conv_factor);
+	tendency_forecast(state->station, reading->tendency, reading->forecast);
+
+	if(!isfinite(reading->temperature_in) || !isfinite(reading->temperature_out) ||
+	   !isfinite(reading->dewpoint) || !isfinite(reading->wind_speed) ||
+	   !isfinite(reading->wind_angle) || !isfinite(reading->wind_chill) ||
+	   !isfinite(reading->rain_1h) || !isfinite(reading->rain_24h) ||
+	   !isfinite(reading->rain_total) || !isfinite(reading->rel_pressure)) {
+		fprintf(stderr, "Invalid value. Reading for %s skipped.\n", reading->datetime);
+		return -1;
+	}
+
+	return 0;
+}
+
+/********************************************************************
+ * bind_text / bind_double bind a value to a named parameter of the
+ * prepared statement. The program exits if it cannot be bound.
+ *
+ ********************************************************************/
+void bind_text(struct state* state, const char *name, const char *value)
+{
+	check_rc(state, sqlite3_bind_text(state->statement,
+	         sqlite3_bind_parameter_index(state->statement, name), value, -1, SQLITE_STATIC));
+}
+
+void bind_double(struct state* state, const char *name, double value)
+{
+	check_rc(state, sqlite3_bind_double(state->statement,
+	         sqlite3_bind_parameter_index(state->statement, name), value));
+}
+
+/********************************************************************
+ * bind_reading binds the values of a reading to the prepared
+ * statement
+ *
+ * Input:	Pointer to state structure
+ *			The reading
+ *
+ * Output:	Values bound to state->statement. Program exit if a
+ *			value cannot be bound.
+ *
+ * Returns: void
+ *
+ ********************************************************************/
+void bind_reading(struct state* state, const struct reading *reading)
+{
+	bind_text(state, ":datetime", reading->datetime);
+	bind_double(state, ":temperature_in", reading->temperature_in);
+	bind_double(state, ":temperature_out", reading->temperature_out);
+	bind_double(state, ":dewpoint", reading->dewpoint);
+	bind_double(state, ":rel_humidity_in", reading->rel_humidity_in);
+	bind_double(state, ":rel_humidity_out", reading->rel_humidity_out);
+	bind_double(state, ":wind_speed", reading->wind_speed);
+	bind_double(state, ":wind_angle", reading->wind_angle);
+	bind_text(state, ":wind_direction", reading->wind_direction);
+	bind_double(state, ":wind_chill", reading->wind_chill);
+	bind_double(state, ":rain_1h", reading->rain_1h);
+	bind_double(state, ":rain_24h", reading->rain_24h);
+	bind_double(state, ":rain_total", reading->rain_total);
+	bind_double(state, ":rel_pressure", reading->rel_pressure);
+	bind_text(state, ":tendency", reading->tendency);
+	bind_text(state, ":forecast", reading->forecast);
+}
+
+/********************************************************************
+ * write_readings inserts readings in one transaction, reusing the
+ * prepared statement. No transaction is open when it returns, so
+ * other programs can write while this one sleeps.
+ *
+ * Input:	Pointer to state structure
+ *			The readings and their number
+ *
+ * Returns: SQLITE_OK or the SQLite error code. SQLITE_BUSY if the
+ *			database stayed locked, so the readings can be written
+ *			later.
+ *
+ ********************************************************************/
+int write_readings(struct state* state, const struct reading *readings, int count)
+{
+	int i, rc;
+
+	rc = sqlite3_exec(state->db, "BEGIN", NULL, NULL, NULL);
+
+	for(i = 0; i < count && rc == SQLITE_OK; i++) {
+		bind_reading(state, &readings[i]);
+		rc = sqlite3_step(state->statement);
+		sqlite3_reset(state->statement);
+		if(rc == SQLITE_DONE)
+			rc = SQLITE_OK;
+	}
+
+	if(rc == SQLITE_OK)
+		rc = sqlite3_exec(state->db, "COMMIT", NULL, NULL, NULL);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error writing %d records: %s\n", count, sqlite3_errmsg(state->db));
+		if(!sqlite3_get_autocommit(state->db))
+			sqlite3_exec(state->db, "ROLLBACK", NULL, NULL, NULL);
+	}
+
+	return rc;
+}
+
+/********************************************************************
+ * request_stop is the SIGINT/SIGTERM handler of the daemon mode.
+ * The main loop writes the readings it holds and exits.
+ *
+ ********************************************************************/
+void request_stop(int signum)
+{
+	stop_requested = 1;
+}
+
 /********** MAIN PROGRAM ************************************************
  *
  * This program reads current weather data from a WS2300
@@ -170,14 +349,18 @@ void check_rc(struct state* state, int rc)
  * If this parameter is omitted the program will look at the default paths
  * See the open2300.conf-dist file for info
  *
+ * With -d the program keeps the station and database open and logs
+ * a record every interval. The same prepared statement is reused.
+ * -b records are kept in memory and written in one transaction, so
+ * the database is only synced once per batch and no transaction is
+ * open while the program sleeps. If the database stays locked the
+ * records are kept and written after the next interval; no new
+ * records are read while all -b places are taken.
+ *
  ***********************************************************************/
 
 int main(int argc, char *argv[])
 {
-	double winddir[6];
-	int winddir_index;
-	char tendency[15];
-	char forecast[15];
 	struct config_type config;
 
 	char *columns[] = {
@@ -199,15 +382,30 @@ int main(int argc, char *argv[])
 		"wind_speed",
 		NULL
 	};
-	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
-							   "S","SSW","SW","WSW","W","WNW","NW","NNW"};
-	int rc;
+	struct reading *readings;
+	int interval = 0, batch = 1, pending = 0, rc, i;
+	int arg = 1;
+
+	stats_option(&argc, argv);
+
+	while(arg < argc - 1 && argv[arg][0] == '-') {
+		if(strcmp(argv[arg], "-d") == 0 && (interval = atoi(argv[arg + 1])) > 0) {
+			arg += 2;
+		}
+		else if(strcmp(argv[arg], "-b") == 0 && (batch = atoi(argv[arg + 1])) > 0) {
+			arg += 2;
+		}
+		else {
+			print_usage();
+			exit(2);
+		}
+	}
 
 	/* Read the configuration */
-	if(argc >= 3) {
-		get_configuration(&config, argv[2]);
+	if(argc - arg >= 2) {
+		get_configuration(&config, argv[arg + 1]);
 	}
-	else if(argc == 2) {
+	else if(argc - arg == 1) {
 		get_configuration(&config, NULL);
 	}
 	else {
@@ -216,77 +414,56 @@ int main(int argc, char *argv[])
 	}
 
 	struct state s;
-	state_init(&s, &config, argv[1], columns);
+	state_init(&s, &config, argv[arg], columns);
 
-	/* Read the weather station values and bind them to the prepared statement */
+	if((readings = malloc(batch * sizeof(*readings))) == NULL) {
+		fprintf(stderr, "Unable to allocate %d records\n", batch);
+		state_finish(&s);
+		exit(EXIT_FAILURE);
+	}
 
-	/* INDOOR TEMPERATURE */
-	/* TODO: add contraints to values and error out if invalid E.g. temp over 60 */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":temperature_in"), temperature_indoor(s.station, config.temperature_conv));
-	check_rc(&s, rc);
-
-	/* OUTDOOR TEMPERATURE */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":temperature_out"), temperature_outdoor(s.station, config.temperature_conv));
-	check_rc(&s, rc);
-
-	/* READ DEWPOINT */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":dewpoint"), dewpoint(s.station, config.temperature_conv));
-	check_rc(&s, rc);
-
-	/* READ RELATIVE HUMIDITY INDOOR */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_humidity_in"), humidity_indoor(s.station));
-	check_rc(&s, rc);
-
-	/* READ RELATIVE HUMIDITY OUTDOOR */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_humidity_out"), humidity_outdoor(s.station));
-	check_rc(&s, rc);
-
-	/* READ WIND SPEED AND DIRECTION */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_speed"), wind_all(s.station, config.wind_speed_conv_factor, &winddir_index, winddir));
-	check_rc(&s, rc);
-
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_angle"), winddir[0]);
-	check_rc(&s, rc);
-
-	rc = sqlite3_bind_text(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_direction"), directions[winddir_index], -1, SQLITE_STATIC);
-	check_rc(&s, rc);
-
-	/* READ WINDCHILL */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_chill"), windchill(s.station, config.temperature_conv));
-	check_rc(&s, rc);
-
-	/* READ RAIN 1H */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rain_1h"), rain_1h(s.station, config.rain_conv_factor));
-	check_rc(&s, rc);
-
-	/* READ RAIN 24H */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rain_24h"), rain_24h(s.station, config.rain_conv_factor));
-	check_rc(&s, rc);
-
-	/* READ RAIN TOTAL */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rain_total"), rain_total(s.station, config.rain_conv_factor));
-	check_rc(&s, rc);
-
-	/* READ RELATIVE PRESSURE */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_pressure"), rel_pressure(s.station, config.pressure_conv_factor));
-	check_rc(&s, rc);
-
-	/* READ TENDENCY AND FORECAST */
-	tendency_forecast(s.station, tendency, forecast);
-	rc = sqlite3_bind_text(s.statement, sqlite3_bind_parameter_index(s.statement, ":tendency"), tendency, -1, SQLITE_STATIC);
-	check_rc(&s, rc);
-	rc = sqlite3_bind_text(s.statement, sqlite3_bind_parameter_index(s.statement, ":forecast"), forecast, -1, SQLITE_STATIC);
-	check_rc(&s, rc);
-
-	/* Run the query */
-	rc = sqlite3_step(s.statement);
-	if(rc != SQLITE_DONE)
-	{
-		fprintf(stderr, "Error executing query: %s\n", sqlite3_errmsg(s.db));
+	if(interval == 0) {
+		if(read_current(&s, &config, &readings[0]) != 0 ||
+		   write_readings(&s, readings, 1) != SQLITE_OK) {
+			state_finish(&s);
+			exit(EXIT_FAILURE);
+		}
+		state_finish(&s);
+		return(EXIT_SUCCESS);
+	}
+
+	signal(SIGINT, request_stop);
+	signal(SIGTERM, request_stop);
+
+	while(!stop_requested) {
+		if(pending < batch && read_current(&s, &config, &readings[pending]) == 0)
+			pending++;
+
+		if(pending >= batch) {
+			rc = write_readings(&s, readings, pending);
+
+			/* A rejected batch is written one by one so only the
+			   record that is rejected is lost */
+			if(rc != SQLITE_OK && rc != SQLITE_BUSY && rc != SQLITE_LOCKED) {
+				for(i = 0; i < pending; i++) {
+					if(write_readings(&s, &readings[i], 1) != SQLITE_OK)
+						fprintf(stderr, "Record for %s dropped\n", readings[i].datetime);
+				}
+			}
+
+			if(rc != SQLITE_BUSY && rc != SQLITE_LOCKED)
+				pending = 0;
+		}
+
+		sleep_long(interval);
+	}
+
+	if(pending > 0 && write_readings(&s, readings, pending) != SQLITE_OK) {
 		state_finish(&s);
 		exit(EXIT_FAILURE);
 	}
 
+	free(readings);
 	state_finish(&s);
 	return(EXIT_SUCCESS);
 }
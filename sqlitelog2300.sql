@@ -18,3 +18,113 @@ CREATE TABLE weather (
   tendency varchar(7) NOT NULL,
   forecast varchar(6) NOT NULL
 );
+
+-- Rollup of the weather table per hour (period 'h'), day ('d') and
+-- month ('m'). start is the first second of the period. For each
+-- column there is the minimum, maximum, sum (mean = sum / count) and
+-- the value of the last reading in the period. The rain in a period is
+-- its rain_total_last minus the rain_total_last of the period before.
+--
+-- The trigger keeps the rollup up to date as readings are inserted.
+-- sqliterollup2300 rebuilds it from the weather table.
+CREATE TABLE weather_rollup (
+  period char(1) NOT NULL,
+  start datetime NOT NULL,
+  count integer NOT NULL,
+  last_time datetime NOT NULL,
+  temperature_in_min real NOT NULL,
+  temperature_in_max real NOT NULL,
+  temperature_in_sum real NOT NULL,
+  temperature_in_last real NOT NULL,
+  temperature_out_min real NOT NULL,
+  temperature_out_max real NOT NULL,
+  temperature_out_sum real NOT NULL,
+  temperature_out_last real NOT NULL,
+  dewpoint_min real NOT NULL,
+  dewpoint_max real NOT NULL,
+  dewpoint_sum real NOT NULL,
+  dewpoint_last real NOT NULL,
+  rel_humidity_in_min real NOT NULL,
+  rel_humidity_in_max real NOT NULL,
+  rel_humidity_in_sum real NOT NULL,
+  rel_humidity_in_last real NOT NULL,
+  rel_humidity_out_min real NOT NULL,
+  rel_humidity_out_max real NOT NULL,
+  rel_humidity_out_sum real NOT NULL,
+  rel_humidity_out_last real NOT NULL,
+  wind_speed_min real NOT NULL,
+  wind_speed_max real NOT NULL,
+  wind_speed_sum real NOT NULL,
+  wind_speed_last real NOT NULL,
+  wind_chill_min real NOT NULL,
+  wind_chill_max real NOT NULL,
+  wind_chill_sum real NOT NULL,
+  wind_chill_last real NOT NULL,
+  rel_pressure_min real NOT NULL,
+  rel_pressure_max real NOT NULL,
+  rel_pressure_sum real NOT NULL,
+  rel_pressure_last real NOT NULL,
+  rain_total_min real NOT NULL,
+  rain_total_max real NOT NULL,
+  rain_total_sum real NOT NULL,
+  rain_total_last real NOT NULL,
+  PRIMARY KEY (period, start)
+);
+
+CREATE TRIGGER weather_rollup_insert AFTER INSERT ON weather
+BEGIN
+  INSERT INTO weather_rollup
+  SELECT p.period, p.start, 1, NEW.datetime,
+         NEW.temperature_in, NEW.temperature_in, NEW.temperature_in, NEW.temperature_in,
+         NEW.temperature_out, NEW.temperature_out, NEW.temperature_out, NEW.temperature_out,
+         NEW.dewpoint, NEW.dewpoint, NEW.dewpoint, NEW.dewpoint,
+         NEW.rel_humidity_in, NEW.rel_humidity_in, NEW.rel_humidity_in, NEW.rel_humidity_in,
+         NEW.rel_humidity_out, NEW.rel_humidity_out, NEW.rel_humidity_out, NEW.rel_humidity_out,
+         NEW.wind_speed, NEW.wind_speed, NEW.wind_speed, NEW.wind_speed,
+         NEW.wind_chill, NEW.wind_chill, NEW.wind_chill, NEW.wind_chill,
+         NEW.rel_pressure, NEW.rel_pressure, NEW.rel_pressure, NEW.rel_pressure,
+         NEW.rain_total, NEW.rain_total, NEW.rain_total, NEW.rain_total
+  FROM (SELECT 'h' AS period, strftime('%Y-%m-%d %H:00:00', NEW.datetime) AS start
+        UNION ALL SELECT 'd', strftime('%Y-%m-%d 00:00:00', NEW.datetime)
+        UNION ALL SELECT 'm', strftime('%Y-%m-01 00:00:00', NEW.datetime)) AS p
+  WHERE 1
+  ON CONFLICT (period, start) DO UPDATE SET
+    temperature_in_min = min(temperature_in_min, excluded.temperature_in_min),
+    temperature_in_max = max(temperature_in_max, excluded.temperature_in_max),
+    temperature_in_sum = temperature_in_sum + excluded.temperature_in_sum,
+    temperature_in_last = CASE WHEN excluded.last_time >= last_time THEN excluded.temperature_in_last ELSE temperature_in_last END,
+    temperature_out_min = min(temperature_out_min, excluded.temperature_out_min),
+    temperature_out_max = max(temperature_out_max, excluded.temperature_out_max),
+    temperature_out_sum = temperature_out_sum + excluded.temperature_out_sum,
+    temperature_out_last = CASE WHEN excluded.last_time >= last_time THEN excluded.temperature_out_last ELSE temperature_out_last END,
+    dewpoint_min = min(dewpoint_min, excluded.dewpoint_min),
+    dewpoint_max = max(dewpoint_max, excluded.dewpoint_max),
+    dewpoint_sum = dewpoint_sum + excluded.dewpoint_sum,
+    dewpoint_last = CASE WHEN excluded.last_time >= last_time THEN excluded.dewpoint_last ELSE dewpoint_last END,
+    rel_humidity_in_min = min(rel_humidity_in_min, excluded.rel_humidity_in_min),
+    rel_humidity_in_max = max(rel_humidity_in_max, excluded.rel_humidity_in_max),
+    rel_humidity_in_sum = rel_humidity_in_sum + excluded.rel_humidity_in_sum,
+    rel_humidity_in_last = CASE WHEN excluded.last_time >= last_time THEN excluded.rel_humidity_in_last ELSE rel_humidity_in_last END,
+    rel_humidity_out_min = min(rel_humidity_out_min, excluded.rel_humidity_out_min),
+    rel_humidity_out_max = max(rel_humidity_out_max, excluded.rel_humidity_out_max),
+    rel_humidity_out_sum = rel_humidity_out_sum + excluded.rel_humidity_out_sum,
+    rel_humidity_out_last = CASE WHEN excluded.last_time >= last_time THEN excluded.rel_humidity_out_last ELSE rel_humidity_out_last END,
+    wind_speed_min = min(wind_speed_min, excluded.wind_speed_min),
+    wind_speed_max = max(wind_speed_max, excluded.wind_speed_max),
+    wind_speed_sum = wind_speed_sum + excluded.wind_speed_sum,
+    wind_speed_last = CASE WHEN excluded.last_time >= last_time THEN excluded.wind_speed_last ELSE wind_speed_last END,
+    wind_chill_min = min(wind_chill_min, excluded.wind_chill_min),
+    wind_chill_max = max(wind_chill_max, excluded.wind_chill_max),
+    wind_chill_sum = wind_chill_sum + excluded.wind_chill_sum,
+    wind_chill_last = CASE WHEN excluded.last_time >= last_time THEN excluded.wind_chill_last ELSE wind_chill_last END,
+    rel_pressure_min = min(rel_pressure_min, excluded.rel_pressure_min),
+    rel_pressure_max = max(rel_pressure_max, excluded.rel_pressure_max),
+    rel_pressure_sum = rel_pressure_sum + excluded.rel_pressure_sum,
+    rel_pressure_last = CASE WHEN excluded.last_time >= last_time THEN excluded.rel_pressure_last ELSE rel_pressure_last END,
+    rain_total_min = min(rain_total_min, excluded.rain_total_min),
+    rain_total_max = max(rain_total_max, excluded.rain_total_max),
+    rain_total_sum = rain_total_sum + excluded.rain_total_sum,
+    rain_total_last = CASE WHEN excluded.last_time >= last_time THEN excluded.rain_total_last ELSE rain_total_last END,
+    count = count + 1,
+    last_time = max(last_time, excluded.last_time);
+END;
@@ -0,0 +1,187 @@
+/*		 sqliterollup2300.c
+ *
+ *		 Open2300 1.11
+ *
+ *		 Rebuild the weather_rollup table of an SQLite database from
+ *		 its weather table
+ *
+ *		 The weather table is read once in time order. Only the open
+ *		 hour, day and month are held in memory so the run time and
+ *		 memory do not depend on how many years are stored.
+ *
+ *		 This program is published under the GNU General Public license
+ *
+ */
+
+#include <sqlite3.h>
+#include "rollup2300.h"
+
+/* Columns of the weather table that are rolled up, in the order of
+   the weather_rollup table */
+static const char *rollup_columns[ROLLUP_FIELDS] = {
+	"temperature_in", "temperature_out", "dewpoint", "rel_humidity_in",
+	"rel_humidity_out", "wind_speed", "wind_chill", "rel_pressure", "rain_total"
+};
+
+#define QUERY_BUF_SIZE 1000
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:	none
+ *
+ * Output:	prints to stderr
+ *
+ * Returns: void
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	fprintf(stderr, "\n");
+	fprintf(stderr, "sqliterollup2300 - Rebuild the hourly, daily and monthly rollup.\n");
+	fprintf(stderr, "Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	fprintf(stderr, "This program is released under the GNU General Public License (GPL)\n\n");
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "sqliterollup2300 sqlite_db_filename\n");
+	fprintf(stderr, "The database must have the tables of sqlitelog2300.sql.\n");
+	fprintf(stderr, "The trigger keeps the rollup up to date after that.\n");
+}
+
+/********************************************************************
+ * fail prints the current SQLite error, rolls back what is not
+ * committed and exits the program
+ *
+ * Input:	Open database
+ *			What was being done
+ *
+ * Returns: does not return
+ *
+ ********************************************************************/
+void fail(sqlite3 *db, const char *what)
+{
+	fprintf(stderr, "%s: %s\n", what, sqlite3_errmsg(db));
+	if(!sqlite3_get_autocommit(db))
+		sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+	sqlite3_close(db);
+	exit(EXIT_FAILURE);
+}
+
+/********************************************************************
+ * write_rollup is the rollup_writer. It inserts a finished period.
+ *
+ * Input:	context - prepared INSERT INTO weather_rollup
+ *			rollup - the period
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int write_rollup(void *context, const struct rollup *rollup)
+{
+	sqlite3_stmt *statement = context;
+	char period[2] = {rollup->period, '\0'};
+	int i, rc;
+
+	sqlite3_bind_text(statement, 1, period, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(statement, 2, rollup->start, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(statement, 3, rollup->count);
+	sqlite3_bind_text(statement, 4, rollup->last_time, -1, SQLITE_STATIC);
+
+	for (i = 0; i < ROLLUP_FIELDS; i++)
+	{
+		sqlite3_bind_double(statement, 5 + 4 * i, rollup->min[i]);
+		sqlite3_bind_double(statement, 6 + 4 * i, rollup->max[i]);
+		sqlite3_bind_double(statement, 7 + 4 * i, rollup->sum[i]);
+		sqlite3_bind_double(statement, 8 + 4 * i, rollup->last[i]);
+	}
+
+	rc = sqlite3_step(statement);
+	sqlite3_reset(statement);
+
+	return rc == SQLITE_DONE ? 0 : -1;
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program empties weather_rollup and fills it again from all
+ * rows of the weather table in one transaction.
+ *
+ * Schema for the tables is shown in sqlitelog2300.sql file
+ *
+ * It takes one parameter. The path to the SQLite database.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	sqlite3 *db;
+	sqlite3_stmt *select, *insert;
+	struct rollup_set set;
+	char query[QUERY_BUF_SIZE];
+	double values[ROLLUP_FIELDS];
+	long readings = 0;
+	int i, rc;
+
+	if(argc != 2) {
+		print_usage();
+		exit(2);
+	}
+
+	if(sqlite3_open(argv[1], &db) != SQLITE_OK)
+		fail(db, "Unable to open database");
+
+	// The datetime primary key gives the rows in time order
+
+	strcpy(query, "SELECT datetime");
+	for (i = 0; i < ROLLUP_FIELDS; i++)
+	{
+		strcat(query, ", ");
+		strcat(query, rollup_columns[i]);
+	}
+	strcat(query, " FROM weather ORDER BY datetime");
+
+	if(sqlite3_prepare_v2(db, query, -1, &select, NULL) != SQLITE_OK)
+		fail(db, "Unable to prepare query");
+
+	strcpy(query, "INSERT INTO weather_rollup VALUES (?, ?, ?, ?");
+	for (i = 0; i < ROLLUP_FIELDS; i++)
+		strcat(query, ", ?, ?, ?, ?");
+	strcat(query, ")");
+
+	if(sqlite3_prepare_v2(db, query, -1, &insert, NULL) != SQLITE_OK)
+		fail(db, "Unable to prepare query");
+
+	if(sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK ||
+	   sqlite3_exec(db, "DELETE FROM weather_rollup", NULL, NULL, NULL) != SQLITE_OK)
+		fail(db, "Unable to empty weather_rollup");
+
+	rollup_init(&set, write_rollup, insert);
+
+	while ((rc = sqlite3_step(select)) == SQLITE_ROW)
+	{
+		for (i = 0; i < ROLLUP_FIELDS; i++)
+			values[i] = sqlite3_column_double(select, i + 1);
+
+		if (rollup_add(&set, (const char *) sqlite3_column_text(select, 0), values) != 0)
+			fail(db, "Could not insert rollup");
+
+		readings++;
+	}
+
+	if (rc != SQLITE_DONE)
+		fail(db, "Could not read weather");
+
+	if (rollup_finish(&set) != 0)
+		fail(db, "Could not insert rollup");
+
+	if(sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+		fail(db, "Unable to commit");
+
+	printf("%ld readings, %ld rollup rows\n", readings, set.written);
+
+	// Goodbye and Goodnight
+	sqlite3_finalize(select);
+	sqlite3_finalize(insert);
+	sqlite3_close(db);
+
+	return(0);
+}
@@ -0,0 +1,2038 @@
+/*  open2300 - srv2300.c
+ *
+ *  Version 1.11
+ *
+ *  Daemon that keeps reading the WS2300 and serves the readings
+ *
+ *  One thread runs everything on the event loop of loop2300.c: the
+ *  serial protocol (serial2300.c) reads the current values over and
+ *  over without gaps, local clients get a log line for every new
+ *  reading, and the readings are uploaded to Weather Underground and
+ *  CWOP while the station is being read. A client that sends the line
+ *  "stats" gets the protocol statistics of stats2300.h of each station,
+ *  ended by an empty line. With -m the readings and statistics are served for
+ *  Prometheus (metrics2300.c) from a text built after each cycle.
+ *  With -d dashboards get the last reading as JSON or as fetch2300
+ *  prints it, a stream of server-sent events with each new reading
+ *  and the readings of the last day. The responses are built once
+ *  per reading and shared by all connections that send them, so any
+ *  number of dashboards costs no more station reads.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <netinet/tcp.h>
+#include "serial2300.h"
+#include "record2300.h"
+#include "net2300.h"
+#include "http2300.h"
+#include "stats2300.h"
+#include "metrics2300.h"
+#include "logsearch2300.h"
+
+#define SRV_PORT          2300     // default port of local clients
+#define SRV_CLIENTS       32       // most local clients
+#define SRV_CLIENT_BUFFER 8192     // unsent bytes before a client is dropped
+#define SRV_COMMAND_SIZE  64       // longest line a client sends
+#define SRV_SCRAPES       4        // metrics requests served at once
+#define SRV_SCRAPE_TIME   10000    // ms to receive a request and send the metrics
+#define SRV_REQUEST_SIZE  2048     // longest HTTP request for the metrics
+#define SRV_WEB_CLIENTS   512      // dashboard connections (-d), streams included
+#define SRV_WEB_BUFFER    4096     // own part of a response: header, history lines
+#define SRV_WEB_TIME      10000    // ms a dashboard connection may make no progress
+#define SRV_WEB_SWEEP     1000     // ms between checks of the dashboard connections
+#define SRV_KEEPALIVE     15000    // ms between comments on an idle event stream
+#define SRV_HISTORY       8640     // readings kept per station for /history
+#define SRV_HISTORY_STEP  10       // seconds between readings kept
+#define SRV_UPLOAD_BUFFER 4096
+
+#define UPLOAD_CLOSED     0        // no connection
+#define UPLOAD_CONNECTING 1
+#define UPLOAD_BANNER     2        // APRS: waiting for the server prompt
+#define UPLOAD_SENDING    3
+#define UPLOAD_RECEIVING  4
+#define UPLOAD_READY      5        // HTTP: kept alive between uploads
+
+struct server;
+struct station;
+
+struct client
+{
+	struct server *server;
+	struct loop_watch watch;
+	int    in_use;
+	int    used;                   // bytes in out
+	char   out[SRV_CLIENT_BUFFER];
+	int    received;               // bytes in command
+	char   command[SRV_COMMAND_SIZE];
+};
+
+/* An HTTP request for the metrics */
+struct scrape
+{
+	struct server *server;
+	struct loop_watch watch;
+	struct loop_timer timeout;
+	int    in_use;
+	int    received;               // bytes in request
+	char   request[SRV_REQUEST_SIZE];
+	int    length;                 // bytes in response, 0 until answered
+	int    sent;
+	char   response[METRICS_TEXT_SIZE + 2048];
+};
+
+/* A response or event built once per reading and sent as it is to
+ * every dashboard connection that asks for it. It is freed when the
+ * station and the last connection sending it are done with it. */
+struct shared
+{
+	int    refs;
+	int    length;
+	char  *data;                   // follows the structure
+};
+
+/* A dashboard connection (-d): one request and its response, or an
+ * event stream that stays open and gets each new reading */
+struct web
+{
+	struct server  *server;
+	struct station *station;       // asked for
+	struct loop_watch watch;
+	int    in_use;
+	int    answered;
+	int    stream;                 // text/event-stream
+	long   deadline;               // clock_milliseconds, 0 = idle stream
+	int    received;               // bytes in request
+	char   request[SRV_REQUEST_SIZE];
+	int    own_length;             // bytes in own, sent before shared
+	int    own_sent;
+	char   own[SRV_WEB_BUFFER];
+	struct shared *shared;         // being sent
+	int    shared_sent;
+	struct shared *next;           // newest event, sent after shared
+	long   history;                // number of the next reading, -1 = none
+	char   history_to[LOG_KEY_LENGTH + 1];
+};
+
+struct upload
+{
+	struct station *station;
+	const char *name;
+	int    http;                   // 1 HTTP GET, 0 APRS
+	int    interval;               // seconds, 0 = off
+	hostdata *hosts;
+	int    host_count;
+	int    host;                   // host being tried
+	int    state;
+	SOCKET sockfd;
+	int    keep_alive;
+	int    reused;                 // sent on a kept-alive connection
+	struct loop_watch watch;
+	struct loop_timer timeout;     // of the step in progress
+	struct loop_timer next;        // of the next upload
+	char   out[SRV_UPLOAD_BUFFER];
+	int    out_length;
+	int    out_sent;
+	char   in[SRV_UPLOAD_BUFFER];
+	int    in_length;
+	unsigned long sent;
+	unsigned long failed;
+};
+
+/* Each station is read and uploaded on its own, so a slow or dead
+ * station does not hold up the others */
+struct station
+{
+	struct server     *server;
+	const char        *id;         // "" when there is one station
+	char   tag[30];                // "id " in front of lines and messages
+	struct config_type config;     // device, units and uploads
+	struct serial_link link;
+	struct log_record  reading;    // being read, metric units
+	struct log_record  current;    // last complete reading
+	int    have_current;
+	int    pending;                // reads of this cycle not done
+	int    cycle_failed;
+	unsigned long cycles;
+	struct loop_timer  retry;      // of a cycle after a failed one
+	struct shared     *json;       // /current.json, NULL until read
+	struct shared     *text;       // /current.txt
+	struct shared     *event;      // the reading for /events
+	struct log_record *history;    // SRV_HISTORY readings, metric units
+	long   history_count;          // readings kept since the start
+	hostdata wu_host;
+	struct upload      wu;
+	struct upload      aprs;
+};
+
+struct server
+{
+	struct config_type config;
+	struct event_loop  loop;
+	SOCKET listener;
+	struct loop_watch  accept_watch;
+	struct client      clients[SRV_CLIENTS];
+	struct station     stations[MAX_STATIONS];
+	int    station_count;
+	SOCKET metrics_listener;       // INVALID_SOCKET without -m
+	struct loop_watch  metrics_watch;
+	struct scrape      scrapes[SRV_SCRAPES];
+	char   metrics[2][METRICS_TEXT_SIZE];   // METRICS_TEXTFILE, METRICS_OPENMETRICS
+	int    metrics_length[2];
+	SOCKET web_listener;           // INVALID_SOCKET without -d
+	struct loop_watch  web_watch;
+	struct loop_timer  web_timer;  // timeouts and keep-alive comments
+	long   web_keepalive;          // clock_milliseconds of the next comments
+	struct web         webs[SRV_WEB_CLIENTS];
+};
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("srv2300 - Read WS-2300 continuously and serve and upload the data.\n");
+	printf("Version %s (C)2004-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("srv2300 [-p port] [-w seconds] [-a seconds] [-m port] [-d port] [--stats]\n");
+	printf("        [config_filename]\n");
+	printf("-p TCP port where clients get a log2300 line per reading (default %d)\n",
+	       SRV_PORT);
+	printf("-w upload to Weather Underground every seconds\n");
+	printf("-a upload to CWOP (APRS) every seconds\n");
+	printf("-m TCP port where Prometheus gets the metrics (http://host:port/metrics)\n");
+	printf("-d TCP port of dashboards: /current.json, /current.txt, /events (server-sent\n");
+	printf("   events) and /history?from=YYYYMMDDhhmmss&to=YYYYMMDDhhmmss, add\n");
+	printf("   station=id for another than the first station\n");
+	printf("--stats print the serial protocol statistics when stopped (SIGTERM)\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * to_config converts a reading to the units of the configuration
+ *
+ ********************************************************************/
+static void to_config(struct config_type *config, struct log_record *reading,
+                      struct log_record *converted)
+{
+	*converted = *reading;
+
+	if (config->temperature_conv)
+	{
+		converted->temperature_indoor = reading->temperature_indoor * 9 / 5 + 32;
+		converted->temperature_outdoor = reading->temperature_outdoor * 9 / 5 + 32;
+		converted->dewpoint = reading->dewpoint * 9 / 5 + 32;
+		converted->windchill = reading->windchill * 9 / 5 + 32;
+	}
+
+	converted->windspeed = reading->windspeed * config->wind_speed_conv_factor;
+	converted->rain_1h = reading->rain_1h / config->rain_conv_factor;
+	converted->rain_24h = reading->rain_24h / config->rain_conv_factor;
+	converted->rain_total = reading->rain_total / config->rain_conv_factor;
+	converted->rel_pressure = reading->rel_pressure / config->pressure_conv_factor;
+}
+
+
+/********************************************************************
+ * client_close drops a local client
+ *
+ ********************************************************************/
+static void client_close(struct client *client)
+{
+	loop_watch_remove(&client->server->loop, &client->watch);
+	close(client->watch.fd);
+	client->in_use = 0;
+}
+
+
+/********************************************************************
+ * client_flush sends what is waiting for a client and waits for room
+ * for the rest
+ *
+ ********************************************************************/
+static void client_flush(struct client *client)
+{
+	int bytes_sent;
+
+	bytes_sent = send(client->watch.fd, client->out, client->used, MSG_NOSIGNAL);
+
+	if (bytes_sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+	{
+		client_close(client);
+		return;
+	}
+
+	if (bytes_sent > 0)
+	{
+		client->used -= bytes_sent;
+		memmove(client->out, client->out + bytes_sent, client->used);
+	}
+
+	loop_watch_set(&client->server->loop, &client->watch,
+	               client->used > 0 ? LOOP_READ | LOOP_WRITE : LOOP_READ);
+}
+
+
+/********************************************************************
+ * client_send queues a line for a client. A client that does not
+ * keep up is dropped.
+ *
+ ********************************************************************/
+static void client_send(struct client *client, const char *line, int length)
+{
+	if (client->used + length > SRV_CLIENT_BUFFER)
+	{
+		client_close(client);
+		return;
+	}
+
+	memcpy(client->out + client->used, line, length);
+	client->used += length;
+	client_flush(client);
+}
+
+
+/********************************************************************
+ * client_command answers a line from a client. "stats" gets the
+ * statistics of each station, after a line "station id" when there
+ * are several, other lines are ignored.
+ *
+ ********************************************************************/
+static void client_command(struct client *client, char *line)
+{
+	struct server *server = client->server;
+	char text[STATS_TEXT_SIZE];
+	int length, i;
+
+	line[strcspn(line, "\r")] = '\0';
+
+	if (strcmp(line, "stats") != 0)
+		return;
+
+	for (i = 0; i < server->station_count && client->in_use; i++)
+	{
+		length = 0;
+		if (server->stations[i].id[0] != '\0')
+			length = snprintf(text, sizeof(text), "station %s\n", server->stations[i].id);
+		length += stats_format(&server->stations[i].link.stats, text + length,
+		                       sizeof(text) - length);
+		client_send(client, text, length);
+	}
+
+	if (client->in_use)
+		client_send(client, "\n", 1);
+}
+
+
+/********************************************************************
+ * client_event sends to a client when there is room and reads the
+ * command lines a client sends. Reading also tells when the client
+ * is gone.
+ *
+ ********************************************************************/
+static void client_event(struct event_loop *loop, struct loop_watch *watch, int events)
+{
+	struct client *client = watch->context;
+	char buffer[256];
+	int bytes_read, i;
+
+	if (events & LOOP_READ)
+	{
+		bytes_read = recv(watch->fd, buffer, sizeof(buffer), 0);
+		if (bytes_read == 0 ||
+		    (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+		{
+			client_close(client);
+			return;
+		}
+
+		for (i = 0; i < bytes_read && client->in_use; i++)
+		{
+			if (buffer[i] != '\n')
+			{
+				// The end of a too long line is dropped
+				if (client->received < SRV_COMMAND_SIZE - 1)
+					client->command[client->received++] = buffer[i];
+				continue;
+			}
+			client->command[client->received] = '\0';
+			client->received = 0;
+			client_command(client, client->command);
+		}
+
+		if (!client->in_use)
+			return;
+	}
+
+	if ((events & LOOP_WRITE) && client->used > 0)
+		client_flush(client);
+}
+
+
+/********************************************************************
+ * current_line gives the current reading of a station as a log2300
+ * line in the units of its configuration, after the station id when
+ * there are several stations
+ *
+ * Returns: length of the line, -1 if fail
+ *
+ ********************************************************************/
+static int current_line(struct station *station, char *line, int size)
+{
+	struct log_record converted;
+	int length = strlen(station->tag);
+
+	to_config(&station->config, &station->current, &converted);
+
+	if (length >= size)
+		return -1;
+	memcpy(line, station->tag, length);
+
+	if ((size = format_log_line(&converted, line + length, size - length)) < 0)
+		return -1;
+
+	return length + size;
+}
+
+
+/********************************************************************
+ * accept_event accepts new local clients. They get the current
+ * reading of each station at once.
+ *
+ ********************************************************************/
+static void accept_event(struct event_loop *loop, struct loop_watch *watch, int events)
+{
+	struct server *server = watch->context;
+	struct client *client = NULL;
+	char line[LOG_LINE_SIZE];
+	int fd, length, i, j;
+
+	while ((fd = accept(server->listener, NULL, NULL)) >= 0)
+	{
+		if (socket_nonblocking(fd, 1) != 0)
+		{
+			close(fd);
+			continue;
+		}
+
+		for (i = 0; i < SRV_CLIENTS && server->clients[i].in_use; i++)
+			;
+		if (i == SRV_CLIENTS)
+		{
+			close(fd);
+			continue;
+		}
+
+		client = &server->clients[i];
+		client->server = server;
+		client->in_use = 1;
+		client->used = 0;
+		client->received = 0;
+		loop_watch_init(&client->watch, fd, client_event, client);
+		if (loop_watch_set(loop, &client->watch, LOOP_READ) != 0)
+		{
+			close(fd);
+			client->in_use = 0;
+			continue;
+		}
+
+		for (j = 0; j < server->station_count && client->in_use; j++)
+		{
+			if (server->stations[j].have_current &&
+			    (length = current_line(&server->stations[j], line, sizeof(line))) > 0)
+				client_send(client, line, length);
+		}
+	}
+}
+
+
+/********************************************************************
+ * open_listener opens the port of the local clients, IPv6 and IPv4
+ * if the system has IPv6
+ *
+ * Returns: the socket, INVALID_SOCKET if fail
+ *
+ ********************************************************************/
+static SOCKET open_listener(int port)
+{
+	struct sockaddr_in6 address6;
+	struct sockaddr_in address;
+	SOCKET sockfd;
+	int on = 1, off = 0;
+
+	memset(&address6, 0, sizeof(address6));
+	address6.sin6_family = AF_INET6;
+	address6.sin6_addr = in6addr_any;
+	address6.sin6_port = htons(port);
+
+	sockfd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sockfd != INVALID_SOCKET)
+	{
+		setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+		if (bind(sockfd, (struct sockaddr *) &address6, sizeof(address6)) == 0 &&
+		    listen(sockfd, 16) == 0)
+			return sockfd;
+		closesocket(sockfd);
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+
+	sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sockfd == INVALID_SOCKET)
+		return INVALID_SOCKET;
+
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(sockfd, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+	    listen(sockfd, 16) != 0)
+	{
+		closesocket(sockfd);
+		return INVALID_SOCKET;
+	}
+
+	return sockfd;
+}
+
+
+/********************************************************************
+ * metrics_stations gives the stations, their last readings and the
+ * statistics of their links for
+ * metrics2300.c
+ *
+ * Output:  stations
+ *
+ * Returns: number of stations
+ *
+ ********************************************************************/
+static int metrics_stations(struct server *server, struct metrics_station *stations)
+{
+	int i;
+
+	for (i = 0; i < server->station_count; i++)
+	{
+		stations[i].id = server->stations[i].id;
+		stations[i].record = server->stations[i].have_current ?
+		                     &server->stations[i].current : NULL;
+		stations[i].stats = &server->stations[i].link.stats;
+	}
+
+	return server->station_count;
+}
+
+
+/********************************************************************
+ * metrics_update builds the metrics texts after a cycle, so a scrape
+ * only copies them
+ *
+ ********************************************************************/
+static void metrics_update(struct server *server)
+{
+	struct metrics_station stations[MAX_STATIONS];
+	int count, format;
+
+	if (server->metrics_listener == INVALID_SOCKET)
+		return;
+
+	count = metrics_stations(server, stations);
+
+	for (format = METRICS_TEXTFILE; format <= METRICS_OPENMETRICS; format++)
+		server->metrics_length[format] = metrics_format(server->metrics[format],
+		                                                METRICS_TEXT_SIZE, stations,
+		                                                count, format);
+}
+
+
+/********************************************************************
+ * scrape_close ends a metrics request
+ *
+ ********************************************************************/
+static void scrape_close(struct scrape *scrape)
+{
+	loop_timer_stop(&scrape->server->loop, &scrape->timeout);
+	loop_watch_remove(&scrape->server->loop, &scrape->watch);
+	close(scrape->watch.fd);
+	scrape->in_use = 0;
+}
+
+
+/********************************************************************
+ * scrape_answer puts together the response to a request: the
+ * metrics text of the last cycle and the age of the readings, as
+ * OpenMetrics when the request accepts it and else as Prometheus
+ * text 0.0.4
+ *
+ ********************************************************************/
+static void scrape_answer(struct scrape *scrape)
+{
+	struct server *server = scrape->server;
+	struct metrics_station stations[MAX_STATIONS];
+	char age[1024];
+	const char *status = NULL;
+	char *path = scrape->request + 4;
+	int format, count, age_length, length;
+
+	if (strncmp(scrape->request, "GET ", 4) != 0)
+		status = "405 Method Not Allowed";
+	else if (strncmp(path, "/metrics", 8) != 0 || (path[8] != ' ' && path[8] != '?'))
+		status = "404 Not Found";
+
+	if (status != NULL)
+	{
+		scrape->length = snprintf(scrape->response, sizeof(scrape->response),
+		                          "HTTP/1.1 %s\r\nContent-Length: 0\r\n"
+		                          "Connection: close\r\n\r\n", status);
+		return;
+	}
+
+	format = strstr(scrape->request, "application/openmetrics-text") != NULL ?
+	         METRICS_OPENMETRICS : METRICS_TEXTFILE;
+
+	count = metrics_stations(server, stations);
+	age_length = metrics_format_age(age, sizeof(age), stations, count, time(NULL), format);
+
+	length = snprintf(scrape->response, sizeof(scrape->response),
+	                  "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %d\r\n"
+	                  "Connection: close\r\n\r\n",
+	                  format == METRICS_OPENMETRICS ? METRICS_CONTENT_OPENMETRICS :
+	                  METRICS_CONTENT_TEXT,
+	                  server->metrics_length[format] + age_length);
+	memcpy(scrape->response + length, server->metrics[format], server->metrics_length[format]);
+	length += server->metrics_length[format];
+	memcpy(scrape->response + length, age, age_length);
+	scrape->length = length + age_length;
+}
+
+
+/********************************************************************
+ * scrape_event reads a metrics request and sends the response. The
+ * connection is closed when it is sent.
+ *
+ ********************************************************************/
+static void scrape_event(struct event_loop *loop, struct loop_watch *watch, int events)
+{
+	struct scrape *scrape = watch->context;
+	int bytes;
+
+	if (scrape->length == 0)
+	{
+		bytes = recv(watch->fd, scrape->request + scrape->received,
+		             sizeof(scrape->request) - 1 - scrape->received, 0);
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (bytes <= 0)
+		{
+			scrape_close(scrape);
+			return;
+		}
+
+		scrape->received += bytes;
+		scrape->request[scrape->received] = '\0';
+
+		if (strstr(scrape->request, "\r\n\r\n") == NULL &&
+		    strstr(scrape->request, "\n\n") == NULL)
+		{
+			// A request that does not fit is not one of Prometheus
+			if (scrape->received == (int) sizeof(scrape->request) - 1)
+				scrape_close(scrape);
+			return;
+		}
+
+		scrape_answer(scrape);
+		loop_watch_set(loop, watch, LOOP_WRITE);
+	}
+
+	bytes = send(watch->fd, scrape->response + scrape->sent,
+	             scrape->length - scrape->sent, MSG_NOSIGNAL);
+	if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+
+	if (bytes <= 0 || (scrape->sent += bytes) == scrape->length)
+		scrape_close(scrape);
+}
+
+
+/********************************************************************
+ * scrape_timeout drops a metrics request that takes too long
+ *
+ ********************************************************************/
+static void scrape_timeout(struct event_loop *loop, struct loop_timer *timer)
+{
+	scrape_close(timer->context);
+}
+
+
+/********************************************************************
+ * scrape_accept_event accepts metrics requests
+ *
+ ********************************************************************/
+static void scrape_accept_event(struct event_loop *loop, struct loop_watch *watch, int events)
+{
+	struct server *server = watch->context;
+	struct scrape *scrape;
+	int fd, i;
+
+	while ((fd = accept(server->metrics_listener, NULL, NULL)) >= 0)
+	{
+		for (i = 0; i < SRV_SCRAPES && server->scrapes[i].in_use; i++)
+			;
+		if (i == SRV_SCRAPES || socket_nonblocking(fd, 1) != 0)
+		{
+			close(fd);
+			continue;
+		}
+
+		scrape = &server->scrapes[i];
+		scrape->server = server;
+		scrape->in_use = 1;
+		scrape->received = 0;
+		scrape->length = 0;
+		scrape->sent = 0;
+		loop_watch_init(&scrape->watch, fd, scrape_event, scrape);
+		loop_timer_init(&scrape->timeout, scrape_timeout, scrape);
+		if (loop_watch_set(loop, &scrape->watch, LOOP_READ) != 0)
+		{
+			close(fd);
+			scrape->in_use = 0;
+			continue;
+		}
+		loop_timer_start(loop, &scrape->timeout, SRV_SCRAPE_TIME);
+	}
+}
+
+
+/********************************************************************
+ * shared_make builds a shared response: an HTTP header for the body
+ * if a content type is given, and the body
+ *
+ * Returns: the response with one reference, NULL if out of memory
+ *
+ ********************************************************************/
+static struct shared *shared_make(const char *content_type, const char *body, int length)
+{
+	struct shared *shared;
+	char header[300];
+	int header_length = 0;
+
+	if (content_type != NULL)
+		header_length = snprintf(header, sizeof(header),
+		                         "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+		                         "Content-Length: %d\r\nCache-Control: no-cache\r\n"
+		                         "Access-Control-Allow-Origin: *\r\n"
+		                         "Connection: close\r\n\r\n", content_type, length);
+
+	if ((shared = malloc(sizeof(*shared) + header_length + length)) == NULL)
+		return NULL;
+
+	shared->refs = 1;
+	shared->length = header_length + length;
+	shared->data = (char *) (shared + 1);
+	memcpy(shared->data, header, header_length);
+	memcpy(shared->data + header_length, body, length);
+
+	return shared;
+}
+
+
+/********************************************************************
+ * shared_release drops a reference to a shared response
+ *
+ ********************************************************************/
+static void shared_release(struct shared *shared)
+{
+	if (shared != NULL && --shared->refs == 0)
+		free(shared);
+}
+
+
+/********************************************************************
+ * web_close ends a dashboard connection
+ *
+ ********************************************************************/
+static void web_close(struct web *web)
+{
+	loop_watch_remove(&web->server->loop, &web->watch);
+	close(web->watch.fd);
+	shared_release(web->shared);
+	shared_release(web->next);
+	web->shared = NULL;
+	web->next = NULL;
+	web->in_use = 0;
+}
+
+
+/********************************************************************
+ * history_key gives the log key (YYYYMMDDhhmmss) of a reading
+ *
+ ********************************************************************/
+static void history_key(struct log_record *record, char *key)
+{
+	strftime(key, LOG_KEY_LENGTH + 1, "%Y%m%d%H%M%S", localtime(&record->timestamp));
+}
+
+
+/********************************************************************
+ * history_find gives the first reading kept at or after a time, by
+ * binary search of the readings kept
+ *
+ * Returns: number of the reading, history_count if none
+ *
+ ********************************************************************/
+static long history_find(struct station *station, const char *key)
+{
+	char record_key[LOG_KEY_LENGTH + 1];
+	long low, high, middle;
+
+	low = station->history_count > SRV_HISTORY ? station->history_count - SRV_HISTORY : 0;
+	high = station->history_count;
+
+	while (low < high)
+	{
+		middle = low + (high - low) / 2;
+		history_key(&station->history[middle % SRV_HISTORY], record_key);
+		if (strcmp(record_key, key) < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+
+/********************************************************************
+ * web_history fills the own buffer of a connection with the next
+ * log2300 lines of /history, in the units of the station's config.
+ * Readings that were replaced while the response was sent are left
+ * out.
+ *
+ * Returns: bytes in the buffer, 0 when the history is all sent
+ *
+ ********************************************************************/
+static int web_history(struct web *web)
+{
+	struct station *station = web->station;
+	struct log_record converted;
+	char line[LOG_LINE_SIZE];
+	int length = 0, line_length;
+
+	if (web->history < station->history_count - SRV_HISTORY)
+		web->history = station->history_count - SRV_HISTORY;
+
+	for (; web->history < station->history_count; web->history++)
+	{
+		to_config(&station->config, &station->history[web->history % SRV_HISTORY],
+		          &converted);
+		if ((line_length = format_log_line(&converted, line, sizeof(line))) < 0)
+			continue;
+		if (strncmp(line, web->history_to, LOG_KEY_LENGTH) > 0)
+		{
+			web->history = station->history_count;
+			break;
+		}
+		if (length + line_length > SRV_WEB_BUFFER)
+			break;
+		memcpy(web->own + length, line, line_length);
+		length += line_length;
+	}
+
+	return length;
+}
+
+
+/********************************************************************
+ * web_send sends what a connection has waiting: its own buffer,
+ * then the shared response or event, then the newest event and the
+ * rest of the history. A response is ended by closing the
+ * connection; an event stream then waits for the next reading.
+ *
+ ********************************************************************/
+static void web_send(struct web *web)
+{
+	const char *data;
+	int length, bytes;
+
+	for (;;)
+	{
+		if (web->own_sent < web->own_length)
+		{
+			data = web->own + web->own_sent;
+			length = web->own_length - web->own_sent;
+		}
+		else if (web->shared != NULL && web->shared_sent < web->shared->length)
+		{
+			data = web->shared->data + web->shared_sent;
+			length = web->shared->length - web->shared_sent;
+		}
+		else if (web->shared != NULL)
+		{
+			shared_release(web->shared);
+			web->shared = NULL;
+			continue;
+		}
+		else if (web->next != NULL)
+		{
+			web->shared = web->next;
+			web->shared_sent = 0;
+			web->next = NULL;
+			continue;
+		}
+		else if (web->history >= 0 && (web->own_length = web_history(web)) > 0)
+		{
+			web->own_sent = 0;
+			continue;
+		}
+		else
+		{
+			break;
+		}
+
+		bytes = send(web->watch.fd, data, length, MSG_NOSIGNAL);
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			if (web->deadline == 0)
+				web->deadline = clock_milliseconds() + SRV_WEB_TIME;
+			loop_watch_set(&web->server->loop, &web->watch,
+			               web->stream ? LOOP_READ | LOOP_WRITE : LOOP_WRITE);
+			return;
+		}
+		if (bytes <= 0)
+		{
+			web_close(web);
+			return;
+		}
+
+		if (web->own_sent < web->own_length)
+			web->own_sent += bytes;
+		else
+			web->shared_sent += bytes;
+		web->deadline = clock_milliseconds() + SRV_WEB_TIME;
+	}
+
+	if (!web->stream)
+	{
+		web_close(web);
+		return;
+	}
+
+	web->deadline = 0;
+	loop_watch_set(&web->server->loop, &web->watch, LOOP_READ);
+}
+
+
+/********************************************************************
+ * query_value gets a parameter of the query of a request line
+ *
+ * Input:   query - after the "?", ends at a space
+ *          name - of the parameter
+ *          size - of value
+ *
+ * Output:  value - zero terminated, not decoded
+ *
+ * Returns: 1 if found, 0 if not
+ *
+ ********************************************************************/
+static int query_value(const char *query, const char *name, char *value, int size)
+{
+	int name_length = strlen(name);
+	int length;
+
+	while (query != NULL && *query != ' ' && *query != '\0')
+	{
+		length = strcspn(query, "& ");
+		if (length > name_length && strncmp(query, name, name_length) == 0 &&
+		    query[name_length] == '=')
+		{
+			snprintf(value, size, "%.*s", length - name_length - 1, query + name_length + 1);
+			return 1;
+		}
+		query += length + (query[length] == '&');
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * web_answer answers a dashboard request:
+ *   /current.json    the last reading as the JSON of FETCH_CACHE
+ *   /current.txt     the last reading as fetch2300 prints it
+ *   /events          a text/event-stream with the reading as JSON
+ *                    at once and each new reading when it is read
+ *   /history?from=&to=  the readings kept as log2300 lines, times
+ *                    as YYYYMMDDhhmmss, both included, may be cut
+ * "station=id" picks a station, the first one by default.
+ *
+ ********************************************************************/
+static void web_answer(struct web *web)
+{
+	struct server *server = web->server;
+	struct station *station = NULL;
+	struct shared *response = NULL;
+	char value[50], from[LOG_KEY_LENGTH + 1];
+	const char *status = NULL;
+	char *path = web->request + 4, *query;
+	int length, i;
+
+	web->answered = 1;
+
+	length = strcspn(path, "? \r\n");
+	query = path[length] == '?' ? path + length + 1 : NULL;
+
+	if (query_value(query, "station", value, sizeof(value)))
+	{
+		for (i = 0; i < server->station_count; i++)
+			if (strcmp(server->stations[i].id, value) == 0)
+				station = &server->stations[i];
+	}
+	else if (server->station_count > 0)
+	{
+		station = &server->stations[0];
+	}
+	web->station = station;
+
+	if (strncmp(web->request, "GET ", 4) != 0)
+		status = "405 Method Not Allowed";
+	else if (station == NULL)
+		status = "404 Not Found";
+	else if (length == 13 && strncmp(path, "/current.json", 13) == 0)
+		response = station->json;
+	else if (length == 12 && strncmp(path, "/current.txt", 12) == 0)
+		response = station->text;
+	else if (length == 7 && strncmp(path, "/events", 7) == 0)
+		web->stream = 1;
+	else if (length == 8 && strncmp(path, "/history", 8) == 0)
+	{
+		strcpy(from, "00000000000000");
+		strcpy(web->history_to, "99999999999999");
+		if ((query_value(query, "from", value, sizeof(value)) &&
+		     log_make_key(value, from) != 0) ||
+		    (query_value(query, "to", value, sizeof(value)) &&
+		     log_make_key(value, web->history_to) != 0))
+			status = "400 Bad Request";
+		else
+			web->history = history_find(station, from);
+	}
+	else
+		status = "404 Not Found";
+
+	if (status == NULL && response == NULL && !web->stream && web->history < 0)
+		status = "503 Service Unavailable";
+
+	if (status != NULL)
+	{
+		web->own_length = snprintf(web->own, sizeof(web->own),
+		                           "HTTP/1.1 %s\r\nContent-Length: 0\r\n"
+		                           "Connection: close\r\n\r\n", status);
+		return;
+	}
+
+	if (response != NULL)
+	{
+		response->refs++;
+		web->shared = response;
+		return;
+	}
+
+	// The history and the stream end when the connection is closed
+	web->own_length = snprintf(web->own, sizeof(web->own),
+	                           "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+	                           "Cache-Control: no-cache\r\n"
+	                           "Access-Control-Allow-Origin: *\r\n"
+	                           "Connection: close\r\n\r\n%s",
+	                           web->stream ? "text/event-stream" : "text/plain; charset=utf-8",
+	                           web->stream ? "retry: 1000\n\n" : "");
+
+	if (web->stream)
+	{
+		i = 1;
+		setsockopt(web->watch.fd, IPPROTO_TCP, TCP_NODELAY, &i, sizeof(i));
+		if ((web->next = station->event) != NULL)
+			web->next->refs++;
+	}
+}
+
+
+/********************************************************************
+ * web_event reads a dashboard request and sends the response. An
+ * event stream is read only to know when the client is gone.
+ *
+ ********************************************************************/
+static void web_event(struct event_loop *loop, struct loop_watch *watch, int events)
+{
+	struct web *web = watch->context;
+	char buffer[256];
+	int bytes;
+
+	if (web->answered)
+	{
+		if (events & LOOP_READ)
+		{
+			bytes = recv(watch->fd, buffer, sizeof(buffer), 0);
+			if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+			{
+				web_close(web);
+				return;
+			}
+		}
+		if (events & LOOP_WRITE)
+			web_send(web);
+		return;
+	}
+
+	bytes = recv(watch->fd, web->request + web->received,
+	             sizeof(web->request) - 1 - web->received, 0);
+	if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+	if (bytes <= 0)
+	{
+		web_close(web);
+		return;
+	}
+
+	web->received += bytes;
+	web->request[web->received] = '\0';
+
+	if (strstr(web->request, "\r\n\r\n") == NULL && strstr(web->request, "\n\n") == NULL)
+	{
+		if (web->received == (int) sizeof(web->request) - 1)
+			web_close(web);
+		return;
+	}
+
+	web_answer(web);
+	web_send(web);
+}
+
+
+/********************************************************************
+ * web_sweep drops dashboard connections that make no progress and
+ * sends a comment on idle event streams now and then, so proxies
+ * keep them open and a client that is gone is found
+ *
+ ********************************************************************/
+static void web_sweep(struct event_loop *loop, struct loop_timer *timer)
+{
+	struct server *server = timer->context;
+	long now = clock_milliseconds();
+	int keepalive = now >= server->web_keepalive;
+	struct web *web;
+	int i;
+
+	if (keepalive)
+		server->web_keepalive = now + SRV_KEEPALIVE;
+
+	for (i = 0; i < SRV_WEB_CLIENTS; i++)
+	{
+		web = &server->webs[i];
+		if (!web->in_use)
+			continue;
+
+		if (web->deadline != 0 && now > web->deadline)
+		{
+			web_close(web);
+		}
+		else if (keepalive && web->stream && web->deadline == 0)
+		{
+			web->own_length = snprintf(web->own, sizeof(web->own), ":\n\n");
+			web->own_sent = 0;
+			web_send(web);
+		}
+	}
+
+	loop_timer_start(loop, timer, SRV_WEB_SWEEP);
+}
+
+
+/********************************************************************
+ * web_accept_event accepts dashboard connections
+ *
+ ********************************************************************/
+static void web_accept_event(struct event_loop *loop, struct loop_watch *watch, int events)
+{
+	struct server *server = watch->context;
+	struct web *web;
+	int fd, i;
+
+	while ((fd = accept(server->web_listener, NULL, NULL)) >= 0)
+	{
+		for (i = 0; i < SRV_WEB_CLIENTS && server->webs[i].in_use; i++)
+			;
+		if (i == SRV_WEB_CLIENTS || socket_nonblocking(fd, 1) != 0)
+		{
+			close(fd);
+			continue;
+		}
+
+		web = &server->webs[i];
+		web->server = server;
+		web->station = NULL;
+		web->in_use = 1;
+		web->answered = 0;
+		web->stream = 0;
+		web->deadline = clock_milliseconds() + SRV_WEB_TIME;
+		web->received = 0;
+		web->own_length = 0;
+		web->own_sent = 0;
+		web->shared = NULL;
+		web->shared_sent = 0;
+		web->next = NULL;
+		web->history = -1;
+		loop_watch_init(&web->watch, fd, web_event, web);
+		if (loop_watch_set(loop, &web->watch, LOOP_READ) != 0)
+		{
+			close(fd);
+			web->in_use = 0;
+		}
+	}
+}
+
+
+/********************************************************************
+ * web_update builds the dashboard responses of a new reading, keeps
+ * the reading for /history and pushes it to the event streams of
+ * the station. A stream that is still sending gets only the newest
+ * reading after it.
+ *
+ ********************************************************************/
+static void web_update(struct station *station)
+{
+	struct server *server = station->server;
+	struct log_record converted, *last;
+	char text[FETCH_TEXT_SIZE], json[FETCH_JSON_SIZE], event[FETCH_JSON_SIZE + 10];
+	struct shared *shared[3];
+	struct web *web;
+	int text_length, json_length, i;
+
+	if (server->web_listener == INVALID_SOCKET)
+		return;
+
+	last = &station->history[(station->history_count + SRV_HISTORY - 1) % SRV_HISTORY];
+	if (station->history_count == 0 ||
+	    station->current.timestamp >= last->timestamp + SRV_HISTORY_STEP)
+		station->history[station->history_count++ % SRV_HISTORY] = station->current;
+
+	to_config(&station->config, &station->current, &converted);
+	if ((text_length = format_fetch_text(&converted, text, sizeof(text))) < 0 ||
+	    (json_length = format_fetch_json(text, converted.timestamp, json, sizeof(json))) < 0)
+		return;
+
+	// "data: " and the JSON, which ends with a newline, and an empty line
+	snprintf(event, sizeof(event), "data: %s\n", json);
+
+	shared[0] = shared_make("text/plain; charset=utf-8", text, text_length);
+	shared[1] = shared_make("application/json", json, json_length);
+	shared[2] = shared_make(NULL, event, json_length + 7);
+	if (shared[0] == NULL || shared[1] == NULL || shared[2] == NULL)
+	{
+		for (i = 0; i < 3; i++)
+			shared_release(shared[i]);
+		return;
+	}
+
+	shared_release(station->text);
+	shared_release(station->json);
+	shared_release(station->event);
+	station->text = shared[0];
+	station->json = shared[1];
+	station->event = shared[2];
+
+	for (i = 0; i < SRV_WEB_CLIENTS; i++)
+	{
+		web = &server->webs[i];
+		if (!web->in_use || !web->stream || web->station != station)
+			continue;
+
+		shared_release(web->next);
+		web->next = station->event;
+		web->next->refs++;
+		if (web->deadline == 0)
+			web_send(web);
+	}
+}
+
+
+/********************************************************************
+ * format_wu makes the Weather Underground request of a reading, with
+ * the query of wu2300 and the request of http2300.c
+ *
+ * Returns: length, -1 if it did not fit
+ *
+ ********************************************************************/
+static int format_wu(struct station *station, char *request, int size)
+{
+	char query[SRV_UPLOAD_BUFFER];
+	int length;
+
+	if ((length = format_wu_query(&station->config, &station->current, -1, 0,
+	                              query, sizeof(query))) < 0)
+		return -1;
+
+	return http_format_request(WEATHER_UNDERGROUND_BASEURL, 80, query, length,
+	                           request, size);
+}
+
+
+/********************************************************************
+ * format_aprs makes the APRS login and weather report of a reading,
+ * as cw2300 sends them
+ *
+ * Returns: length, -1 if it did not fit
+ *
+ ********************************************************************/
+static int format_aprs(struct station *station, char *packet, int size)
+{
+	struct config_type *config = &station->config;
+	int length, report;
+
+	length = snprintf(packet, size, "user %s pass %s vers open2300 %s\n",
+	                  config->citizen_weather_id, config->citizen_weather_passcode, VERSION);
+
+	if (length < 0 || length >= size ||
+	    (report = format_aprs_report(config, &station->current, packet + length,
+	                                 size - length - 1)) < 0)
+		return -1;
+
+	length += report;
+	packet[length++] = '\n';
+	packet[length] = '\0';
+
+	return length;
+}
+
+
+/********************************************************************
+ * upload_close closes the connection of an upload
+ *
+ ********************************************************************/
+static void upload_close(struct upload *upload)
+{
+	struct event_loop *loop = &upload->station->server->loop;
+
+	loop_timer_stop(loop, &upload->timeout);
+
+	if (upload->sockfd != INVALID_SOCKET)
+	{
+		loop_watch_remove(loop, &upload->watch);
+		closesocket(upload->sockfd);
+		upload->sockfd = INVALID_SOCKET;
+	}
+
+	upload->state = UPLOAD_CLOSED;
+}
+
+
+/********************************************************************
+ * upload_done ends an upload. A kept-alive HTTP connection stays open
+ * for the next one.
+ *
+ * Input:   error - why the upload failed, NULL on success
+ *
+ ********************************************************************/
+static void upload_done(struct upload *upload, const char *error)
+{
+	if (error != NULL)
+	{
+		fprintf(stderr, "%s%s upload failed: %s\n", upload->station->tag, upload->name,
+		        error);
+		upload->failed++;
+		upload_close(upload);
+		return;
+	}
+
+	upload->sent++;
+
+	if (upload->http && upload->keep_alive)
+	{
+		// Only to see the server close it
+		loop_timer_stop(&upload->station->server->loop, &upload->timeout);
+		upload->state = UPLOAD_READY;
+		loop_watch_set(&upload->station->server->loop, &upload->watch, LOOP_READ);
+	}
+	else
+	{
+		upload_close(upload);
+	}
+}
+
+
+/********************************************************************
+ * upload_step moves an upload to its next state and waits for the
+ * socket to be ready for it
+ *
+ ********************************************************************/
+static void upload_step(struct upload *upload, int state, int events)
+{
+	upload->state = state;
+	loop_watch_set(&upload->station->server->loop, &upload->watch, events);
+	loop_timer_start(&upload->station->server->loop, &upload->timeout, NET_TIMEOUT * 1000L);
+}
+
+
+static void upload_event(struct event_loop *loop, struct loop_watch *watch, int events);
+
+
+/********************************************************************
+ * upload_connect starts connecting to the first host from
+ * upload->host on that can be tried. Addresses come from the resolver
+ * cache, which is kept fresh by its own thread, so this does not
+ * wait for DNS.
+ *
+ * Returns: 0 when a connect was started, -1 if no host is left
+ *
+ ********************************************************************/
+static int upload_connect(struct upload *upload)
+{
+	struct net_address address;
+	hostdata *host;
+	SOCKET sockfd;
+
+	for (; upload->host < upload->host_count; upload->host++)
+	{
+		host = &upload->hosts[upload->host];
+
+		if (net_resolve(host->name, host->port, &address, 1) < 1)
+			continue;
+
+		sockfd = socket(address.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (sockfd == INVALID_SOCKET)
+			continue;
+
+		if (connect(sockfd, (struct sockaddr *) &address.address, address.length) != 0 &&
+		    errno != EINPROGRESS)
+		{
+			closesocket(sockfd);
+			continue;
+		}
+
+		upload->sockfd = sockfd;
+		loop_watch_init(&upload->watch, sockfd, upload_event, upload);
+		upload_step(upload, UPLOAD_CONNECTING, LOOP_WRITE);
+		return 0;
+	}
+
+	return -1;
+}
+
+
+/********************************************************************
+ * upload_next_host gives up the host being connected to and tries
+ * the next
+ *
+ ********************************************************************/
+static void upload_next_host(struct upload *upload)
+{
+	upload_close(upload);
+	upload->host++;
+
+	if (upload_connect(upload) != 0)
+		upload_done(upload, "no server answered");
+}
+
+
+/********************************************************************
+ * upload_failed ends a failed upload. The server may have closed a
+ * kept-alive connection just when it was used again; then the upload
+ * is sent once more on a new connection.
+ *
+ ********************************************************************/
+static void upload_failed(struct upload *upload, const char *error)
+{
+	if (!upload->reused || upload->in_length > 0)
+	{
+		upload_done(upload, error);
+		return;
+	}
+
+	upload_close(upload);
+	upload->reused = 0;
+	upload->out_sent = 0;
+	upload->host = 0;
+
+	if (upload_connect(upload) != 0)
+		upload_done(upload, "no server can be resolved");
+}
+
+
+/********************************************************************
+ * http_response tells if the whole HTTP response has been received
+ * and sets upload->keep_alive from it. The lines are parsed as
+ * http2300.c does.
+ *
+ * Input:   closed - the server has closed the connection
+ *
+ * Returns: status code when complete, 0 if more is to come, -1 if the
+ *          response is not valid
+ *
+ ********************************************************************/
+static int http_response(struct upload *upload, int closed)
+{
+	struct http_head head;
+	char *end, *line, *next;
+	int header;
+
+	upload->in[upload->in_length] = '\0';
+
+	if ((end = strstr(upload->in, "\r\n\r\n")) == NULL)
+		return closed ? -1 : 0;
+
+	if (http_status_line(&head, upload->in) != 0)
+		return -1;
+
+	header = end - upload->in + 4;
+
+	if (head.status / 100 == 1)
+	{
+		// 100 Continue comes before the real response
+		upload->in_length -= header;
+		memmove(upload->in, upload->in + header, upload->in_length);
+		return http_response(upload, closed);
+	}
+
+	for (line = strstr(upload->in, "\r\n") + 2; line < end + 2; line = next + 2)
+	{
+		next = strstr(line, "\r\n");
+		*next = '\0';
+		http_header_line(&head, line);
+		*next = '\r';
+	}
+
+	upload->keep_alive = head.keep_alive;
+
+	if (head.status == 204 || head.status == 304)
+		return head.status;
+
+	if (head.chunked)
+		return upload->in_length >= header + 5 &&
+		       memcmp(upload->in + upload->in_length - 5, "0\r\n\r\n", 5) == 0 ?
+		       head.status : 0;
+
+	if (head.length >= 0)
+		return upload->in_length - header >= head.length ? head.status : 0;
+
+	// The body ends when the server closes the connection
+	upload->keep_alive = 0;
+
+	return closed ? head.status : 0;
+}
+
+
+/********************************************************************
+ * upload_receive reads the answer of the server
+ *
+ ********************************************************************/
+static void upload_receive(struct upload *upload)
+{
+	char message[50];
+	int bytes_read, status, space;
+
+	space = SRV_UPLOAD_BUFFER - 1 - upload->in_length;
+	if (space == 0)
+	{
+		// Only the status line and headers matter
+		upload->in_length = 0;
+		space = SRV_UPLOAD_BUFFER - 1;
+	}
+
+	bytes_read = recv(upload->sockfd, upload->in + upload->in_length, space, 0);
+
+	if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+
+	if (bytes_read > 0)
+		upload->in_length += bytes_read;
+
+	if (!upload->http)
+	{
+		// Any answer (or none) after the report will do
+		upload_done(upload, NULL);
+		return;
+	}
+
+	if ((status = http_response(upload, bytes_read <= 0)) == 0)
+		return;
+
+	if (status < 0)
+	{
+		upload_failed(upload, "no valid response");
+	}
+	else if (status >= 300)
+	{
+		snprintf(message, sizeof(message), "HTTP status %d", status);
+		upload_done(upload, message);
+	}
+	else
+	{
+		upload_done(upload, NULL);
+	}
+}
+
+
+/********************************************************************
+ * upload_event moves an upload on when its socket is ready
+ *
+ ********************************************************************/
+static void upload_event(struct event_loop *loop, struct loop_watch *watch, int events)
+{
+	struct upload *upload = watch->context;
+	socklen_t length = sizeof(int);
+	int error = 0, bytes;
+
+	switch (upload->state)
+	{
+	case UPLOAD_CONNECTING:
+		if (getsockopt(upload->sockfd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 ||
+		    error != 0)
+		{
+			upload_next_host(upload);
+			return;
+		}
+		upload->in_length = 0;
+		if (upload->http)
+			upload_step(upload, UPLOAD_SENDING, LOOP_WRITE);
+		else
+			upload_step(upload, UPLOAD_BANNER, LOOP_READ);
+		return;
+
+	case UPLOAD_BANNER:
+		if (recv(upload->sockfd, upload->in, SRV_UPLOAD_BUFFER - 1, 0) <= 0)
+		{
+			upload_done(upload, "connection closed");
+			return;
+		}
+		upload_step(upload, UPLOAD_SENDING, LOOP_WRITE);
+		return;
+
+	case UPLOAD_SENDING:
+		bytes = send(upload->sockfd, upload->out + upload->out_sent,
+		             upload->out_length - upload->out_sent, MSG_NOSIGNAL);
+		if (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			upload_failed(upload, "connection closed");
+			return;
+		}
+		if (bytes > 0 && (upload->out_sent += bytes) == upload->out_length)
+		{
+			upload->in_length = 0;
+			upload_step(upload, UPLOAD_RECEIVING, LOOP_READ);
+		}
+		return;
+
+	case UPLOAD_RECEIVING:
+		upload_receive(upload);
+		return;
+
+	case UPLOAD_READY:
+		// The server closed the idle connection (or sent something
+		// it should not); the next upload connects again
+		upload_close(upload);
+		return;
+	}
+}
+
+
+/********************************************************************
+ * upload_timeout handles a server that does not answer in time
+ *
+ ********************************************************************/
+static void upload_timeout(struct event_loop *loop, struct loop_timer *timer)
+{
+	struct upload *upload = timer->context;
+
+	if (upload->state == UPLOAD_CONNECTING)
+		upload_next_host(upload);
+	else if (upload->state == UPLOAD_RECEIVING && !upload->http)
+		upload_done(upload, NULL);
+	else
+		upload_done(upload, "timeout");
+}
+
+
+/********************************************************************
+ * upload_start sends the current reading. Runs every interval.
+ *
+ ********************************************************************/
+static void upload_start(struct event_loop *loop, struct loop_timer *timer)
+{
+	struct upload *upload = timer->context;
+	struct station *station = upload->station;
+
+	loop_timer_start(loop, timer, upload->interval * 1000L);
+
+	if (!station->have_current)
+		return;
+
+	if (upload->state != UPLOAD_CLOSED && upload->state != UPLOAD_READY)
+	{
+		fprintf(stderr, "%s%s upload skipped, the last one is not done\n",
+		        station->tag, upload->name);
+		return;
+	}
+
+	if (upload->http)
+		upload->out_length = format_wu(station, upload->out, sizeof(upload->out));
+	else
+		upload->out_length = format_aprs(station, upload->out, sizeof(upload->out));
+
+	if (upload->out_length < 0)
+	{
+		fprintf(stderr, "%s%s upload too long\n", station->tag, upload->name);
+		return;
+	}
+
+	upload->out_sent = 0;
+	upload->in_length = 0;
+	upload->reused = upload->state == UPLOAD_READY;
+
+	if (upload->state == UPLOAD_READY)
+	{
+		upload_step(upload, UPLOAD_SENDING, LOOP_WRITE);
+		return;
+	}
+
+	upload->host = 0;
+	if (upload_connect(upload) != 0)
+		upload_done(upload, "no server can be resolved");
+}
+
+
+/********************************************************************
+ * upload_init prepares an upload that runs every interval seconds
+ *
+ ********************************************************************/
+static void upload_init(struct upload *upload, struct station *station, const char *name,
+                        int http, int interval, hostdata *hosts, int host_count)
+{
+	struct net_address address;
+	int i;
+
+	memset(upload, 0, sizeof(*upload));
+	upload->station = station;
+	upload->name = name;
+	upload->http = http;
+	upload->interval = interval;
+	upload->hosts = hosts;
+	upload->host_count = host_count;
+	upload->sockfd = INVALID_SOCKET;
+	loop_timer_init(&upload->timeout, upload_timeout, upload);
+	loop_timer_init(&upload->next, upload_start, upload);
+
+	if (interval <= 0)
+		return;
+
+	// Look the servers up now, later the cache is kept fresh
+	for (i = 0; i < host_count; i++)
+		net_resolve(hosts[i].name, hosts[i].port, &address, 1);
+
+	// The first reading takes a few seconds
+	loop_timer_start(&station->server->loop, &upload->next, (interval < 10 ? interval : 10) * 1000L);
+}
+
+
+static void start_cycle(struct station *station);
+
+
+/********************************************************************
+ * poll_done stores a value of the cycle. When all are read the
+ * reading is sent to the clients and the next cycle starts at once,
+ * so the serial link is never idle.
+ *
+ ********************************************************************/
+static void poll_done(void *context, int address, unsigned char *data, int number)
+{
+	struct station *station = context;
+	struct server *server = station->server;
+	char line[LOG_LINE_SIZE + 30];
+	int length, i;
+
+	if (number < 0)
+		station->cycle_failed = 1;
+	else
+		decode_current(&station->reading, address, data);
+
+	if (--station->pending > 0)
+		return;
+
+	if (station->cycle_failed)
+	{
+		// Give a station that does not answer a rest
+		loop_timer_start(&server->loop, &station->retry, 1000);
+		metrics_update(server);
+		return;
+	}
+
+	station->reading.timestamp = time(NULL);
+	station->current = station->reading;
+	station->have_current = 1;
+	station->cycles++;
+	metrics_update(server);
+	web_update(station);
+
+	if ((length = current_line(station, line, sizeof(line))) > 0)
+	{
+		for (i = 0; i < SRV_CLIENTS; i++)
+		{
+			if (server->clients[i].in_use)
+				client_send(&server->clients[i], line, length);
+		}
+	}
+
+	start_cycle(station);
+}
+
+
+/********************************************************************
+ * start_cycle queues the reads of all current values of a station
+ *
+ ********************************************************************/
+static void start_cycle(struct station *station)
+{
+	int i;
+
+	station->pending = CURRENT_ITEMS;
+	station->cycle_failed = 0;
+
+	for (i = 0; i < CURRENT_ITEMS; i++)
+		serial_read(&station->link, current_items[i].address, current_items[i].bytes,
+		            poll_done, station);
+}
+
+
+/********************************************************************
+ * retry_cycle starts a cycle after a failed one. A device that hung
+ * up is reopened first, or tried again a second later.
+ *
+ ********************************************************************/
+static void retry_cycle(struct event_loop *loop, struct loop_timer *timer)
+{
+	struct station *station = timer->context;
+
+	if (station->link.closed && serial_reopen(&station->link) != 0)
+	{
+		loop_timer_start(loop, timer, 1000);
+		return;
+	}
+
+	start_cycle(station);
+}
+
+
+/********************************************************************
+ * station_open starts the reads and uploads of a station
+ *
+ * Input:   id - station id, NULL if it is the only station
+ *          path - its config file
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+static int station_open(struct server *server, const char *id, char *path,
+                        int wu_interval, int aprs_interval)
+{
+	struct station *station = &server->stations[server->station_count];
+	FILE *file;
+
+	station->id = id != NULL ? id : "";
+
+	if (id == NULL)
+	{
+		station->config = server->config;
+		station->tag[0] = '\0';
+	}
+	else
+	{
+		// get_configuration falls back to the default files
+		if ((file = fopen(path, "r")) == NULL ||
+		    (fclose(file), get_configuration(&station->config, path)) != 0)
+		{
+			fprintf(stderr, "Station %s: cannot read %s\n", id, path);
+			return -1;
+		}
+		snprintf(station->tag, sizeof(station->tag), "%s ", id);
+	}
+
+	station->server = server;
+
+	if (server->web_listener != INVALID_SOCKET &&
+	    (station->history = malloc(SRV_HISTORY * sizeof(struct log_record))) == NULL)
+	{
+		fprintf(stderr, "Station %s: out of memory\n", station->id);
+		return -1;
+	}
+
+	if (serial_open(&station->link, &server->loop, station->config.serial_device_name) != 0)
+		return -1;
+
+	loop_timer_init(&station->retry, retry_cycle, station);
+
+	snprintf(station->wu_host.name, sizeof(station->wu_host.name), "%s",
+	         WEATHER_UNDERGROUND_BASEURL);
+	station->wu_host.port = 80;
+	upload_init(&station->wu, station, "Weather Underground", 1, wu_interval,
+	            &station->wu_host, 1);
+	upload_init(&station->aprs, station, "APRS", 0, aprs_interval,
+	            station->config.aprs_host, station->config.num_hosts);
+
+	server->station_count++;
+	start_cycle(station);
+
+	return 0;
+}
+
+
+static struct event_loop *running_loop;
+
+/********************************************************************
+ * request_stop ends the event loop on SIGTERM or SIGINT, so the
+ * stations are closed and --stats is printed
+ *
+ ********************************************************************/
+static void request_stop(int signum)
+{
+	loop_stop(running_loop);
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program keeps reading the current values of a WS2300, or of
+ * each station given by a STATION line in the config file. Each
+ * complete reading is sent as a log2300 line to the local clients and
+ * uploaded to Weather Underground and CWOP at the given intervals.
+ *
+ * It takes the config file name with path as last parameter.
+ * If this parameter is omitted the program will look at the default paths
+ * See the open2300.conf-dist file for info
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	static struct server server;
+	int port = SRV_PORT, wu_interval = 0, aprs_interval = 0, metrics_port = 0;
+	int web_port = 0;
+	int arg, i;
+
+	stats_option(&argc, argv);
+
+	for (arg = 1; arg < argc && argv[arg][0] == '-'; arg += 2)
+	{
+		if (arg + 1 >= argc)
+			print_usage();
+
+		switch (argv[arg][1])
+		{
+		case 'p':
+			port = atoi(argv[arg + 1]);
+			break;
+		case 'w':
+			wu_interval = atoi(argv[arg + 1]);
+			break;
+		case 'a':
+			aprs_interval = atoi(argv[arg + 1]);
+			break;
+		case 'm':
+			metrics_port = atoi(argv[arg + 1]);
+			break;
+		case 'd':
+			web_port = atoi(argv[arg + 1]);
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	get_configuration(&server.config, argv[arg]);
+
+	net_cache_open(server.config.dns_cache_file, server.config.dns_cache_ttl);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (loop_init(&server.loop) != 0)
+		exit(EXIT_FAILURE);
+
+	if ((server.listener = open_listener(port)) == INVALID_SOCKET)
+	{
+		fprintf(stderr, "Cannot listen on port %d\n", port);
+		exit(EXIT_FAILURE);
+	}
+
+	loop_watch_init(&server.accept_watch, server.listener, accept_event, &server);
+	loop_watch_set(&server.loop, &server.accept_watch, LOOP_READ);
+
+	server.metrics_listener = INVALID_SOCKET;
+	if (metrics_port > 0)
+	{
+		if ((server.metrics_listener = open_listener(metrics_port)) == INVALID_SOCKET)
+		{
+			fprintf(stderr, "Cannot listen on port %d\n", metrics_port);
+			exit(EXIT_FAILURE);
+		}
+		loop_watch_init(&server.metrics_watch, server.metrics_listener,
+		                scrape_accept_event, &server);
+		loop_watch_set(&server.loop, &server.metrics_watch, LOOP_READ);
+	}
+
+	server.web_listener = INVALID_SOCKET;
+	if (web_port > 0)
+	{
+		if ((server.web_listener = open_listener(web_port)) == INVALID_SOCKET)
+		{
+			fprintf(stderr, "Cannot listen on port %d\n", web_port);
+			exit(EXIT_FAILURE);
+		}
+		loop_watch_init(&server.web_watch, server.web_listener, web_accept_event, &server);
+		loop_watch_set(&server.loop, &server.web_watch, LOOP_READ);
+		server.web_keepalive = clock_milliseconds() + SRV_KEEPALIVE;
+		loop_timer_init(&server.web_timer, web_sweep, &server);
+		loop_timer_start(&server.loop, &server.web_timer, SRV_WEB_SWEEP);
+	}
+
+	if (server.config.num_stations == 0)
+	{
+		if (station_open(&server, NULL, NULL, wu_interval, aprs_interval) != 0)
+			exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < server.config.num_stations; i++)
+	{
+		if (station_open(&server, server.config.stations[i].id,
+		                 server.config.stations[i].config_file,
+		                 wu_interval, aprs_interval) != 0)
+			exit(EXIT_FAILURE);
+	}
+
+	net_refresh_start();
+	metrics_update(&server);
+
+	running_loop = &server.loop;
+	signal(SIGTERM, request_stop);
+	signal(SIGINT, request_stop);
+
+	loop_run(&server.loop);
+
+	for (i = 0; i < server.station_count; i++)
+	{
+		stats_merge(stats_get(), &server.stations[i].link.stats);
+		serial_close(&server.stations[i].link);
+	}
+	loop_close(&server.loop);
+	net_cache_close();
+
+	return 0;
+}
@@ -0,0 +1,273 @@
+/*  open2300 - stats2300.c
+ *
+ *  Version 1.11
+ *
+ *  Counters and latency histograms of the serial protocol.
+ *  See stats2300.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "stats2300.h"
+
+static struct protocol_stats stats;
+
+
+/********************************************************************
+ * stats_get gives the statistics of this process
+ *
+ ********************************************************************/
+struct protocol_stats *stats_get(void)
+{
+	return &stats;
+}
+
+
+/********************************************************************
+ * stats_reset clears the statistics
+ *
+ ********************************************************************/
+void stats_reset(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+
+/********************************************************************
+ * stats_add adds a latency to a histogram
+ *
+ * Input:   start - clock_microseconds when it started
+ *
+ ********************************************************************/
+void stats_add(struct stats_histogram *histogram, long long start)
+{
+	long long latency = clock_microseconds() - start;
+	int bucket = 0;
+
+	if (latency < 0)
+		latency = 0;
+
+	while (bucket < STATS_BUCKETS - 1 && latency >= 2LL << bucket)
+		bucket++;
+
+	histogram->count++;
+	histogram->total += latency;
+	histogram->bucket[bucket]++;
+	if (latency > histogram->max)
+		histogram->max = latency;
+}
+
+
+/********************************************************************
+ * stats_retry counts a read or write that is tried again
+ *
+ * Input:   stats - statistics to count in
+ *          address - of the first nibble
+ *
+ ********************************************************************/
+void stats_retry(struct protocol_stats *stats, int address)
+{
+	int range = address >> 8;
+
+	stats->retries[range < STATS_RANGES ? range : STATS_RANGES - 1]++;
+}
+
+
+/********************************************************************
+ * merge_histogram adds the latencies of one histogram to another
+ *
+ ********************************************************************/
+static void merge_histogram(struct stats_histogram *total,
+                            const struct stats_histogram *histogram)
+{
+	int i;
+
+	total->count += histogram->count;
+	total->total += histogram->total;
+	if (histogram->max > total->max)
+		total->max = histogram->max;
+	for (i = 0; i < STATS_BUCKETS; i++)
+		total->bucket[i] += histogram->bucket[i];
+}
+
+
+/********************************************************************
+ * stats_merge adds one set of statistics to another, e.g. those of
+ * the serial links of srv2300 to the process for --stats
+ *
+ ********************************************************************/
+void stats_merge(struct protocol_stats *total, const struct protocol_stats *stats)
+{
+	int i;
+
+	total->transactions += stats->transactions;
+	total->failed += stats->failed;
+	total->bytes_sent += stats->bytes_sent;
+	total->bytes_received += stats->bytes_received;
+	total->echo_mismatches += stats->echo_mismatches;
+	total->checksum_failures += stats->checksum_failures;
+	total->timeouts += stats->timeouts;
+	total->resets += stats->resets;
+	total->reset_commands += stats->reset_commands;
+	for (i = 0; i < STATS_RANGES; i++)
+		total->retries[i] += stats->retries[i];
+
+	merge_histogram(&total->read_data, &stats->read_data);
+	merge_histogram(&total->write_data, &stats->write_data);
+	merge_histogram(&total->read_safe, &stats->read_safe);
+	merge_histogram(&total->write_safe, &stats->write_safe);
+	merge_histogram(&total->reset, &stats->reset);
+	merge_histogram(&total->drain, &stats->drain);
+}
+
+
+/********************************************************************
+ * percentile gives the upper bound of the bucket a percentile of a
+ * histogram falls in
+ *
+ * Returns: milliseconds
+ *
+ ********************************************************************/
+static double percentile(struct stats_histogram *histogram, double fraction)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < STATS_BUCKETS; i++)
+	{
+		sum += histogram->bucket[i];
+		if (sum >= fraction * histogram->count)
+			break;
+	}
+
+	return (2LL << i) / 1000.0;
+}
+
+
+/********************************************************************
+ * format_histogram adds a histogram to a report: a line with count,
+ * average, percentiles and max, then the buckets in use
+ *
+ * Returns: length added
+ *
+ ********************************************************************/
+static int format_histogram(char *text, int size, const char *name,
+                            struct stats_histogram *histogram)
+{
+	int length, i;
+
+	if (histogram->count == 0)
+		return 0;
+
+	length = snprintf(text, size,
+	                  "%-11s %8lu  avg %9.3f ms  p50 < %9.3f  p90 < %9.3f  p99 < %9.3f  max %9.3f ms\n",
+	                  name, histogram->count, histogram->total / 1000.0 / histogram->count,
+	                  percentile(histogram, 0.5), percentile(histogram, 0.9),
+	                  percentile(histogram, 0.99), histogram->max / 1000.0);
+
+	for (i = 0; i < STATS_BUCKETS && length < size; i++)
+	{
+		if (histogram->bucket[i] == 0)
+			continue;
+		length += snprintf(text + length, size - length, "    < %10.3f ms %8lu\n",
+		                   (2LL << i) / 1000.0, histogram->bucket[i]);
+	}
+
+	return length < size ? length : size - 1;
+}
+
+
+/********************************************************************
+ * stats_format writes a report of the statistics
+ *
+ * Input:   stats - the statistics, stats_get() for the process
+ *          size - of text, STATS_TEXT_SIZE is enough
+ *
+ * Output:  text - zero terminated report
+ *
+ * Returns: length of the report
+ *
+ ********************************************************************/
+int stats_format(struct protocol_stats *stats, char *text, int size)
+{
+	int length, i;
+
+	length = snprintf(text, size,
+	                  "transactions %lu\nfailed %lu\nbytes_sent %lu\nbytes_received %lu\n"
+	                  "echo_mismatches %lu\nchecksum_failures %lu\ntimeouts %lu\n"
+	                  "resets %lu\nreset_commands %lu\n",
+	                  stats->transactions, stats->failed, stats->bytes_sent,
+	                  stats->bytes_received, stats->echo_mismatches, stats->checksum_failures,
+	                  stats->timeouts, stats->resets, stats->reset_commands);
+
+	for (i = 0; i < STATS_RANGES && length < size; i++)
+	{
+		if (stats->retries[i] > 0)
+			length += snprintf(text + length, size - length, "retries %04X-%04X %lu\n",
+			                   i << 8, i == STATS_RANGES - 1 ? 0xFFFF : (i << 8) + 0xFF,
+			                   stats->retries[i]);
+	}
+
+	if (length >= size)
+		return size - 1;
+
+	length += format_histogram(text + length, size - length, "read_data", &stats->read_data);
+	length += format_histogram(text + length, size - length, "write_data", &stats->write_data);
+	length += format_histogram(text + length, size - length, "read_safe", &stats->read_safe);
+	length += format_histogram(text + length, size - length, "write_safe", &stats->write_safe);
+	length += format_histogram(text + length, size - length, "reset_06", &stats->reset);
+	length += format_histogram(text + length, size - length, "tcdrain", &stats->drain);
+
+	return length;
+}
+
+
+/********************************************************************
+ * stats_print prints the report
+ *
+ ********************************************************************/
+void stats_print(FILE *stream)
+{
+	char text[STATS_TEXT_SIZE];
+
+	stats_format(&stats, text, sizeof(text));
+	fputs(text, stream);
+}
+
+
+static void print_at_exit(void)
+{
+	stats_print(stderr);
+}
+
+
+/********************************************************************
+ * stats_option handles the --stats option of the tools: it is taken
+ * out of the arguments and the report is printed to stderr when the
+ * program exits
+ *
+ * Input:   argc, argv - of main
+ *
+ * Output:  argc, argv - without --stats
+ *
+ ********************************************************************/
+void stats_option(int *argc, char *argv[])
+{
+	static int registered;
+	int i, j;
+
+	for (i = 1; i < *argc; i++)
+	{
+		if (strcmp(argv[i], STATS_OPTION) != 0)
+			continue;
+
+		for (j = i; j < *argc; j++)
+			argv[j] = argv[j + 1];
+		(*argc)--;
+		i--;
+
+		if (!registered)
+			atexit(print_at_exit);
+		registered = 1;
+	}
+}
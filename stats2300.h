@@ -0,0 +1,71 @@
+/* open2300 - stats2300.h
+ * Include file for the counters and latency histograms of the serial
+ * protocol.
+ *
+ * read_device, write_device, reset_06, read_data, write_data,
+ * read_safe and write_safe count what they do into one set of
+ * statistics per process (stats_get). The non-blocking protocol of
+ * srv2300 counts into a set per serial link, so each station has its
+ * own. Latencies go into histograms with one bucket per power of two
+ * microseconds. A tool run with --stats prints them when it exits,
+ * srv2300 sends those of each station to a client that sends "stats".
+ * The statistics are not locked; the serial protocol runs in one
+ * thread.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_STATS2300_H_
+#define _INCLUDE_STATS2300_H_
+
+#include "rw2300.h"
+
+#define STATS_BUCKETS    32        // bucket i: below 2^(i+1) microseconds
+#define STATS_RANGES     20        // address ranges of 0x100 nibbles
+#define STATS_TEXT_SIZE  8192      // room for stats_format
+#define STATS_OPTION     "--stats"
+
+struct stats_histogram
+{
+	unsigned long count;
+	long long     total;           // microseconds
+	long long     max;
+	unsigned long bucket[STATS_BUCKETS];
+};
+
+struct protocol_stats
+{
+	unsigned long transactions;    // read_data and write_data
+	unsigned long failed;          // transactions that failed
+	unsigned long bytes_sent;
+	unsigned long bytes_received;
+	unsigned long echo_mismatches; // command not answered as expected
+	unsigned long checksum_failures;
+	unsigned long timeouts;        // reads that got no byte
+	unsigned long resets;          // reset_06
+	unsigned long reset_commands;  // 0x06 sent
+	unsigned long retries[STATS_RANGES];   // read_safe / write_safe tries again
+	struct stats_histogram read_data;
+	struct stats_histogram write_data;
+	struct stats_histogram read_safe;
+	struct stats_histogram write_safe;
+	struct stats_histogram reset;
+	struct stats_histogram drain;  // tcdrain in write_device
+};
+
+struct protocol_stats *stats_get(void);
+
+void stats_reset(void);
+
+void stats_add(struct stats_histogram *histogram, long long start);
+
+void stats_retry(struct protocol_stats *stats, int address);
+
+void stats_merge(struct protocol_stats *total, const struct protocol_stats *stats);
+
+int  stats_format(struct protocol_stats *stats, char *text, int size);
+
+void stats_print(FILE *stream);
+
+void stats_option(int *argc, char *argv[]);
+
+#endif /* _INCLUDE_STATS2300_H_ */
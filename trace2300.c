@@ -0,0 +1,611 @@
+/*  open2300 - trace2300.c
+ *
+ *  Version 1.11
+ *
+ *  Capture and replay of serial sessions. See trace2300.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "trace2300.h"
+#include "link2300.h"
+
+#define TRACE_ANSWER     64        // bytes the model has to answer
+#define TRACE_BYTES      16        // most bytes in one read command
+#define TRACE_BYTE_US    4167      // one byte at 2400 baud
+
+#define MODEL_IDLE       0
+#define MODEL_ADDRESS    1         // reset done, address bytes come
+#define MODEL_COMMAND    2         // address done, count or data come
+
+struct trace_event
+{
+	long long time;                // microseconds from the first record
+	int    direction;
+	long   offset;                 // of the bytes in replay.data
+	int    length;
+};
+
+struct trace_delay
+{
+	long   delay;                  // microseconds before the answer
+	int    answered;               // 0 = the read timed out
+};
+
+static char   trace_path[200];
+static double replay_speed = 1.0;
+
+static FILE  *capture;
+static long long capture_last;
+
+static struct
+{
+	int    open;
+	unsigned char *data;           // the whole file
+	struct trace_event *events;
+	int    count;
+	int    next;                   // event to replay
+	int    strict;                 // still following the recording
+	long long start;               // clock of the first event
+	struct trace_delay *delays;
+	int    delay_count;
+	int    delay_next;
+	unsigned char memory[TRACE_NIBBLES];
+	int    state;
+	int    step;
+	int    address;
+	unsigned char answer[TRACE_ANSWER];
+	int    answer_first;
+	int    answer_length;
+} replay;
+
+
+/********************************************************************
+ * trace_setup sets the file sessions are recorded into and the speed
+ * of replays. Called by get_configuration.
+ *
+ * Input:   path - SERIAL_TRACE, "" = no recording
+ *          speed - SERIAL_REPLAY_SPEED, 0 = as fast as possible
+ *
+ ********************************************************************/
+void trace_setup(const char *path, double speed)
+{
+	snprintf(trace_path, sizeof(trace_path), "%s", path);
+	replay_speed = speed < 0 ? 1.0 : speed;
+}
+
+
+/********************************************************************
+ * put_varint writes a number 7 bits per byte, low bits first, the top
+ * bit set in all bytes but the last
+ *
+ ********************************************************************/
+static void put_varint(FILE *file, unsigned long long value)
+{
+	while (value >= 0x80)
+	{
+		putc((int) (value & 0x7F) | 0x80, file);
+		value >>= 7;
+	}
+	putc((int) value, file);
+}
+
+
+/********************************************************************
+ * get_varint reads a number written by put_varint
+ *
+ * Returns: bytes used, 0 if the buffer ends in the number
+ *
+ ********************************************************************/
+static int get_varint(const unsigned char *buffer, long size, unsigned long long *value)
+{
+	int i, shift = 0;
+
+	*value = 0;
+	for (i = 0; i < size && shift < 64; i++, shift += 7)
+	{
+		*value |= (unsigned long long) (buffer[i] & 0x7F) << shift;
+		if ((buffer[i] & 0x80) == 0)
+			return i + 1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * trace_capture_open starts recording the session into SERIAL_TRACE
+ * if it is set. Called when the station is opened.
+ *
+ * Returns: 0 on success or when not recording, -1 if fail
+ *
+ ********************************************************************/
+int trace_capture_open(void)
+{
+	if (trace_path[0] == '\0' || capture != NULL)
+		return 0;
+
+	if ((capture = fopen(trace_path, "wb")) == NULL)
+	{
+		perror("Cannot create serial trace file");
+		return -1;
+	}
+
+	fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), capture);
+	capture_last = clock_microseconds();
+
+	return 0;
+}
+
+
+/********************************************************************
+ * trace_record records a read or write if a session is recorded
+ *
+ * Input:   direction - TRACE_READ or TRACE_WRITE
+ *          data - the bytes
+ *          length - number of bytes, 0 or less for none
+ *
+ ********************************************************************/
+void trace_record(int direction, const unsigned char *data, int length)
+{
+	long long now;
+
+	if (capture == NULL)
+		return;
+
+	if (length < 0)
+		length = 0;
+
+	now = clock_microseconds();
+	put_varint(capture, ((unsigned long long) (now - capture_last) << 1) | direction);
+	put_varint(capture, length);
+	fwrite(data, 1, length, capture);
+	capture_last = now;
+}
+
+
+/********************************************************************
+ * answer_add queues a byte the station model answers
+ *
+ ********************************************************************/
+static void answer_add(int byte)
+{
+	if (replay.answer_length < TRACE_ANSWER)
+		replay.answer[replay.answer_length++] = (unsigned char) byte;
+}
+
+
+/********************************************************************
+ * model_write gives a command byte to the station model, which
+ * queues the answer a WS2300 gives (see read_data and write_data)
+ *
+ ********************************************************************/
+static void model_write(int byte)
+{
+	unsigned char data[TRACE_BYTES];
+	int number, nibble, i;
+
+	if (byte == 0x06)
+	{
+		replay.state = MODEL_ADDRESS;
+		replay.step = 0;
+		replay.address = 0;
+		replay.answer_first = replay.answer_length = 0;
+		answer_add(0x02);
+		return;
+	}
+
+	if (replay.state == MODEL_ADDRESS && byte >= 0x82 && byte <= 0xBE && (byte & 3) == 2)
+	{
+		nibble = (byte - 0x82) / 4;
+		replay.address = (replay.address << 4) | nibble;
+		answer_add(replay.step * 16 + nibble);
+		if (++replay.step == 4)
+			replay.state = MODEL_COMMAND;
+		return;
+	}
+
+	if (replay.state == MODEL_COMMAND && (byte & 3) == 2)
+	{
+		if (byte >= 0xC2)
+		{
+			number = (byte - 0xC2) / 4;
+			for (i = 0; i < number; i++)
+			{
+				data[i] = replay.memory[(replay.address + 2 * i) % TRACE_NIBBLES] |
+				          replay.memory[(replay.address + 2 * i + 1) % TRACE_NIBBLES] << 4;
+			}
+			answer_add(command_check4(number));
+			for (i = 0; i < number; i++)
+				answer_add(data[i]);
+			answer_add(data_checksum(data, number));
+			replay.state = MODEL_IDLE;
+			return;
+		}
+
+		if (byte >= WRITENIB && byte <= WRITENIB + 0x3C)
+		{
+			nibble = (byte - WRITENIB) / 4;
+			replay.memory[replay.address++ % TRACE_NIBBLES] = nibble;
+			answer_add(nibble + WRITEACK);
+			return;
+		}
+
+		if (byte >= SETBIT && byte <= SETBIT + 0x0C)
+		{
+			nibble = (byte - SETBIT) / 4;
+			replay.memory[replay.address % TRACE_NIBBLES] |= 1 << nibble;
+			answer_add(nibble + SETACK);
+			return;
+		}
+
+		if (byte >= UNSETBIT && byte <= UNSETBIT + 0x0C)
+		{
+			nibble = (byte - UNSETBIT) / 4;
+			replay.memory[replay.address % TRACE_NIBBLES] &= ~(1 << nibble);
+			answer_add(nibble + UNSETACK);
+			return;
+		}
+	}
+
+	// Not understood, the station does not answer
+	replay.state = MODEL_IDLE;
+}
+
+
+/********************************************************************
+ * learn fills the memory of the station model with the data of the
+ * reads in the recording that passed the checksum, and collects the
+ * answer delays
+ *
+ ********************************************************************/
+static void learn(void)
+{
+	struct trace_event *event;
+	unsigned char bytes[TRACE_BYTES + 2];
+	int state = MODEL_IDLE, address = 0, step = 0, number = -1, received = 0;
+	int i, j, byte;
+
+	for (i = 0; i < replay.count; i++)
+	{
+		event = &replay.events[i];
+
+		if (event->direction == TRACE_READ)
+		{
+			replay.delays[replay.delay_count].delay =
+				(long) (event->time - (i > 0 ? replay.events[i - 1].time : 0));
+			replay.delays[replay.delay_count++].answered = event->length > 0;
+		}
+
+		for (j = 0; j < event->length; j++)
+		{
+			byte = replay.data[event->offset + j];
+
+			if (event->direction == TRACE_READ)
+			{
+				if (number < 0)
+					continue;
+				bytes[received++] = byte;
+				if (received < number + 2)
+					continue;
+				// count answer, data and checksum
+				if (bytes[0] == command_check4(number) &&
+				    bytes[number + 1] == data_checksum(bytes + 1, number))
+				{
+					for (step = 0; step < number; step++)
+					{
+						replay.memory[(address + 2 * step) % TRACE_NIBBLES] = bytes[step + 1] & 0x0F;
+						replay.memory[(address + 2 * step + 1) % TRACE_NIBBLES] = bytes[step + 1] >> 4;
+					}
+				}
+				number = -1;
+				continue;
+			}
+
+			number = -1;
+			if (byte == 0x06)
+			{
+				state = MODEL_ADDRESS;
+				step = 0;
+				address = 0;
+			}
+			else if (state == MODEL_ADDRESS && byte >= 0x82 && byte <= 0xBE && (byte & 3) == 2)
+			{
+				address = (address << 4) | ((byte - 0x82) / 4);
+				if (++step == 4)
+					state = MODEL_COMMAND;
+			}
+			else if (state == MODEL_COMMAND && byte >= 0xC2 && (byte & 3) == 2)
+			{
+				number = (byte - 0xC2) / 4;
+				received = 0;
+				state = MODEL_IDLE;
+			}
+			else
+			{
+				state = MODEL_IDLE;
+			}
+		}
+	}
+}
+
+
+/********************************************************************
+ * trace_replay_open loads a recorded session to be played back by
+ * read_device and write_device
+ *
+ * Input:   path - file recorded with SERIAL_TRACE
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int trace_replay_open(const char *path)
+{
+	unsigned long long value, length;
+	long long time = 0;
+	long size, position;
+	int used, allocated = 0;
+	FILE *file;
+
+	trace_close();
+	memset(&replay, 0, sizeof(replay));
+
+	if ((file = fopen(path, "rb")) == NULL)
+	{
+		perror("Cannot open serial trace file");
+		return -1;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	rewind(file);
+
+	if (size < (long) strlen(TRACE_MAGIC) || (replay.data = malloc(size)) == NULL ||
+	    fread(replay.data, 1, size, file) != (size_t) size ||
+	    memcmp(replay.data, TRACE_MAGIC, strlen(TRACE_MAGIC)) != 0)
+	{
+		fprintf(stderr, "%s is not a serial trace\n", path);
+		fclose(file);
+		free(replay.data);
+		return -1;
+	}
+	fclose(file);
+
+	position = strlen(TRACE_MAGIC);
+	while (position < size)
+	{
+		if ((used = get_varint(replay.data + position, size - position, &value)) == 0)
+			break;
+		position += used;
+		if ((used = get_varint(replay.data + position, size - position, &length)) == 0 ||
+		    length > (unsigned long long) (size - position - used))
+			break;
+		position += used;
+
+		if (replay.count == allocated)
+		{
+			allocated = allocated ? allocated * 2 : 1024;
+			replay.events = realloc(replay.events, allocated * sizeof(*replay.events));
+			if (replay.events == NULL)
+			{
+				fprintf(stderr, "Out of memory for %s\n", path);
+				free(replay.data);
+				return -1;
+			}
+		}
+
+		time += (long long) (value >> 1);
+		replay.events[replay.count].time = time;
+		replay.events[replay.count].direction = (int) (value & 1);
+		replay.events[replay.count].offset = position;
+		replay.events[replay.count].length = (int) length;
+		replay.count++;
+		position += (long) length;
+	}
+
+	if (position < size)
+		fprintf(stderr, "%s ends in a broken record, replaying %d records\n", path, replay.count);
+
+	replay.delays = malloc((replay.count + 1) * sizeof(*replay.delays));
+	if (replay.delays == NULL)
+	{
+		fprintf(stderr, "Out of memory for %s\n", path);
+		free(replay.events);
+		free(replay.data);
+		return -1;
+	}
+
+	learn();
+
+	replay.open = 1;
+	replay.strict = 1;
+	replay.start = -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * trace_replaying tells if read_device and write_device replay
+ *
+ ********************************************************************/
+int trace_replaying(void)
+{
+	return replay.open;
+}
+
+
+/********************************************************************
+ * wait_until waits for a time of the replay clock
+ *
+ * Input:   due - clock_microseconds value
+ *
+ ********************************************************************/
+static void wait_until(long long due)
+{
+	long long left;
+
+	if (replay_speed <= 0)
+		return;
+
+	if ((left = due - clock_microseconds()) > 0)
+		sleep_short((int) ((left + 999) / 1000));
+}
+
+
+/********************************************************************
+ * wait_recorded waits a span of recorded time, scaled by the replay
+ * speed. At speed 0 there is no wait and nothing is divided by it.
+ *
+ * Input:   microseconds - span at the speed of the recording
+ *
+ ********************************************************************/
+static void wait_recorded(double microseconds)
+{
+	if (replay_speed <= 0)
+		return;
+
+	wait_until(clock_microseconds() + (long long) (microseconds / replay_speed));
+}
+
+
+/********************************************************************
+ * event_due gives when a recorded event is replayed
+ *
+ ********************************************************************/
+static long long event_due(struct trace_event *event)
+{
+	if (replay_speed <= 0)
+		return 0;
+
+	if (replay.start < 0)
+		replay.start = clock_microseconds() - (long long) (event->time / replay_speed);
+
+	return replay.start + (long long) (event->time / replay_speed);
+}
+
+
+/********************************************************************
+ * leave_strict hands the replay over to the station model
+ *
+ ********************************************************************/
+static void leave_strict(const char *what)
+{
+	replay.strict = 0;
+
+	if (replay.next >= replay.count)
+		fprintf(stderr, "Replay: end of the recording, the station model answers from here\n");
+	else
+		fprintf(stderr, "Replay: %s differs from the recording at record %d, "
+		        "the station model answers from here\n", what, replay.next);
+}
+
+
+/********************************************************************
+ * trace_replay_read replays read_device
+ *
+ * Returns: number of bytes read, 0 on a timeout
+ *
+ ********************************************************************/
+int trace_replay_read(unsigned char *buffer, int size)
+{
+	struct trace_event *event = &replay.events[replay.next];
+	struct trace_delay delay = {TRACE_BYTE_US, 1};
+	int pending, length;
+
+	if (replay.strict &&
+	    (replay.next >= replay.count || event->direction != TRACE_READ))
+		leave_strict("read");
+
+	if (replay.strict)
+	{
+		wait_until(event_due(event));
+		length = event->length < size ? event->length : size;
+		memcpy(buffer, replay.data + event->offset, length);
+		replay.next++;
+
+		// The model answers in step with the recording
+		pending = replay.answer_length - replay.answer_first;
+		replay.answer_first += length < pending ? length : pending;
+
+		return length;
+	}
+
+	if ((pending = replay.answer_length - replay.answer_first) == 0)
+	{
+		// As long as a read on the device with the loaded profile
+		wait_recorded(link_timing()->timeout * 1000.0);
+		return 0;
+	}
+
+	if (replay.delay_count > 0)
+		delay = replay.delays[replay.delay_next++ % replay.delay_count];
+
+	wait_recorded(delay.delay);
+
+	if (!delay.answered)
+	{
+		replay.answer_first = replay.answer_length = 0;
+		return 0;
+	}
+
+	length = pending < size ? pending : size;
+	memcpy(buffer, replay.answer + replay.answer_first, length);
+	replay.answer_first += length;
+
+	return length;
+}
+
+
+/********************************************************************
+ * trace_replay_write replays write_device
+ *
+ * Returns: number of bytes written
+ *
+ ********************************************************************/
+int trace_replay_write(const unsigned char *buffer, int size)
+{
+	struct trace_event *event = &replay.events[replay.next];
+	int i;
+
+	for (i = 0; i < size; i++)
+		model_write(buffer[i]);
+
+	if (replay.strict &&
+	    (replay.next >= replay.count || event->direction != TRACE_WRITE ||
+	     event->length != size || memcmp(replay.data + event->offset, buffer, size) != 0))
+		leave_strict("write");
+
+	if (replay.strict)
+	{
+		wait_until(event_due(event));
+		replay.next++;
+		return size;
+	}
+
+	wait_recorded((double) size * TRACE_BYTE_US);
+
+	return size;
+}
+
+
+/********************************************************************
+ * trace_close ends a recording or a replay
+ *
+ ********************************************************************/
+void trace_close(void)
+{
+	if (capture != NULL)
+	{
+		fclose(capture);
+		capture = NULL;
+	}
+
+	if (replay.open)
+	{
+		free(replay.delays);
+		free(replay.events);
+		free(replay.data);
+		replay.open = 0;
+	}
+}
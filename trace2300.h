@@ -0,0 +1,49 @@
+/* open2300 - trace2300.h
+ * Include file for capture and replay of serial sessions.
+ *
+ * With SERIAL_TRACE set every read_device and write_device call is
+ * recorded with its bytes and a monotonic timestamp, a read that timed
+ * out with no bytes. A record is a varint of the microseconds since
+ * the previous record shifted left by one with the direction in bit 0,
+ * a varint of the byte count and the bytes, so a session at 2400 baud
+ * takes about three bytes per byte on the line.
+ *
+ * SERIAL_DEVICE replay:file plays a recording back instead of the
+ * station, with the recorded timing divided by SERIAL_REPLAY_SPEED
+ * (0 = no waiting). As long as the program sends what was recorded it
+ * gets the recorded answers at the recorded times, retries and all.
+ * When it sends something else (a changed protocol) or the recording
+ * ends, a model of the station takes over: it answers the WS2300
+ * commands from the memory seen in the recording and with the answer
+ * delays and timeouts of the recording, in their order.
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_TRACE2300_H_
+#define _INCLUDE_TRACE2300_H_
+
+#include "rw2300.h"
+
+#define TRACE_WRITE      0         // bytes sent to the station
+#define TRACE_READ       1         // bytes received, none on a timeout
+#define TRACE_MAGIC      "W2T1"
+#define TRACE_REPLAY     "replay:" // SERIAL_DEVICE prefix
+#define TRACE_NIBBLES    0x10000   // station memory of the model
+
+void trace_setup(const char *path, double speed);
+
+int  trace_capture_open(void);
+
+void trace_record(int direction, const unsigned char *data, int length);
+
+int  trace_replay_open(const char *path);
+
+int  trace_replaying(void);
+
+int  trace_replay_read(unsigned char *buffer, int size);
+
+int  trace_replay_write(const unsigned char *buffer, int size);
+
+void trace_close(void);
+
+#endif /* _INCLUDE_TRACE2300_H_ */
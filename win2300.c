@@ -13,7 +13,11 @@
 #ifdef WIN32
 #define DEBUG 0
 
-#include "rw2300.h"
+#include <io.h>
+#include "net2300.h"
+#include "trace2300.h"
+#include "stats2300.h"
+#include "link2300.h"
 
 /********************************************************************
  * open_weatherstation, Windows version
@@ -29,6 +33,19 @@ WEATHERSTATION open_weatherstation (char *device)
 	DCB dcb;
 	COMMTIMEOUTS commtimeouts;
 
+	link_profile_load(device);
+
+	// A recorded session instead of the station
+	if (strncmp(device, TRACE_REPLAY, strlen(TRACE_REPLAY)) == 0)
+	{
+		if (trace_replay_open(device + strlen(TRACE_REPLAY)) != 0)
+			exit(EXIT_FAILURE);
+		ws = CreateFile("NUL", GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+		if (ws == INVALID_HANDLE_VALUE)
+			exit(EXIT_FAILURE);
+		return ws;
+	}
+
 	//Setup serial port
 
 	ws = CreateFile( device,
@@ -78,7 +95,7 @@ WEATHERSTATION open_weatherstation (char *device)
 
 	commtimeouts.ReadIntervalTimeout = MAXDWORD;
 	commtimeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
-	commtimeouts.ReadTotalTimeoutConstant = 175;
+	commtimeouts.ReadTotalTimeoutConstant = link_timing()->timeout;
 	commtimeouts.WriteTotalTimeoutConstant = 0;
 	commtimeouts.WriteTotalTimeoutMultiplier = 0;
 
@@ -102,6 +119,7 @@ WEATHERSTATION open_weatherstation (char *device)
  ********************************************************************/
 void close_weatherstation (WEATHERSTATION ws)
 {
+	trace_close();
 	CloseHandle (ws);
 	return;
 }
@@ -118,14 +136,18 @@ void reset_06(WEATHERSTATION serdevice)
 {
 	unsigned char command = 0x06;
 	unsigned char answer;
+	long long start = clock_microseconds();
 	int i;
 
+	stats_get()->resets++;
+
 	for (i = 0; i < 100; i++)
 	{
 
 		PurgeComm(serdevice, PURGE_RXCLEAR);
 
 		write_device(serdevice, &command, 1);
+		stats_get()->reset_commands++;
 
 		// Occasionally 0, then 2 is returned.  If zero comes back, continue
 		// reading as this is more efficient than sending an out-of sync
@@ -142,11 +164,12 @@ void reset_06(WEATHERSTATION serdevice)
 				// clear anything that might come after the response
 				PurgeComm(serdevice, PURGE_RXCLEAR);
 
+				stats_add(&stats_get()->reset, start);
 				return;
 			}
 		}
 
-		Sleep(5 * i);
+		Sleep(link_timing()->backoff * i);
 	}
 	printf("\nCould not reset\n");
 	exit(EXIT_FAILURE);
@@ -169,10 +192,24 @@ int read_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
 {
 	DWORD dwRead = 0;
 
-	if (!ReadFile(serdevice, buffer, size, &dwRead, NULL))
+	if (trace_replaying())
 	{
-		return -1;
+		dwRead = trace_replay_read(buffer, size);
 	}
+	else
+	{
+		if (!ReadFile(serdevice, buffer, size, &dwRead, NULL))
+		{
+			return -1;
+		}
+
+		trace_record(TRACE_READ, buffer, (int) dwRead);
+	}
+
+	if (dwRead > 0)
+		stats_get()->bytes_received += dwRead;
+	else
+		stats_get()->timeouts++;
 
 	return (int) dwRead;
 }
@@ -192,14 +229,49 @@ int write_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
 {
 	DWORD dwWritten;
 
-	if (!WriteFile(serdevice, buffer, size, &dwWritten, NULL))
+	if (trace_replaying())
 	{
-		return -1;
+		dwWritten = trace_replay_write(buffer, size);
+	}
+	else
+	{
+		if (!WriteFile(serdevice, buffer, size, &dwWritten, NULL))
+		{
+			return -1;
+		}
+
+		trace_record(TRACE_WRITE, buffer, (int) dwWritten);
 	}
 
+	stats_get()->bytes_sent += dwWritten;
+
 	return (int) dwWritten;
 }
 
+/********************************************************************
+ * set_read_timeout - Windows version
+ *
+ * Inputs:  serdevice - opened file handle
+ *          milliseconds - how long read_device waits for a byte
+ *
+ * Returns: 0 on success, -1 if fail
+ *
+ ********************************************************************/
+int set_read_timeout(WEATHERSTATION serdevice, int milliseconds)
+{
+	COMMTIMEOUTS commtimeouts;
+
+	if (trace_replaying())
+		return 0;
+
+	if (!GetCommTimeouts(serdevice, &commtimeouts))
+		return -1;
+
+	commtimeouts.ReadTotalTimeoutConstant = milliseconds;
+
+	return SetCommTimeouts(serdevice, &commtimeouts) ? 0 : -1;
+}
+
 /********************************************************************
  * sleep_short - Windows version
  * 
@@ -226,6 +298,197 @@ void sleep_long(int seconds)
 	Sleep(seconds*1000);
 }
 
+/********************************************************************
+ * publish_file - Windows version
+ *
+ * Inputs: path - file name of the published document
+ *         data - complete document to publish
+ *         size - number of bytes in data
+ *         compare_from - offset from where the content is compared
+ *                        with the existing file (see file_unchanged)
+ *
+ * Returns: 1 if the file was replaced, 0 if the content was unchanged
+ *          and the file was left untouched, -1 if fail.
+ *
+ * Action: Writes the document to a temporary file and moves it
+ *         over the target in one operation.
+ *
+ ********************************************************************/
+int publish_file(char *path, const char *data, int size, int compare_from)
+{
+	char temppath[300];
+	FILE *fptr;
+
+	if (file_unchanged(path, data, size, compare_from))
+		return 0;
+
+	snprintf(temppath, sizeof(temppath), "%s.tmp", path);
+
+	if ((fptr = fopen(temppath, "wb")) == NULL)
+	{
+		perror("Cannot create temporary file");
+		return -1;
+	}
+
+	if ((int) fwrite(data, 1, size, fptr) != size || fflush(fptr) != 0)
+	{
+		perror("Cannot write temporary file");
+		fclose(fptr);
+		DeleteFile(temppath);
+		return -1;
+	}
+
+	fclose(fptr);
+
+	if (!MoveFileEx(temppath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		printf("Cannot replace file %s\n", path);
+		DeleteFile(temppath);
+		return -1;
+	}
+
+	return 1;
+}
+
+/********************************************************************
+ * sync_file - Windows version
+ *
+ * Inputs: stream - file open for writing
+ *
+ * Returns: 0 on success, -1 if fail.
+ *
+ * Action: Writes the buffered data and waits until it is on disk.
+ *
+ ********************************************************************/
+int sync_file(FILE *stream)
+{
+	if (fflush(stream) != 0 ||
+	    !FlushFileBuffers((HANDLE) _get_osfhandle(_fileno(stream))))
+		return -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * lock_file - Windows version
+ *
+ * Inputs: stream - open file
+ *         seconds - longest wait for a lock held by another process
+ *
+ * Returns: 0 when locked, -1 if fail.
+ *
+ * Action: Takes an exclusive lock (LockFileEx) on the file. The lock
+ *         ends when the file is closed.
+ *
+ ********************************************************************/
+int lock_file(FILE *stream, int seconds)
+{
+	HANDLE handle = (HANDLE) _get_osfhandle(_fileno(stream));
+	OVERLAPPED overlapped;
+	int waited;
+
+	memset(&overlapped, 0, sizeof(overlapped));
+
+	for (waited = 0; !LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY,
+	                             0, 1, 0, &overlapped); waited += 100)
+	{
+		if (GetLastError() != ERROR_LOCK_VIOLATION || waited >= seconds * 1000)
+			return -1;
+		Sleep(100);
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * make_directory - Windows version
+ *
+ * Inputs: path - directory to create
+ *
+ * Returns: 0 on success or if it exists, -1 if fail.
+ *
+ ********************************************************************/
+int make_directory(const char *path)
+{
+	if (!CreateDirectory(path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+		return -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * network_startup - Windows version
+ *
+ * Returns: 0 on success, -1 if no useable winsock.dll
+ *
+ * Action: Start Winsock 2.2. Every call must be matched by WSACleanup
+ *         but the programs just exit.
+ *
+ ********************************************************************/
+int network_startup(void)
+{
+	WSADATA wsaData;
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		perror("Couldn't find a useable winsock.dll");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * socket_nonblocking - Windows version
+ *
+ * Inputs: sockfd - socket
+ *         nonblocking - 1 to make calls return at once, 0 to block
+ *
+ * Returns: 0 on success, -1 if fail.
+ *
+ ********************************************************************/
+int socket_nonblocking(SOCKET sockfd, int nonblocking)
+{
+	u_long mode = nonblocking;
+
+	return ioctlsocket(sockfd, FIONBIO, &mode) != 0 ? -1 : 0;
+}
+
+
+/********************************************************************
+ * clock_milliseconds - Windows version
+ *
+ * Returns: milliseconds since Windows started, for measuring time
+ *
+ ********************************************************************/
+long clock_milliseconds(void)
+{
+	return (long) GetTickCount();
+}
+
+
+/********************************************************************
+ * clock_microseconds - Windows version
+ *
+ * Returns: microseconds of the performance counter, for timing
+ *          serial bytes
+ *
+ ********************************************************************/
+long long clock_microseconds(void)
+{
+	LARGE_INTEGER frequency, now;
+
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&now);
+
+	return (long long) (now.QuadPart / (double) frequency.QuadPart * 1000000.0);
+}
+
+
 /********************************************************************
  * http_request_url - Windows version
  * 
@@ -243,8 +506,7 @@ int http_request_url(char *urlline)
 	WSADATA wsaData;
 	int err;
 	SOCKET sockfd;
-	struct hostent *hostinfo;
-	struct sockaddr_in urladdress;
+	hostdata server = {WEATHER_UNDERGROUND_BASEURL, 80}; /*default HTTP Server port */
 	char buffer[1024];
 	int bytes_read;
 	
@@ -267,29 +529,10 @@ int http_request_url(char *urlline)
 	    return(-1);   
 	}
 
-	if ( (hostinfo = gethostbyname(WEATHER_UNDERGROUND_BASEURL)) == NULL )
+	if ( (sockfd = net_connect(&server, 1, NET_TIMEOUT, NULL)) == INVALID_SOCKET )
 	{
-		perror("Host not known by DNS server or DNS server not working");
-		return(-1);
-	}
-	
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	
-	if (sockfd == INVALID_SOCKET)
-	{
-		perror("Cannot open socket");
-		return(-1);
-	}
-
-	memset(&urladdress, 0, sizeof(urladdress));
-	urladdress.sin_family = AF_INET;
-	urladdress.sin_port = htons(80); /*default HTTP Server port */
-
-	urladdress.sin_addr = *(struct in_addr *)*hostinfo->h_addr_list;
-
-	if (connect(sockfd,(struct sockaddr*)&urladdress,sizeof(urladdress)) != 0)
-	{
-		perror("Cannot connect to host");
+		fprintf(stderr, "Cannot connect to host\n");
+		WSACleanup();
 		return(-1);
 	}
 	
@@ -327,72 +570,20 @@ int http_request_url(char *urlline)
  ********************************************************************/
 int citizen_weather_send(struct config_type *config, char *aprsline)
 {
-	WORD wVersionRequested;
-	WSADATA wsaData;
-	int err;
-	SOCKET sockfd = INVALID_SOCKET; // Prevent warning
-	struct hostent *hostinfo;
-	struct sockaddr_in urladdress;
+	SOCKET sockfd;
 	char buffer[1024];
 	int bytes_read;
 	int hostnum;
 	
-	wVersionRequested = MAKEWORD( 1, 1 );
-	
-	err = WSAStartup( wVersionRequested, &wsaData );
-	if ( err != 0 )
-	{
-		perror("Couldn't find a useable winsock.dll");
-	    return(-1);
-	}
-	
-	/* Confirm that the Windows Sockets DLL supports 1.1.*/
-	
-	if ( LOBYTE( wsaData.wVersion ) != 1 ||
-	         HIBYTE( wsaData.wVersion ) != 1 )
-	{
-	    WSACleanup();
-		perror("Couldn't find a useable winsock.dll");
-	    return(-1);   
-	}
-
+	if (network_startup() != 0)
+		return(-1);
 
-	for (hostnum = 0; hostnum <= config->num_hosts; hostnum++)
+	// all defined servers are tried at once, the first to answer wins
+	sockfd = net_connect(config->aprs_host, config->num_hosts, NET_TIMEOUT, &hostnum);
+	if (sockfd == INVALID_SOCKET)
 	{
-		if ( hostnum == config->num_hosts )
-			return(-1);          // tried 'em all, fail exit		
-
-		if ( (hostinfo = gethostbyname(config->aprs_host[hostnum].name) ) == NULL )		
-		{
-			sprintf(buffer,"Host, %s, not known ", config->aprs_host[hostnum].name);
-			perror(buffer);
-			continue;
-		}
-				
-		sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	
-		if (sockfd == INVALID_SOCKET)
-		{
-			sprintf(buffer,"Cannot open socket on %s ", config->aprs_host[hostnum].name);
-			perror(buffer);
-			continue;
-		}
-		
-		memset(&urladdress, 0, sizeof(urladdress));// clear the structure
-		urladdress.sin_family = AF_INET;
-		urladdress.sin_port = htons(config->aprs_host[hostnum].port);
-		urladdress.sin_addr = *(struct in_addr *)*hostinfo->h_addr_list;
-
-		if ( connect(sockfd, (struct sockaddr*)&urladdress, sizeof(urladdress)) != 0 )
-		{
-			sprintf(buffer,"Cannot connect to host: %s ", config->aprs_host[hostnum].name);
-			perror(buffer);
-			continue;
-		}
-		else
-		{
-			break;   // success
-		}
+		fprintf(stderr, "Cannot connect to any APRS server\n");
+		return(-1);          // tried 'em all, fail exit
 	}
 
 	if (DEBUG) printf("%d: %s: ",hostnum, config->aprs_host[hostnum].name);
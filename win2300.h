@@ -4,8 +4,11 @@
 #ifndef _INCLUDE_WIN2300_H_
 #define _INCLUDE_WIN2300_H_ 
 
+/* Winsock 2 for getaddrinfo (Windows XP and later) */
+#define _WIN32_WINNT 0x0501
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
-#include <winsock.h>
 
 #define STRINGIZE(x) #x
 
@@ -14,5 +17,8 @@ typedef HANDLE WEATHERSTATION;
 #define BAUDRATE CBR_2400
 #define DEFAULT_SERIAL_DEVICE "COM1"
 
+/* Winsock has no SIGPIPE */
+#define MSG_NOSIGNAL 0
+
 #endif /* _INCLUDE_WIN2300_H_ */
 
@@ -11,109 +11,300 @@
 #define DEBUG 0  // wu2300 stops writing to standard out if setting this to 0
 #define GUST  1  // report wind gust information (resets wind min/max)
 
-#include "rw2300.h"
+#include "spool2300.h"
+#include "record2300.h"
+#include "http2300.h"
+#include "stats2300.h"
 
-/********** MAIN PROGRAM ************************************************
+#define RAPIDFIRE_MIN     2.0      // shortest period in seconds
+#define RAPIDFIRE_SLOW    60       // seconds between reads of the slow values
+#define RAPIDFIRE_REPORT  300      // seconds between latency reports
+
+struct latency_stats
+{
+	int    uploads;
+	int    failed;
+	int    changes;                // uploads carrying a changed value
+	long   read_total;             // ms reading the station
+	long   upload_total;           // ms of the HTTP request
+	long   change_total;           // ms from change to upload
+	long   change_max;
+};
+
+/********************************************************************
+ * print_usage prints a short user guide
  *
- * This program reads all current weather data from a WS2300
- * and sends it to Weather Underground.
+ * Input:   none
  *
- * It takes one parameter which is the config file name with path
- * If this parameter is omitted the program will look at the default paths
- * See the open2300.conf-dist file for info
+ * Output:  prints to stdout
  *
- ***********************************************************************/
-int main(int argc, char *argv[])
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
 {
-	WEATHERSTATION ws2300;
-	struct config_type config;
-	char urlline[3000] = "";
-	char tempstring[1000] = "";
-	char datestring[50];        //used to hold the date stamp for the log file
-	double tempfloat;
-	time_t basictime;
-
-	get_configuration(&config, argv[1]);
-
-	ws2300 = open_weatherstation(config.serial_device_name);
-
-
-	/* START WITH URL, ID AND PASSWORD */
-
-	sprintf(urlline, "GET %s?ID=%s&PASSWORD=%s", WEATHER_UNDERGROUND_PATH,
-	        config.weather_underground_id,config.weather_underground_password);
-
-	/* GET DATE AND TIME FOR URL */
-	
-	time(&basictime);
-	basictime = basictime - atof(config.timezone) * 60 * 60;
-	strftime(datestring,sizeof(datestring),"&dateutc=%Y-%m-%d+%H%%3A%M%%3A%S",
-	         localtime(&basictime));
-	strcat(urlline, datestring);
-
-
-	/* READ TEMPERATURE OUTDOOR - deg F for Weather Underground */
+	printf("\n");
+	printf("wu2300 - Send current data from WS-2300 to Weather Underground.\n");
+	printf("Version %s (C)2004-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("wu2300 [-r seconds] [config_filename]\n");
+	printf("-r keeps running and uploads wind, temperature and humidity every\n");
+	printf("   seconds (at least %.0f, e.g. 2.5) as RapidFire realtime updates on\n",
+	       RAPIDFIRE_MIN);
+	printf("   one connection. The other values are read every %d seconds.\n",
+	       RAPIDFIRE_SLOW);
+	printf("   The delay from a changed reading to its upload is reported\n");
+	printf("   every %d seconds.\n", RAPIDFIRE_REPORT);
+	exit(0);
+}
 
-	sprintf(tempstring, "&tempf=%.2f", temperature_outdoor(ws2300, FAHRENHEIT) );
-	strcat(urlline, tempstring);
 
+/********************************************************************
+ * send_requests sends spooled requests to Weather Underground, oldest
+ * first, pipelined on one connection. Used as spool sender.
+ *
+ * Returns: number of requests sent before the first failure
+ *
+ ********************************************************************/
+int send_requests(void *context, char **requests, int *sizes, int count)
+{
+	return http_pipeline(context, requests, sizes, count);
+}
 
-	/* READ DEWPOINT - deg F for Weather Underground*/
-	
-	sprintf(tempstring, "&dewptf=%.2f", dewpoint(ws2300, FAHRENHEIT) );
-	strcat(urlline, tempstring);
 
+/********************************************************************
+ * read_fast reads the values that change between polls: outdoor
+ * temperature and humidity, wind speed and direction
+ *
+ ********************************************************************/
+void read_fast(WEATHERSTATION ws2300, struct log_record *reading)
+{
+	reading->temperature_outdoor = temperature_outdoor(ws2300, CELCIUS);
+	reading->humidity_outdoor = humidity_outdoor(ws2300);
+	reading->windspeed = wind_current(ws2300, METERS_PER_SECOND, &reading->winddir_degrees);
+}
 
-	/* READ RELATIVE HUMIDITY OUTDOOR */
 
-	sprintf(tempstring, "&humidity=%d", humidity_outdoor(ws2300) );
-	strcat(urlline, tempstring);
+/********************************************************************
+ * read_slow reads the values that change slowly: dewpoint, rain
+ * and pressure
+ *
+ ********************************************************************/
+void read_slow(WEATHERSTATION ws2300, struct log_record *reading)
+{
+	reading->dewpoint = dewpoint(ws2300, CELCIUS);
+	reading->rain_1h = rain_1h(ws2300, MILLIMETERS);
+	reading->rain_24h = rain_24h(ws2300, MILLIMETERS);
+	reading->rel_pressure = rel_pressure(ws2300, HECTOPASCAL);
+}
 
 
-	/* READ WIND SPEED AND DIRECTION - miles/hour for Weather Underground */
+/********************************************************************
+ * fast_changed tells if a value read every poll has changed
+ *
+ ********************************************************************/
+int fast_changed(struct log_record *reading, struct log_record *last)
+{
+	return reading->temperature_outdoor != last->temperature_outdoor ||
+	       reading->humidity_outdoor != last->humidity_outdoor ||
+	       reading->windspeed != last->windspeed ||
+	       reading->winddir_degrees != last->winddir_degrees;
+}
 
-	sprintf(tempstring, "&windspeedmph=%.2f", wind_current(ws2300, MILES_PER_HOUR, &tempfloat) );
-	strcat(urlline, tempstring);
-	sprintf(tempstring,"&winddir=%.1f", tempfloat);
-	strcat(urlline, tempstring);
 
+/********************************************************************
+ * rapidfire keeps the station and the connection open and uploads
+ * realtime updates every period. Only the fast values are read each
+ * poll, the slow ones are kept and read every RAPIDFIRE_SLOW seconds.
+ * The gust is the highest wind speed polled since the slow values
+ * were read, the station's own min/max is left alone.
+ *
+ * The delay from a change to its upload is measured from the middle
+ * of the poll that first saw a value differ from the last uploaded
+ * reading and the poll before it, as the change happened somewhere
+ * in between, to the response of the first upload that got through
+ * after it. A failed upload delivers nothing, so the last uploaded
+ * reading is only moved on by a 2xx response. The delay is printed
+ * every RAPIDFIRE_REPORT seconds.
+ *
+ * Input:   ws2300 - open station
+ *          config - configuration
+ *          period - seconds between uploads
+ *
+ * Returns: does not return
+ *
+ ********************************************************************/
+void rapidfire(WEATHERSTATION ws2300, struct config_type *config, double period)
+{
+	struct http_connection http;
+	struct log_record reading, last;
+	struct latency_stats stats;
+	char urlline[3000];
+	long period_ms = (long) (period * 1000);
+	long poll_start, last_poll = 0, read_done, upload_done;
+	long next_poll, next_slow, next_report, change, changed = 0;
+	double gust = 0;
+	int status, first = 1, uploaded = 0;
+
+	http_init(&http, WEATHER_UNDERGROUND_RAPIDFIRE_URL, 80, HTTP_TIMEOUT);
+
+	// The uploads must not wait for the resolver
+	net_refresh_start();
+
+	memset(&stats, 0, sizeof(stats));
+	memset(&last, 0, sizeof(last));
+	next_poll = clock_milliseconds();
+	next_slow = next_poll;
+	next_report = next_poll + RAPIDFIRE_REPORT * 1000L;
+
+	while (1)
+	{
+		poll_start = clock_milliseconds();
+
+		read_fast(ws2300, &reading);
+		if (first || poll_start >= next_slow)
+		{
+			read_slow(ws2300, &reading);
+			gust = reading.windspeed;
+			next_slow = poll_start + RAPIDFIRE_SLOW * 1000L;
+		}
+		else if (reading.windspeed > gust)
+		{
+			gust = reading.windspeed;
+		}
+
+		read_done = clock_milliseconds();
+
+		// First poll that sees a value not uploaded yet
+		if (uploaded && changed == 0 && fast_changed(&reading, &last))
+			changed = (last_poll + poll_start) / 2;
+		last_poll = poll_start;
+
+		reading.timestamp = time(NULL);
+		if (format_wu_query(config, &reading, GUST ? gust : -1, period,
+		                    urlline, sizeof(urlline)) < 0)
+		{
+			fprintf(stderr, "Weather Underground request too long\n");
+			exit(EXIT_FAILURE);
+		}
+
+		status = http_get(&http, urlline);
+		upload_done = clock_milliseconds();
+
+		stats.uploads++;
+		stats.read_total += read_done - poll_start;
+		stats.upload_total += upload_done - read_done;
+
+		if (status < 200 || status >= 300)
+		{
+			stats.failed++;
+		}
+		else
+		{
+			if (changed != 0 && fast_changed(&reading, &last))
+			{
+				change = upload_done - changed;
+				stats.changes++;
+				stats.change_total += change;
+				if (change > stats.change_max)
+					stats.change_max = change;
+			}
+			last = reading;
+			uploaded = 1;
+			changed = 0;
+		}
+
+		first = 0;
+
+		if (upload_done >= next_report)
+		{
+			printf("%d uploads, %d failed. Read %ld ms, upload %ld ms. "
+			       "Change to upload %ld ms, max %ld ms (%d changes)\n",
+			       stats.uploads, stats.failed,
+			       stats.read_total / stats.uploads,
+			       stats.upload_total / stats.uploads,
+			       stats.changes ? stats.change_total / stats.changes : 0,
+			       stats.change_max, stats.changes);
+			fflush(stdout);
+			memset(&stats, 0, sizeof(stats));
+			next_report = upload_done + RAPIDFIRE_REPORT * 1000L;
+		}
+
+		// Keep the period even when a poll was slow, but do not try
+		// to catch up on missed polls
+		next_poll += period_ms;
+		if (next_poll < upload_done)
+			next_poll = upload_done;
+		else
+			sleep_short(next_poll - upload_done);
+	}
+}
 
-	/* READ WIND GUST - miles/hour for Weather Underground */
 
-	if (GUST)
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program reads all current weather data from a WS2300
+ * and sends it to Weather Underground.
+ *
+ * It takes one parameter which is the config file name with path
+ * If this parameter is omitted the program will look at the default paths
+ * See the open2300.conf-dist file for info
+ *
+ * With -r it keeps running and sends RapidFire realtime updates.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	WEATHERSTATION ws2300;
+	struct config_type config;
+	char urlline[3000] = "";    //path and query of the request
+	struct log_record reading;
+	double gust = -1;
+	struct spool spool;
+	struct http_connection http;
+	double period = 0;
+	int arg = 1;
+	int failed = 0;
+
+	stats_option(&argc, argv);
+
+	if (argc > 2 && strcmp(argv[1], "-r") == 0)
+	{
+		if ((period = atof(argv[2])) < RAPIDFIRE_MIN)
+			print_usage();
+		arg = 3;
+	}
+	else if (argc > 1 && argv[1][0] == '-')
 	{
-		sprintf(tempstring, "&windgustmph=%.2f",
-		        wind_minmax(ws2300, MILES_PER_HOUR, NULL, NULL, NULL, NULL));
-		strcat(urlline, tempstring);
+		print_usage();
 	}
 
+	get_configuration(&config, argv[arg]);
 
-	/* READ RAIN 1H - inches for Weather Underground */
-	
-	sprintf(tempstring, "&rainin=%.2f", rain_1h(ws2300, INCHES) );
-	strcat(urlline, tempstring);
+	net_cache_open(config.dns_cache_file, config.dns_cache_ttl);
 
+	ws2300 = open_weatherstation(config.serial_device_name);
+
+	if (period > 0)
+		rapidfire(ws2300, &config, period);
 
-	/* READ RAIN 24H - inches for Weather Underground */
 
-	sprintf(tempstring, "&dailyrainin=%.2f", rain_24h(ws2300, INCHES) );
-	strcat(urlline, tempstring);
+	/* READ ALL VALUES */
 
+	read_fast(ws2300, &reading);
+	read_slow(ws2300, &reading);
 
-	/* READ RELATIVE PRESSURE - Inches of Hg for Weather Underground */
 
-	sprintf(tempstring, "&baromin=%.3f", rel_pressure(ws2300, INCHES_HG) );
-	strcat(urlline, tempstring);
+	/* READ WIND GUST - sent in miles/hour by format_wu_query */
 
+	if (GUST)
+	{
+		gust = wind_minmax(ws2300, METERS_PER_SECOND, NULL, NULL, NULL, NULL);
+	}
 
-	/* ADD SOFTWARE TYPE AND ACTION */
-	sprintf(tempstring, "&softwaretype=open2300-%s&action=updateraw", VERSION);
-	strcat(urlline, tempstring);
-	
-	sprintf(tempstring, " HTTP/1.0\r\nUser-Agent: open2300/%s\r\nAccept: */*\r\n"
-	                   "Host: %s\r\nConnection: Keep-Alive\r\n\r\n",
-	        VERSION, WEATHER_UNDERGROUND_BASEURL);
-	strcat(urlline, tempstring);
+	reading.timestamp = time(NULL);
+	format_wu_query(&config, &reading, gust, 0, urlline, sizeof(urlline));
 
 
 	/* Reset minimum and maximum wind readings if reporting gusts */
@@ -131,12 +322,45 @@ int main(int argc, char *argv[])
 	if (DEBUG)
 	{
 		printf("%s\n",urlline);
+		return(0);
+	}
+
+	http_init(&http, WEATHER_UNDERGROUND_BASEURL, 80, HTTP_TIMEOUT);
+
+	if (config.spool_directory[0] != '\0' &&
+	    spool_open(&spool, config.spool_directory, "wu2300") == 0)
+	{
+		// The reading is sent with the ones that could not be sent
+		// before. If the upload fails it stays in the spool.
+		if (spool_append(&spool, urlline, strlen(urlline)) == 0 &&
+		    spool_sync(&spool) == 0)
+		{
+			spool_drain(&spool, SPOOL_BATCH, send_requests, &http);
+			if (!spool_empty(&spool))
+			{
+				fprintf(stderr, "Reading kept in spool %s\n", spool.dir);
+				failed = 1;
+			}
+		}
+		else if (http_get(&http, urlline) != 200)
+		{
+			failed = 1;
+		}
+		spool_close(&spool);
 	}
-	else
+	else if (http_get(&http, urlline) != 200)
 	{
-		http_request_url(urlline);
+		failed = 1;
 	}
-	
+
+	http_close(&http);
+
+	/* KEEP THE SERVER ADDRESS FOR THE NEXT RUN */
+	net_cache_close();
+
+	if (failed)
+		exit(EXIT_FAILURE);
+
 	return(0);
 }
 
@@ -0,0 +1,311 @@
+/*  open2300 - wxarchive2300.c
+ *
+ *  Version 1.11
+ *
+ *  Maintains a columnar archive of the station history (see
+ *  archive2300.h). Log files from log2300 or histlog2300, text or
+ *  binary, are imported into the archive and statistics over a field
+ *  and time range are computed from the memory mapped columns.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include <limits.h>
+#include "archive2300.h"
+#include "binlog2300.h"
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("wxarchive2300 - Columnar archive of the WS2300 station history.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("wxarchive2300 import archive_dir log_file [log_file ...]\n");
+	printf("  Append the records of log files newer than the archive.\n");
+	printf("wxarchive2300 stats archive_dir field [from_time [to_time]]\n");
+	printf("  Print count, min, max and mean of a field.\n");
+	printf("wxarchive2300 bench archive_dir log_file field\n");
+	printf("  Compare the time of the stats on the archive with a log file scan.\n");
+	printf("Fields: Ti To DP RHi RHo WS DIR WC rain RP\n");
+	printf("Times are given as YYYYMMDDhhmmss. Trailing digits may be left out.\n");
+	exit(0);
+}
+
+/********************************************************************
+ * parse_time_argument converts a command line time like
+ * 20070719 or 20070719153000 to time_t
+ *
+ * Input:   argument - the string from the command line
+ *
+ * Returns: time, -1 if not valid
+ *
+ ********************************************************************/
+time_t parse_time_argument(const char *argument)
+{
+	char key[] = "00000101000000";
+	int length = strlen(argument);
+
+	if (length > 14)
+		return -1;
+
+	memcpy(key, argument, length);
+
+	return parse_log_timestamp(key);
+}
+
+/********************************************************************
+ * elapsed returns the seconds since a start time
+ *
+ ********************************************************************/
+double elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/********************************************************************
+ * import_log appends the records of one log file that are newer
+ * than the last record of the archive
+ *
+ * Input:   archive - archive opened writable
+ *          path - text or binary log file
+ *
+ * Returns: number of records added, -1 if fail
+ *
+ ********************************************************************/
+long import_log(struct archive *archive, char *path)
+{
+	struct binlog binary_input;
+	struct log_record record;
+	char line[LOG_LINE_SIZE];
+	char magic[8];
+	time_t last = archive_last_time(archive);
+	long number, count = 0;
+	FILE *input;
+	int binary;
+
+	if ((input = fopen(path, "rb")) == NULL)
+		return -1;
+
+	binary = (fread(magic, 1, 8, input) == 8 && memcmp(magic, BINLOG_MAGIC, 8) == 0);
+	rewind(input);
+
+	if (binary)
+	{
+		fclose(input);
+		if (binlog_open(&binary_input, path, 0) != 0)
+			return -1;
+
+		for (number = binlog_find(&binary_input, last + 1);
+		     binlog_read(&binary_input, number, &record); number++)
+		{
+			if (archive_append(archive, &record) != 0)
+				break;
+			count++;
+		}
+		binlog_close(&binary_input);
+	}
+	else
+	{
+		while (fgets(line, sizeof(line), input) != NULL)
+		{
+			if (!parse_log_line(line, strlen(line), &record) ||
+			    (last && record.timestamp <= last))
+				continue;
+			if (archive_append(archive, &record) != 0)
+				break;
+			count++;
+		}
+		fclose(input);
+	}
+
+	return count;
+}
+
+/********************************************************************
+ * scan_log computes the stats of a field by parsing a text log
+ * file. Used as reference for the bench command.
+ *
+ ********************************************************************/
+int scan_log(char *path, int column, struct archive_stats *stats)
+{
+	struct log_record record;
+	char line[LOG_LINE_SIZE];
+	double value = 0;
+	FILE *input;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->min = HUGE_VAL;
+	stats->max = -HUGE_VAL;
+
+	if ((input = fopen(path, "r")) == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), input) != NULL)
+	{
+		if (!parse_log_line(line, strlen(line), &record))
+			continue;
+
+		switch (column)
+		{
+		case ARCHIVE_TI:   value = record.temperature_indoor; break;
+		case ARCHIVE_TO:   value = record.temperature_outdoor; break;
+		case ARCHIVE_DP:   value = record.dewpoint; break;
+		case ARCHIVE_RHI:  value = record.humidity_indoor == HUMIDITY_MISSING ?
+		                           NAN : record.humidity_indoor; break;
+		case ARCHIVE_RHO:  value = record.humidity_outdoor == HUMIDITY_MISSING ?
+		                           NAN : record.humidity_outdoor; break;
+		case ARCHIVE_WS:   value = record.windspeed; break;
+		case ARCHIVE_DIR:  value = record.winddir_degrees; break;
+		case ARCHIVE_WC:   value = record.windchill; break;
+		case ARCHIVE_RAIN: value = record.rain_total; break;
+		case ARCHIVE_RP:   value = record.rel_pressure; break;
+		}
+
+		if (isnan(value))
+			continue;
+		if (value < stats->min)
+			stats->min = value;
+		if (value > stats->max)
+			stats->max = value;
+		stats->sum += value;
+		stats->count++;
+	}
+
+	fclose(input);
+
+	if (stats->count > 0)
+		stats->mean = stats->sum / stats->count;
+
+	return 0;
+}
+
+/********************************************************************
+ * print_stats prints the result of a stats calculation
+ *
+ ********************************************************************/
+void print_stats(const char *field, struct archive_stats *stats)
+{
+	if (stats->count == 0)
+	{
+		printf("%s: no values\n", field);
+		return;
+	}
+
+	printf("%s: count %ld min %.3f max %.3f mean %.3f\n",
+	       field, stats->count, stats->min, stats->max, stats->mean);
+}
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program imports log files into a columnar archive and
+ * calculates statistics from it.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	struct archive archive;
+	struct archive_stats stats, reference;
+	struct timespec start;
+	time_t from = 0, to = LONG_MAX;
+	double archive_time, scan_time;
+	long added;
+	int column, i;
+
+	if (argc < 4)
+		print_usage();
+
+	if (strcmp(argv[1], "import") == 0)
+	{
+		if (archive_open(&archive, argv[2], 1) != 0)
+		{
+			fprintf(stderr, "Cannot open archive %s\n", argv[2]);
+			exit(EXIT_FAILURE);
+		}
+
+		for (i = 3; i < argc; i++)
+		{
+			if ((added = import_log(&archive, argv[i])) < 0)
+			{
+				fprintf(stderr, "Cannot read log file %s\n", argv[i]);
+				archive_close(&archive);
+				exit(EXIT_FAILURE);
+			}
+			printf("%s: %ld records added\n", argv[i], added);
+		}
+
+		archive_close(&archive);
+	}
+	else if (strcmp(argv[1], "stats") == 0 && argc <= 6)
+	{
+		if ((column = archive_column_id(argv[3])) <= ARCHIVE_TIME)
+			print_usage();
+
+		if (argc > 4 && (from = parse_time_argument(argv[4])) == -1)
+			print_usage();
+
+		if (argc > 5 && (to = parse_time_argument(argv[5])) == -1)
+			print_usage();
+
+		archive_open(&archive, argv[2], 0);
+
+		if (archive_stats(&archive, column, from, to, &stats) != 0)
+		{
+			fprintf(stderr, "Cannot read archive %s\n", argv[2]);
+			exit(EXIT_FAILURE);
+		}
+
+		print_stats(argv[3], &stats);
+		archive_close(&archive);
+	}
+	else if (strcmp(argv[1], "bench") == 0 && argc == 5)
+	{
+		if ((column = archive_column_id(argv[4])) <= ARCHIVE_TIME)
+			print_usage();
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (scan_log(argv[3], column, &reference) != 0)
+		{
+			fprintf(stderr, "Cannot read log file %s\n", argv[3]);
+			exit(EXIT_FAILURE);
+		}
+		scan_time = elapsed(&start);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		archive_open(&archive, argv[2], 0);
+		if (archive_stats(&archive, column, from, to, &stats) != 0)
+		{
+			fprintf(stderr, "Cannot read archive %s\n", argv[2]);
+			exit(EXIT_FAILURE);
+		}
+		archive_close(&archive);
+		archive_time = elapsed(&start);
+
+		print_stats("log file", &reference);
+		print_stats("archive ", &stats);
+		printf("log file scan %.6f s, archive %.6f s", scan_time, archive_time);
+		if (archive_time > 0)
+			printf(" (%.0fx)", scan_time / archive_time);
+		printf("\n");
+	}
+	else
+	{
+		print_usage();
+	}
+
+	return(0);
+}
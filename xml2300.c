@@ -16,9 +16,21 @@
  *
  *  1.2 2004 Mar 07 Kenneth Lavrsen  Completely re-written to match
  *                  (OZ1IDD)         rw2300 v 1.2
+ *
+ *  1.3             The document is rendered in memory and published
+ *                                   with write to temp file and rename
+ *                                   so readers never see a partial file.
+ *                                   The file is only replaced when the
+ *                                   readings changed. A JSON twin with
+ *                                   the same data is written next to it.
+ *                                   Date and Time in the files tell when
+ *                                   the readings last changed.
  */
 
 #include "rw2300.h"
+#include "stats2300.h"
+
+#define DOCUMENT_SIZE 8192
 
 /********************************************************************
  * print_usage prints a short user guide
@@ -39,13 +51,111 @@ void print_usage(void)
 	printf("Usage:\n");
 	printf("With default config file: xml2300 xml-file\n");
 	printf("With given config file:   xml2300 xml-file config-file\n");
+	printf("A JSON file with the same data is written next to the xml-file\n");
+	printf("(name.xml becomes name.json)\n");
 	exit(0);
 }
 
+/********************************************************************
+ * xml_minmax appends the min/max block used by most XML sections
+ *
+ * Input:   xml - document buffer (DOCUMENT_SIZE)
+ *          indent - tabs to put in front of each element
+ *          format - printf format used for the values
+ *          min, max - values
+ *          time_min, time_max - time stamps of the min and max
+ * 
+ * Returns: nothing
+ *
+ ********************************************************************/
+void xml_minmax(char *xml, const char *indent, const char *format,
+                double min, double max,
+                struct timestamp *time_min, struct timestamp *time_max)
+{
+	char line[100];
+
+	snprintf(line, sizeof(line), "%s<Min>%s</Min>\n", indent, format);
+	buffer_printf(xml, DOCUMENT_SIZE, line, min);
+	snprintf(line, sizeof(line), "%s<Max>%s</Max>\n", indent, format);
+	buffer_printf(xml, DOCUMENT_SIZE, line, max);
+
+	buffer_printf(xml, DOCUMENT_SIZE,
+	              "%s<MinTime>%02d:%02d</MinTime>\n"
+	              "%s<MinDate>%04d-%02d-%02d</MinDate>\n",
+	              indent, time_min->hour, time_min->minute,
+	              indent, time_min->year, time_min->month, time_min->day);
+
+	buffer_printf(xml, DOCUMENT_SIZE,
+	              "%s<MaxTime>%02d:%02d</MaxTime>\n"
+	              "%s<MaxDate>%04d-%02d-%02d</MaxDate>\n",
+	              indent, time_max->hour, time_max->minute,
+	              indent, time_max->year, time_max->month, time_max->day);
+}
+
+/********************************************************************
+ * json_minmax appends a complete value object with min/max
+ *
+ * Input:   json - document buffer (DOCUMENT_SIZE)
+ *          indent - tabs to put in front of the object members
+ *          format - printf format used for the values
+ *          value, min, max - values
+ *          time_min, time_max - time stamps of the min and max
+ * 
+ * Returns: nothing
+ *
+ ********************************************************************/
+void json_minmax(char *json, const char *indent, const char *format,
+                 double value, double min, double max,
+                 struct timestamp *time_min, struct timestamp *time_max)
+{
+	char line[200];
+
+	snprintf(line, sizeof(line),
+	         "{\n%s\"value\": %s,\n%s\"min\": %s,\n%s\"max\": %s,\n",
+	         indent, format, indent, format, indent, format);
+	buffer_printf(json, DOCUMENT_SIZE, line, value, min, max);
+
+	buffer_printf(json, DOCUMENT_SIZE,
+	              "%s\"min_time\": \"%02d:%02d\",\n"
+	              "%s\"min_date\": \"%04d-%02d-%02d\",\n"
+	              "%s\"max_time\": \"%02d:%02d\",\n"
+	              "%s\"max_date\": \"%04d-%02d-%02d\"\n",
+	              indent, time_min->hour, time_min->minute,
+	              indent, time_min->year, time_min->month, time_min->day,
+	              indent, time_max->hour, time_max->minute,
+	              indent, time_max->year, time_max->month, time_max->day);
+}
+
+/********************************************************************
+ * json_filename derives the name of the JSON twin from the XML
+ * file name. A trailing .xml is replaced, otherwise .json is added.
+ *
+ * Input:   xmlname - name of the xml file
+ *          size - size of jsonname buffer
+ * 
+ * Output:  jsonname - name of the json file
+ * 
+ * Returns: nothing
+ *
+ ********************************************************************/
+void json_filename(const char *xmlname, char *jsonname, int size)
+{
+	int length = strlen(xmlname);
+
+	if (length > 4 && strcmp(xmlname + length - 4, ".xml") == 0)
+		length -= 4;
+
+	snprintf(jsonname, size, "%.*s.json", length, xmlname);
+}
+
 /********** MAIN PROGRAM ************************************************
  *
  * This program reads all current and min/max data from a WS2300
- * weather station and write it to an XML file.
+ * weather station and write it to an XML file and a JSON file.
+ *
+ * Both documents are rendered completely in memory and published
+ * atomically (temp file + rename). If nothing but the date and time
+ * changed since the last run the files are not rewritten.
  *
  * It takes two parameters. xml_file_path and config_file_path
  *
@@ -56,6 +166,9 @@ void print_usage(void)
 int main(int argc, char *argv[])
 {
 	WEATHERSTATION ws2300;
+	char xml[DOCUMENT_SIZE] = "";
+	char json[DOCUMENT_SIZE] = "";
+	char jsonname[300];
 	char datestring[50];        //used to hold the date stamp for the log file
 	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
 	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
@@ -63,12 +176,13 @@ int main(int argc, char *argv[])
 	char tendency[15];
 	char forecast[15];
 	struct config_type config;
-	double tempfloat_min, tempfloat_max;
+	double tempfloat, tempfloat_min, tempfloat_max;
 	int tempint, tempint_min, tempint_max;
+	int xml_header, json_header;
 	struct timestamp time_min, time_max;
 	time_t basictime;
-	//char datestring[100];		//used to hold the date stamp for the log file
-	FILE *fileptr;
+
+	stats_option(&argc, argv);
 
 	if (argc < 2 || argc > 3)
 	{
@@ -76,21 +190,15 @@ int main(int argc, char *argv[])
 	}
 	
 	get_configuration(&config, argv[2]);
-	
-	fileptr = fopen(argv[1], "w");
-	if (fileptr == NULL)
-	{
-		printf("Cannot open file %s\n",argv[1]);
-		exit(EXIT_FAILURE);
-	}
-	
+
+	json_filename(argv[1], jsonname, sizeof(jsonname));
 
 	ws2300 = open_weatherstation(config.serial_device_name);
 
 	/* XML header */
 
-	fprintf(fileptr, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
-			"<ws2300 version=\"1.0\">\n");
+	buffer_printf(xml, DOCUMENT_SIZE, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+	              "<ws2300 version=\"1.0\">\n");
 
 	/* GET DATE AND TIME FOR LOG FILE, PLACE BEFORE ALL DATA IN LOG LINE */
 
@@ -99,273 +207,274 @@ int main(int argc, char *argv[])
 	time(&basictime);
 	strftime(datestring, sizeof(datestring), "\t<Date>%Y-%m-%d</Date>\n"
 			 "\t<Time>%H:%M:%S</Time>\n", localtime(&basictime));
-			 
-	fprintf(fileptr, datestring);
+	buffer_printf(xml, DOCUMENT_SIZE, "%s", datestring);
+
+	strftime(datestring, sizeof(datestring), "{\n\t\"date\": \"%Y-%m-%d\",\n"
+			 "\t\"time\": \"%H:%M:%S\",\n", localtime(&basictime));
+	buffer_printf(json, DOCUMENT_SIZE, "%s", datestring);
+
+	// The header has fixed length. Only what follows decides if the
+	// published files need to be replaced.
+	xml_header = strlen(xml);
+	json_header = strlen(json);
 
 
 	/* <temperature> <indoor> */
 	
-	fprintf(fileptr, "\t<Temperature>\n" "\t\t<Indoor>\n");
-	fprintf(fileptr, "\t\t\t<Value>%.1f</Value>\n",
-		temperature_indoor(ws2300, config.temperature_conv));
-
+	tempfloat = temperature_indoor(ws2300, config.temperature_conv);
 	temperature_indoor_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 		                      &tempfloat_max, &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t\t<Min>%.1f</Min>\n", tempfloat_min);
-	fprintf(fileptr, "\t\t\t<Max>%.1f</Max>\n", tempfloat_max);
-
-	fprintf(fileptr, "\t\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t<Temperature>\n" "\t\t<Indoor>\n"
+	              "\t\t\t<Value>%.1f</Value>\n", tempfloat);
+	xml_minmax(xml, "\t\t\t", "%.1f", tempfloat_min, tempfloat_max,
+	           &time_min, &time_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t</Indoor>\n" "\t\t<Outdoor>\n");
 
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</Indoor>\n" "\t\t<Outdoor>\n");
+	buffer_printf(json, DOCUMENT_SIZE, "\t\"temperature\": {\n\t\t\"indoor\": ");
+	json_minmax(json, "\t\t\t", "%.1f", tempfloat, tempfloat_min, tempfloat_max,
+	            &time_min, &time_max);
+	buffer_printf(json, DOCUMENT_SIZE, "\t\t},\n\t\t\"outdoor\": ");
 
 
 	/* <temperature> <outdoor> */
 
-	fprintf(fileptr, "\t\t\t<Value>%.1f</Value>\n",
-			temperature_outdoor(ws2300, config.temperature_conv));
-	
+	tempfloat = temperature_outdoor(ws2300, config.temperature_conv);
 	temperature_outdoor_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 	                          &tempfloat_max, &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t\t<Min>%.1f</Min>\n", tempfloat_min);
-	fprintf(fileptr, "\t\t\t<Max>%.1f</Max>\n", tempfloat_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t\t<Value>%.1f</Value>\n", tempfloat);
+	xml_minmax(xml, "\t\t\t", "%.1f", tempfloat_min, tempfloat_max,
+	           &time_min, &time_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t</Outdoor>\n" "\t</Temperature>\n");
 
-
-	fprintf(fileptr, "\t\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
-
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</Outdoor>\n" "\t</Temperature>\n");
+	json_minmax(json, "\t\t\t", "%.1f", tempfloat, tempfloat_min, tempfloat_max,
+	            &time_min, &time_max);
+	buffer_printf(json, DOCUMENT_SIZE, "\t\t}\n\t},\n");
 
 
 	/* <indoor> <humidity> */
 
-	fprintf(fileptr, "\t<Humidity>\n" "\t\t<Indoor>\n");
-
-	fprintf(fileptr, "\t\t\t<Value>%d</Value>\n",
-			humidity_indoor_all(ws2300, &tempint_min, &tempint_max,
-			                    &time_min, &time_max));
-
-	fprintf(fileptr, "\t\t\t<Min>%d</Min>\n", tempint_min);
-	fprintf(fileptr, "\t\t\t<Max>%d</Max>\n", tempint_max);
-
-	fprintf(fileptr, "\t\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
+	tempint = humidity_indoor_all(ws2300, &tempint_min, &tempint_max,
+	                              &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t<Humidity>\n" "\t\t<Indoor>\n"
+	              "\t\t\t<Value>%d</Value>\n", tempint);
+	xml_minmax(xml, "\t\t\t", "%.0f", tempint_min, tempint_max,
+	           &time_min, &time_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t</Indoor>\n" "\t\t<Outdoor>\n");
 
-	fprintf(fileptr, "\t\t</Indoor>\n" "\t\t<Outdoor>\n");
+	buffer_printf(json, DOCUMENT_SIZE, "\t\"humidity\": {\n\t\t\"indoor\": ");
+	json_minmax(json, "\t\t\t", "%.0f", tempint, tempint_min, tempint_max,
+	            &time_min, &time_max);
+	buffer_printf(json, DOCUMENT_SIZE, "\t\t},\n\t\t\"outdoor\": ");
 	
 
 	/* <outdoor> <humidity> */
 
-	fprintf(fileptr, "\t\t\t<Value>%d</Value>\n",
-			humidity_outdoor_all(ws2300, &tempint_min, &tempint_max,
-			                    &time_min, &time_max));
+	tempint = humidity_outdoor_all(ws2300, &tempint_min, &tempint_max,
+	                               &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t\t<Min>%d</Min>\n", tempint_min);
-	fprintf(fileptr, "\t\t\t<Max>%d</Max>\n", tempint_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t\t<Value>%d</Value>\n", tempint);
+	xml_minmax(xml, "\t\t\t", "%.0f", tempint_min, tempint_max,
+	           &time_min, &time_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t</Outdoor>\n" "\t</Humidity>\n" "\t<Dewpoint>\n");
 
-	fprintf(fileptr, "\t\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
+	json_minmax(json, "\t\t\t", "%.0f", tempint, tempint_min, tempint_max,
+	            &time_min, &time_max);
+	buffer_printf(json, DOCUMENT_SIZE, "\t\t}\n\t},\n");
 
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</Outdoor>\n" "\t</Humidity>\n" "\t<Dewpoint>\n");
 
 	/* <Dewpoint> */
 
-	fprintf(fileptr, "\t\t<Value>%.1f</Value>\n",
-	        dewpoint(ws2300, config.temperature_conv));
-
+	tempfloat = dewpoint(ws2300, config.temperature_conv);
 	dewpoint_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 	               &tempfloat_max, &time_min, &time_max);
-	                           
-	fprintf(fileptr, "\t\t<Min>%.1f</Min>\n", tempfloat_min);
-	fprintf(fileptr, "\t\t<Max>%.1f</Max>\n", tempfloat_max);
-
-	fprintf(fileptr, "\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
 
-	fprintf(fileptr, "\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t<Value>%.1f</Value>\n", tempfloat);
+	xml_minmax(xml, "\t\t", "%.1f", tempfloat_min, tempfloat_max,
+	           &time_min, &time_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t</Dewpoint>\n" "\t<Wind>\n");
 
-	fprintf(fileptr, "\t</Dewpoint>\n" "\t<Wind>\n");
+	buffer_printf(json, DOCUMENT_SIZE, "\t\"dewpoint\": ");
+	json_minmax(json, "\t\t", "%.1f", tempfloat, tempfloat_min, tempfloat_max,
+	            &time_min, &time_max);
+	buffer_printf(json, DOCUMENT_SIZE, "\t},\n");
 	
 
 	/* <Wind> */
 
-	fprintf(fileptr, "\t\t<Value>%.1f</Value>\n",
-		   wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir));
-
-	fprintf(fileptr, "\t\t<Direction>\n");
-	fprintf(fileptr, "\t\t\t<Text>%s</Text>\n"
-			"\t\t\t<Dir0>%0.1f</Dir0>\n"
-			"\t\t\t<Dir1>%0.1f</Dir1>\n"
-			"\t\t\t<Dir2>%0.1f</Dir2>\n"
-			"\t\t\t<Dir3>%0.1f</Dir3>\n"
-			"\t\t\t<Dir4>%0.1f</Dir4>\n"
-			"\t\t\t<Dir5>%0.1f</Dir5>\n"
-			"\t\t</Direction>\n",
-			directions[tempint],
-			winddir[0], winddir[1], winddir[2],
-			winddir[3], winddir[4], winddir[5]);
+	tempfloat = wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir);
 
 	//Get Windspeed min/max
 	wind_minmax(ws2300, config.wind_speed_conv_factor, &tempfloat_min,
 	            &tempfloat_max, &time_min, &time_max);
-	
-	fprintf(fileptr, "\t\t<Min>%.1f</Min>\n", tempfloat_min);
-	fprintf(fileptr, "\t\t<Max>%.1f</Max>\n", tempfloat_max);
-
-	fprintf(fileptr, "\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
 
-	fprintf(fileptr, "\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t</Wind>\n" "\t<Windchill>\n");
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t<Value>%.1f</Value>\n", tempfloat);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t<Direction>\n"
+	              "\t\t\t<Text>%s</Text>\n"
+	              "\t\t\t<Dir0>%0.1f</Dir0>\n"
+	              "\t\t\t<Dir1>%0.1f</Dir1>\n"
+	              "\t\t\t<Dir2>%0.1f</Dir2>\n"
+	              "\t\t\t<Dir3>%0.1f</Dir3>\n"
+	              "\t\t\t<Dir4>%0.1f</Dir4>\n"
+	              "\t\t\t<Dir5>%0.1f</Dir5>\n"
+	              "\t\t</Direction>\n",
+	              directions[tempint],
+	              winddir[0], winddir[1], winddir[2],
+	              winddir[3], winddir[4], winddir[5]);
+	xml_minmax(xml, "\t\t", "%.1f", tempfloat_min, tempfloat_max,
+	           &time_min, &time_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t</Wind>\n" "\t<Windchill>\n");
+
+	buffer_printf(json, DOCUMENT_SIZE, "\t\"wind\": ");
+	json_minmax(json, "\t\t", "%.1f", tempfloat, tempfloat_min, tempfloat_max,
+	            &time_min, &time_max);
+	// json_minmax ends the last member without a comma
+	json[strlen(json) - 1] = '\0';
+	buffer_printf(json, DOCUMENT_SIZE, ",\n\t\t\"direction\": {\n"
+	              "\t\t\t\"text\": \"%s\",\n"
+	              "\t\t\t\"degrees\": [%.1f, %.1f, %.1f, %.1f, %.1f, %.1f]\n"
+	              "\t\t}\n\t},\n",
+	              directions[tempint],
+	              winddir[0], winddir[1], winddir[2],
+	              winddir[3], winddir[4], winddir[5]);
 	
 	
 	/* <Windchill> */
 
-	fprintf(fileptr, "\t\t<Value>%.1f</Value>\n",
-	        windchill(ws2300, config.temperature_conv));
-	
+	tempfloat = windchill(ws2300, config.temperature_conv);
 	windchill_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 	                 &tempfloat_max, &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t<Min>%.1f</Min>\n",tempfloat_min);
-	fprintf(fileptr, "\t\t<Max>%.1f</Max>\n",tempfloat_max);
-
-	fprintf(fileptr, "\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t<Value>%.1f</Value>\n", tempfloat);
+	xml_minmax(xml, "\t\t", "%.1f", tempfloat_min, tempfloat_max,
+	           &time_min, &time_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t</Windchill>\n" "\t<Rain>\n" "\t\t<OneHour>\n");
 
-	fprintf(fileptr, "\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t</Windchill>\n" "\t<Rain>\n" "\t\t<OneHour>\n");
+	buffer_printf(json, DOCUMENT_SIZE, "\t\"windchill\": ");
+	json_minmax(json, "\t\t", "%.1f", tempfloat, tempfloat_min, tempfloat_max,
+	            &time_min, &time_max);
+	buffer_printf(json, DOCUMENT_SIZE, "\t},\n");
 
 
 	/* <Rain> <OneHour> */
 
-	fprintf(fileptr, "\t\t\t<Value>%.2f</Value>\n",
-	        rain_1h_all(ws2300, config.rain_conv_factor,
-	                    &tempfloat_max, &time_max));
-
-	fprintf(fileptr, "\t\t\t<Max>%.2f</Max>\n", tempfloat_max);
-
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</OneHour>\n" "\t\t<TwentyFourHour>\n");
+	tempfloat = rain_1h_all(ws2300, config.rain_conv_factor,
+	                        &tempfloat_max, &time_max);
+
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t\t<Value>%.2f</Value>\n", tempfloat);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t\t<Max>%.2f</Max>\n", tempfloat_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
+	              "\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
+	              time_max.hour, time_max.minute, time_max.year,
+	              time_max.month, time_max.day);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t</OneHour>\n" "\t\t<TwentyFourHour>\n");
+
+	buffer_printf(json, DOCUMENT_SIZE, "\t\"rain\": {\n\t\t\"one_hour\": {\n"
+	              "\t\t\t\"value\": %.2f,\n\t\t\t\"max\": %.2f,\n"
+	              "\t\t\t\"max_time\": \"%02d:%02d\",\n"
+	              "\t\t\t\"max_date\": \"%04d-%02d-%02d\"\n\t\t},\n",
+	              tempfloat, tempfloat_max,
+	              time_max.hour, time_max.minute, time_max.year,
+	              time_max.month, time_max.day);
 	
 	
 	/* <Rain> <TwentyFourHour> */
 
-	fprintf(fileptr, "\t\t\t<Value>%.2f</Value>\n",
-			rain_24h_all(ws2300, config.rain_conv_factor,
-			             &tempfloat_max, &time_max));
-
-	fprintf(fileptr, "\t\t\t<Max>%.2f</Max>\n", tempfloat_max);
-
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</TwentyFourHour>\n" "\t\t<Total>\n");
+	tempfloat = rain_24h_all(ws2300, config.rain_conv_factor,
+	                         &tempfloat_max, &time_max);
+
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t\t<Value>%.2f</Value>\n", tempfloat);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t\t<Max>%.2f</Max>\n", tempfloat_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
+	              "\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
+	              time_max.hour, time_max.minute, time_max.year,
+	              time_max.month, time_max.day);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t</TwentyFourHour>\n" "\t\t<Total>\n");
+
+	buffer_printf(json, DOCUMENT_SIZE, "\t\t\"twenty_four_hour\": {\n"
+	              "\t\t\t\"value\": %.2f,\n\t\t\t\"max\": %.2f,\n"
+	              "\t\t\t\"max_time\": \"%02d:%02d\",\n"
+	              "\t\t\t\"max_date\": \"%04d-%02d-%02d\"\n\t\t},\n",
+	              tempfloat, tempfloat_max,
+	              time_max.hour, time_max.minute, time_max.year,
+	              time_max.month, time_max.day);
 	
 	
 	/* <Rain> <Total> */
 
-	fprintf(fileptr, "\t\t\t<Value>%.2f</Value>\n",
-	        rain_total_all(ws2300, config.rain_conv_factor, &time_max));
-
-	fprintf(fileptr, "\t\t\t<Time>%02d:%02d</Time>\n"
-			"\t\t\t<Date>%04d-%02d-%02d</Date>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</Total>\n" "\t</Rain>\n" "\t<Pressure>\n");
+	tempfloat = rain_total_all(ws2300, config.rain_conv_factor, &time_max);
+
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t\t<Value>%.2f</Value>\n", tempfloat);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t\t<Time>%02d:%02d</Time>\n"
+	              "\t\t\t<Date>%04d-%02d-%02d</Date>\n",
+	              time_max.hour, time_max.minute, time_max.year,
+	              time_max.month, time_max.day);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t</Total>\n" "\t</Rain>\n" "\t<Pressure>\n");
+
+	buffer_printf(json, DOCUMENT_SIZE, "\t\t\"total\": {\n"
+	              "\t\t\t\"value\": %.2f,\n"
+	              "\t\t\t\"time\": \"%02d:%02d\",\n"
+	              "\t\t\t\"date\": \"%04d-%02d-%02d\"\n\t\t}\n\t},\n",
+	              tempfloat,
+	              time_max.hour, time_max.minute, time_max.year,
+	              time_max.month, time_max.day);
 	
 
 	/* <Pressure> */
 
-	fprintf(fileptr, "\t\t<Value>%.3f</Value>\n",
-	        rel_pressure(ws2300, config.pressure_conv_factor));
-
+	tempfloat = rel_pressure(ws2300, config.pressure_conv_factor);
 	rel_pressure_minmax(ws2300, config.pressure_conv_factor, &tempfloat_min,
 	                    &tempfloat_max, &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t<Min>%.3f</Min>\n", tempfloat_min);
-	fprintf(fileptr, "\t\t<Max>%.3f</Max>\n", tempfloat_max);
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t<Value>%.3f</Value>\n", tempfloat);
+	xml_minmax(xml, "\t\t", "%.3f", tempfloat_min, tempfloat_max,
+	           &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
-
-	fprintf(fileptr, "\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
+	buffer_printf(json, DOCUMENT_SIZE, "\t\"pressure\": ");
+	json_minmax(json, "\t\t", "%.3f", tempfloat, tempfloat_min, tempfloat_max,
+	            &time_min, &time_max);
+	json[strlen(json) - 1] = '\0';
 			
 
 	/* <Tendency> <Forecast> */
 	
 	tendency_forecast(ws2300, tendency, forecast);
 
-	fprintf(fileptr, "\t\t<Tendency>%s</Tendency>\n"
-			"\t</Pressure>\n"
-			"\t<Forecast>%s</Forecast>\n", tendency, forecast);
+	close_weatherstation(ws2300);
 
+	buffer_printf(xml, DOCUMENT_SIZE, "\t\t<Tendency>%s</Tendency>\n"
+	              "\t</Pressure>\n"
+	              "\t<Forecast>%s</Forecast>\n", tendency, forecast);
 
-	fprintf(fileptr, "</ws2300>\n");
+	if (buffer_printf(xml, DOCUMENT_SIZE, "</ws2300>\n") < 0)
+	{
+		fprintf(stderr, "XML document too large\n");
+		exit(EXIT_FAILURE);
+	}
 
-	fflush(fileptr);
-	fclose(fileptr);
+	if (buffer_printf(json, DOCUMENT_SIZE, ",\n\t\t\"tendency\": \"%s\"\n\t},\n"
+	                  "\t\"forecast\": \"%s\"\n}\n", tendency, forecast) < 0)
+	{
+		fprintf(stderr, "JSON document too large\n");
+		exit(EXIT_FAILURE);
+	}
 
-	close_weatherstation(ws2300);
+
+	/* PUBLISH BOTH DOCUMENTS */
+
+	if (publish_file(argv[1], xml, strlen(xml), xml_header) < 0)
+	{
+		printf("Cannot write file %s\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (publish_file(jsonname, json, strlen(json), json_header) < 0)
+	{
+		printf("Cannot write file %s\n", jsonname);
+		exit(EXIT_FAILURE);
+	}
 
 	return (0);
 }